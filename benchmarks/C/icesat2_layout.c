@@ -0,0 +1,798 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "hdf5.h"
+
+#define SUCCEED 0
+#define FAIL (-1)
+
+#define FILEPATH_BUFFER_SIZE 1024
+
+#define PATH_DELIMITER "/"
+
+/*
+ * Macro to push the current function to the current error stack
+ * and then goto the "done" label, which should appear inside the
+ * function. (compatible with v1 and v2 errors)
+ */
+#define FUNC_GOTO_ERROR(err_msg)      \
+	fprintf(stderr, "%s\n", err_msg); \
+	fprintf(stderr, "\n");            \
+	exit(1);
+
+/* Print if program is run with debug flag */
+#define PRINT_DEBUG(...)              \
+	if (debug)                        \
+	{                                 \
+		fprintf(stderr, __VA_ARGS__); \
+	}
+
+#define USAGE "usage: icesat2_layout [-debug] [-use_ros3] [-chunks] [-procs N] [-page_kib N] [-group <path>] <input> [<input> ...]\n"
+
+/* Page size used for the alignment figures of files without paged aggregation */
+#define DEFAULT_PAGE_BYTES (1024 * 1024)
+
+/* Chunk sizes are histogrammed in power of two buckets up to 2^MAX_SIZE_BUCKET bytes */
+#define MAX_SIZE_BUCKET 40
+
+bool debug = false;
+bool use_ros3 = false;
+
+/* Print one line per chunk as well as the per-dataset summaries */
+bool print_chunks = false;
+
+/* Number of worker processes, 0 to use one per online CPU */
+size_t num_procs = 0;
+
+/* Page size for the alignment figures, 0 to use the file's own page size */
+hsize_t page_bytes = 0;
+
+/* Only datasets under this group are profiled */
+const char *group_path = PATH_DELIMITER;
+
+/* Where one chunk is stored in the file */
+typedef struct ChunkRecord{
+	haddr_t addr;
+	hsize_t size;
+	unsigned filter_mask;
+} ChunkRecord;
+
+/* A dataset found while walking the file. Its chunks go to slots [first, first + max_chunks) of the records,
+ * which is enough for every chunk in the current extent. */
+typedef struct LayoutDataset{
+	char *path;
+	H5D_layout_t layout;
+	hsize_t logical_bytes;
+	hsize_t chunk_bytes;
+	int num_filters;
+	size_t first;
+	size_t max_chunks;
+	size_t worker;
+} LayoutDataset;
+
+/* The records and the per-dataset chunk counts are in a shared mapping, so the worker processes fill them in
+ * for the parent */
+typedef struct LayoutContext{
+	LayoutDataset *dsets;
+	size_t num_dsets;
+	size_t max_dsets;
+	size_t num_slots;
+	ChunkRecord *records;
+	size_t *num_chunks;
+	size_t mapping_bytes;
+} LayoutContext;
+
+/* Chunk sizes, compression ratios and placement of one dataset, or of all datasets of a file */
+typedef struct LayoutStats{
+	size_t num_chunks;
+	hsize_t stored_bytes;
+	hsize_t min_size;
+	hsize_t median_size;
+	hsize_t p90_size;
+	hsize_t max_size;
+	double min_ratio;
+	double median_ratio;
+	double max_ratio;
+	size_t extents;
+	hsize_t span;
+	size_t backward_seeks;
+	hsize_t pages;
+	size_t split_chunks;
+} LayoutStats;
+
+double get_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+size_t get_num_procs(void) {
+	long online_cpus = 0;
+
+	if (num_procs > 0)
+		return num_procs;
+
+	online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (online_cpus > 0) ? (size_t)online_cpus : 1;
+}
+
+int compare_hsize(const void *a, const void *b) {
+	hsize_t x = *(const hsize_t *)a;
+	hsize_t y = *(const hsize_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+int compare_record_addr(const void *a, const void *b) {
+	haddr_t x = ((const ChunkRecord *)a)->addr;
+	haddr_t y = ((const ChunkRecord *)b)->addr;
+
+	return (x > y) - (x < y);
+}
+
+hid_t create_fapl(void) {
+	hid_t fapl_id = H5I_INVALID_HID;
+
+	if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create FAPL")
+	}
+
+	if (use_ros3) {
+		H5FD_ros3_fapl_t param;
+
+		memset(&param, 0, sizeof(param));
+		strcpy(param.aws_region, "us-west-2");
+		param.version = 1;
+		param.authenticate = 0;
+
+		if (H5Pset_fapl_ros3(fapl_id, &param) < 0) {
+			FUNC_GOTO_ERROR("Failed to set ros3 in FAPL")
+		}
+	}
+
+	return fapl_id;
+}
+
+/* Record the layout of the dataset at path and how many chunk slots it needs */
+void add_dataset(LayoutContext *ctx, const char *path, hid_t dset) {
+	LayoutDataset *ld = NULL;
+	hid_t type = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t dcpl = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	hsize_t chunk_dims[H5S_MAX_RANK];
+	int ndims = 0;
+
+	if (ctx->num_dsets == ctx->max_dsets) {
+		ctx->max_dsets = (ctx->max_dsets) ? ctx->max_dsets * 2 : 64;
+
+		if ((ctx->dsets = realloc(ctx->dsets, ctx->max_dsets * sizeof(LayoutDataset))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate dataset list")
+		}
+	}
+
+	ld = &ctx->dsets[ctx->num_dsets++];
+	memset(ld, 0, sizeof(*ld));
+	ld->path = strdup(path);
+
+	if ((type = H5Dget_type(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataset type")
+	}
+
+	if ((space = H5Dget_space(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataset space")
+	}
+
+	if ((dcpl = H5Dget_create_plist(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dcpl")
+	}
+
+	if ((ndims = H5Sget_simple_extent_dims(space, dims, NULL)) < 0) {
+		FUNC_GOTO_ERROR("Failed to get dataset dimensions")
+	}
+
+	ld->layout = H5Pget_layout(dcpl);
+	ld->num_filters = H5Pget_nfilters(dcpl);
+	ld->logical_bytes = H5Tget_size(type);
+
+	for (int i = 0; i < ndims; i++)
+		ld->logical_bytes *= dims[i];
+
+	if (ld->layout == H5D_CHUNKED) {
+		if (H5Pget_chunk(dcpl, ndims, chunk_dims) != ndims) {
+			FUNC_GOTO_ERROR("Failed to get chunk dimensions")
+		}
+
+		ld->chunk_bytes = H5Tget_size(type);
+		ld->max_chunks = 1;
+
+		for (int i = 0; i < ndims; i++) {
+			ld->chunk_bytes *= chunk_dims[i];
+			ld->max_chunks *= (dims[i] + chunk_dims[i] - 1) / chunk_dims[i];
+		}
+	}
+	else if (ld->layout == H5D_CONTIGUOUS) {
+		/* One extent, counted as one chunk of the whole dataset */
+		ld->chunk_bytes = ld->logical_bytes;
+		ld->max_chunks = 1;
+	}
+
+	ld->first = ctx->num_slots;
+	ctx->num_slots += ld->max_chunks;
+
+	H5Pclose(dcpl);
+	H5Sclose(space);
+	H5Tclose(type);
+}
+
+/* Walk the groups under path and add every dataset. Soft and external links aren't followed. */
+void find_datasets(LayoutContext *ctx, hid_t fid, const char *path) {
+	hid_t group = H5I_INVALID_HID;
+	H5G_info_t ginfo;
+	char name[FILEPATH_BUFFER_SIZE];
+	char child_path[FILEPATH_BUFFER_SIZE];
+
+	if ((group = H5Gopen2(fid, path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open group")
+	}
+
+	if (H5Gget_info(group, &ginfo) < 0) {
+		FUNC_GOTO_ERROR("Failed to get group info")
+	}
+
+	for (hsize_t i = 0; i < ginfo.nlinks; i++) {
+		H5L_info_t linfo;
+		hid_t obj = H5I_INVALID_HID;
+
+		if (H5Lget_name_by_idx(group, ".", H5_INDEX_NAME, H5_ITER_INC, i, name, sizeof(name), H5P_DEFAULT) < 0) {
+			FUNC_GOTO_ERROR("Failed to get link name")
+		}
+
+		/* A path that doesn't fit is left out of the layout rather than opened truncated */
+		if ((size_t)snprintf(child_path, sizeof(child_path), "%s%s%s", path, (strcmp(path, PATH_DELIMITER)) ? PATH_DELIMITER : "", name) >= sizeof(child_path)) {
+			fprintf(stderr, "Object path too long, skipping %s in %s\n", name, path);
+			continue;
+		}
+
+		if (H5Lget_info(group, name, &linfo, H5P_DEFAULT) < 0) {
+			FUNC_GOTO_ERROR("Failed to get link info")
+		}
+
+		if (linfo.type != H5L_TYPE_HARD)
+			continue;
+
+		if ((obj = H5Oopen(fid, child_path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open object")
+		}
+
+		if (H5Iget_type(obj) == H5I_GROUP)
+			find_datasets(ctx, fid, child_path);
+		else if (H5Iget_type(obj) == H5I_DATASET)
+			add_dataset(ctx, child_path, obj);
+
+		H5Oclose(obj);
+	}
+
+	H5Gclose(group);
+}
+
+/* Hand out the datasets to the workers, largest first, each to the worker with the fewest chunk slots so far */
+void assign_workers(LayoutContext *ctx, size_t workers) {
+	size_t *load = NULL;
+	bool *assigned = NULL;
+
+	if ((load = calloc(workers, sizeof(size_t))) == NULL || (assigned = calloc(ctx->num_dsets + 1, sizeof(bool))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate worker loads")
+	}
+
+	for (size_t n = 0; n < ctx->num_dsets; n++) {
+		size_t largest = 0;
+		size_t worker = 0;
+
+		while (assigned[largest])
+			largest++;
+
+		for (size_t i = largest + 1; i < ctx->num_dsets; i++) {
+			if (!assigned[i] && ctx->dsets[i].max_chunks > ctx->dsets[largest].max_chunks)
+				largest = i;
+		}
+
+		for (size_t w = 1; w < workers; w++) {
+			if (load[w] < load[worker])
+				worker = w;
+		}
+
+		ctx->dsets[largest].worker = worker;
+		load[worker] += ctx->dsets[largest].max_chunks + 1;
+		assigned[largest] = true;
+	}
+
+	free(assigned);
+	free(load);
+}
+
+typedef struct ChunkIter{
+	ChunkRecord *records;
+	size_t max_chunks;
+	size_t num_chunks;
+} ChunkIter;
+
+#if H5_VERSION_GE(1, 14, 0)
+int chunk_iter_callback(const hsize_t *offset, unsigned filter_mask, haddr_t addr, hsize_t size, void *op_data) {
+	ChunkIter *iter = (ChunkIter *)op_data;
+
+	if (iter->num_chunks == iter->max_chunks) {
+		FUNC_GOTO_ERROR("More chunks than the dataset extent holds")
+	}
+
+	iter->records[iter->num_chunks].addr = addr;
+	iter->records[iter->num_chunks].size = size;
+	iter->records[iter->num_chunks].filter_mask = filter_mask;
+	iter->num_chunks++;
+
+	return H5_ITER_CONT;
+}
+#endif
+
+/* Fill in the chunk records of one dataset in the order of its chunk index. With 1.14 the index is walked once
+ * with H5Dchunk_iter, older libraries look every chunk up by its position in the index. */
+size_t read_chunk_records(hid_t dset, LayoutDataset *ld, ChunkRecord *records) {
+	ChunkIter iter = {records, ld->max_chunks, 0};
+
+	if (ld->layout == H5D_CONTIGUOUS) {
+		haddr_t addr = H5Dget_offset(dset);
+
+		/* Not yet allocated */
+		if (addr == HADDR_UNDEF)
+			return 0;
+
+		records[0].addr = addr;
+		records[0].size = H5Dget_storage_size(dset);
+		records[0].filter_mask = 0;
+
+		return 1;
+	}
+
+	if (ld->layout != H5D_CHUNKED || ld->max_chunks == 0)
+		return 0;
+
+#if H5_VERSION_GE(1, 14, 0)
+	if (H5Dchunk_iter(dset, H5P_DEFAULT, chunk_iter_callback, &iter) < 0) {
+		FUNC_GOTO_ERROR("Failed to iterate chunks")
+	}
+#else
+	{
+		hid_t space = H5I_INVALID_HID;
+		hsize_t num_chunks = 0;
+		hsize_t offset[H5S_MAX_RANK];
+
+		if ((space = H5Dget_space(dset)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dataset space")
+		}
+
+		if (H5Dget_num_chunks(dset, space, &num_chunks) < 0) {
+			FUNC_GOTO_ERROR("Failed to get number of chunks")
+		}
+
+		if (num_chunks > ld->max_chunks) {
+			FUNC_GOTO_ERROR("More chunks than the dataset extent holds")
+		}
+
+		for (hsize_t i = 0; i < num_chunks; i++) {
+			ChunkRecord *record = &records[i];
+
+			if (H5Dget_chunk_info(dset, space, i, offset, &record->filter_mask, &record->addr, &record->size) < 0) {
+				FUNC_GOTO_ERROR("Failed to get chunk info")
+			}
+		}
+
+		iter.num_chunks = num_chunks;
+		H5Sclose(space);
+	}
+#endif
+
+	return iter.num_chunks;
+}
+
+/* Open the file separately and read the chunk records of the datasets assigned to worker */
+void profile_datasets(LayoutContext *ctx, const char *input_path, size_t worker) {
+	hid_t fapl_id = create_fapl();
+	hid_t fid = H5I_INVALID_HID;
+
+	if ((fid = H5Fopen(input_path, H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input file in worker")
+	}
+
+	for (size_t i = 0; i < ctx->num_dsets; i++) {
+		LayoutDataset *ld = &ctx->dsets[i];
+		hid_t dset = H5I_INVALID_HID;
+
+		if (ld->worker != worker)
+			continue;
+
+		if ((dset = H5Dopen2(fid, ld->path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open dataset")
+		}
+
+		ctx->num_chunks[i] = read_chunk_records(dset, ld, &ctx->records[ld->first]);
+
+		PRINT_DEBUG("worker %zu: %s, %zu chunks\n", worker, ld->path, ctx->num_chunks[i])
+
+		H5Dclose(dset);
+	}
+
+	H5Fclose(fid);
+	H5Pclose(fapl_id);
+}
+
+/* Read the chunk records of every dataset with one process per worker. The library isn't thread-safe, so
+ * the workers are forked processes with their own handle on the file, which also spreads the index reads
+ * of a ros3 file over that many connections. */
+void run_workers(LayoutContext *ctx, const char *input_path, size_t workers) {
+	pid_t *pids = NULL;
+	void *mapping = NULL;
+
+	ctx->mapping_bytes = ctx->num_slots * sizeof(ChunkRecord) + ctx->num_dsets * sizeof(size_t);
+
+	if (ctx->mapping_bytes == 0)
+		return;
+
+	if ((mapping = mmap(NULL, ctx->mapping_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		FUNC_GOTO_ERROR("Failed to map chunk records")
+	}
+
+	ctx->records = (ChunkRecord *)mapping;
+	ctx->num_chunks = (size_t *)(ctx->records + ctx->num_slots);
+
+	if (workers == 1) {
+		profile_datasets(ctx, input_path, 0);
+		return;
+	}
+
+	if ((pids = calloc(workers, sizeof(pid_t))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate worker list")
+	}
+
+	/* Otherwise buffered output would be written again by every worker */
+	fflush(stdout);
+	fflush(stderr);
+
+	for (size_t w = 0; w < workers; w++) {
+		if ((pids[w] = fork()) < 0) {
+			FUNC_GOTO_ERROR("Failed to fork worker")
+		}
+
+		if (pids[w] == 0) {
+			profile_datasets(ctx, input_path, w);
+			fflush(stderr);
+			_exit(0);
+		}
+	}
+
+	for (size_t w = 0; w < workers; w++) {
+		int status = 0;
+
+		if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			FUNC_GOTO_ERROR("Worker failed to read chunk records")
+		}
+	}
+
+	free(pids);
+}
+
+/* Count the pages of page_size that the address sorted records touch, and the chunks that cross a page boundary */
+hsize_t count_pages(const ChunkRecord *sorted, size_t num_records, hsize_t page_size, size_t *split_chunks) {
+	hsize_t pages = 0;
+	hsize_t next_page = 0;
+
+	*split_chunks = 0;
+
+	for (size_t i = 0; i < num_records; i++) {
+		hsize_t first_page = 0;
+		hsize_t last_page = 0;
+
+		if (sorted[i].size == 0)
+			continue;
+
+		first_page = sorted[i].addr / page_size;
+		last_page = (sorted[i].addr + sorted[i].size - 1) / page_size;
+
+		if (first_page != last_page)
+			(*split_chunks)++;
+
+		/* Pages shared with the previous chunk are counted once */
+		if (first_page < next_page)
+			first_page = next_page;
+
+		if (last_page >= first_page) {
+			pages += last_page - first_page + 1;
+			next_page = last_page + 1;
+		}
+	}
+
+	return pages;
+}
+
+/* Summarize num_records chunk records in index order, chunk_bytes_of[i] being the size of chunk i before filtering */
+void get_layout_stats(const ChunkRecord *records, size_t num_records, const hsize_t *chunk_bytes_of, hsize_t page_size, LayoutStats *stats) {
+	hsize_t *sizes = NULL;
+	double *ratios = NULL;
+	ChunkRecord *sorted = NULL;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->num_chunks = num_records;
+
+	if (num_records == 0)
+		return;
+
+	sizes = malloc(num_records * sizeof(hsize_t));
+	ratios = malloc(num_records * sizeof(double));
+	sorted = malloc(num_records * sizeof(ChunkRecord));
+
+	if (sizes == NULL || ratios == NULL || sorted == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate layout statistics")
+	}
+
+	for (size_t i = 0; i < num_records; i++) {
+		sizes[i] = records[i].size;
+		ratios[i] = (records[i].size > 0) ? (double)chunk_bytes_of[i] / records[i].size : 0;
+		stats->stored_bytes += records[i].size;
+
+		/* A reader going through the chunks in index order has to seek back here */
+		if (i > 0 && records[i].addr < records[i - 1].addr)
+			stats->backward_seeks++;
+	}
+
+	qsort(sizes, num_records, sizeof(hsize_t), compare_hsize);
+	qsort(ratios, num_records, sizeof(double), compare_double);
+
+	stats->min_size = sizes[0];
+	stats->median_size = sizes[(num_records - 1) / 2];
+	stats->p90_size = sizes[(num_records - 1) * 9 / 10];
+	stats->max_size = sizes[num_records - 1];
+	stats->min_ratio = ratios[0];
+	stats->median_ratio = ratios[(num_records - 1) / 2];
+	stats->max_ratio = ratios[num_records - 1];
+
+	/* Extents are runs of chunks that follow each other in the file with no gap */
+	memcpy(sorted, records, num_records * sizeof(ChunkRecord));
+	qsort(sorted, num_records, sizeof(ChunkRecord), compare_record_addr);
+
+	stats->extents = 1;
+
+	for (size_t i = 1; i < num_records; i++) {
+		if (sorted[i].addr != sorted[i - 1].addr + sorted[i - 1].size)
+			stats->extents++;
+	}
+
+	stats->span = sorted[num_records - 1].addr + sorted[num_records - 1].size - sorted[0].addr;
+	stats->pages = count_pages(sorted, num_records, page_size, &stats->split_chunks);
+
+	free(sorted);
+	free(ratios);
+	free(sizes);
+}
+
+const char *get_layout_name(H5D_layout_t layout) {
+	switch (layout) {
+		case H5D_COMPACT:
+			return "compact";
+		case H5D_CONTIGUOUS:
+			return "contiguous";
+		case H5D_CHUNKED:
+			return "chunked";
+		case H5D_VIRTUAL:
+			return "virtual";
+		default:
+			return "unknown";
+	}
+}
+
+/* Profile one file: walk it on the main thread, read the chunk records in the workers, then print
+ *   "chunks, <path>, <layout>, <filters>, <chunks>, <logical bytes>, <stored bytes>, <chunk bytes>,
+ *    <min>, <median>, <p90>, <max stored chunk bytes>, <ratio>, <min>, <median>, <max chunk ratio>"
+ *   "locality, <path>, <extents>, <span bytes>, <density>, <backward seeks>, <pages>, <split chunks>, <page efficiency>"
+ * per dataset, "chunk, <path>, <index>, <address>, <stored bytes>, <ratio>, <filter mask>" per chunk with -chunks,
+ * "histogram, <file>, <bucket upper bytes>, <chunks>, <stored bytes>" per power of two of stored chunk sizes and
+ *   "layout, <file>, <seconds>, <workers>, <datasets>, <chunks>, <file bytes>, <raw bytes>, <metadata bytes>,
+ *    <page size>, <paged>, <pages>, <page efficiency>, <extents>, <largest chunk bytes>"
+ * for the whole file. Contiguous datasets count as a single chunk. */
+void profile_file(const char *input_path) {
+	LayoutContext ctx;
+	LayoutStats stats;
+	hid_t fapl_id = create_fapl();
+	hid_t fid = H5I_INVALID_HID;
+	hid_t fcpl = H5I_INVALID_HID;
+	H5F_fspace_strategy_t strategy;
+	hbool_t persist = false;
+	hsize_t threshold = 0;
+	hsize_t file_page_size = 0;
+	hsize_t page_size = 0;
+	hsize_t file_bytes = 0;
+	hsize_t largest_chunk = 0;
+	hsize_t *all_chunk_bytes = NULL;
+	ChunkRecord *all_records = NULL;
+	size_t num_records = 0;
+	size_t workers = get_num_procs();
+	size_t bucket_chunks[MAX_SIZE_BUCKET + 1];
+	hsize_t bucket_bytes[MAX_SIZE_BUCKET + 1];
+	double start_time = get_time();
+	double elapsed = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(bucket_chunks, 0, sizeof(bucket_chunks));
+	memset(bucket_bytes, 0, sizeof(bucket_bytes));
+
+	if ((fid = H5Fopen(input_path, H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input file")
+	}
+
+	if ((fcpl = H5Fget_create_plist(fid)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get fcpl")
+	}
+
+	if (H5Pget_file_space_strategy(fcpl, &strategy, &persist, &threshold) < 0) {
+		FUNC_GOTO_ERROR("Failed to get file space strategy")
+	}
+
+	if (H5Pget_file_space_page_size(fcpl, &file_page_size) < 0) {
+		FUNC_GOTO_ERROR("Failed to get file space page size")
+	}
+
+	if (H5Fget_filesize(fid, &file_bytes) < 0) {
+		FUNC_GOTO_ERROR("Failed to get file size")
+	}
+
+	if (page_bytes > 0)
+		page_size = page_bytes;
+	else if (strategy == H5F_FSPACE_STRATEGY_PAGE)
+		page_size = file_page_size;
+	else
+		page_size = DEFAULT_PAGE_BYTES;
+
+	find_datasets(&ctx, fid, group_path);
+
+	/* The workers open the file themselves, a handle inherited across fork would share its file offset */
+	H5Pclose(fcpl);
+	H5Fclose(fid);
+
+	if (workers > ctx.num_dsets)
+		workers = (ctx.num_dsets > 0) ? ctx.num_dsets : 1;
+
+	assign_workers(&ctx, workers);
+	run_workers(&ctx, input_path, workers);
+
+	elapsed = get_time() - start_time;
+
+	PRINT_DEBUG("%s: %zu datasets, %zu chunk slots, %zu workers, %.3f s\n", input_path, ctx.num_dsets, ctx.num_slots, workers, elapsed)
+
+	if ((all_records = malloc((ctx.num_slots + 1) * sizeof(ChunkRecord))) == NULL ||
+		(all_chunk_bytes = malloc((ctx.num_slots + 1) * sizeof(hsize_t))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate file chunk records")
+	}
+
+	for (size_t i = 0; i < ctx.num_dsets; i++) {
+		LayoutDataset *ld = &ctx.dsets[i];
+		size_t num_chunks = (ctx.num_chunks) ? ctx.num_chunks[i] : 0;
+		const char *layout = get_layout_name(ld->layout);
+
+		for (size_t c = 0; c < num_chunks; c++) {
+			ChunkRecord *record = &ctx.records[ld->first + c];
+			int bucket = 0;
+
+			all_records[num_records] = *record;
+			all_chunk_bytes[num_records] = ld->chunk_bytes;
+			num_records++;
+
+			while (bucket < MAX_SIZE_BUCKET && ((hsize_t)1 << bucket) < record->size)
+				bucket++;
+
+			bucket_chunks[bucket]++;
+			bucket_bytes[bucket] += record->size;
+
+			if (print_chunks) {
+				printf("chunk, %s, %zu, %llu, %llu, %.3f, %u\n", ld->path, c, (unsigned long long)record->addr, (unsigned long long)record->size,
+					   (record->size > 0) ? (double)ld->chunk_bytes / record->size : 0.0, record->filter_mask);
+			}
+		}
+
+		if (num_chunks > 0 && ld->chunk_bytes > largest_chunk)
+			largest_chunk = ld->chunk_bytes;
+
+		get_layout_stats(&all_records[num_records - num_chunks], num_chunks, &all_chunk_bytes[num_records - num_chunks], page_size, &stats);
+
+		printf("chunks, %s, %s, %d, %zu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %.3f, %.3f, %.3f, %.3f\n", ld->path, layout, ld->num_filters,
+			   stats.num_chunks, (unsigned long long)ld->logical_bytes, (unsigned long long)stats.stored_bytes, (unsigned long long)ld->chunk_bytes,
+			   (unsigned long long)stats.min_size, (unsigned long long)stats.median_size, (unsigned long long)stats.p90_size,
+			   (unsigned long long)stats.max_size, (stats.stored_bytes > 0) ? (double)ld->logical_bytes / stats.stored_bytes : 0.0,
+			   stats.min_ratio, stats.median_ratio, stats.max_ratio);
+
+		printf("locality, %s, %zu, %llu, %.3f, %zu, %llu, %zu, %.3f\n", ld->path, stats.extents, (unsigned long long)stats.span,
+			   (stats.span > 0) ? (double)stats.stored_bytes / stats.span : 0.0, stats.backward_seeks, (unsigned long long)stats.pages,
+			   stats.split_chunks, (stats.pages > 0) ? (double)stats.stored_bytes / (stats.pages * page_size) : 0.0);
+	}
+
+	for (int bucket = 0; bucket <= MAX_SIZE_BUCKET; bucket++) {
+		if (bucket_chunks[bucket] > 0) {
+			printf("histogram, %s, %llu, %zu, %llu\n", input_path, (unsigned long long)1 << bucket, bucket_chunks[bucket],
+				   (unsigned long long)bucket_bytes[bucket]);
+		}
+	}
+
+	/* Pages and extents over all datasets, which may share pages */
+	get_layout_stats(all_records, num_records, all_chunk_bytes, page_size, &stats);
+
+	printf("layout, %s, %.3f, %zu, %zu, %zu, %llu, %llu, %llu, %llu, %d, %llu, %.3f, %zu, %llu\n", input_path, elapsed, workers, ctx.num_dsets,
+		   num_records, (unsigned long long)file_bytes, (unsigned long long)stats.stored_bytes,
+		   (unsigned long long)((file_bytes > stats.stored_bytes) ? file_bytes - stats.stored_bytes : 0), (unsigned long long)page_size,
+		   strategy == H5F_FSPACE_STRATEGY_PAGE, (unsigned long long)stats.pages,
+		   (stats.pages > 0) ? (double)stats.stored_bytes / (stats.pages * page_size) : 0.0, stats.extents, (unsigned long long)largest_chunk);
+
+	if (ctx.mapping_bytes > 0)
+		munmap(ctx.records, ctx.mapping_bytes);
+
+	for (size_t i = 0; i < ctx.num_dsets; i++)
+		free(ctx.dsets[i].path);
+
+	free(all_chunk_bytes);
+	free(all_records);
+	free(ctx.dsets);
+	H5Pclose(fapl_id);
+}
+
+int main(int argc, char **argv) {
+	int first_input = 0;
+
+	for (int optind = 1; optind < argc; optind++)
+	{
+		if (strcmp(argv[optind], "-debug") == 0) {
+			debug = true;
+		}
+		else if (strcmp(argv[optind], "-use_ros3") == 0) {
+			use_ros3 = true;
+		}
+		else if (strcmp(argv[optind], "-chunks") == 0) {
+			print_chunks = true;
+		}
+		else if (strcmp(argv[optind], "-procs") == 0 && optind + 1 < argc) {
+			num_procs = strtoul(argv[++optind], NULL, 10);
+		}
+		else if (strcmp(argv[optind], "-page_kib") == 0 && optind + 1 < argc) {
+			page_bytes = strtoull(argv[++optind], NULL, 10) * 1024;
+		}
+		else if (strcmp(argv[optind], "-group") == 0 && optind + 1 < argc) {
+			group_path = argv[++optind];
+		}
+		else {
+			first_input = optind;
+			break;
+		}
+	}
+
+	if (first_input == 0) {
+		fprintf(stderr, USAGE);
+		exit(1);
+	}
+
+	for (int i = first_input; i < argc; i++)
+		profile_file(argv[i]);
+
+	return 0;
+}
@@ -0,0 +1,1048 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "hdf5.h"
+#include "hdf5_hl.h"
+
+#include "thread_pool.h"
+
+#define SUCCEED 0
+#define FAIL (-1)
+
+#define FILEPATH_BUFFER_SIZE 1024
+
+#define PATH_DELIMITER "/"
+
+/*
+ * Macro to push the current function to the current error stack
+ * and then goto the "done" label, which should appear inside the
+ * function. (compatible with v1 and v2 errors)
+ */
+#define FUNC_GOTO_ERROR(err_msg)      \
+	fprintf(stderr, "%s\n", err_msg); \
+	fprintf(stderr, "\n");            \
+	exit(1);
+
+/* Print if program is run with debug flag */
+#define PRINT_DEBUG(...)              \
+	if (debug)                        \
+	{                                 \
+		fprintf(stderr, __VA_ARGS__); \
+	}
+
+#define USAGE "usage: icesat2_repack [-debug] [-use_ros3] [-threads N] [-page_mib N] [-chunk_kib N] [-level N] <input> <output>\n"
+
+/* Output chunks of one dataset compressed in parallel per slab, per worker thread */
+#define CHUNKS_PER_THREAD 2
+
+bool debug = false;
+bool use_ros3 = false;
+
+/* Number of worker threads, 0 to use one per online CPU */
+size_t num_threads = 0;
+
+/* Page size of the output file */
+size_t page_size = 10 * 1024 * 1024;
+
+/* Target uncompressed size of an output chunk */
+size_t chunk_target_bytes = 1024 * 1024;
+
+/* Deflate level of the output, 0 to write chunks unfiltered */
+int deflate_level = 4;
+
+/* Datasets that get per-chunk min/max attributes, matched against the last path component */
+const char *stats_datasets[] = {"lat_ph",
+								"lon_ph",
+								"reference_photon_lat",
+								"reference_photon_lon",
+								0};
+
+/* A dataset found while copying the structure, rewritten chunk by chunk in the second pass */
+typedef struct RepackDataset{
+	char *path;
+	bool rechunk;
+	bool stats;
+	bool references;
+	hsize_t chunk_rows;
+	hsize_t num_chunks;
+} RepackDataset;
+
+typedef struct RepackContext{
+	hid_t fin;
+	hid_t fout;
+	RepackDataset *dsets;
+	size_t num_dsets;
+	size_t max_dsets;
+} RepackContext;
+
+ThreadPool *thread_pool = NULL;
+
+/* One output chunk: the worker shuffles and compresses data into out, and takes its min/max if wanted */
+typedef struct EncodeTask{
+	const unsigned char *data;
+	size_t nbytes;
+	size_t nelems;
+	size_t elem_size;
+
+	bool stats;
+	double min;
+	double max;
+
+	unsigned char *out;
+	size_t out_bytes;
+	unsigned char *scratch;
+} EncodeTask;
+
+/* Byte-transpose the elements the way the HDF5 shuffle filter does */
+void shuffle(const unsigned char *src, unsigned char *dest, size_t nelems, size_t elem_size) {
+	for (size_t i = 0; i < nelems; i++) {
+		for (size_t j = 0; j < elem_size; j++) {
+			dest[j * nelems + i] = src[i * elem_size + j];
+		}
+	}
+}
+
+void encode_task(void *arg) {
+	EncodeTask *task = (EncodeTask *)arg;
+	const unsigned char *src = task->data;
+	uLongf out_bytes = 0;
+
+	if (task->stats) {
+		task->min = task->max = 0;
+
+		for (size_t i = 0; i < task->nelems; i++) {
+			double value = (task->elem_size == sizeof(double)) ? ((const double *)task->data)[i] : ((const float *)task->data)[i];
+
+			if (i == 0 || value < task->min)
+				task->min = value;
+
+			if (i == 0 || value > task->max)
+				task->max = value;
+		}
+	}
+
+	if (deflate_level == 0) {
+		task->out_bytes = task->nbytes;
+		memcpy(task->out, task->data, task->nbytes);
+		return;
+	}
+
+	if (task->elem_size > 1) {
+		shuffle(task->data, task->scratch, task->nbytes / task->elem_size, task->elem_size);
+		src = task->scratch;
+	}
+
+	out_bytes = compressBound(task->nbytes);
+
+	if (compress2(task->out, &out_bytes, src, task->nbytes, deflate_level) != Z_OK) {
+		FUNC_GOTO_ERROR("Failed to compress chunk")
+	}
+
+	task->out_bytes = out_bytes;
+}
+
+/* Return true if the last component of path is one of the stats datasets */
+bool wants_stats(const char *path) {
+	const char *name = strrchr(path, '/');
+
+	name = (name) ? name + 1 : path;
+
+	for (size_t i = 0; stats_datasets[i]; i++) {
+		if (!strcmp(name, stats_datasets[i]))
+			return true;
+	}
+
+	return false;
+}
+
+typedef struct AttrCopy{
+	hid_t dest;
+	bool is_scale;
+} AttrCopy;
+
+herr_t copy_attr_callback(hid_t src, const char *attr_name, const H5A_info_t *ainfo, void *op_data) {
+	AttrCopy *copy = (AttrCopy *)op_data;
+	hid_t attr = H5I_INVALID_HID;
+	hid_t type = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t out_attr = H5I_INVALID_HID;
+	hssize_t num_elems = 0;
+	void *data = NULL;
+
+	(void)ainfo;
+
+	if (!strcmp(attr_name, "DIMENSION_LIST") || !strcmp(attr_name, "REFERENCE_LIST"))
+		return 0;
+
+	if (copy->is_scale && (!strcmp(attr_name, "CLASS") || !strcmp(attr_name, "NAME")))
+		return 0;
+
+	if ((attr = H5Aopen(src, attr_name, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open attribute")
+	}
+
+	if ((type = H5Aget_type(attr)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get datatype of attribute")
+	}
+
+	if ((space = H5Aget_space(attr)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataspace of attribute")
+	}
+
+	if ((num_elems = H5Sget_simple_extent_npoints(space)) < 0) {
+		FUNC_GOTO_ERROR("Failed to get number of elements")
+	}
+
+	if ((data = calloc(num_elems ? num_elems : 1, H5Tget_size(type))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate attribute buffer")
+	}
+
+	if (H5Aread(attr, type, data) < 0) {
+		FUNC_GOTO_ERROR("Failed to read from attribute")
+	}
+
+	if ((out_attr = H5Acreate(copy->dest, attr_name, type, space, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create attribute in output file")
+	}
+
+	if (H5Awrite(out_attr, type, data) < 0) {
+		FUNC_GOTO_ERROR("Failed to write to copied attribute")
+	}
+
+	if (H5Tdetect_class(type, H5T_VLEN) > 0 || H5Tis_variable_str(type) > 0)
+		H5Dvlen_reclaim(type, space, H5P_DEFAULT, data);
+
+	free(data);
+	H5Aclose(out_attr);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Aclose(attr);
+
+	return 0;
+}
+
+/* Copy every attribute of src to dest, except the dimension scale bookkeeping. DIMENSION_LIST and
+ * REFERENCE_LIST hold object references into the input file; the scales are reattached in attach_scales. */
+void copy_attributes(hid_t src, hid_t dest) {
+	AttrCopy copy;
+
+	copy.dest = dest;
+	copy.is_scale = H5Iget_type(src) == H5I_DATASET && H5DSis_scale(src) > 0;
+
+	if (H5Aiterate2(src, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_attr_callback, &copy) < 0) {
+		FUNC_GOTO_ERROR("Failed to copy attributes")
+	}
+}
+
+/* Rows per output chunk: whole rows along track, up to the target chunk size */
+hsize_t get_chunk_rows(hsize_t dim0, size_t row_bytes) {
+	hsize_t rows = chunk_target_bytes / row_bytes;
+
+	if (rows == 0)
+		rows = 1;
+
+	if (rows > dim0)
+		rows = dim0;
+
+	return rows;
+}
+
+/* Create the output dataset for path. Fixed-size numeric datasets get a new layout: chunked along track
+ * only, shuffle and deflate, and fixed maximum dimensions so the library uses a fixed array chunk index,
+ * which a reader locates with one metadata read. Everything else is copied as is. */
+void create_dataset(RepackContext *ctx, const char *path, hid_t src) {
+	RepackDataset *rd = NULL;
+	hid_t src_type = H5I_INVALID_HID;
+	hid_t type = H5I_INVALID_HID;
+	hid_t src_space = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t dcpl = H5I_INVALID_HID;
+	hid_t dest = H5I_INVALID_HID;
+	H5T_class_t type_class;
+	int ndims = 0;
+	hsize_t dims[H5S_MAX_RANK];
+	size_t row_bytes = 0;
+
+	if (ctx->num_dsets == ctx->max_dsets) {
+		ctx->max_dsets = (ctx->max_dsets) ? ctx->max_dsets * 2 : 64;
+
+		if ((ctx->dsets = realloc(ctx->dsets, ctx->max_dsets * sizeof(RepackDataset))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate dataset list")
+		}
+	}
+
+	rd = &ctx->dsets[ctx->num_dsets++];
+	memset(rd, 0, sizeof(*rd));
+	rd->path = strdup(path);
+
+	if ((src_type = H5Dget_type(src)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataset type")
+	}
+
+	/* A transient copy, in case the input type is committed */
+	if ((type = H5Tcopy(src_type)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to copy dataset type")
+	}
+
+	if ((src_space = H5Dget_space(src)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataset space")
+	}
+
+	if ((dcpl = H5Dget_create_plist(src)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dcpl")
+	}
+
+	type_class = H5Tget_class(type);
+	ndims = H5Sget_simple_extent_dims(src_space, dims, NULL);
+
+	rd->references = type_class == H5T_REFERENCE;
+
+	rd->rechunk = ndims > 0 && dims[0] > 0 && type_class != H5T_VLEN && type_class != H5T_REFERENCE &&
+				  H5Tis_variable_str(type) <= 0 && H5Tdetect_class(type, H5T_VLEN) <= 0;
+
+	if (rd->rechunk) {
+		hsize_t chunk_dims[H5S_MAX_RANK];
+
+		row_bytes = H5Tget_size(type);
+
+		for (int i = 1; i < ndims; i++) {
+			row_bytes *= dims[i];
+			chunk_dims[i] = dims[i];
+		}
+
+		rd->chunk_rows = get_chunk_rows(dims[0], row_bytes);
+		rd->num_chunks = (dims[0] + rd->chunk_rows - 1) / rd->chunk_rows;
+		chunk_dims[0] = rd->chunk_rows;
+
+		rd->stats = wants_stats(path) && ndims == 1 && type_class == H5T_FLOAT &&
+					(H5Tequal(type, H5T_NATIVE_DOUBLE) > 0 || H5Tequal(type, H5T_NATIVE_FLOAT) > 0);
+
+		if ((space = H5Screate_simple(ndims, dims, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create dataset space")
+		}
+
+		if (H5Premove_filter(dcpl, H5Z_FILTER_ALL) < 0) {
+			FUNC_GOTO_ERROR("Failed to remove filters")
+		}
+
+		if (H5Pset_alloc_time(dcpl, H5D_ALLOC_TIME_INCR) < 0) {
+			FUNC_GOTO_ERROR("Failed to set allocation time")
+		}
+
+		if (H5Pset_chunk(dcpl, ndims, chunk_dims) < 0) {
+			FUNC_GOTO_ERROR("Failed to set chunk dimensions")
+		}
+
+		if (deflate_level > 0) {
+			if (H5Tget_size(type) > 1 && H5Pset_shuffle(dcpl) < 0) {
+				FUNC_GOTO_ERROR("Failed to set shuffle filter")
+			}
+
+			if (H5Pset_deflate(dcpl, deflate_level) < 0) {
+				FUNC_GOTO_ERROR("Failed to set deflate filter")
+			}
+		}
+	}
+	else {
+		if ((space = H5Scopy(src_space)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to copy dataset space")
+		}
+	}
+
+	if ((dest = H5Dcreate2(ctx->fout, path, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create dataset in output file")
+	}
+
+	copy_attributes(src, dest);
+
+	/* Created now, written after the data, so they land in the metadata pages with everything else */
+	if (rd->stats) {
+		const char *attr_names[] = {"chunk_min", "chunk_max", 0};
+		hid_t attr_space = H5I_INVALID_HID;
+
+		if ((attr_space = H5Screate_simple(1, &rd->num_chunks, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create stats space")
+		}
+
+		for (size_t i = 0; attr_names[i]; i++) {
+			hid_t attr = H5I_INVALID_HID;
+
+			if ((attr = H5Acreate(dest, attr_names[i], H5T_NATIVE_DOUBLE, attr_space, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to create stats attribute")
+			}
+
+			H5Aclose(attr);
+		}
+
+		H5Sclose(attr_space);
+	}
+
+	/* Strings and empty datasets are small; copy them whole. References are remapped once every target exists. */
+	if (!rd->rechunk && !rd->references) {
+		hssize_t num_elems = H5Sget_simple_extent_npoints(src_space);
+		void *data = NULL;
+
+		if (num_elems > 0) {
+			if ((data = calloc(num_elems, H5Tget_size(type))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate dataset buffer")
+			}
+
+			if (H5Dread(src, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) < 0) {
+				FUNC_GOTO_ERROR("Failed to read from dataset")
+			}
+
+			if (H5Dwrite(dest, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) < 0) {
+				FUNC_GOTO_ERROR("Failed to write to dataset")
+			}
+
+			if (H5Tdetect_class(type, H5T_VLEN) > 0 || H5Tis_variable_str(type) > 0)
+				H5Dvlen_reclaim(type, src_space, H5P_DEFAULT, data);
+
+			free(data);
+		}
+	}
+
+	PRINT_DEBUG("%s: %s, %llu rows per chunk\n", path, (rd->rechunk) ? "rechunked" : "copied", (unsigned long long)rd->chunk_rows)
+
+	H5Dclose(dest);
+	H5Pclose(dcpl);
+	H5Sclose(space);
+	H5Sclose(src_space);
+	H5Tclose(type);
+	H5Tclose(src_type);
+}
+
+/* First pass: recreate the groups, links, datasets and attributes under path, without rechunked data */
+void copy_structure(RepackContext *ctx, const char *path) {
+	hid_t group = H5I_INVALID_HID;
+	H5G_info_t ginfo;
+	char name[FILEPATH_BUFFER_SIZE];
+	char child_path[FILEPATH_BUFFER_SIZE];
+
+	if ((group = H5Gopen2(ctx->fin, path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input group")
+	}
+
+	if (H5Gget_info(group, &ginfo) < 0) {
+		FUNC_GOTO_ERROR("Failed to get group info")
+	}
+
+	for (hsize_t i = 0; i < ginfo.nlinks; i++) {
+		H5L_info_t linfo;
+		hid_t obj = H5I_INVALID_HID;
+
+		if (H5Lget_name_by_idx(group, ".", H5_INDEX_NAME, H5_ITER_INC, i, name, sizeof(name), H5P_DEFAULT) < 0) {
+			FUNC_GOTO_ERROR("Failed to get link name")
+		}
+
+		if ((size_t)snprintf(child_path, sizeof(child_path), "%s%s%s", path, (strcmp(path, PATH_DELIMITER)) ? PATH_DELIMITER : "", name) >= sizeof(child_path)) {
+			FUNC_GOTO_ERROR("Object path too long")
+		}
+
+		if (H5Lget_info(group, name, &linfo, H5P_DEFAULT) < 0) {
+			FUNC_GOTO_ERROR("Failed to get link info")
+		}
+
+		/* Soft and external links are recreated rather than followed */
+		if (linfo.type == H5L_TYPE_SOFT || linfo.type == H5L_TYPE_EXTERNAL) {
+			char *link_val = NULL;
+
+			if ((link_val = malloc(linfo.u.val_size)) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate link value")
+			}
+
+			if (H5Lget_val(group, name, link_val, linfo.u.val_size, H5P_DEFAULT) < 0) {
+				FUNC_GOTO_ERROR("Failed to get link value")
+			}
+
+			if (linfo.type == H5L_TYPE_SOFT) {
+				if (H5Lcreate_soft(link_val, ctx->fout, child_path, H5P_DEFAULT, H5P_DEFAULT) < 0) {
+					FUNC_GOTO_ERROR("Failed to create soft link")
+				}
+			}
+			else {
+				const char *file_name = NULL;
+				const char *obj_name = NULL;
+
+				if (H5Lunpack_elink_val(link_val, linfo.u.val_size, NULL, &file_name, &obj_name) < 0) {
+					FUNC_GOTO_ERROR("Failed to unpack external link")
+				}
+
+				if (H5Lcreate_external(file_name, obj_name, ctx->fout, child_path, H5P_DEFAULT, H5P_DEFAULT) < 0) {
+					FUNC_GOTO_ERROR("Failed to create external link")
+				}
+			}
+
+			free(link_val);
+			continue;
+		}
+
+		if ((obj = H5Oopen(ctx->fin, child_path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open input object")
+		}
+
+		switch (H5Iget_type(obj)) {
+			case H5I_GROUP: {
+				hid_t out_group = H5I_INVALID_HID;
+
+				if ((out_group = H5Gcreate2(ctx->fout, child_path, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+					FUNC_GOTO_ERROR("Failed to create group in output file")
+				}
+
+				copy_attributes(obj, out_group);
+				H5Gclose(out_group);
+
+				copy_structure(ctx, child_path);
+				break;
+			}
+
+			case H5I_DATASET:
+				create_dataset(ctx, child_path, obj);
+				break;
+
+			case H5I_DATATYPE:
+				if (H5Ocopy(ctx->fin, child_path, ctx->fout, child_path, H5P_DEFAULT, H5P_DEFAULT) < 0) {
+					FUNC_GOTO_ERROR("Failed to copy named datatype")
+				}
+				break;
+
+			default:
+				FUNC_GOTO_ERROR("Unexpected object type in input file")
+		}
+
+		H5Oclose(obj);
+	}
+
+	H5Gclose(group);
+}
+
+typedef struct ScaleAttach{
+	hid_t fout;
+	hid_t dest;
+} ScaleAttach;
+
+herr_t attach_scale_callback(hid_t did, unsigned dim, hid_t dsid, void *visitor_data) {
+	ScaleAttach *attach = (ScaleAttach *)visitor_data;
+	hid_t dest_scale = H5I_INVALID_HID;
+	char scale_path[FILEPATH_BUFFER_SIZE];
+
+	(void)did;
+
+	if (H5Iget_name(dsid, scale_path, sizeof(scale_path)) <= 0) {
+		FUNC_GOTO_ERROR("Failed to get dimension scale path")
+	}
+
+	if ((dest_scale = H5Dopen2(attach->fout, scale_path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open output dimension scale")
+	}
+
+	if (H5DSattach_scale(attach->dest, dest_scale, dim) < 0) {
+		FUNC_GOTO_ERROR("Failed to attach dimension scale")
+	}
+
+	H5Dclose(dest_scale);
+
+	return 0;
+}
+
+/* Mark the output dimension scales and reattach them to the same dimensions as in the input */
+void attach_scales(RepackContext *ctx) {
+	for (int attach = 0; attach < 2; attach++) {
+		for (size_t i = 0; i < ctx->num_dsets; i++) {
+			hid_t src = H5I_INVALID_HID;
+			hid_t dest = H5I_INVALID_HID;
+			hid_t space = H5I_INVALID_HID;
+
+			if ((src = H5Dopen2(ctx->fin, ctx->dsets[i].path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to open input dataset")
+			}
+
+			if ((dest = H5Dopen2(ctx->fout, ctx->dsets[i].path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to open output dataset")
+			}
+
+			if (!attach && H5DSis_scale(src) > 0) {
+				char scale_name[FILEPATH_BUFFER_SIZE] = "";
+
+				H5DSget_scale_name(src, scale_name, sizeof(scale_name));
+
+				if (H5DSset_scale(dest, (scale_name[0]) ? scale_name : NULL) < 0) {
+					FUNC_GOTO_ERROR("Failed to set dimension scale")
+				}
+			}
+			else if (attach && H5DSis_scale(src) <= 0) {
+				ScaleAttach scale_attach = {ctx->fout, dest};
+
+				space = H5Dget_space(src);
+
+				for (int dim = 0; dim < H5Sget_simple_extent_ndims(space); dim++) {
+					if (H5DSget_num_scales(src, dim) > 0 &&
+						H5DSiterate_scales(src, dim, NULL, attach_scale_callback, &scale_attach) < 0) {
+						FUNC_GOTO_ERROR("Failed to iterate dimension scales")
+					}
+				}
+
+				H5Sclose(space);
+			}
+
+			H5Dclose(dest);
+			H5Dclose(src);
+		}
+	}
+}
+
+/* References hold object addresses in the input file, so recreate each one against the object at the same
+ * path in the output. Null references stay null. */
+void remap_references(RepackContext *ctx, RepackDataset *rd) {
+	hid_t src = H5I_INVALID_HID;
+	hid_t dest = H5I_INVALID_HID;
+	hid_t type = H5I_INVALID_HID;
+	hid_t mem_type = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	H5R_type_t ref_type = H5R_BADTYPE;
+	size_t ref_size = 0;
+	hssize_t num_elems = 0;
+	unsigned char *src_refs = NULL;
+	unsigned char *dest_refs = NULL;
+	unsigned char *null_ref = NULL;
+	char target[FILEPATH_BUFFER_SIZE];
+
+	if ((src = H5Dopen2(ctx->fin, rd->path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input dataset")
+	}
+
+	if ((dest = H5Dopen2(ctx->fout, rd->path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open output dataset")
+	}
+
+	if ((type = H5Dget_type(src)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataset type")
+	}
+
+	if (H5Tequal(type, H5T_STD_REF_OBJ) > 0) {
+		ref_type = H5R_OBJECT;
+		ref_size = sizeof(hobj_ref_t);
+		mem_type = H5T_STD_REF_OBJ;
+	}
+	else if (H5Tequal(type, H5T_STD_REF_DSETREG) > 0) {
+		ref_type = H5R_DATASET_REGION;
+		ref_size = sizeof(hdset_reg_ref_t);
+		mem_type = H5T_STD_REF_DSETREG;
+	}
+	else {
+		FUNC_GOTO_ERROR("Unsupported reference type")
+	}
+
+	if ((space = H5Dget_space(src)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataset space")
+	}
+
+	if ((num_elems = H5Sget_simple_extent_npoints(space)) > 0) {
+		if ((src_refs = calloc(num_elems, ref_size)) == NULL || (dest_refs = calloc(num_elems, ref_size)) == NULL ||
+			(null_ref = calloc(1, ref_size)) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate reference buffers")
+		}
+
+		if (H5Dread(src, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, src_refs) < 0) {
+			FUNC_GOTO_ERROR("Failed to read references")
+		}
+
+		for (hssize_t i = 0; i < num_elems; i++) {
+			const void *src_ref = src_refs + i * ref_size;
+			void *dest_ref = dest_refs + i * ref_size;
+			hid_t region = H5I_INVALID_HID;
+			ssize_t name_len = 0;
+
+			if (!memcmp(src_ref, null_ref, ref_size))
+				continue;
+
+			name_len = H5Rget_name(src, ref_type, src_ref, target, sizeof(target));
+
+			if (name_len <= 0 || (size_t)name_len >= sizeof(target)) {
+				FUNC_GOTO_ERROR("Failed to get reference target")
+			}
+
+			if (ref_type == H5R_DATASET_REGION && (region = H5Rget_region(src, ref_type, src_ref)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to get referenced region")
+			}
+
+			if (H5Rcreate(dest_ref, ctx->fout, target, ref_type, region) < 0) {
+				FUNC_GOTO_ERROR("Failed to create reference in output file")
+			}
+
+			if (region != H5I_INVALID_HID)
+				H5Sclose(region);
+		}
+
+		if (H5Dwrite(dest, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, dest_refs) < 0) {
+			FUNC_GOTO_ERROR("Failed to write references")
+		}
+	}
+
+	PRINT_DEBUG("%s: %lld references remapped\n", rd->path, (long long)num_elems)
+
+	free(null_ref);
+	free(dest_refs);
+	free(src_refs);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Dclose(dest);
+	H5Dclose(src);
+}
+
+/* Read up to num_chunks output chunks of rows starting at chunk first into slab, padding the last chunk */
+hsize_t read_slab(hid_t src, hid_t type, RepackDataset *rd, hsize_t first, hsize_t num_chunks, size_t chunk_bytes, unsigned char *slab) {
+	hid_t file_space = H5I_INVALID_HID;
+	hid_t mem_space = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	hsize_t start[H5S_MAX_RANK];
+	hsize_t count[H5S_MAX_RANK];
+	int ndims = 0;
+
+	if (first + num_chunks > rd->num_chunks)
+		num_chunks = rd->num_chunks - first;
+
+	if ((file_space = H5Dget_space(src)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataset space")
+	}
+
+	ndims = H5Sget_simple_extent_dims(file_space, dims, NULL);
+
+	for (int i = 0; i < ndims; i++) {
+		start[i] = 0;
+		count[i] = dims[i];
+	}
+
+	start[0] = first * rd->chunk_rows;
+	count[0] = num_chunks * rd->chunk_rows;
+
+	if (start[0] + count[0] > dims[0])
+		count[0] = dims[0] - start[0];
+
+	if (H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL) < 0) {
+		FUNC_GOTO_ERROR("Failed to select slab")
+	}
+
+	if ((mem_space = H5Screate_simple(ndims, count, NULL)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create slab space")
+	}
+
+	/* Edge chunks are stored full size, the rows past the extent are never read back */
+	memset(slab, 0, num_chunks * chunk_bytes);
+
+	if (H5Dread(src, type, mem_space, file_space, H5P_DEFAULT, slab) < 0) {
+		FUNC_GOTO_ERROR("Failed to read slab")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+
+	return num_chunks;
+}
+
+/* Second pass: stream one rechunked dataset. The main thread reads the next slab of chunks through the
+ * library while the pool shuffles, compresses and takes stats of the current one, then writes the
+ * encoded chunks in order with H5Dwrite_chunk so the raw data of a dataset is contiguous in the file. */
+void repack_dataset(RepackContext *ctx, RepackDataset *rd) {
+	hid_t src = H5I_INVALID_HID;
+	hid_t dest = H5I_INVALID_HID;
+	hid_t type = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	hsize_t offset[H5S_MAX_RANK];
+	int ndims = 0;
+	size_t chunk_bytes = 0;
+	size_t slab_chunks = get_num_threads() * CHUNKS_PER_THREAD;
+	unsigned char *slabs[2] = {NULL, NULL};
+	EncodeTask *tasks[2] = {NULL, NULL};
+	double *chunk_min = NULL;
+	double *chunk_max = NULL;
+	hsize_t num_read[2] = {0, 0};
+	hsize_t first = 0;
+	int cur = 0;
+
+	if ((src = H5Dopen2(ctx->fin, rd->path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input dataset")
+	}
+
+	if ((dest = H5Dopen2(ctx->fout, rd->path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open output dataset")
+	}
+
+	type = H5Dget_type(dest);
+	space = H5Dget_space(dest);
+	ndims = H5Sget_simple_extent_dims(space, dims, NULL);
+
+	chunk_bytes = H5Tget_size(type) * rd->chunk_rows;
+
+	for (int i = 1; i < ndims; i++)
+		chunk_bytes *= dims[i];
+
+	if (slab_chunks > rd->num_chunks)
+		slab_chunks = rd->num_chunks;
+
+	if (rd->stats) {
+		chunk_min = calloc(rd->num_chunks, sizeof(double));
+		chunk_max = calloc(rd->num_chunks, sizeof(double));
+	}
+
+	for (int b = 0; b < 2; b++) {
+		if ((slabs[b] = malloc(slab_chunks * chunk_bytes)) == NULL || (tasks[b] = calloc(slab_chunks, sizeof(EncodeTask))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate slab")
+		}
+
+		for (size_t i = 0; i < slab_chunks; i++) {
+			EncodeTask *task = &tasks[b][i];
+
+			task->data = slabs[b] + i * chunk_bytes;
+			task->nbytes = chunk_bytes;
+			task->nelems = (rd->stats) ? rd->chunk_rows : 0;
+			task->elem_size = H5Tget_size(type);
+			task->out = malloc(compressBound(chunk_bytes));
+			task->scratch = malloc(chunk_bytes);
+
+			if (task->out == NULL || task->scratch == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate chunk buffers")
+			}
+		}
+	}
+
+	for (int i = 0; i < ndims; i++)
+		offset[i] = 0;
+
+	num_read[cur] = read_slab(src, type, rd, 0, slab_chunks, chunk_bytes, slabs[cur]);
+
+	while (num_read[cur] > 0) {
+		hsize_t next = first + num_read[cur];
+
+		for (hsize_t i = 0; i < num_read[cur]; i++) {
+			EncodeTask *task = &tasks[cur][i];
+
+			task->stats = rd->stats;
+
+			/* Stats cover only the rows inside the extent */
+			if (rd->stats && (first + i + 1) * rd->chunk_rows > dims[0])
+				task->nelems = dims[0] - (first + i) * rd->chunk_rows;
+			else if (rd->stats)
+				task->nelems = rd->chunk_rows;
+
+			thread_pool_submit(thread_pool, encode_task, task);
+		}
+
+		num_read[1 - cur] = (next < rd->num_chunks) ? read_slab(src, type, rd, next, slab_chunks, chunk_bytes, slabs[1 - cur]) : 0;
+
+		thread_pool_wait(thread_pool);
+
+		for (hsize_t i = 0; i < num_read[cur]; i++) {
+			EncodeTask *task = &tasks[cur][i];
+
+			offset[0] = (first + i) * rd->chunk_rows;
+
+			if (H5Dwrite_chunk(dest, H5P_DEFAULT, 0, offset, task->out_bytes, task->out) < 0) {
+				FUNC_GOTO_ERROR("Failed to write chunk")
+			}
+
+			if (rd->stats) {
+				chunk_min[first + i] = task->min;
+				chunk_max[first + i] = task->max;
+			}
+		}
+
+		first = next;
+		cur = 1 - cur;
+	}
+
+	if (rd->stats) {
+		hid_t attr = H5I_INVALID_HID;
+
+		if ((attr = H5Aopen(dest, "chunk_min", H5P_DEFAULT)) == H5I_INVALID_HID || H5Awrite(attr, H5T_NATIVE_DOUBLE, chunk_min) < 0) {
+			FUNC_GOTO_ERROR("Failed to write chunk_min")
+		}
+
+		H5Aclose(attr);
+
+		if ((attr = H5Aopen(dest, "chunk_max", H5P_DEFAULT)) == H5I_INVALID_HID || H5Awrite(attr, H5T_NATIVE_DOUBLE, chunk_max) < 0) {
+			FUNC_GOTO_ERROR("Failed to write chunk_max")
+		}
+
+		H5Aclose(attr);
+	}
+
+	PRINT_DEBUG("%s: wrote %llu chunks\n", rd->path, (unsigned long long)rd->num_chunks)
+
+	for (int b = 0; b < 2; b++) {
+		for (size_t i = 0; i < slab_chunks; i++) {
+			free(tasks[b][i].out);
+			free(tasks[b][i].scratch);
+		}
+
+		free(tasks[b]);
+		free(slabs[b]);
+	}
+
+	free(chunk_min);
+	free(chunk_max);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Dclose(dest);
+	H5Dclose(src);
+}
+
+int main(int argc, char **argv) {
+	hid_t fapl_id_in = H5I_INVALID_HID;
+	hid_t fapl_id_out = H5I_INVALID_HID;
+	hid_t fcpl_id = H5I_INVALID_HID;
+	hid_t root = H5I_INVALID_HID;
+	hid_t out_root = H5I_INVALID_HID;
+
+	const char *input_path = NULL;
+	const char *output_path = NULL;
+
+	RepackContext ctx;
+	hsize_t input_size = 0;
+	hsize_t output_size = 0;
+	double start_time = get_time();
+	double elapsed = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	for (int optind = 1; optind < argc; optind++)
+	{
+		if (strcmp(argv[optind], "-debug") == 0) {
+			debug = true;
+		}
+		else if (strcmp(argv[optind], "-use_ros3") == 0) {
+			use_ros3 = true;
+		}
+		else if (strcmp(argv[optind], "-threads") == 0 && optind + 1 < argc) {
+			num_threads = strtoul(argv[++optind], NULL, 10);
+		}
+		else if (strcmp(argv[optind], "-page_mib") == 0 && optind + 1 < argc) {
+			page_size = strtoul(argv[++optind], NULL, 10) * 1024 * 1024;
+		}
+		else if (strcmp(argv[optind], "-chunk_kib") == 0 && optind + 1 < argc) {
+			chunk_target_bytes = strtoul(argv[++optind], NULL, 10) * 1024;
+		}
+		else if (strcmp(argv[optind], "-level") == 0 && optind + 1 < argc) {
+			deflate_level = atoi(argv[++optind]);
+		}
+		else if (input_path == NULL) {
+			input_path = argv[optind];
+		}
+		else if (output_path == NULL) {
+			output_path = argv[optind];
+		}
+	}
+
+	if (input_path == NULL || output_path == NULL || page_size == 0 || chunk_target_bytes == 0 || deflate_level < 0 || deflate_level > 9) {
+		fprintf(stderr, USAGE);
+		exit(1);
+	}
+
+	if ((fapl_id_in = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create FAPL")
+	}
+
+	if (use_ros3) {
+		H5FD_ros3_fapl_t param;
+
+		memset(&param, 0, sizeof(param));
+		strcpy(param.aws_region, "us-west-2");
+		param.version = 1;
+		param.authenticate = 0;
+
+		if (H5Pset_fapl_ros3(fapl_id_in, &param) < 0) {
+			FUNC_GOTO_ERROR("Failed to set ros3 in FAPL")
+		}
+	}
+
+	/* Paged aggregation keeps metadata and raw data in separate pages. The structure is created before any
+	 * rechunked data is written, so the object headers, chunk indexes and attributes fill the first
+	 * metadata pages and a reader gets the whole object tree in a few page reads. */
+	if ((fcpl_id = H5Pcreate(H5P_FILE_CREATE)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create FCPL")
+	}
+
+	if (H5Pset_file_space_strategy(fcpl_id, H5F_FSPACE_STRATEGY_PAGE, false, 1) < 0) {
+		FUNC_GOTO_ERROR("Failed to set page strategy for output file")
+	}
+
+	if (H5Pset_file_space_page_size(fcpl_id, page_size) < 0) {
+		FUNC_GOTO_ERROR("Failed to set page size for output file")
+	}
+
+	if ((fapl_id_out = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create FAPL2")
+	}
+
+	if (H5Pset_libver_bounds(fapl_id_out, H5F_LIBVER_V110, H5F_LIBVER_LATEST) < 0) {
+		FUNC_GOTO_ERROR("Failed to set library version bounds")
+	}
+
+	if ((ctx.fin = H5Fopen(input_path, H5F_ACC_RDONLY, fapl_id_in)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input file")
+	}
+
+	if ((ctx.fout = H5Fcreate(output_path, H5F_ACC_TRUNC, fcpl_id, fapl_id_out)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create output file")
+	}
+
+	thread_pool = thread_pool_create(get_num_threads());
+
+	root = H5Gopen2(ctx.fin, PATH_DELIMITER, H5P_DEFAULT);
+	out_root = H5Gopen2(ctx.fout, PATH_DELIMITER, H5P_DEFAULT);
+	copy_attributes(root, out_root);
+	H5Gclose(out_root);
+	H5Gclose(root);
+
+	copy_structure(&ctx, PATH_DELIMITER);
+	attach_scales(&ctx);
+
+	for (size_t i = 0; i < ctx.num_dsets; i++) {
+		if (ctx.dsets[i].references)
+			remap_references(&ctx, &ctx.dsets[i]);
+	}
+
+	PRINT_DEBUG("Structure copied in %.3f s, %zu datasets\n", get_time() - start_time, ctx.num_dsets)
+
+	for (size_t i = 0; i < ctx.num_dsets; i++) {
+		if (ctx.dsets[i].rechunk)
+			repack_dataset(&ctx, &ctx.dsets[i]);
+	}
+
+	H5Fget_filesize(ctx.fin, &input_size);
+
+	if (H5Fclose(ctx.fout) < 0) {
+		FUNC_GOTO_ERROR("Failed to close output file")
+	}
+
+	elapsed = get_time() - start_time;
+
+	if ((ctx.fout = H5Fopen(output_path, H5F_ACC_RDONLY, H5P_DEFAULT)) != H5I_INVALID_HID) {
+		H5Fget_filesize(ctx.fout, &output_size);
+		H5Fclose(ctx.fout);
+	}
+
+	/* "repack, <seconds>, <input bytes>, <output bytes>, <input MiB/s>" */
+	printf("repack, %.3f, %llu, %llu, %.2f\n", elapsed, (unsigned long long)input_size, (unsigned long long)output_size,
+		   (elapsed > 0) ? input_size / elapsed / (1024 * 1024) : 0.0);
+
+	thread_pool_destroy(thread_pool);
+
+	for (size_t i = 0; i < ctx.num_dsets; i++)
+		free(ctx.dsets[i].path);
+
+	free(ctx.dsets);
+	H5Fclose(ctx.fin);
+	H5Pclose(fapl_id_out);
+	H5Pclose(fapl_id_in);
+	H5Pclose(fcpl_id);
+
+	return 0;
+}
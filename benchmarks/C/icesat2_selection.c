@@ -1,8 +1,35 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <yaml.h>
 #include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <curl/curl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <spawn.h>
+
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#else
+#include <zlib.h>
+#endif
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 
 #include "hdf5.h"
 
@@ -14,6 +41,23 @@
 #define PATH_DELIMITER "/"
 
 #include "rest_vol_public.h"
+#include "thread_pool.h"
+
+/* A distributed run is aborted as a whole, as the other ranks would wait on a failed one in their next collective */
+#ifdef USE_MPI
+#define EXIT_FAILURE_RUN()                       \
+	{                                            \
+		int mpi_started = 0;                     \
+		int mpi_finished = 0;                    \
+		MPI_Initialized(&mpi_started);           \
+		MPI_Finalized(&mpi_finished);            \
+		if (mpi_started && !mpi_finished)        \
+			MPI_Abort(MPI_COMM_WORLD, 1);        \
+		exit(1);                                 \
+	}
+#else
+#define EXIT_FAILURE_RUN() exit(1);
+#endif
 
 /*
  * Macro to push the current function to the current error stack
@@ -23,7 +67,15 @@
 #define FUNC_GOTO_ERROR(err_msg)      \
 	fprintf(stderr, "%s\n", err_msg); \
 	fprintf(stderr, "\n");            \
-	exit(1);
+	EXIT_FAILURE_RUN()
+
+/* For code that must outlive an error, such as the subset server: print the message, set ret_value to FAIL and goto "done" */
+#define FUNC_GOTO_FAIL(err_msg)           \
+	{                                     \
+		fprintf(stderr, "%s\n", err_msg); \
+		ret_value = FAIL;                 \
+		goto done;                        \
+	}
 
 /* Print if program is run with debug flag */
 #define PRINT_DEBUG(...)              \
@@ -37,6 +89,7 @@
 #define PATH_PREFIX "/home/test_user1/"
 
 #define GEOLOCATION_PHOTON_DSET "/geolocation/segment_ph_cnt"
+#define HEIGHTS_DELTA_TIME_DSET "/heights/delta_time"
 
 bool debug = false;
 bool check_output = false;
@@ -44,9 +97,75 @@ bool readonly = false;
 bool use_ros3 = false;
 bool use_rest_vol = false;
 bool use_multi = false;
+bool parallel_decode = false;
+bool split_copy = false;
+bool decode_bench = false;
+bool use_manifest = false;
+bool use_prefetch = false;
+bool virtual_output = false;
+bool catalog_query = false;
+bool monotonic_search = false;
+bool build_lod = false;
+bool aggregate = false;
+bool kernel_bench = false;
+
+/* Previous -kernel_bench output to compare with, NULL for none */
+char *kernel_baseline_path = NULL;
+
+/* Results of -kernel_bench kernels land here so they aren't optimized away */
+volatile double kernel_sink = 0.0;
+
+/* Unix socket path to serve subset requests on with -serve, NULL to run once */
+char *serve_path = NULL;
+
+/* Virtual subset to give its own data with -materialize */
+char *materialize_path = NULL;
+
+/* Start -materialize on the -virtual subset in a process of its own once it is written */
+bool materialize_later = false;
+
+/* Passed on to the -materialize_later process */
+extern char **environ;
+
+#ifdef USE_MPI
+/* File listing the granules of a distributed run, one per line, NULL to run over input_filename alone */
+char *granule_list_path = NULL;
+
+/* Write a file per rank and stitch them with virtual datasets instead of writing one file with parallel HDF5 */
+bool rank_files = false;
+#endif
+
+/* Number of worker threads, 0 to use one per online CPU */
+size_t num_threads = 0;
+
+/* Bytes of selected data read by the copy phase, reported when the run completes */
+size_t bytes_copied = 0;
+
+/* Absolute path of the input the -virtual subset maps its datasets to, NULL to copy the data */
+char *virtual_source = NULL;
+
+/* Mappings written by -virtual and the bytes of data they cover */
+size_t num_mappings = 0;
+size_t bytes_mapped = 0;
+
+/* Single rows and whole blocks read by the binary searches of delta_time and lat */
+size_t bound_probes = 0;
+size_t bound_blocks = 0;
+
+/* Tracks the index phase found by binary search with -monotonic_search */
+size_t monotonic_tracks = 0;
+
+/* Datasets copied in pieces with -split_copy, the pieces and the source chunks they were assembled from */
+size_t split_datasets = 0;
+size_t split_pieces = 0;
+size_t split_chunks = 0;
 
 char *ground_tracks[] = {"gt1l", "gt1r", "gt2l", "gt2r", "gt3l", "gt3r", 0};
 
+/* Datasets of each pyramid level. The first NUM_LOD_SOURCE_DATASETS hold the first photon of each bin and are read
+ * from heights/ under the same name, the rest summarize h_ph over the bin. */
+char *lod_datasets[] = {"lat_ph", "lon_ph", "h_ph", "h_ph_min", "h_ph_max", "h_ph_mean", 0};
+
 const char *scalar_datasets[] = {"/orbit_info/sc_orient",
 								 "/ancillary_data/start_rgt",
 								 "/ancillary_data/start_cycle",
@@ -69,6 +188,8 @@ char *ph_count_datasets[] = {
 
 #define NUM_REFERENCE_DATASETS 3
 #define NUM_PHOTON_COUNT_DATASETS 7
+#define NUM_LOD_DATASETS 6
+#define NUM_LOD_SOURCE_DATASETS 3
 #define NUM_GROUND_TRACKS 6
 #define NUM_SCALAR_DATASETS 3
 #define NUM_COPY_RANGE_DATASETS (NUM_GROUND_TRACKS * NUM_REFERENCE_DATASETS + NUM_GROUND_TRACKS * NUM_PHOTON_COUNT_DATASETS)
@@ -88,11 +209,108 @@ typedef struct Range_Indices{
 	size_t max;
 } Range_Indices;
 
+/* Disjoint dim-0 runs of one selection, in increasing order. Touching runs are merged and empty ones dropped. */
+typedef struct Range_Runs{
+	size_t num_runs;
+	size_t max_runs;
+	Range_Indices *runs;
+} Range_Runs;
+
 typedef struct Range_Doubles{
 	double min;
 	double max;
 } Range_Doubles;
 
+/* What the selection is made by */
+typedef enum SelectionMode{
+	SELECT_BBOX,
+	SELECT_TIME,
+	SELECT_TIME_BBOX
+} SelectionMode;
+
+/* Rows of the synthetic tracks timed by -kernel_bench, the shares of their rows that the bbox selects, and the
+ * repetitions of each case. A repetition runs the kernel often enough to cover at least
+ * KERNEL_BENCH_MIN_ELEMENTS elements, so the small sizes aren't lost in timer resolution. */
+#define KERNEL_BENCH_SIZES {1 << 16, 1 << 20, 1 << 23}
+#define KERNEL_BENCH_SELECTIVITIES {0.01, 0.1, 0.5}
+#define KERNEL_BENCH_REPS 9
+#define KERNEL_BENCH_MIN_ELEMENTS (4 * 1024 * 1024)
+#define KERNEL_BENCH_CHUNK_ROWS 10000
+#define KERNEL_BENCH_NOISE_ROWS 50.0
+
+/* Local file of the inputs, created in the working directory and removed when the benchmark ends */
+#define KERNEL_BENCH_FILENAME "kernel_bench.h5"
+
+/* A case is reported as a regression when its median ns/element is this much above the baseline's. A case whose
+ * kernel call took under KERNEL_SMALL_CASE_NS in the baseline is at the mercy of timer and scheduling noise, so it
+ * is only a regression past KERNEL_SMALL_REGRESSION_TOLERANCE. */
+#define KERNEL_REGRESSION_TOLERANCE 0.2
+#define KERNEL_SMALL_CASE_NS 1e6
+#define KERNEL_SMALL_REGRESSION_TOLERANCE 1.0
+#define KERNEL_KEY_SIZE 128
+
+typedef enum KernelId{
+	KERNEL_MINMAX,
+	KERNEL_RANGE,
+	KERNEL_COUNT,
+	KERNEL_COPY,
+	NUM_KERNELS
+} KernelId;
+
+/* Where a kernel's inputs are read from: arrays and an in-memory file, or a file on local disk */
+enum {KERNEL_MEMORY, KERNEL_FILE, NUM_KERNEL_SOURCES};
+
+/* One synthetic track for -kernel_bench. The datasets hold the same arrays as lat, lon and counts. The file source
+ * is read into the file_ arrays, allocated with the inputs so the timed runs don't allocate. */
+typedef struct KernelInputs{
+	size_t num_rows;
+	double *lat;
+	double *lon;
+	int *counts;
+	double *file_lat;
+	double *file_lon;
+	int *file_counts;
+	hid_t files[NUM_KERNEL_SOURCES];
+	hid_t lat_dset[NUM_KERNEL_SOURCES];
+	hid_t lon_dset[NUM_KERNEL_SOURCES];
+	hid_t count_dset[NUM_KERNEL_SOURCES];
+	hid_t out_file;
+	hid_t out_dset;
+} KernelInputs;
+
+typedef struct KernelBaseline{
+	char key[KERNEL_KEY_SIZE];
+	double median_ns;
+} KernelBaseline;
+
+/* Photons reduced per task by -aggregate, and the signal_conf_ph values it counts for each surface type */
+#define AGGREGATE_BLOCK_ROWS (256 * 1024)
+#define NUM_SURFACE_TYPES 5
+#define MIN_SIGNAL_CONF -2
+#define NUM_SIGNAL_CONF 7
+
+/* Photons per bin grow by this factor from one pyramid level to the next */
+#define LOD_FACTOR 4
+
+/* Pyramid levels are added until one has at most LOD_MIN_BINS bins */
+#define LOD_MIN_BINS 1024
+#define MAX_LOD_LEVELS 16
+
+/* Photons read at a time when building a pyramid, and the chunk size of its datasets */
+#define LOD_SLAB_ROWS (1024 * 1024)
+#define LOD_CHUNK_BINS 16384
+
+/* Rows of a track summarized by each block of its footprint */
+#define FOOTPRINT_BLOCK_ROWS 1024
+
+/* Coarse footprint of a track, the lat/lon bbox of each FOOTPRINT_BLOCK_ROWS rows in order. A block with no
+ * valid points has min > max and intersects nothing. */
+typedef struct TrackFootprint{
+	size_t num_blocks;
+	size_t max_blocks;
+	BBox *blocks;
+} TrackFootprint;
+
 typedef struct ConfigValues{
 	char *loglevel;
 	char *logfile;
@@ -106,9 +324,506 @@ typedef struct ConfigValues{
 	double min_lon;
 	double max_lon;
 
+	/* "bbox", "time" for the delta_time window alone, or "time_bbox" for both */
+	char *selection_mode;
+	double min_delta_time;
+	double max_delta_time;
+
 	int page_buf_size_exp;
+
+	/* Overrides for the backend's default batch policy, negative to keep the default */
+	int batch_max_mib;
+	int batch_max_count;
+	int batch_max_gap_mib;
+
+	/* Upper bound on the raw data chunk caches of all open datasets */
+	int chunk_cache_budget_mib;
+
+	/* Expected size of the metadata pages of a paged input file */
+	int page_buf_meta_mib;
+
+	/* Chunk manifest for -use_manifest, empty for <input path>.manifest */
+	char *manifest_filename;
+
+	/* Granules kept open by -serve */
+	int serve_max_granules;
+
+	/* Upper bound on data buffers for the run, 0 for no limit */
+	int memory_budget_mib;
+
+	/* Selected photons per track above which a track is copied from its pyramid, 0 to always copy every photon */
+	int lod_point_budget;
+
+	/* Pyramid written by -build_pyramid, empty for <input path>.lod.h5 */
+	char *lod_filename;
+
+	/* Footprints of the granules indexed so far, checked before a granule is opened */
+	char *catalog_filename;
+
+	/* Directory of subsets kept to answer contained queries, empty to disable */
+	char *result_cache_dir;
+	int result_cache_max_mib;
+	int result_cache_max_age_s;
+
+	/* Range requests over HTTP: the latency percentile past which one is duplicated, 0 to never hedge,
+	 * how many times a transient failure is retried after a backoff that doubles each time, and how
+	 * long one attempt may take before it fails as a timeout, 0 for no limit */
+	int request_hedge_percentile;
+	int request_max_retries;
+	int request_retry_backoff_ms;
+	int request_timeout_ms;
 } ConfigValues;
 
+typedef enum Backend{
+	BACKEND_NATIVE,
+	BACKEND_ROS3,
+	BACKEND_REST_VOL
+} Backend;
+
+/* Limits used to group the selections of one _multi call into batches. Zero means unlimited. */
+typedef struct BatchPolicy{
+	size_t max_bytes;
+	size_t max_count;
+	size_t max_gap;
+} BatchPolicy;
+
+/* Selection indices in the order they are issued, split into batches.
+ * Batch i covers order[batch_start[i]] up to (not including) order[batch_start[i + 1]]. */
+typedef struct BatchPlan{
+	size_t num_batches;
+	size_t *order;
+	size_t *batch_start;
+	size_t *batch_bytes;
+} BatchPlan;
+
+/* Default batch policy for each backend, indexed by Backend.
+ * The REST VOL must keep request bodies under the server limits, ros3 gains nothing
+ * from large batches but benefits from issuing nearby selections together. */
+const BatchPolicy default_batch_policies[] = {
+	{0, 0, 0},
+	{64 * 1024 * 1024, 0, 16 * 1024 * 1024},
+	{32 * 1024 * 1024, 16, 0}
+};
+
+BatchPolicy batch_policy = {0, 0, 0};
+
+/* File space handling of a file, as stored in its FCPL */
+typedef struct PageLayout{
+	H5F_fspace_strategy_t strategy;
+	hbool_t persist;
+	hsize_t threshold;
+	hsize_t page_size;
+} PageLayout;
+
+/* Pages of raw data kept per contiguous dataset being read: the current page and the one a read may straddle into */
+#define PAGE_BUF_DATA_PAGES 2
+
+/* Bytes of the object header of a dataset with its attributes and filter pipeline, as planned for the page buffer */
+#define PAGE_BUF_HEADER_BYTES 2048
+
+/* Bytes a chunk index spends per chunk, besides 8 per dimension for its offset: the size, filter mask and address */
+#define PAGE_BUF_INDEX_ENTRY_BYTES 24
+
+/* Raw data chunk cache parameters for one dataset, as passed to H5Pset_chunk_cache */
+typedef struct ChunkCachePlan{
+	size_t nslots;
+	size_t nbytes;
+	double w0;
+} ChunkCachePlan;
+
+/* Chunk cache memory held by an open dataset */
+typedef struct CacheReservation{
+	hid_t dset;
+	size_t nbytes;
+} CacheReservation;
+
+#define CHUNK_CACHE_MIN_SLOTS 521
+#define MAX_CACHE_RESERVATIONS (NUM_COPY_RANGE_DATASETS + 3 * NUM_GROUND_TRACKS)
+
+/* Total chunk cache memory allowed across all open datasets, and the amount currently reserved */
+size_t chunk_cache_budget = 0;
+size_t chunk_cache_reserved = 0;
+CacheReservation cache_reservations[MAX_CACHE_RESERVATIONS];
+
+/* Size of each block of the run arena, larger allocations get a block of their own */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock{
+	struct ArenaBlock *next;
+	size_t size;
+	size_t used;
+	_Alignas(max_align_t) unsigned char data[];
+} ArenaBlock;
+
+/* Bump allocator for the small allocations of one run (paths, dims, config strings), released all at once */
+typedef struct Arena{
+	ArenaBlock *head;
+	size_t num_blocks;
+	size_t bytes;
+} Arena;
+
+Arena run_arena = {NULL, 0, 0};
+
+/* Memory allowed for data buffers, decoded chunks and the run arena, and the amount in use.
+ * async counts bytes held by thread pool tasks, which are the only ones an allocation can wait for. */
+typedef struct MemoryBudget{
+	size_t limit;
+	size_t in_use;
+	size_t async;
+	size_t peak;
+	const char *phase;
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+} MemoryBudget;
+
+/* Unlimited until set_memory_budget reads the config */
+MemoryBudget memory_budget = {0, 0, 0, 0, "setup", PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+ThreadPool *thread_pool = NULL;
+
+/* Everything needed to decode the chunks of one dataset and place them in a dim-0 selection */
+typedef struct DecodeContext{
+	int ndims;
+	hsize_t dims[H5S_MAX_RANK];
+	hsize_t chunk_dims[H5S_MAX_RANK];
+	size_t elem_size;
+	size_t chunk_bytes;
+
+	int nfilters;
+	H5Z_filter_t filters[H5Z_MAX_NFILTERS];
+	unsigned shuffle_elem_size;
+
+	/* Selected rows and the buffer holding them, NULL when only decoding */
+	Range_Indices range;
+	void *dest;
+} DecodeContext;
+
+/* One raw chunk as stored in the file */
+typedef struct RawChunk{
+	DecodeContext *ctx;
+	hsize_t offset[H5S_MAX_RANK];
+	uint32_t filter_mask;
+	size_t nbytes;
+	void *data;
+
+	/* Memory budget held until the chunk is decoded */
+	size_t reserved;
+} RawChunk;
+
+/* Target size of one piece of a -split_copy, rounded down to whole source chunks. Each piece is one output chunk. */
+#define SPLIT_COPY_PIECE_BYTES (4 * 1024 * 1024)
+
+/* Largest chunk HDF5 can store, 4 GiB less one byte */
+#define MAX_CHUNK_BYTES ((size_t)0xffffffff)
+
+/* Selections of fewer pieces are copied in one piece as usual */
+#define SPLIT_COPY_MIN_PIECES 4
+
+/* Upper bound on the size of a deflated piece */
+#define DEFLATE_BOUND(nbytes) ((nbytes) + (nbytes) / 256 + 64)
+
+/* Source rows placed into a piece at dest */
+typedef struct SplitSegment{
+	Range_Indices rows;
+	unsigned char *dest;
+} SplitSegment;
+
+/* How a selection is split: the source's decode context, its filters to run again on the output,
+ * and the segments of the pieces in flight */
+typedef struct SplitCopy{
+	DecodeContext ctx;
+	int deflate_level;
+	hsize_t piece_rows;
+	size_t row_bytes;
+	size_t piece_bytes;
+	size_t out_bytes;
+
+	SplitSegment *segments;
+	size_t num_segments;
+	size_t max_segments;
+} SplitCopy;
+
+/* One output chunk of a split copy. encoded points at data, out or scratch once the filters have run. */
+typedef struct CopyPiece{
+	SplitCopy *split;
+	unsigned char *data;
+	unsigned char *out;
+	unsigned char *scratch;
+	unsigned char *encoded;
+	size_t encoded_bytes;
+} CopyPiece;
+
+/* A raw source chunk on its way to the segments of a wave */
+typedef struct SplitChunk{
+	SplitCopy *split;
+	RawChunk *chunk;
+} SplitChunk;
+
+/* Byte ranges further apart than this are fetched with separate requests in -use_manifest mode */
+#define MANIFEST_MAX_GAP (1024 * 1024)
+
+/* Upper bound on the size of one coalesced range request */
+#define MANIFEST_MAX_REQUEST (64 * 1024 * 1024)
+
+/* Where one chunk of a dataset is stored, as listed in the manifest */
+typedef struct ManifestChunk{
+	hsize_t offset[H5S_MAX_RANK];
+	uint64_t addr;
+	size_t nbytes;
+	uint32_t filter_mask;
+} ManifestChunk;
+
+/* A dataset listed in the manifest. ctx describes its shape and filters as init_decode_context would. */
+typedef struct ManifestDataset{
+	char *path;
+	char dtype[8];
+	DecodeContext ctx;
+	unsigned char *fill_value;
+	size_t num_chunks;
+	size_t max_chunks;
+	ManifestChunk *chunks;
+} ManifestDataset;
+
+typedef struct Manifest{
+	size_t num_dsets;
+	size_t max_dsets;
+	ManifestDataset *dsets;
+} Manifest;
+
+/* The input file read by byte range in -use_manifest mode, through pread or libcurl */
+typedef struct RangeSource{
+	const char *location;
+	int fd;
+	CURL *curl;
+
+	/* Second connection for hedged requests, run alongside the first by multi */
+	CURL *hedge;
+	CURLM *multi;
+	size_t num_requests;
+	size_t bytes_fetched;
+} RangeSource;
+
+/* Threads that fetch ranges ahead of need with -prefetch, each over a connection of its own */
+#define PREFETCH_THREADS 4
+
+/* Estimated photon windows are widened on each side by this share of their length */
+#define PREFETCH_MARGIN 0.05
+
+typedef enum PrefetchState{
+	PREFETCH_PENDING,
+	PREFETCH_FETCHING,
+	PREFETCH_DONE,
+	PREFETCH_TRIMMED
+} PrefetchState;
+
+/* One range request made ahead of need. data holds its bytes once state is PREFETCH_DONE. */
+typedef struct PrefetchRange{
+	struct Prefetcher *prefetcher;
+	ManifestDataset *md;
+	uint64_t addr;
+	size_t nbytes;
+	unsigned char *data;
+	PrefetchState state;
+} PrefetchRange;
+
+/* Ranges of the photon datasets of one track, fetched on a pool of their own while its photon counts are read */
+typedef struct Prefetcher{
+	ThreadPool *pool;
+	RangeSource sources[PREFETCH_THREADS];
+	bool busy[PREFETCH_THREADS];
+	size_t num_ranges;
+	size_t max_ranges;
+	PrefetchRange **ranges;
+	pthread_mutex_t lock;
+	pthread_cond_t fetched;
+	size_t num_requested;
+	size_t num_trimmed;
+	size_t num_topped_up;
+	size_t bytes_prefetched;
+	size_t bytes_used;
+} Prefetcher;
+
+/* Set by -prefetch in -use_manifest mode, NULL otherwise */
+Prefetcher *prefetcher = NULL;
+
+/* Range requests over HTTP are duplicated once they take longer than hedge_percentile of the last
+ * REQUEST_LATENCY_WINDOW of their size, after REQUEST_MIN_SAMPLES of that size have been seen */
+#define REQUEST_LATENCY_WINDOW 256
+#define REQUEST_MIN_SAMPLES 16
+
+/* Requests are sized into buckets whose latencies are kept apart: below REQUEST_BUCKET_MIN_BYTES, then
+ * one for each power of 4 above it, the last taking everything larger */
+#define REQUEST_SIZE_BUCKETS 6
+#define REQUEST_BUCKET_MIN_BYTES (64 * 1024)
+
+/* An attempt that moves fewer than REQUEST_LOW_SPEED_BYTES a second for a quarter of its timeout has stalled,
+ * and fails as a timeout without waiting out the rest */
+#define REQUEST_LOW_SPEED_BYTES 1024
+
+/* Longest wait on the connections of a request before checking whether to hedge it */
+#define REQUEST_POLL_MS 100
+
+/* Longest wait before a retry, however many retries came before it */
+#define REQUEST_MAX_BACKOFF_S 60.0
+
+/* How range requests over HTTP are hedged, timed out and retried, and how that went. latencies holds a ring
+ * of the last REQUEST_LATENCY_WINDOW successful requests of each size bucket. */
+typedef struct RequestPolicy{
+	double hedge_percentile;
+	int max_retries;
+	double retry_backoff;
+	long timeout_ms;
+	double latencies[REQUEST_SIZE_BUCKETS][REQUEST_LATENCY_WINDOW];
+	size_t num_latencies[REQUEST_SIZE_BUCKETS];
+	size_t num_requests;
+	size_t num_retries;
+	size_t num_hedges;
+	size_t hedges_won;
+	pthread_mutex_t lock;
+} RequestPolicy;
+
+RequestPolicy request_policy = {95.0, 3, 0.1, 30000, {{0}}, {0}, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+/* Growable buffer that libcurl writes a response body into */
+typedef struct ResponseBuffer{
+	unsigned char *data;
+	size_t size;
+	size_t capacity;
+} ResponseBuffer;
+
+/* Longest request line accepted by -serve */
+#define SERVE_MAX_REQUEST 4096
+
+/* One ground track of a granule held open by -serve, with the geolocation that every request searches */
+typedef struct ServedTrack{
+	size_t num_segments;
+	double *lat;
+	double *lon;
+
+	/* photon_index[i] is the first photon of segment i, photon_index[num_segments] the number of photons */
+	size_t *photon_index;
+
+	hid_t dsets[NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS];
+	hid_t mem_types[NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS];
+} ServedTrack;
+
+typedef struct ServedGranule{
+	char path[FILEPATH_BUFFER_SIZE];
+	hid_t fin;
+	unsigned long last_used;
+	ServedTrack tracks[NUM_GROUND_TRACKS];
+} ServedGranule;
+
+/* Open granules of -serve, the least recently used is closed to make room */
+typedef struct GranuleCache{
+	size_t capacity;
+	size_t count;
+	unsigned long clock;
+	ServedGranule *granules;
+	hid_t fapl_id;
+	ConfigValues *config;
+} GranuleCache;
+
+#ifdef USE_MPI
+/* Bounds on the photon rows of a track that one rank copies in a distributed run */
+#define DIST_MIN_PIECE_ROWS (1 << 18)
+#define DIST_MAX_PIECE_ROWS (1 << 22)
+
+/* Pieces per rank the photons of a distributed run are cut into, so the largest track doesn't hold up the rest */
+#define DIST_PIECES_PER_RANK 4
+
+#define NUM_DIST_DATASETS (NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS)
+
+/* One ground track of one granule in a distributed run. Its runs are found by one rank and shared with every rank. */
+typedef struct DistTrack{
+	size_t granule;
+	size_t track;
+	Range_Runs *index_runs;
+	Range_Runs *photon_runs;
+	size_t first_piece;
+	size_t num_pieces;
+} DistTrack;
+
+/* Rows [first_row, end_row) of the selected photons of a track, copied by one rank. The first piece of a track
+ * also copies its reference datasets, and rows counts the rows of both that the piece copies. */
+typedef struct DistPiece{
+	size_t track;
+	size_t index;
+	size_t first_row;
+	size_t end_row;
+	size_t rows;
+	int rank;
+} DistPiece;
+#endif
+
+/* Name of the index in the result cache directory */
+#define RESULT_CACHE_INDEX "index"
+
+/* Stats of the photons reduced by -aggregate */
+typedef struct PhotonStats{
+	size_t count;
+	double min_h;
+	double max_h;
+	double sum_h;
+	size_t conf_counts[NUM_SURFACE_TYPES][NUM_SIGNAL_CONF];
+} PhotonStats;
+
+/* One block of photons on its way through a reducer. conf holds conf_cols values per row. */
+typedef struct AggregateBlock{
+	float *h;
+	signed char *conf;
+	size_t rows;
+	size_t conf_cols;
+	PhotonStats stats;
+} AggregateBlock;
+
+/* A subset kept by the result cache. granule and datasets are hashes of the input's identity and of the dataset list. */
+typedef struct CachedResult{
+	char file[64];
+	uint64_t granule;
+	uint64_t datasets;
+	BBox bbox;
+	size_t nbytes;
+	time_t created;
+} CachedResult;
+
+/* The result cache index. It is locked only while it is read or rewritten, so concurrent runs sharing the directory
+ * don't wait on each other's selections; what a run changes is merged into the index as it is when the run ends. */
+typedef struct ResultCache{
+	const char *dir;
+	const char *index_path;
+	size_t max_bytes;
+	time_t max_age;
+	size_t hits;
+	size_t misses;
+	size_t num_entries;
+	size_t max_entries;
+	CachedResult *entries;
+
+	/* This run's changes, applied by close_result_cache */
+	size_t run_hits;
+	size_t run_misses;
+	bool stored;
+	CachedResult stored_entry;
+} ResultCache;
+
+/* A granule in the footprint catalog, with the blocks of all its tracks */
+typedef struct CatalogGranule{
+	char *path;
+	uint64_t id;
+	size_t num_blocks;
+	size_t max_blocks;
+	BBox *blocks;
+} CatalogGranule;
+
+/* Footprints of a collection of granules, in the order they were indexed. A granule indexed again after it
+ * changed replaces its old entry. */
+typedef struct Catalog{
+	size_t num_granules;
+	size_t max_granules;
+	CatalogGranule *granules;
+} Catalog;
+
 typedef enum ConfigType{
 	CONFIG_UNKNOWN_T,
 	CONFIG_STRING_T,
@@ -116,1038 +831,8042 @@ typedef enum ConfigType{
 	CONFIG_INT_T
 } ConfigType;
 
-/* Copy each attribute from fin to the file whose hid_t is pointed to by fout_data */
-herr_t copy_attr_callback(hid_t fin, const char *attr_name, const H5A_info_t *ainfo, void *fout_data) {
-	herr_t ret_value = SUCCEED;
-
-	hid_t fout = *((hid_t *)fout_data);
-	hid_t fin_aapl_id = H5I_INVALID_HID;
-	hid_t fin_attr = H5I_INVALID_HID;
-
-	hid_t acpl_id = H5I_INVALID_HID;
-	hid_t dtype_id = H5I_INVALID_HID;
-	hid_t dstype_id = H5I_INVALID_HID;
-	hid_t fout_attr = H5I_INVALID_HID;
+Backend get_backend(void) {
+	if (use_rest_vol)
+		return BACKEND_REST_VOL;
 
-	size_t dtype_size = 0;
-	size_t num_elems = 0;
+	if (use_ros3)
+		return BACKEND_ROS3;
 
-	void *attr_data = NULL;
+	return BACKEND_NATIVE;
+}
 
-	if ((fin_attr = H5Aopen(fin, attr_name, H5P_DEFAULT)) == H5I_INVALID_HID)
-	{
-		FUNC_GOTO_ERROR("can't open file attribute in copy callback");
+void set_memory_budget(ConfigValues *config) {
+	if (config->memory_budget_mib > 0) {
+		memory_budget.limit = (size_t)config->memory_budget_mib * 1024 * 1024;
 	}
 
-	if ((dtype_id = H5Aget_type(fin_attr)) == H5I_INVALID_HID)
-	{
-		FUNC_GOTO_ERROR("Failed to get datatype of attribute")
-	}
+	PRINT_DEBUG("Memory budget is %zu bytes\n", memory_budget.limit)
+}
 
-	if ((dstype_id = H5Aget_space(fin_attr)) < 0)
-	{
-		FUNC_GOTO_ERROR("Failed to get dataspace of attribute")
+void set_request_policy(ConfigValues *config) {
+	if (config->request_hedge_percentile < 0 || config->request_hedge_percentile >= 100) {
+		FUNC_GOTO_ERROR("request_hedge_percentile must be from 0 to 99")
 	}
 
-	if ((acpl_id = H5Aget_create_plist(fin_attr)) < 0)
-	{
-		FUNC_GOTO_ERROR("Failed to get acpl")
+	if (config->request_max_retries < 0 || config->request_retry_backoff_ms < 0 || config->request_timeout_ms < 0) {
+		FUNC_GOTO_ERROR("request_max_retries, request_retry_backoff_ms and request_timeout_ms can't be negative")
 	}
 
-	if ((dtype_size = H5Tget_size(dtype_id)) == 0)
-	{
-		FUNC_GOTO_ERROR("Failed to get size of datatype")
-	}
+	request_policy.hedge_percentile = config->request_hedge_percentile;
+	request_policy.max_retries = config->request_max_retries;
+	request_policy.retry_backoff = config->request_retry_backoff_ms / 1000.0;
+	request_policy.timeout_ms = config->request_timeout_ms;
+}
 
-	if ((num_elems = H5Sget_simple_extent_npoints(dstype_id)) < 0)
-	{
-		FUNC_GOTO_ERROR("Failed to get number of elements")
-	}
+/* Take nbytes from the memory budget, with async set for memory a thread pool task will release.
+ * While tasks hold memory an allocation that doesn't fit waits for them, otherwise the run fails
+ * rather than go over the budget. */
+void budget_acquire(size_t nbytes, bool async) {
+	pthread_mutex_lock(&memory_budget.lock);
+
+	while (memory_budget.limit > 0 && memory_budget.in_use + nbytes > memory_budget.limit) {
+		if (memory_budget.async == 0) {
+			fprintf(stderr, "%zu bytes requested in phase %s with %zu of %zu in use\n",
+					nbytes, memory_budget.phase, memory_budget.in_use, memory_budget.limit);
+			FUNC_GOTO_ERROR("Memory budget exceeded")
+		}
 
-	if ((attr_data = malloc(dtype_size * num_elems)) == 0)
-	{
-		FUNC_GOTO_ERROR("Failed to allocate memory for dtype")
+		pthread_cond_wait(&memory_budget.released, &memory_budget.lock);
 	}
 
-	if (H5Aread(fin_attr, dtype_id, attr_data) < 0)
-	{
-		FUNC_GOTO_ERROR("Failed to read from attribute")
-	}
+	memory_budget.in_use += nbytes;
 
-	if (!readonly)
-	{
-		if ((fout_attr = H5Acreate(fout, attr_name, dtype_id, dstype_id, acpl_id, H5P_DEFAULT)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to create attribute in output file")
-		}
+	if (async)
+		memory_budget.async += nbytes;
 
-		if (H5Awrite(fout_attr, dtype_id, attr_data) < 0) {
-			FUNC_GOTO_ERROR("Failed to write to copied attribute")
-		}
+	if (memory_budget.in_use > memory_budget.peak)
+		memory_budget.peak = memory_budget.in_use;
 
-		if (H5Aclose(fout_attr) < 0) {
-			FUNC_GOTO_ERROR("Failed to close output attribute")
-		}
-	}
+	pthread_mutex_unlock(&memory_budget.lock);
+}
 
-	free(attr_data);
+void budget_release(size_t nbytes, bool async) {
+	pthread_mutex_lock(&memory_budget.lock);
 
-	if (H5Aclose(fin_attr) < 0)
-	{
-		FUNC_GOTO_ERROR("Failed to close input attribute")
-	}
+	memory_budget.in_use -= nbytes;
 
-	return ret_value;
+	if (async)
+		memory_budget.async -= nbytes;
+
+	pthread_cond_broadcast(&memory_budget.released);
+	pthread_mutex_unlock(&memory_budget.lock);
 }
 
-/* Copy datasets and their paths from file fin to file fout */
-herr_t copy_scalar_datasets(hid_t fin, hid_t fout) {
-#define NUM_SCALAR_DATASETS 3
+/* Bytes that can still be taken from the budget, SIZE_MAX when there is no limit */
+size_t budget_available(void) {
+	size_t available = SIZE_MAX;
 
-	hid_t parent_group = H5I_INVALID_HID;
-	hid_t child_group = H5I_INVALID_HID;
+	pthread_mutex_lock(&memory_budget.lock);
 
-	hid_t dset[NUM_SCALAR_DATASETS];
-	hid_t dtype[NUM_SCALAR_DATASETS];
-	hid_t dstype[NUM_SCALAR_DATASETS];
-	hid_t dcpl = H5I_INVALID_HID;
-	hid_t dapl = H5I_INVALID_HID;
-	hid_t copied_scalar_dataset[NUM_SCALAR_DATASETS];
+	if (memory_budget.limit > 0)
+		available = (memory_budget.in_use < memory_budget.limit) ? memory_budget.limit - memory_budget.in_use : 0;
 
-	hid_t select_all_arr[NUM_SCALAR_DATASETS];
-	size_t num_elems = 0;
-	size_t elem_size = 0;
-	size_t dset_idx = 0;
+	pthread_mutex_unlock(&memory_budget.lock);
 
-	char *prev_group_name;
-	char *group_name;
-	char *dset_name;
-	char *dset_path;
-	char dset_path_buffer[FILEPATH_BUFFER_SIZE];
-		
-	void *data[NUM_SCALAR_DATASETS];
+	return available;
+}
 
-	for (dset_idx = 0; dset_idx < NUM_SCALAR_DATASETS; dset_idx++) {
-		select_all_arr[dset_idx] = H5S_ALL;
+/* calloc for data buffers, counted against the memory budget until budget_free */
+void *budget_calloc(size_t count, size_t size) {
+	void *ptr = NULL;
+
+	budget_acquire(count * size, false);
+
+	if ((ptr = calloc(count ? count : 1, size ? size : 1)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate data buffer")
 	}
 
-	const char **current_dset = scalar_datasets;
+	return ptr;
+}
 
-	dset_idx = 0;
+/* budget_calloc for callers that recover, NULL when the buffer doesn't fit in the budget or can't be allocated */
+void *budget_try_calloc(size_t count, size_t size) {
+	void *ptr = NULL;
 
-	/* Iterate over path to make sure all parent groups exist and get dset name */
-	while (*current_dset != 0)
-	{
+	pthread_mutex_lock(&memory_budget.lock);
 
-		/* Copy the dataset path for strtok */
-		dset_path = &(dset_path_buffer[0]);
-		strncpy(dset_path, *current_dset, strlen(*current_dset) + 1);
+	while (memory_budget.limit > 0 && memory_budget.in_use + count * size > memory_budget.limit) {
+		if (memory_budget.async == 0) {
+			pthread_mutex_unlock(&memory_budget.lock);
+			return NULL;
+		}
 
-		PRINT_DEBUG("Copying scalar dset %s\n", dset_path);
+		pthread_cond_wait(&memory_budget.released, &memory_budget.lock);
+	}
 
-		/* Separate filepath into groups */
-		group_name = strtok_r(dset_path, PATH_DELIMITER, &dset_path);
+	memory_budget.in_use += count * size;
 
-		parent_group = fout;
+	if (memory_budget.in_use > memory_budget.peak)
+		memory_budget.peak = memory_budget.in_use;
 
-		/* Until end of path */
-		if (!readonly) {
-			while (group_name != NULL)
-			{
-				/* If the end of the path is reached, keep track of dset name and do not create it as a group*/
-				prev_group_name = group_name;
-				if ((group_name = strtok_r(NULL, PATH_DELIMITER, &dset_path)) == NULL)
-				{
-					dset_name = prev_group_name;
-					break;
-				}
+	pthread_mutex_unlock(&memory_budget.lock);
 
-				/* If this group does not exist, attempt to create it */
-				H5E_BEGIN_TRY
-				{
-					if ((child_group = H5Gopen(parent_group, prev_group_name, H5P_DEFAULT)) == H5I_INVALID_HID)
-					{
-						if ((child_group = H5Gcreate(parent_group, prev_group_name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID)
-						{
-							FUNC_GOTO_ERROR("Failed to create child group")
-						}
-					}
-				}
-				H5E_END_TRY
+	if ((ptr = calloc(count ? count : 1, size ? size : 1)) == NULL)
+		budget_release(count * size, false);
 
-				/* Only close intermediate groups that were just created, not the file itself */
-				if (parent_group != fout)
-				{
-					if (H5Gclose(parent_group) < 0)
-					{
-						FUNC_GOTO_ERROR("Failed to create group")
-					}
-				}
+	return ptr;
+}
 
-				parent_group = child_group;
-			}
-		}
+void budget_free(void *ptr, size_t nbytes) {
+	free(ptr);
+	budget_release(nbytes, false);
+}
 
-		/* Access information about dset */
-		if ((dset[dset_idx] = H5Dopen(fin, *current_dset, H5P_DEFAULT)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to open dset")
-		}
+/* Report the peak usage of the phase that ends and start measuring the next one from current usage */
+void budget_phase(const char *phase) {
+	pthread_mutex_lock(&memory_budget.lock);
 
-		if ((dtype[dset_idx] = H5Dget_type(dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dtype")
-		}
+	printf("memory, %s, %zu, %zu\n", memory_budget.phase, memory_budget.peak, memory_budget.limit);
 
-		if ((dstype[dset_idx] = H5Dget_space(dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dstype")
-		}
+	memory_budget.phase = phase;
+	memory_budget.peak = memory_budget.in_use;
 
-		if ((dcpl = H5Dget_create_plist(dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dcpl")
-		}
+	pthread_mutex_unlock(&memory_budget.lock);
+}
 
-		if ((dapl = H5Dget_access_plist(dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dapl")
-		}
+/* Return nbytes of zeroed memory from the arena. Blocks come out of the memory budget. */
+void *arena_alloc(Arena *arena, size_t nbytes) {
+	ArenaBlock *block = arena->head;
+	void *ptr = NULL;
 
-		if ((num_elems = H5Sget_simple_extent_npoints(dstype[dset_idx])) < 0) {
-			FUNC_GOTO_ERROR("Failed to get number of elements")
-		}
+	nbytes = (nbytes + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
 
-		if ((elem_size = H5Tget_size(dtype[dset_idx])) == 0) {
-			FUNC_GOTO_ERROR("Failed to get dtype size")
+	if (block == NULL || block->size - block->used < nbytes) {
+		size_t size = (nbytes > ARENA_BLOCK_SIZE) ? nbytes : ARENA_BLOCK_SIZE;
+
+		budget_acquire(sizeof(ArenaBlock) + size, false);
+
+		if ((block = calloc(1, sizeof(ArenaBlock) + size)) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate arena block")
 		}
 
-		data[dset_idx] = calloc(num_elems, elem_size);
+		block->size = size;
 
-		if (!readonly) {
-			if ((copied_scalar_dataset[dset_idx] = H5Dcreate(parent_group, dset_name, dtype[dset_idx], dstype[dset_idx], H5P_DEFAULT, dcpl, dapl)) == H5I_INVALID_HID)
-			{
-				FUNC_GOTO_ERROR("Failed to create dset")
-			}
+		/* An oversized block goes behind the head so the rest of the head block stays in use */
+		if (arena->head && size > ARENA_BLOCK_SIZE) {
+			block->next = arena->head->next;
+			arena->head->next = block;
+		}
+		else {
+			block->next = arena->head;
+			arena->head = block;
 		}
 
-		dset_idx++;
-		++current_dset;
+		arena->num_blocks++;
 	}
 
-	if (use_multi) {
-		PRINT_DEBUG("Using _multi API to copy scalar datasets\n");
+	ptr = block->data + block->used;
+	block->used += nbytes;
+	arena->bytes += nbytes;
 
-		if (H5Dread_multi(NUM_SCALAR_DATASETS, dset, dtype, select_all_arr, select_all_arr, H5P_DEFAULT, data) < 0) {
-			FUNC_GOTO_ERROR("Failed to multi read datasets while copying scalar")
-		}
+	return ptr;
+}
 
-		if (H5Dwrite_multi(NUM_SCALAR_DATASETS, copied_scalar_dataset, dtype, select_all_arr, select_all_arr, H5P_DEFAULT, (const void **) data) < 0) {
-			FUNC_GOTO_ERROR("Failed to multi write to datasets while copying scalar")
-		}
-	} else {
-		for (dset_idx = 0; dset_idx < NUM_SCALAR_DATASETS; dset_idx++) {
-			if (H5Dread(dset[dset_idx], dtype[dset_idx], select_all_arr[dset_idx], select_all_arr[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0)
-			{
-				FUNC_GOTO_ERROR("Failed to read dataset while copying scalar")
-			}
+/* snprintf into a string allocated from the arena */
+char *arena_printf(Arena *arena, const char *format, ...) {
+	va_list args;
+	char *str = NULL;
+	int len = 0;
 
-			if (H5Dwrite(copied_scalar_dataset[dset_idx], dtype[dset_idx], select_all_arr[dset_idx], select_all_arr[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0)
-			{
-				FUNC_GOTO_ERROR("Failed to write to dataset while copying scalar")
-			}
-		}
-	}
-		
-	/* Clean up*/
-	if (H5Pclose(dcpl) < 0)
-	{
-		FUNC_GOTO_ERROR("Failed to close dcpl")
-	}
+	va_start(args, format);
+	len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
 
-	if (H5Pclose(dapl) < 0)
-	{
-		FUNC_GOTO_ERROR("Failed to close dapl")
+	if (len < 0) {
+		FUNC_GOTO_ERROR("Failed to format arena string")
 	}
 
-	for (dset_idx = 0; dset_idx < NUM_SCALAR_DATASETS; dset_idx++) {
-		if (H5Dclose(copied_scalar_dataset[dset_idx]) < 0)
-			{
-				FUNC_GOTO_ERROR("Failed to close copied scalar dataset")
-			}
-		free(data[dset_idx]);
+	str = arena_alloc(arena, (size_t)len + 1);
 
-		if (H5Dclose(dset[dset_idx]) < 0) {
-			FUNC_GOTO_ERROR("Failed to close scalar dset")
-		}
+	va_start(args, format);
+	vsnprintf(str, (size_t)len + 1, format, args);
+	va_end(args);
+
+	return str;
+}
+
+/* Free every allocation made from the arena */
+void arena_release(Arena *arena) {
+	ArenaBlock *block = arena->head;
 
+	while (block) {
+		ArenaBlock *next = block->next;
 
+		budget_release(sizeof(ArenaBlock) + block->size, false);
+		free(block);
+		block = next;
 	}
-}
 
-/* Copy any attributes from input root group to output root group
- * Return non-negative on success, negative on failure. */
-herr_t copy_root_attrs(hid_t fin, hid_t fout) {
-	herr_t ret_value = SUCCEED;
-	H5Aiterate(fin, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_attr_callback, &fout);
-	return ret_value;
+	arena->head = NULL;
+	arena->num_blocks = 0;
+	arena->bytes = 0;
 }
 
-/* Get min and max values for the given array within the given range*/
-Range_Doubles get_minmax(double arr[], Range_Indices range) {
-	Range_Doubles out_range;
+/* Estimate the number of bytes a selection moves in memory */
+size_t estimate_selection_bytes(hid_t dset, hid_t mem_type, hid_t file_space) {
+	hid_t space_id = file_space;
+	hssize_t npoints = 0;
 
-	PRINT_DEBUG("Minmax search range is %ld - %ld\n", range.min, range.max)
+	if (file_space == H5S_ALL) {
+		if ((space_id = H5Dget_space(dset)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dataspace to estimate selection size")
+		}
+	}
 
-	/* Initialize fields */
-	out_range.min = arr[range.min];
-	out_range.max = arr[range.min];
+	if ((npoints = H5Sget_select_npoints(space_id)) < 0) {
+		FUNC_GOTO_ERROR("Failed to get number of selected points")
+	}
 
-	for (size_t i = range.min; i < range.max; i++)
+	if (file_space == H5S_ALL) {
+		H5Sclose(space_id);
+	}
+
+	return (size_t)npoints * H5Tget_size(mem_type);
+}
+
+/* Get the file address of the first byte of a selection, or HADDR_UNDEF if it can't be determined.
+ * Only the native file format exposes addresses; the REST VOL always returns HADDR_UNDEF. */
+haddr_t get_selection_address(hid_t dset, hid_t file_space) {
+	haddr_t addr = HADDR_UNDEF;
+	hid_t space_id = file_space;
+	hid_t dcpl = H5I_INVALID_HID;
+	hsize_t start[H5S_MAX_RANK];
+	hsize_t end[H5S_MAX_RANK];
+	hsize_t chunk_dims[H5S_MAX_RANK];
+	hsize_t chunk_size = 0;
+	unsigned filter_mask = 0;
+	int ndims = 0;
+
+	if (get_backend() == BACKEND_REST_VOL)
+		return HADDR_UNDEF;
+
+	if (file_space == H5S_ALL) {
+		space_id = H5Dget_space(dset);
+	}
+
+	H5E_BEGIN_TRY
 	{
-		double elem = arr[i];
+		if (H5Sget_select_npoints(space_id) > 0 &&
+			(ndims = H5Sget_simple_extent_ndims(space_id)) > 0 &&
+			H5Sget_select_bounds(space_id, start, end) >= 0 &&
+			(dcpl = H5Dget_create_plist(dset)) != H5I_INVALID_HID)
+		{
+			if (H5Pget_layout(dcpl) == H5D_CHUNKED && H5Pget_chunk(dcpl, ndims, chunk_dims) == ndims) {
+				/* Chunk info is looked up by the logical offset of the chunk holding the first element */
+				for (int i = 0; i < ndims; i++) {
+					start[i] -= start[i] % chunk_dims[i];
+				}
 
-		if (elem < out_range.min) {
-			out_range.min = elem;
-		}
+				if (H5Dget_chunk_info_by_coord(dset, start, &filter_mask, &addr, &chunk_size) < 0) {
+					addr = HADDR_UNDEF;
+				}
+			}
+			else if (H5Pget_layout(dcpl) == H5D_CONTIGUOUS) {
+				addr = H5Dget_offset(dset);
+			}
 
-		if (elem > out_range.max) {
-			out_range.max = elem;
+			H5Pclose(dcpl);
 		}
 	}
+	H5E_END_TRY
 
-	PRINT_DEBUG("Minmax values of array in the range are %lf, %lf\n", out_range.min, out_range.max)
+	if (file_space == H5S_ALL) {
+		H5Sclose(space_id);
+	}
 
-	return out_range;
+	return addr;
 }
 
-/* Return the lowest and highest indices of the given array where the lat/lon values fall within the given bounding box */
-Range_Indices *get_range(double lat_arr[], size_t lat_size, double lon_arr[], size_t lon_size,
-						 BBox *bbox, Range_Indices *range) {
-	Range_Indices *ret_range = malloc(sizeof(*range));
-	ret_range->min = 0;
-	ret_range->max = 0;
+/* Group the selections of a _multi call into batches according to batch_policy.
+ * If addrs is non-NULL, selections are first ordered by file address so nearby selections share a batch. */
+BatchPlan *plan_batches(size_t count, size_t *bytes, haddr_t *addrs) {
+	BatchPlan *plan = NULL;
+	size_t batch_count = 0;
+	size_t batch_bytes = 0;
+	haddr_t prev_addr = HADDR_UNDEF;
 
-	Range_Indices default_range;
-	default_range.min = 0;
-	default_range.max = lat_size;
+	if ((plan = calloc(1, sizeof(*plan))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate batch plan")
+	}
 
-	if (lat_size != lon_size)
-	{
-		FUNC_GOTO_ERROR("expected lat and lon arrays to have same shape")
+	plan->order = malloc(count * sizeof(size_t));
+	plan->batch_start = malloc((count + 1) * sizeof(size_t));
+	plan->batch_bytes = calloc(count + 1, sizeof(size_t));
+
+	if (!plan->order || !plan->batch_start || !plan->batch_bytes) {
+		FUNC_GOTO_ERROR("Failed to allocate batch plan")
 	}
 
-	if (range == NULL)
-	{
-		range = &default_range;
+	for (size_t i = 0; i < count; i++) {
+		plan->order[i] = i;
 	}
 
-	PRINT_DEBUG("get_range range has min %zu and max %zu\n", range->min, range->max)
+	/* Stable insertion sort by address; selections without an address keep their relative order at the end */
+	if (addrs) {
+		for (size_t i = 1; i < count; i++) {
+			size_t idx = plan->order[i];
+			size_t j = i;
 
-	Range_Doubles lat_range = get_minmax(lat_arr, *range);
-	Range_Doubles lon_range = get_minmax(lon_arr, *range);
+			while (j > 0 && addrs[plan->order[j - 1]] > addrs[idx]) {
+				plan->order[j] = plan->order[j - 1];
+				j--;
+			}
 
-	/* If entirely outside bbox, return NULL */
-	if (lat_range.min > bbox->max_lat ||
-		lat_range.max < bbox->min_lat ||
-		lon_range.min > bbox->max_lon ||
-		lon_range.max < bbox->min_lon)
-	{
-		PRINT_DEBUG("%s\n", "Entirely outside bbox")
-		free(ret_range);
-		ret_range = NULL;
-	}
-	else if (lat_range.min >= bbox->min_lat &&
-			 lat_range.max <= bbox->max_lat &&
-			 lon_range.min >= bbox->min_lon &&
-			 lon_range.max <= bbox->max_lon)
-	{
-		PRINT_DEBUG("%s\n", "Entirely within bbox")
-		memcpy(ret_range, range, sizeof(*range));
+			plan->order[j] = idx;
+		}
 	}
-	else
-	{
-		/* If entirely in bbox, return current range */
-		size_t middle_index = (size_t)((range->min + range->max) / 2);
 
-		Range_Indices range_select_low;
-		range_select_low.min = range->min;
-		range_select_low.max = middle_index;
-		Range_Indices *range_low = get_range(lat_arr, lat_size, lon_arr, lon_size, bbox, &range_select_low);
+	for (size_t i = 0; i < count; i++) {
+		size_t idx = plan->order[i];
+		haddr_t addr = (addrs) ? addrs[idx] : HADDR_UNDEF;
+		bool split = false;
 
-		Range_Indices range_select_high;
-		range_select_high.min = middle_index;
-		range_select_high.max = range->max;
-		Range_Indices *range_high = get_range(lat_arr, lat_size, lon_arr, lon_size, bbox, &range_select_high);
+		if (batch_count > 0) {
+			if (batch_policy.max_count && batch_count >= batch_policy.max_count)
+				split = true;
 
-		if (range_low == NULL) {
-			PRINT_DEBUG("Return range high\n")
-			ret_range->min = range_high->min;
-			ret_range->max = range_high->max;
-			free(range_high);
-			return ret_range;
-		}
-		else if (range_high == NULL) {
-			PRINT_DEBUG("Return range low\n")
-			ret_range->min = range_low->min;
-			ret_range->max = range_low->max;
-			free(range_low);
-			return ret_range;
+			if (batch_policy.max_bytes && batch_bytes + bytes[idx] > batch_policy.max_bytes)
+				split = true;
+
+			if (batch_policy.max_gap && addr != HADDR_UNDEF && prev_addr != HADDR_UNDEF &&
+				addr - prev_addr > batch_policy.max_gap)
+				split = true;
 		}
 
-		/* If neither is empty, concatenate the ranges */
-		PRINT_DEBUG("Concatenating ranges\n")
-		ret_range->min = range_low->min;
-		ret_range->max = range_high->max;
+		if (batch_count == 0 || split) {
+			plan->batch_start[plan->num_batches] = i;
+			plan->num_batches++;
+			batch_count = 0;
+			batch_bytes = 0;
+		}
 
-		free(range_low);
-		free(range_high);
+		batch_count++;
+		batch_bytes += bytes[idx];
+		plan->batch_bytes[plan->num_batches - 1] = batch_bytes;
+		prev_addr = addr;
 	}
 
-	return ret_range;
-}
+	plan->batch_start[plan->num_batches] = count;
 
-/* Get min/max index for the given lat/lon bounds */
-Range_Indices **get_index_range(hid_t fin, char **ground_track, BBox *bbox) {
-	Range_Indices **ret_ranges = calloc(NUM_GROUND_TRACKS, sizeof(Range_Indices*));
+	return plan;
+}
 
-	hid_t lat_dset[NUM_GROUND_TRACKS];
-	hid_t lon_dset[NUM_GROUND_TRACKS];
-	hid_t lat_dspace_id[NUM_GROUND_TRACKS];
-	hid_t lon_dspace_id[NUM_GROUND_TRACKS];
-	hid_t select_all_arr[NUM_GROUND_TRACKS];
-	hid_t dtype_id[NUM_GROUND_TRACKS];
+void free_batch_plan(BatchPlan *plan) {
+	free(plan->order);
+	free(plan->batch_start);
+	free(plan->batch_bytes);
+	free(plan);
+}
 
-	double *lat_arrs[NUM_GROUND_TRACKS];
-	double *lon_arrs[NUM_GROUND_TRACKS];
+/* Perform H5Dread_multi or H5Dwrite_multi over the given selections in planned batches,
+ * reporting the latency of each batch as "batch, <phase>, <index>, <count>, <bytes>, <seconds>" */
+void multi_batched(bool is_write, const char *phase, size_t count, hid_t *dset, hid_t *mem_type,
+				   hid_t *mem_space, hid_t *file_space, void **buf) {
+	BatchPlan *plan = NULL;
+	size_t *bytes = NULL;
+	haddr_t *addrs = NULL;
+
+	hid_t *batch_dset = NULL;
+	hid_t *batch_mem_type = NULL;
+	hid_t *batch_mem_space = NULL;
+	hid_t *batch_file_space = NULL;
+	void **batch_buf = NULL;
+
+	if (count == 0)
+		return;
+
+	bytes = malloc(count * sizeof(size_t));
+	batch_dset = malloc(count * sizeof(hid_t));
+	batch_mem_type = malloc(count * sizeof(hid_t));
+	batch_mem_space = malloc(count * sizeof(hid_t));
+	batch_file_space = malloc(count * sizeof(hid_t));
+	batch_buf = malloc(count * sizeof(void *));
+
+	if (!bytes || !batch_dset || !batch_mem_type || !batch_mem_space || !batch_file_space || !batch_buf) {
+		FUNC_GOTO_ERROR("Failed to allocate memory for batched multi I/O")
+	}
 
-	char *lat_dset_names[NUM_GROUND_TRACKS];
-	char *lon_dset_names[NUM_GROUND_TRACKS];
+	for (size_t i = 0; i < count; i++) {
+		bytes[i] = estimate_selection_bytes(dset[i], mem_type[i], file_space[i]);
+	}
 
-	size_t num_elems_lat[NUM_GROUND_TRACKS];
-	size_t num_elems_lon[NUM_GROUND_TRACKS];
+	/* Locality only matters for the source file, writes keep their original order */
+	if (!is_write) {
+		if ((addrs = malloc(count * sizeof(haddr_t))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate memory for selection addresses")
+		}
 
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		select_all_arr[i] = H5S_ALL;
+		for (size_t i = 0; i < count; i++) {
+			addrs[i] = get_selection_address(dset[i], file_space[i]);
+		}
 	}
 
-	/* Set up lat/lon information for H5Dread(_multi) */
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		PRINT_DEBUG("get_index_range with ground_track = %s\n", ground_track[i])
+	plan = plan_batches(count, bytes, addrs);
 
-		lat_dset_names[i] = malloc(strlen(ground_track[i]) + strlen(geolocation_lat) + 1);
-		strncpy(lat_dset_names[i], ground_track[i], strlen(ground_track[i]) + 1);
-		strcat(lat_dset_names[i], geolocation_lat);
+	PRINT_DEBUG("Planned %zu batch(es) for %zu selections in %s\n", plan->num_batches, count, phase)
 
-		if ((lat_dset[i] = H5Dopen(fin, lat_dset_names[i], H5P_DEFAULT)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to open lat datset")
-		}
+	for (size_t b = 0; b < plan->num_batches; b++) {
+		size_t batch_size = plan->batch_start[b + 1] - plan->batch_start[b];
+		double start_time = 0.0;
 
-		lat_dspace_id[i] = H5Dget_space(lat_dset[i]);
-		dtype_id[i] = H5Dget_type(lat_dset[i]);
+		for (size_t i = 0; i < batch_size; i++) {
+			size_t idx = plan->order[plan->batch_start[b] + i];
 
-		num_elems_lat[i] = H5Sget_simple_extent_npoints(lat_dspace_id[i]);
-		PRINT_DEBUG("Number of elements in lat dataset is %zu\n", num_elems_lat[i])
-		lat_arrs[i] = malloc(sizeof(double) * num_elems_lat[i]);
+			batch_dset[i] = dset[idx];
+			batch_mem_type[i] = mem_type[idx];
+			batch_mem_space[i] = mem_space[idx];
+			batch_file_space[i] = file_space[idx];
+			batch_buf[i] = buf[idx];
+		}
 
-		lon_dset_names[i] = malloc(strlen(ground_track[i]) + strlen(geolocation_lon) + 1);
-		strncpy(lon_dset_names[i], ground_track[i], strlen(ground_track[i]) + 1);
-		strcat(lon_dset_names[i], geolocation_lon);
+		start_time = get_time();
 
-		if ((lon_dset[i] = H5Dopen(fin, lon_dset_names[i], H5P_DEFAULT)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to open lon dataset")
+		if (is_write) {
+			if (H5Dwrite_multi(batch_size, batch_dset, batch_mem_type, batch_mem_space, batch_file_space, H5P_DEFAULT, (const void **) batch_buf) < 0) {
+				FUNC_GOTO_ERROR("Failed to multi-write batch")
+			}
+		} else {
+			if (H5Dread_multi(batch_size, batch_dset, batch_mem_type, batch_mem_space, batch_file_space, H5P_DEFAULT, batch_buf) < 0) {
+				FUNC_GOTO_ERROR("Failed to multi-read batch")
+			}
 		}
 
-		lon_dspace_id[i] = H5Dget_space(lon_dset[i]);
-		num_elems_lon[i] = H5Sget_simple_extent_npoints(lon_dspace_id[i]);
-
-		lon_arrs[i] = malloc(sizeof(double) * num_elems_lon[i]);
-		
+		printf("batch, %s, %zu, %zu, %zu, %.6f\n", phase, b, batch_size, plan->batch_bytes[b], get_time() - start_time);
 	}
 
-	/* Perform H5Dread(_multi) for lat/lon */
-	if (use_multi) {
-		if (H5Dread_multi(NUM_GROUND_TRACKS, lat_dset, dtype_id, select_all_arr, select_all_arr, H5P_DEFAULT, (void **) lat_arrs) < 0) {
-			FUNC_GOTO_ERROR("Failed to read_multi from lat dataset")
-		}
-		
-		if (H5Dread_multi(NUM_GROUND_TRACKS, lon_dset, dtype_id, select_all_arr, select_all_arr, H5P_DEFAULT, (void **) lon_arrs) < 0) {
-			FUNC_GOTO_ERROR("Failed to read from lon dataset")
-		}
-	} else {
+	free_batch_plan(plan);
+	free(bytes);
+	free(addrs);
+	free(batch_dset);
+	free(batch_mem_type);
+	free(batch_mem_space);
+	free(batch_file_space);
+	free(batch_buf);
+}
 
-		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-			if (H5Dread(lat_dset[i], dtype_id[i], select_all_arr[i], select_all_arr[i], H5P_DEFAULT, lat_arrs[i]) < 0) {
-				FUNC_GOTO_ERROR("Failed to read from lat dataset")
-			}
+void read_multi_batched(const char *phase, size_t count, hid_t *dset, hid_t *mem_type,
+						hid_t *mem_space, hid_t *file_space, void **buf) {
+	multi_batched(false, phase, count, dset, mem_type, mem_space, file_space, buf);
+}
+
+void write_multi_batched(const char *phase, size_t count, hid_t *dset, hid_t *mem_type,
+						 hid_t *mem_space, hid_t *file_space, const void **buf) {
+	multi_batched(true, phase, count, dset, mem_type, mem_space, file_space, (void **) buf);
+}
+
+/* Start from the backend's default batch policy and apply any overrides from the config */
+void set_batch_policy(ConfigValues *config) {
+	batch_policy = default_batch_policies[get_backend()];
+
+	if (config->batch_max_mib >= 0)
+		batch_policy.max_bytes = (size_t)config->batch_max_mib * 1024 * 1024;
+
+	if (config->batch_max_count >= 0)
+		batch_policy.max_count = (size_t)config->batch_max_count;
+
+	if (config->batch_max_gap_mib >= 0)
+		batch_policy.max_gap = (size_t)config->batch_max_gap_mib * 1024 * 1024;
+
+	PRINT_DEBUG("Batch policy: max_bytes = %zu, max_count = %zu, max_gap = %zu\n",
+				batch_policy.max_bytes, batch_policy.max_count, batch_policy.max_gap)
+}
 
-			if (H5Dread(lon_dset[i], dtype_id[i], select_all_arr[i], select_all_arr[i], H5P_DEFAULT, lon_arrs[i]) < 0) {
-				FUNC_GOTO_ERROR("Failed to read from lon dataset")
+/* Return the smallest prime that is >= n, as recommended for the number of chunk cache slots */
+size_t next_prime(size_t n) {
+	if (n <= 2)
+		return 2;
+
+	for (;; n++) {
+		bool is_prime = true;
+
+		for (size_t d = 2; d * d <= n; d++) {
+			if (n % d == 0) {
+				is_prime = false;
+				break;
 			}
 		}
+
+		if (is_prime)
+			return n;
 	}
+}
 
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		ret_ranges[i] = get_range(lat_arrs[i], num_elems_lat[i], lon_arrs[i], num_elems_lon[i], bbox, NULL);
+/* Size a chunk cache so that no chunk touched by more than one of the planned reads is decoded twice.
+ * reads are the dim-0 ranges the dataset handle will serve, in order; a chunk must stay cached from the
+ * first read that touches it until the last one, so the cache needs room for the peak number of such
+ * chunks alive at once. A dataset read only once gets no cache at all. */
+ChunkCachePlan plan_chunk_cache(hsize_t chunk_extent, size_t chunk_bytes, size_t num_reads, Range_Indices *reads) {
+	ChunkCachePlan plan = {CHUNK_CACHE_MIN_SLOTS, 0, 1.0};
+	size_t first_chunk = SIZE_MAX;
+	size_t last_chunk = 0;
+	size_t peak_live = 0;
+
+	for (size_t r = 0; r < num_reads; r++) {
+		if (reads[r].max <= reads[r].min)
+			continue;
 
-		if (ret_ranges[i]) {
-			PRINT_DEBUG("get_index_range using index with min %zu and max %zu\n", ret_ranges[i]->min, ret_ranges[i]->max)
-		}
+		if (reads[r].min / chunk_extent < first_chunk)
+			first_chunk = reads[r].min / chunk_extent;
+
+		if ((reads[r].max - 1) / chunk_extent > last_chunk)
+			last_chunk = (reads[r].max - 1) / chunk_extent;
 	}
 
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		H5Dclose(lon_dset[i]);
-		H5Dclose(lat_dset[i]);
-		free(lat_arrs[i]);
-		free(lon_arrs[i]);
-		free(lat_dset_names[i]);
-		free(lon_dset_names[i]);
+	if (num_reads < 2 || first_chunk == SIZE_MAX)
+		return plan;
+
+	/* After read t, a chunk is live if it was touched by a read <= t and will be touched by a read > t */
+	for (size_t t = 0; t + 1 < num_reads; t++) {
+		size_t live = 0;
+
+		for (size_t c = first_chunk; c <= last_chunk; c++) {
+			bool seen = false;
+			bool needed = false;
+
+			for (size_t r = 0; r < num_reads; r++) {
+				if (reads[r].max <= reads[r].min)
+					continue;
+
+				if (c >= reads[r].min / chunk_extent && c <= (reads[r].max - 1) / chunk_extent) {
+					if (r <= t)
+						seen = true;
+					else
+						needed = true;
+				}
+			}
+
+			if (seen && needed)
+				live++;
+		}
+
+		if (live > peak_live)
+			peak_live = live;
 	}
 
-	return ret_ranges;
-}
+	plan.nbytes = peak_live * chunk_bytes;
+	plan.nslots = next_prime((peak_live * 100 > CHUNK_CACHE_MIN_SLOTS) ? peak_live * 100 : CHUNK_CACHE_MIN_SLOTS);
 
-/* Copy given index range from source dataset to destination dataset */
-void copy_dataset_range(hid_t fin, hid_t fout, char **h5path, Range_Indices **index_range) {
-	hid_t source_dset[NUM_COPY_RANGE_DATASETS];
-	hid_t child_group = H5I_INVALID_HID;
-	hid_t parent_group = H5I_INVALID_HID;
-	hid_t copy_dset[NUM_COPY_RANGE_DATASETS];
-	hid_t native_dtype[NUM_COPY_RANGE_DATASETS];
+	return plan;
+}
 
-	hid_t dtype[NUM_COPY_RANGE_DATASETS];
-	hid_t file_dataspace[NUM_COPY_RANGE_DATASETS];
-	hid_t memory_dataspace[NUM_COPY_RANGE_DATASETS];
+/* Open a dataset with a chunk cache sized for the planned dim-0 reads, within the global chunk cache budget.
+ * num_reads of 0 means the dataset is read once in full. Datasets opened here must be closed with close_dataset. */
+hid_t open_dataset(hid_t fin, const char *h5path, size_t num_reads, Range_Indices *reads) {
+	hid_t dset = H5I_INVALID_HID;
 	hid_t dcpl = H5I_INVALID_HID;
 	hid_t dapl = H5I_INVALID_HID;
+	hid_t dtype = H5I_INVALID_HID;
+	hsize_t chunk_dims[H5S_MAX_RANK];
+	size_t chunk_bytes = 0;
+	int ndims = 0;
+	ChunkCachePlan plan;
 
-	hsize_t *stride_arr = NULL;
-	hsize_t *block_size_arr = NULL;
-	hsize_t *start_arr = NULL;
+	if ((dset = H5Dopen(fin, h5path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		return H5I_INVALID_HID;
+	}
 
-	int ndims = 0;
-	hsize_t *dims = NULL;
+	/* The REST VOL caches chunks on the server, so there is nothing to plan */
+	if (get_backend() == BACKEND_REST_VOL)
+		return dset;
 
-	char *prev_group_name;
-	char *group_name;
-	char *dset_name;
-	char *dset_path;
-	char dset_path_buffer[FILEPATH_BUFFER_SIZE];
+	if ((dcpl = H5Dget_create_plist(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dcpl for chunk cache planning")
+	}
 
-	void *data[NUM_COPY_RANGE_DATASETS];
+	if (H5Pget_layout(dcpl) != H5D_CHUNKED) {
+		H5Pclose(dcpl);
+		return dset;
+	}
 
-	hid_t select_all_arr[NUM_COPY_RANGE_DATASETS];
+	if ((ndims = H5Pget_chunk(dcpl, H5S_MAX_RANK, chunk_dims)) < 0) {
+		FUNC_GOTO_ERROR("Failed to get chunk dims for chunk cache planning")
+	}
 
-	for (size_t dset_idx = 0; dset_idx < NUM_COPY_RANGE_DATASETS; dset_idx++) {
-		select_all_arr[dset_idx] = H5S_ALL;
+	dtype = H5Dget_type(dset);
+	chunk_bytes = H5Tget_size(dtype);
+
+	for (int i = 0; i < ndims; i++) {
+		chunk_bytes *= chunk_dims[i];
 	}
 
-	for (size_t dset_idx = 0; dset_idx < NUM_COPY_RANGE_DATASETS; dset_idx++) {
-		size_t extent = index_range[dset_idx]->max - index_range[dset_idx]->min;
-		size_t total_num_elems = 1;
-		size_t elem_size = 0;
+	H5Tclose(dtype);
+	H5Pclose(dcpl);
 
-		PRINT_DEBUG("Creating dataset %s with extent %lu\n", h5path[dset_idx], extent)
+	plan = plan_chunk_cache(chunk_dims[0], chunk_bytes, num_reads, reads);
 
-		/* Copy scalar dataset paths to stack for strtok */
-		dset_path = &(dset_path_buffer[0]);
-		strncpy(dset_path, h5path[dset_idx], strlen(h5path[dset_idx]) + 1);
+	if (chunk_cache_reserved + plan.nbytes > chunk_cache_budget) {
+		size_t remaining = chunk_cache_budget - chunk_cache_reserved;
 
-		parent_group = fout;
+		PRINT_DEBUG("Chunk cache budget exhausted for %s, wanted %zu bytes, have %zu\n", h5path, plan.nbytes, remaining)
+		plan.nbytes = remaining - remaining % chunk_bytes;
+	}
 
-		/* Separate filepath into groups */
-		group_name = strtok_r(dset_path, PATH_DELIMITER, &dset_path);
+	PRINT_DEBUG("Chunk cache for %s: chunk_bytes = %zu, nslots = %zu, nbytes = %zu\n", h5path, chunk_bytes, plan.nslots, plan.nbytes)
 
-		if (!readonly) {
-			while (group_name != NULL)
-			{
+	/* A dataset's chunk cache is fixed at open, so reopen it with the planned access properties */
+	if (H5Dclose(dset) < 0) {
+		FUNC_GOTO_ERROR("Failed to close dataset for chunk cache planning")
+	}
 
-				/* If the end of the path is reached, keep track of dset name and don't create it as a group */
-				prev_group_name = group_name;
+	if ((dapl = H5Pcreate(H5P_DATASET_ACCESS)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create dapl")
+	}
 
-				if ((group_name = strtok_r(NULL, PATH_DELIMITER, &dset_path)) == NULL)
-				{
-					dset_name = prev_group_name;
-					break;
-				}
+	if (H5Pset_chunk_cache(dapl, plan.nslots, plan.nbytes, plan.w0) < 0) {
+		FUNC_GOTO_ERROR("Failed to set chunk cache")
+	}
 
-				H5E_BEGIN_TRY
-				{
-					if ((child_group = H5Gopen(parent_group, prev_group_name, H5P_DEFAULT)) == H5I_INVALID_HID)
-					{
-						if ((child_group = H5Gcreate(parent_group, prev_group_name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID)
-						{
-							FUNC_GOTO_ERROR("Failed to create child group")
-						}
-					}
-				}
-				H5E_END_TRY
+	if ((dset = H5Dopen(fin, h5path, dapl)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to reopen dataset with planned chunk cache")
+	}
 
-				/* Only close intermediate groups that were just created, not the file itself */
-				if (parent_group != fout)
-				{
-					if (H5Gclose(parent_group) < 0)
-					{
-						FUNC_GOTO_ERROR("Failed to close parent group")
-					}
-				}
+	H5Pclose(dapl);
 
-				parent_group = child_group;
-			}
+	for (size_t i = 0; i < MAX_CACHE_RESERVATIONS; i++) {
+		if (cache_reservations[i].nbytes == 0) {
+			cache_reservations[i].dset = dset;
+			cache_reservations[i].nbytes = plan.nbytes;
+			chunk_cache_reserved += plan.nbytes;
+			break;
 		}
+	}
 
-		/* Copy the data in the source dataset to a new dataset*/
+	return dset;
+}
 
-		/* Access data from old dset */
-		if ((source_dset[dset_idx] = H5Dopen(fin, h5path[dset_idx], H5P_DEFAULT)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to open source dataset")
+/* Close a dataset opened with open_dataset and release its share of the chunk cache budget */
+herr_t close_dataset(hid_t dset) {
+	for (size_t i = 0; i < MAX_CACHE_RESERVATIONS; i++) {
+		if (cache_reservations[i].nbytes > 0 && cache_reservations[i].dset == dset) {
+			chunk_cache_reserved -= cache_reservations[i].nbytes;
+			cache_reservations[i].nbytes = 0;
+			cache_reservations[i].dset = H5I_INVALID_HID;
+			break;
 		}
+	}
 
-		if ((dtype[dset_idx] = H5Dget_type(source_dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dtype")
-		}
+	return H5Dclose(dset);
+}
 
-		if ((file_dataspace[dset_idx] = H5Dget_space(source_dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dataspace from source")
-		}
+void set_chunk_cache_budget(ConfigValues *config) {
+	chunk_cache_budget = (size_t)config->chunk_cache_budget_mib * 1024 * 1024;
 
-		if ((ndims = H5Sget_simple_extent_ndims(file_dataspace[dset_idx])) < 0) {
-			FUNC_GOTO_ERROR("Failed to get number of dims")
-		}
+	PRINT_DEBUG("Chunk cache budget: %zu bytes\n", chunk_cache_budget)
+}
 
-		/* Create memory dataspace */
+/* Read the file space strategy and page size of an open file from its FCPL */
+PageLayout detect_page_layout(hid_t fid) {
+	PageLayout layout = {H5F_FSPACE_STRATEGY_FSM_AGGR, false, 1, 0};
+	hid_t fcpl = H5I_INVALID_HID;
 
-		dims = calloc(ndims, sizeof(hsize_t));
+	/* Page buffering is a native file format feature, the REST VOL has no pages */
+	if (get_backend() == BACKEND_REST_VOL)
+		return layout;
 
-		// TODO - should be possible for this to be multidimensional?
-		if (H5Sget_simple_extent_dims(file_dataspace[dset_idx], dims, NULL) <= 0) {
-			FUNC_GOTO_ERROR("Failed to get dataspace dim size")
-		}
+	if ((fcpl = H5Fget_create_plist(fid)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get input fcpl")
+	}
 
-		dims[0] = extent;
+	if (H5Pget_file_space_strategy(fcpl, &layout.strategy, &layout.persist, &layout.threshold) < 0) {
+		FUNC_GOTO_ERROR("Failed to get file space strategy")
+	}
 
-		if ((memory_dataspace[dset_idx] = H5Screate_simple(ndims, dims, NULL)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to create simple dataspace")
-		}
+	if (H5Pget_file_space_page_size(fcpl, &layout.page_size) < 0) {
+		FUNC_GOTO_ERROR("Failed to get file space page size")
+	}
 
-		/* Create file dataspace */
-		start_arr = calloc(ndims, sizeof(hsize_t));
-		stride_arr = calloc(ndims, sizeof(size_t));
-		block_size_arr = calloc(ndims, sizeof(size_t));
+	H5Pclose(fcpl);
 
-		for (size_t i = 0; i < ndims; i++) {
-			if (i == 0)
-			{
-				start_arr[i] = index_range[dset_idx]->min;
-			}
-			else
-			{
-				start_arr[i] = 0;
-			}
+	PRINT_DEBUG("Input file space strategy %d, page size %llu\n", (int)layout.strategy, (unsigned long long)layout.page_size)
 
-			stride_arr[i] = 1;
-			block_size_arr[i] = 1;
-		}
+	return layout;
+}
 
-		if (0 > H5Sselect_hyperslab(file_dataspace[dset_idx], H5S_SELECT_SET, start_arr, stride_arr, dims, block_size_arr)) {
-			FUNC_GOTO_ERROR("Failed to select hyperslab in get_photon_count_range")
-		}
+/* Add what one dataset of a planned selection touches: the bytes of its object header and chunk index to meta_bytes,
+ * and the pages a chunk in flight spans to data_pages. A missing dataset adds nothing. */
+void add_dataset_pages(hid_t fid, const char *h5path, hsize_t page_size, size_t *meta_bytes, size_t *data_pages) {
+	hid_t dset = H5I_INVALID_HID;
+	hid_t dcpl = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t dtype = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	hsize_t chunk_dims[H5S_MAX_RANK];
+	size_t chunk_bytes = 0;
+	size_t num_chunks = 1;
+	int ndims = 0;
 
-		/* Get remaining plists */
-		if ((dcpl = H5Dget_create_plist(source_dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dcpl")
-		}
+	H5E_BEGIN_TRY
+	{
+		dset = H5Dopen(fid, h5path, H5P_DEFAULT);
+	}
+	H5E_END_TRY
 
-		if ((dapl = H5Dget_access_plist(source_dset[dset_idx])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dapl")
-		}
+	if (dset == H5I_INVALID_HID)
+		return;
 
-		/* Store entire dataset as one chunk */
-		if (H5Pset_chunk(dcpl, ndims, dims) < 0) {
-			FUNC_GOTO_ERROR("Failed to set chunk size")
-		}
+	dcpl = H5Dget_create_plist(dset);
+	space = H5Dget_space(dset);
+	dtype = H5Dget_type(dset);
+	ndims = H5Sget_simple_extent_dims(space, dims, NULL);
+	chunk_bytes = H5Tget_size(dtype);
 
-		/*
-		if (H5Pset_layout(dcpl, H5D_CONTIGUOUS) < 0) {
-			FUNC_GOTO_ERROR("Failed to make layout contiguous")
-		}
-		*/
-		
-		for (size_t i = 0; i < ndims; i++) {
-			total_num_elems *= dims[i];
+	*meta_bytes += PAGE_BUF_HEADER_BYTES;
+
+	if (H5Pget_layout(dcpl) == H5D_CHUNKED && H5Pget_chunk(dcpl, ndims, chunk_dims) == ndims) {
+		for (int i = 0; i < ndims; i++) {
+			chunk_bytes *= chunk_dims[i];
+			num_chunks *= (dims[i] + chunk_dims[i] - 1) / chunk_dims[i];
 		}
 
-		native_dtype[dset_idx] = H5Tget_native_type(dtype[dset_idx], H5T_DIR_DEFAULT);
+		*meta_bytes += num_chunks * (PAGE_BUF_INDEX_ENTRY_BYTES + 8 * ndims);
 
-		if ((elem_size = H5Tget_size(native_dtype[dset_idx])) == 0) {
-			FUNC_GOTO_ERROR("Failed to get size of dtype")
-		}
+		/* Stored chunks are no larger than unfiltered ones, and may straddle one more page */
+		*data_pages += (chunk_bytes + page_size - 1) / page_size + 1;
+	}
+	else {
+		*data_pages += PAGE_BUF_DATA_PAGES;
+	}
 
-		data[dset_idx] = calloc(total_num_elems, elem_size);
+	H5Tclose(dtype);
+	H5Sclose(space);
+	H5Pclose(dcpl);
+	H5Dclose(dset);
+}
 
-		if ((copy_dset[dset_idx] = H5Dcreate(parent_group, dset_name, dtype[dset_idx], memory_dataspace[dset_idx], H5P_DEFAULT, dcpl, dapl)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to create copy dset")
+/* Size the page buffer of a paged file from the working set of the planned selections, returning 0 for files
+ * without paged aggregation. Every phase revisits the metadata pages of the datasets it reads, their object headers
+ * and chunk indexes, so all of them are kept. Raw pages aren't revisited once a chunk is passed, the chunk caches
+ * absorb re-reads, so only the pages of the chunks read at once are kept: lat and lon of a track in the index phase,
+ * one dataset in the copy, or every dataset of the phase with -use_multi. page_buf_meta_mib caps the metadata share,
+ * which min_meta_perc protects from eviction by raw data. */
+size_t plan_page_buffer(hid_t fid, PageLayout *layout, ConfigValues *config, unsigned *min_meta_perc) {
+	char h5path[FILEPATH_BUFFER_SIZE];
+	size_t meta_bytes = 0;
+	size_t meta_pages = 0;
+	size_t index_pages = 0;
+	size_t copy_pages = 0;
+	size_t data_pages = 0;
+	size_t max_meta_pages = 0;
+	size_t total_pages = 0;
+	size_t page_buf_size = 0;
+
+	*min_meta_perc = 0;
+
+	if (layout->strategy != H5F_FSPACE_STRATEGY_PAGE || layout->page_size == 0)
+		return 0;
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		size_t track_pages = 0;
+
+		snprintf(h5path, sizeof(h5path), "%s%s", ground_tracks[i], geolocation_lat);
+		add_dataset_pages(fid, h5path, layout->page_size, &meta_bytes, &track_pages);
+
+		snprintf(h5path, sizeof(h5path), "%s%s", ground_tracks[i], geolocation_lon);
+		add_dataset_pages(fid, h5path, layout->page_size, &meta_bytes, &track_pages);
+
+		index_pages = (use_multi) ? index_pages + track_pages : (track_pages > index_pages) ? track_pages : index_pages;
+
+		for (size_t r_idx = 0; r_idx < NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS; r_idx++) {
+			const char *dset_name = (r_idx < NUM_REFERENCE_DATASETS) ? reference_datasets[r_idx] : ph_count_datasets[r_idx - NUM_REFERENCE_DATASETS];
+			size_t dset_pages = 0;
+
+			snprintf(h5path, sizeof(h5path), "%s/%s", ground_tracks[i], dset_name);
+			add_dataset_pages(fid, h5path, layout->page_size, &meta_bytes, &dset_pages);
+
+			copy_pages = (use_multi) ? copy_pages + dset_pages : (dset_pages > copy_pages) ? dset_pages : copy_pages;
 		}
-	
-		free(start_arr);
-		free(stride_arr);
-		free(block_size_arr);
-		free(dims);
 	}
-	
-	/* Read and copy selected data */
-	if (use_multi) {
-		PRINT_DEBUG("Attempting multi read of ranges\n");
 
-		if (H5Dread_multi(NUM_COPY_RANGE_DATASETS, source_dset, native_dtype, memory_dataspace, file_dataspace, H5P_DEFAULT, data) < 0) {
-			FUNC_GOTO_ERROR("Failed to multi-read from dset with hyperslab selection")
-		}
+	/* Metadata is aggregated into pages of its own, so the pages it takes are its bytes plus one it may straddle into */
+	meta_pages = (meta_bytes + layout->page_size - 1) / layout->page_size + 1;
+	max_meta_pages = ((size_t)config->page_buf_meta_mib * 1024 * 1024 + layout->page_size - 1) / layout->page_size;
 
-		PRINT_DEBUG("Attempting multi write of ranges\n");
-		/* mem_space_id is H5S_ALL so that memory_dataspace is used for filespace and memory space */
-		if (!readonly && H5Dwrite_multi(NUM_COPY_RANGE_DATASETS, copy_dset, native_dtype, select_all_arr, memory_dataspace, H5P_DEFAULT, (const void**) data) < 0) {
-			FUNC_GOTO_ERROR("Failed to multi-write data when copying range")
-		}
+	if (max_meta_pages > 0 && meta_pages > max_meta_pages)
+		meta_pages = max_meta_pages;
 
-	} else {
-		for (size_t dset_idx = 0; dset_idx < NUM_COPY_RANGE_DATASETS; dset_idx++) {
-			if (H5Dread(source_dset[dset_idx], native_dtype[dset_idx], memory_dataspace[dset_idx], file_dataspace[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0) {
-				FUNC_GOTO_ERROR("Failed to read from dset with hyperslab selection")
-			}
-			
-			/* mem_space_id is H5S_ALL so that memory_dataspace is used for filespace and memory space */
-			if (!readonly && H5Dwrite(copy_dset[dset_idx], native_dtype[dset_idx], select_all_arr[dset_idx], memory_dataspace[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0)
-			{
-				FUNC_GOTO_ERROR("Failed to write data when copying range")
-			}
+	data_pages = (index_pages > copy_pages) ? index_pages : copy_pages;
+
+	if (data_pages < PAGE_BUF_DATA_PAGES)
+		data_pages = PAGE_BUF_DATA_PAGES;
+
+	total_pages = meta_pages + data_pages;
+	page_buf_size = total_pages * layout->page_size;
+
+	/* An explicit size is honored unless it can't hold the working set */
+	if (config->page_buf_size_exp > 0) {
+		size_t requested = (size_t)1 << config->page_buf_size_exp;
+
+		if (requested < page_buf_size) {
+			PRINT_DEBUG("Page buffer of %zu bytes would thrash, using %zu\n", requested, page_buf_size)
+		}
+		else {
+			page_buf_size = requested - requested % layout->page_size;
+			total_pages = page_buf_size / layout->page_size;
 		}
 	}
 
-	for (size_t dset_idx = 0; dset_idx < NUM_COPY_RANGE_DATASETS; dset_idx++) {
-		free(data[dset_idx]);
+	*min_meta_perc = (unsigned)(meta_pages * 100 / total_pages);
 
-		if (!readonly && H5Dclose(copy_dset[dset_idx]) < 0)
-			{
-				FUNC_GOTO_ERROR("Failed to close copy dset")
-			}
-	}
+	PRINT_DEBUG("Page buffer of %zu bytes (%zu pages, %zu for metadata, %u%% reserved for metadata)\n", page_buf_size, total_pages, meta_pages, *min_meta_perc)
 
-	if (H5Pclose(dcpl) < 0)
+	return page_buf_size;
+}
+
+/* Open a granule read-only, with a page buffer planned from its layout if it is paged. HDF5 sets the page buffer at
+ * open, so only a paged file is opened a second time, with the buffer its first open planned. Any other file keeps
+ * its one open. page_buf_size is set to 0 when there's no page buffer. Returns H5I_INVALID_HID if it can't be opened. */
+hid_t open_input(const char *path, hid_t fapl_id, ConfigValues *config, PageLayout *layout, size_t *page_buf_size, unsigned *min_meta_perc) {
+	hid_t fid = H5I_INVALID_HID;
+	hid_t paged_fapl = H5I_INVALID_HID;
+
+	*page_buf_size = 0;
+	*min_meta_perc = 0;
+
+	H5E_BEGIN_TRY
 	{
-		FUNC_GOTO_ERROR("Failed to close dcpl")
+		fid = H5Fopen(path, H5F_ACC_RDONLY, fapl_id);
 	}
+	H5E_END_TRY
 
-	if (H5Pclose(dapl) < 0)
+	if (fid == H5I_INVALID_HID)
+		return H5I_INVALID_HID;
+
+	*layout = detect_page_layout(fid);
+
+	if ((*page_buf_size = plan_page_buffer(fid, layout, config, min_meta_perc)) == 0)
+		return fid;
+
+	H5Fclose(fid);
+
+	if ((paged_fapl = H5Pcopy(fapl_id)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to copy FAPL")
+	}
+
+	if (H5Pset_page_buffer_size(paged_fapl, *page_buf_size, *min_meta_perc, 0) < 0) {
+		FUNC_GOTO_ERROR("Failed to set page buffer size")
+	}
+
+	H5E_BEGIN_TRY
 	{
-		FUNC_GOTO_ERROR("Failed to close dapl")
+		fid = H5Fopen(path, H5F_ACC_RDONLY, paged_fapl);
 	}
+	H5E_END_TRY
+
+	H5Pclose(paged_fapl);
+
+	return fid;
 }
 
-/* Sum up elements from 0 to index in given dataset*/
-Range_Indices **get_photon_count_range(hid_t fin, char **h5path, Range_Indices **range) {
-	Range_Indices **ret_ranges; //malloc(sizeof(Range_Indices));
-	hid_t dset[NUM_GROUND_TRACKS];
-	hid_t fspace[NUM_GROUND_TRACKS];
-	hid_t dtype[NUM_GROUND_TRACKS];
-	hid_t native_dtype[NUM_GROUND_TRACKS];
-	hid_t select_all_arr[NUM_GROUND_TRACKS];
-	int *data[NUM_GROUND_TRACKS];
+/* Report page buffer hit rates as "page_buffer, <meta hits>, <meta misses>, <raw hits>, <raw misses>, <evictions>" */
+void print_page_buffer_stats(hid_t fid) {
+	unsigned accesses[2];
+	unsigned hits[2];
+	unsigned misses[2];
+	unsigned evictions[2];
+	unsigned bypasses[2];
 
-	size_t sum_base = 0;
-	size_t sum_inc = 0;
-	
-	if ((ret_ranges = calloc(NUM_GROUND_TRACKS, sizeof(Range_Indices*))) == NULL) {
-		FUNC_GOTO_ERROR("Failed to allocate memory for photon count ranges");
+	if (H5Fget_page_buffering_stats(fid, accesses, hits, misses, evictions, bypasses) < 0) {
+		FUNC_GOTO_ERROR("Failed to get page buffering stats")
 	}
-	
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		select_all_arr[i] = H5S_ALL;
+
+	printf("page_buffer, %u, %u, %u, %u, %u\n", hits[0], misses[0], hits[1], misses[1], evictions[0] + evictions[1]);
+}
+
+/* Fill in the decode context for a chunked dataset.
+ * Return false if the layout or a filter can't be decoded outside the library. */
+bool init_decode_context(hid_t dset, hid_t mem_type, DecodeContext *ctx) {
+	bool ret_value = true;
+	hid_t dcpl = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t file_type = H5I_INVALID_HID;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	if (get_backend() == BACKEND_REST_VOL)
+		return false;
+
+	if ((dcpl = H5Dget_create_plist(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dcpl for decoding")
 	}
 
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		PRINT_DEBUG("Counting photons for dataset %zu : %s from %zu to %zu\n", i, h5path[i], range[i]->min, range[i]->max)
+	space = H5Dget_space(dset);
+	file_type = H5Dget_type(dset);
 
-		if ((ret_ranges[i] = calloc(1, sizeof(Range_Indices))) == NULL) {
-			FUNC_GOTO_ERROR("Failed to allocate memory for return ranges")
-		}
-	
-		if (H5I_INVALID_HID == (dset[i] = H5Dopen(fin, h5path[i], H5P_DEFAULT))) {
-			FUNC_GOTO_ERROR("Failed to open dset in get_photon_count_range")
-		}
+	ctx->ndims = H5Sget_simple_extent_ndims(space);
+	H5Sget_simple_extent_dims(space, ctx->dims, NULL);
+	ctx->elem_size = H5Tget_size(file_type);
 
-		/* Create hyperslab selection to read up to range max */
-		if ((fspace[i] = H5Dget_space(dset[i])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get filespace")
+	/* Decoded chunks are placed in memory as-is, so the memory type must match the file type */
+	if (H5Pget_layout(dcpl) != H5D_CHUNKED || ctx->ndims < 1 || H5Tequal(file_type, mem_type) <= 0) {
+		ret_value = false;
+	}
+	else {
+		H5Pget_chunk(dcpl, ctx->ndims, ctx->chunk_dims);
+
+		ctx->chunk_bytes = ctx->elem_size;
+
+		for (int i = 0; i < ctx->ndims; i++) {
+			ctx->chunk_bytes *= ctx->chunk_dims[i];
 		}
 
-		if (0 > H5Sselect_hyperslab(fspace[i], H5S_SELECT_SET, (hsize_t[]) {0},
-									(hsize_t[]) {1},
-									(hsize_t[]) {range[i]->max},
-									(hsize_t[]) {1})) {
-			FUNC_GOTO_ERROR("Failed to select hyperslab in get_photon_count_range")
+		ctx->nfilters = H5Pget_nfilters(dcpl);
+
+		for (int i = 0; i < ctx->nfilters && ret_value; i++) {
+			unsigned flags = 0;
+			unsigned cd_values[8];
+			size_t cd_nelmts = 8;
+
+			ctx->filters[i] = H5Pget_filter2(dcpl, (unsigned)i, &flags, &cd_nelmts, cd_values, 0, NULL, NULL);
+
+			switch (ctx->filters[i]) {
+			case H5Z_FILTER_SHUFFLE:
+				ctx->shuffle_elem_size = (cd_nelmts > 0) ? cd_values[0] : (unsigned)ctx->elem_size;
+				break;
+			case H5Z_FILTER_DEFLATE:
+			case H5Z_FILTER_FLETCHER32:
+				break;
+			default:
+				PRINT_DEBUG("Filter %d can't be decoded outside the library\n", (int)ctx->filters[i])
+				ret_value = false;
+			}
 		}
+	}
 
-		if ((dtype[i] = H5Dget_type(dset[i])) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get dtype")
+	H5Tclose(file_type);
+	H5Sclose(space);
+	H5Pclose(dcpl);
+
+	return ret_value;
+}
+
+/* Undo the byte shuffle filter */
+void unshuffle(const unsigned char *src, unsigned char *dst, size_t nbytes, size_t elem_size) {
+	size_t nelems = nbytes / elem_size;
+
+	for (size_t b = 0; b < elem_size; b++) {
+		for (size_t e = 0; e < nelems; e++) {
+			dst[e * elem_size + b] = src[b * nelems + e];
 		}
+	}
 
-		if ((native_dtype[i] = H5Tget_native_type(dtype[i], H5T_DIR_DEFAULT)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to get native dtype")
+	/* Trailing bytes that don't make up a whole element are stored unshuffled */
+	memcpy(dst + nelems * elem_size, src + nelems * elem_size, nbytes - nelems * elem_size);
+}
+
+#ifdef USE_LIBDEFLATE
+/* Each thread keeps one decompressor, freed when the thread exits */
+pthread_key_t decompressor_key;
+pthread_once_t decompressor_once = PTHREAD_ONCE_INIT;
+
+void free_decompressor(void *decompressor) {
+	libdeflate_free_decompressor(decompressor);
+}
+
+void create_decompressor_key(void) {
+	if (pthread_key_create(&decompressor_key, free_decompressor) != 0) {
+		FUNC_GOTO_ERROR("Failed to create decompressor key")
+	}
+}
+
+struct libdeflate_decompressor *get_decompressor(void) {
+	struct libdeflate_decompressor *decompressor = NULL;
+
+	pthread_once(&decompressor_once, create_decompressor_key);
+
+	if ((decompressor = pthread_getspecific(decompressor_key)) == NULL) {
+		if ((decompressor = libdeflate_alloc_decompressor()) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate decompressor")
 		}
 
-		data[i] = calloc(range[i]->max, H5Tget_size(native_dtype[i]));
+		pthread_setspecific(decompressor_key, decompressor);
+	}
+
+	return decompressor;
+}
+#endif
 
+/* Inflate a zlib stream of nbytes into out, which holds out_size bytes. Return the inflated size. */
+size_t inflate_chunk(const void *in, size_t nbytes, void *out, size_t out_size) {
+#ifdef USE_LIBDEFLATE
+	size_t actual = 0;
+
+	if (libdeflate_zlib_decompress(get_decompressor(), in, nbytes, out, out_size, &actual) != LIBDEFLATE_SUCCESS) {
+		FUNC_GOTO_ERROR("Failed to inflate chunk")
 	}
 
-	if (use_multi) {
-		PRINT_DEBUG("Attempting multi-read for photon counting\n");
-		if (0 > H5Dread_multi(NUM_GROUND_TRACKS,dset, dtype, select_all_arr, fspace, H5P_DEFAULT, (void**) data)) {
-			FUNC_GOTO_ERROR("Failed to read from data in get_photon_count_range")
+	return actual;
+#else
+	uLongf actual = out_size;
+
+	if (uncompress(out, &actual, in, nbytes) != Z_OK) {
+		FUNC_GOTO_ERROR("Failed to inflate chunk")
+	}
+
+	return actual;
+#endif
+}
+
+/* Run the filter pipeline of a raw chunk in reverse, returning a malloc'd buffer of ctx->chunk_bytes */
+void *decode_chunk(RawChunk *chunk) {
+	DecodeContext *ctx = chunk->ctx;
+	unsigned char *buf = chunk->data;
+	unsigned char *tmp = NULL;
+	size_t nbytes = chunk->nbytes;
+
+	/* Scratch buffers must hold both the decoded chunk and the raw input */
+	size_t buf_size = (ctx->chunk_bytes > nbytes) ? ctx->chunk_bytes : nbytes;
+
+	if ((tmp = malloc(buf_size)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate decode buffer")
+	}
+
+	for (int i = ctx->nfilters - 1; i >= 0; i--) {
+		unsigned char *swap = NULL;
+
+		/* A set bit in the filter mask means the filter was skipped for this chunk */
+		if (chunk->filter_mask & (1u << i))
+			continue;
+
+		switch (ctx->filters[i]) {
+		case H5Z_FILTER_FLETCHER32:
+			nbytes -= 4;
+			continue;
+		case H5Z_FILTER_DEFLATE:
+			nbytes = inflate_chunk(buf, nbytes, tmp, ctx->chunk_bytes);
+			break;
+		case H5Z_FILTER_SHUFFLE:
+			unshuffle(buf, tmp, nbytes, ctx->shuffle_elem_size);
+			break;
 		}
-	} else {
-		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-			if (0 > H5Dread(dset[i], dtype[i], H5S_ALL, fspace[i], H5P_DEFAULT, data[i]))
-			{
-				FUNC_GOTO_ERROR("Failed to read from data in get_photon_count_range")
+
+		swap = buf;
+		buf = tmp;
+
+		if (swap == chunk->data) {
+			if ((tmp = malloc(buf_size)) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate decode buffer")
 			}
 		}
+		else {
+			tmp = swap;
+		}
 	}
 
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		sum_base = 0;
-		sum_inc = 0;
+	free(tmp);
 
-		for (size_t j = 0; j < range[i]->min; j++) {
-			if (data[i][j] < 0) {
-				FUNC_GOTO_ERROR("Photon count cannot be negative!");
-			}
-			sum_base = sum_base + (data[i][j]);
+	/* Unfiltered chunks decode to their raw bytes */
+	if (buf == chunk->data) {
+		if ((buf = malloc(buf_size)) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate decode buffer")
 		}
 
-		for (size_t j = range[i]->min; j < range[i]->max; j++) {
-			if (data[i][j] < 0) {
-				FUNC_GOTO_ERROR("Photon count cannot be negative!");
-			}
-			sum_inc = sum_inc + (data[i][j]);
+		memcpy(buf, chunk->data, nbytes);
+	}
+
+	return buf;
+}
+
+/* Copy the part of a decoded chunk that falls inside the selected rows into ctx->dest */
+void place_chunk(DecodeContext *ctx, const hsize_t *chunk_offset, const unsigned char *decoded) {
+	hsize_t lo[H5S_MAX_RANK];
+	hsize_t hi[H5S_MAX_RANK];
+	hsize_t idx[H5S_MAX_RANK];
+	hsize_t sel_dims[H5S_MAX_RANK];
+	int last = ctx->ndims - 1;
+	size_t run_bytes = 0;
+
+	/* Overlap of the chunk with the selection, in dataset coordinates */
+	for (int i = 0; i < ctx->ndims; i++) {
+		hsize_t sel_lo = (i == 0) ? ctx->range.min : 0;
+		hsize_t sel_hi = (i == 0) ? ctx->range.max : ctx->dims[i];
+		hsize_t chunk_hi = chunk_offset[i] + ctx->chunk_dims[i];
+
+		lo[i] = (chunk_offset[i] > sel_lo) ? chunk_offset[i] : sel_lo;
+		hi[i] = (chunk_hi < sel_hi) ? chunk_hi : sel_hi;
+		sel_dims[i] = sel_hi - sel_lo;
+
+		if (lo[i] >= hi[i])
+			return;
+
+		idx[i] = lo[i];
+	}
+
+	run_bytes = (hi[last] - lo[last]) * ctx->elem_size;
+
+	/* Copy one contiguous run along the fastest dimension at a time */
+	while (true) {
+		size_t src_offset = 0;
+		size_t dst_offset = 0;
+		int d = 0;
+
+		for (int i = 0; i < ctx->ndims; i++) {
+			hsize_t dst_coord = (i == 0) ? idx[i] - ctx->range.min : idx[i];
+
+			src_offset = src_offset * ctx->chunk_dims[i] + (idx[i] - chunk_offset[i]);
+			dst_offset = dst_offset * sel_dims[i] + dst_coord;
 		}
 
-		ret_ranges[i]->min = sum_base;
-		ret_ranges[i]->max = sum_base + sum_inc;
+		memcpy((unsigned char *)ctx->dest + dst_offset * ctx->elem_size, decoded + src_offset * ctx->elem_size, run_bytes);
+
+		for (d = last - 1; d >= 0; d--) {
+			if (++idx[d] < hi[d])
+				break;
 
-		PRINT_DEBUG("Got photon count range %s for (%zu, %zu) of (%zu, %zu)\n", h5path[i], range[i]->min, range[i]->max, ret_ranges[i]->min, ret_ranges[i]->max)
+			idx[d] = lo[d];
+		}
 
+		if (d < 0)
+			break;
 	}
-		
-	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		H5Dclose(dset[i]);
-		free(data[i]);
+}
+
+void decode_task(void *arg) {
+	RawChunk *chunk = (RawChunk *)arg;
+	void *decoded = decode_chunk(chunk);
+
+	if (chunk->ctx->dest) {
+		place_chunk(chunk->ctx, chunk->offset, decoded);
 	}
 
-	return ret_ranges;
+	free(decoded);
+	free(chunk->data);
+
+	if (chunk->reserved)
+		budget_release(chunk->reserved, true);
+
+	free(chunk);
 }
 
-// TODO Move process_layer and get_config_values to another file
+/* Budget for a raw chunk of nbytes on its way through decode_chunk: the raw bytes and two scratch buffers */
+size_t reserve_decode_memory(DecodeContext *ctx, size_t nbytes) {
+	size_t buf_size = (ctx->chunk_bytes > nbytes) ? ctx->chunk_bytes : nbytes;
+	size_t reserved = nbytes + 2 * buf_size;
 
-/* Process one value from the yaml file. If the value is determined to be a keyname,
- *	this will recurse to assign the next parsed value as its keyvalue.
- *
- *	If type is CONFIG_UNKNOWN_T, then it expects to be the outermost layer, and for the next value to be a keyname.
- *	Otherwise, it expects to be a recursion, and for the next value to be a keyvalue of ConfigType type.
- */
-void process_layer(yaml_parser_t *parser, void *storage_location, ConfigType type) {
-	ConfigValues *config2;
-	ConfigType new_type;
-	yaml_event_t event;
-	yaml_char_t *value;
+	budget_acquire(reserved, true);
 
-	if (type == CONFIG_UNKNOWN_T)
-		config2 = (ConfigValues *)storage_location;
+	return reserved;
+}
 
-	yaml_parser_parse(parser, &event);
-	value = event.data.scalar.value;
+/* Fetch the raw chunk at the given logical offset. Return NULL if the chunk isn't allocated. */
+RawChunk *fetch_raw_chunk(hid_t dset, DecodeContext *ctx, const hsize_t *offset) {
+	RawChunk *chunk = NULL;
+	hsize_t nbytes = 0;
+	herr_t status = FAIL;
 
-	while (event.type != YAML_STREAM_END_EVENT)
+	/* Unallocated chunks are reported as errors by some library versions */
+	H5E_BEGIN_TRY
 	{
+		status = H5Dget_chunk_storage_size(dset, offset, &nbytes);
+	}
+	H5E_END_TRY
 
-		switch (event.type) {
-		case YAML_SCALAR_EVENT:
-			switch (type)
-			{
-			case CONFIG_STRING_T:
-			{
-				char *storage_loc = (char *)storage_location;
-				strcpy(storage_loc, value);
+	if (status < 0 || nbytes == 0)
+		return NULL;
 
-				PRINT_DEBUG("Key assigned value %s from original %s\n", storage_loc, value)
-				break;
-			}
-			case CONFIG_DOUBLE_T:
-			{
-				double dval = strtod((char *)value, NULL);
+	if ((chunk = calloc(1, sizeof(*chunk))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate raw chunk")
+	}
 
-				double *storage_loc = (double *)storage_location;
-				*storage_loc = dval;
+	/* Chunks fetched only to be decoded by the benchmark stay outside the budget */
+	if (ctx->dest)
+		chunk->reserved = reserve_decode_memory(ctx, nbytes);
 
-				PRINT_DEBUG("Key assigned value %lf\n", *((double *)storage_location))
-				break;
-			}
-			case CONFIG_INT_T:
-			{
-				int intval = strtod((char *)value, NULL);
+	if ((chunk->data = malloc(nbytes)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate raw chunk")
+	}
 
-				int *storage_loc = (int *)storage_location;
-				*storage_loc = intval;
-				PRINT_DEBUG("Key assigned value %d\n", *((int *)storage_location))
+	chunk->ctx = ctx;
+	chunk->nbytes = nbytes;
+	memcpy(chunk->offset, offset, ctx->ndims * sizeof(hsize_t));
 
-				break;
-			}
-			default:
-			{
-				void *next_storage_location = NULL;
+	if (H5Dread_chunk(dset, H5P_DEFAULT, offset, &chunk->filter_mask, chunk->data) < 0) {
+		FUNC_GOTO_ERROR("Failed to read raw chunk")
+	}
 
-				if (!strcmp("loglevel", value))
-				{
-					next_storage_location = config2->loglevel;
-					new_type = CONFIG_STRING_T;
-				}
-				else if (!strcmp("logfile", value))
-				{
-					next_storage_location = config2->logfile;
-					new_type = CONFIG_STRING_T;
-				}
-				else if (!strcmp("input_foldername", value))
-				{
-					next_storage_location = config2->input_foldername;
-					new_type = CONFIG_STRING_T;
-				}
-				else if (!strcmp("input_filename", value))
-				{
-					next_storage_location = config2->input_filename;
-					new_type = CONFIG_STRING_T;
-				}
-				else if (!strcmp("output_foldername", value))
-				{
-					next_storage_location = config2->output_foldername;
-					new_type = CONFIG_STRING_T;
-				}
-				else if (!strcmp("output_filename", value))
-				{
-					next_storage_location = config2->output_filename;
-					new_type = CONFIG_STRING_T;
-				}
-				else if (!strcmp("min_lat", value))
-				{
-					next_storage_location = (void *)&(config2->min_lat);
-					new_type = CONFIG_DOUBLE_T;
-				}
-				else if (!strcmp("max_lat", value))
-				{
-					next_storage_location = (void *)&(config2->max_lat);
-					new_type = CONFIG_DOUBLE_T;
-				}
-				else if (!strcmp("min_lon", value))
-				{
-					next_storage_location = (void *)&(config2->min_lon);
-					new_type = CONFIG_DOUBLE_T;
-				}
-				else if (!strcmp("max_lon", value))
-				{
-					next_storage_location = (void *)&(config2->max_lon);
-					new_type = CONFIG_DOUBLE_T;
-				}
-				else if (!strcmp("page_buf_size_exp", value))
-				{
-					next_storage_location = (void *)&(config2->page_buf_size_exp);
-					new_type = CONFIG_INT_T;
-				}
-				else
-				{
-					PRINT_DEBUG("Key named %s not found, skipping\n", value)
-					break;
-				}
+	return chunk;
+}
 
-				PRINT_DEBUG("%s%s\n", "Recursing in yaml parsing to assign key ", value)
-				process_layer(parser, next_storage_location, new_type);
-				break;
-			}
+/* Advance offset to the next chunk of the rows [first_row, last_row) in row-major chunk order.
+ * Return false once every chunk has been visited. */
+bool next_chunk_offset(DecodeContext *ctx, hsize_t first_row, hsize_t last_row, hsize_t *offset) {
+	for (int d = ctx->ndims - 1; d >= 0; d--) {
+		hsize_t limit = (d == 0) ? last_row : ctx->dims[d];
+
+		offset[d] += ctx->chunk_dims[d];
+
+		if (offset[d] < limit)
+			return true;
+
+		offset[d] = (d == 0) ? first_row - first_row % ctx->chunk_dims[0] : 0;
+	}
+
+	return false;
+}
+
+/* Return a malloc'd chunk of the dataset's fill value, which is what unallocated chunks read as */
+unsigned char *create_fill_chunk(hid_t dset, hid_t mem_type, DecodeContext *ctx) {
+	hid_t dcpl = H5I_INVALID_HID;
+	unsigned char *fill_chunk = NULL;
+
+	if ((fill_chunk = malloc(ctx->chunk_bytes)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate fill chunk")
+	}
+
+	dcpl = H5Dget_create_plist(dset);
+
+	if (H5Pget_fill_value(dcpl, mem_type, fill_chunk) < 0) {
+		memset(fill_chunk, 0, ctx->elem_size);
+	}
+
+	H5Pclose(dcpl);
+
+	for (size_t i = 1; i < ctx->chunk_bytes / ctx->elem_size; i++) {
+		memcpy(fill_chunk + i * ctx->elem_size, fill_chunk, ctx->elem_size);
+	}
+
+	return fill_chunk;
+}
+
+/* Read rows [range.min, range.max) of a chunked dataset into buf by fetching raw chunks on the calling
+ * thread and decoding them on the thread pool. Return false if the dataset must be read with H5Dread. */
+bool read_range_parallel(hid_t dset, hid_t mem_type, Range_Indices range, void *buf) {
+	DecodeContext ctx;
+	hsize_t offset[H5S_MAX_RANK];
+	unsigned char *fill_chunk = NULL;
+	size_t num_chunks = 0;
+
+	if (!init_decode_context(dset, mem_type, &ctx))
+		return false;
+
+	/* The library reads through its own chunk cache when a chunk on its way through decoding won't fit */
+	if (3 * ctx.chunk_bytes > budget_available()) {
+		PRINT_DEBUG("Chunks of %zu bytes don't fit in the memory budget, not decoding in parallel\n", ctx.chunk_bytes)
+		return false;
+	}
+
+	if (range.max <= range.min)
+		return true;
+
+	ctx.range = range;
+	ctx.dest = buf;
+
+	memset(offset, 0, sizeof(offset));
+	offset[0] = range.min - range.min % ctx.chunk_dims[0];
+
+	/* HDF5 calls stay on this thread; workers only decode and place */
+	do {
+		RawChunk *chunk = fetch_raw_chunk(dset, &ctx, offset);
+
+		if (chunk) {
+			thread_pool_submit(thread_pool, decode_task, chunk);
+			num_chunks++;
+			continue;
+		}
+
+		/* Unallocated chunks read as the fill value. Chunks never overlap, so this can't race the workers. */
+		if (!fill_chunk)
+			fill_chunk = create_fill_chunk(dset, mem_type, &ctx);
+
+		place_chunk(&ctx, offset, fill_chunk);
+	} while (next_chunk_offset(&ctx, range.min, range.max, offset));
+
+	thread_pool_wait(thread_pool);
+	free(fill_chunk);
+
+	PRINT_DEBUG("Decoded %zu chunks in parallel\n", num_chunks)
+
+	return true;
+}
+
+/* Decode each run into buf one after another, false if the dataset can't be decoded here */
+bool read_runs_parallel(hid_t dset, hid_t mem_type, Range_Runs *runs, void *buf) {
+	unsigned char *dest = buf;
+	size_t row_bytes = 0;
+	hid_t space = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	int ndims = 0;
+
+	space = H5Dget_space(dset);
+	ndims = H5Sget_simple_extent_dims(space, dims, NULL);
+	H5Sclose(space);
+
+	row_bytes = H5Tget_size(mem_type);
+
+	for (int i = 1; i < ndims; i++)
+		row_bytes *= dims[i];
+
+	for (size_t r = 0; r < runs->num_runs; r++) {
+		/* Nothing is read before read_range_parallel decides it can't decode the dataset */
+		if (!read_range_parallel(dset, mem_type, runs->runs[r], dest))
+			return false;
+
+		dest += (runs->runs[r].max - runs->runs[r].min) * row_bytes;
+	}
+
+	return true;
+}
+
+/* Apply the byte shuffle filter, the inverse of unshuffle */
+void shuffle_bytes(const unsigned char *src, unsigned char *dst, size_t nbytes, size_t elem_size) {
+	size_t nelems = nbytes / elem_size;
+
+	for (size_t b = 0; b < elem_size; b++) {
+		for (size_t e = 0; e < nelems; e++) {
+			dst[b * nelems + e] = src[e * elem_size + b];
+		}
+	}
+
+	memcpy(dst + nelems * elem_size, src + nelems * elem_size, nbytes - nelems * elem_size);
+}
+
+/* Deflate nbytes of in into a zlib stream in out, which holds out_size bytes. Return the deflated size. */
+size_t deflate_piece(const void *in, size_t nbytes, void *out, size_t out_size, int level) {
+#ifdef USE_LIBDEFLATE
+	struct libdeflate_compressor *compressor = NULL;
+	size_t actual = 0;
+
+	if ((compressor = libdeflate_alloc_compressor(level)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate compressor")
+	}
+
+	if ((actual = libdeflate_zlib_compress(compressor, in, nbytes, out, out_size)) == 0) {
+		FUNC_GOTO_ERROR("Failed to deflate piece")
+	}
+
+	libdeflate_free_compressor(compressor);
+
+	return actual;
+#else
+	uLongf actual = out_size;
+
+	if (compress2(out, &actual, in, nbytes, level) != Z_OK) {
+		FUNC_GOTO_ERROR("Failed to deflate piece")
+	}
+
+	return actual;
+#endif
+}
+
+/* Decide whether a selection of data_bytes from dset is copied in pieces, and fill in split if so.
+ * The pieces are written with the source's filters, so those have to be ones this file can run. */
+bool plan_split_copy(hid_t dset, hid_t mem_type, size_t data_bytes, SplitCopy *split) {
+	hid_t dcpl = H5I_INVALID_HID;
+	hsize_t chunks_per_piece = 0;
+	size_t slot_bytes = 0;
+
+	memset(split, 0, sizeof(*split));
+
+	if (!split_copy || !init_decode_context(dset, mem_type, &split->ctx))
+		return false;
+
+	for (int i = 0; i < split->ctx.nfilters; i++) {
+		if (split->ctx.filters[i] == H5Z_FILTER_FLETCHER32) {
+			PRINT_DEBUG("Fletcher32 checksums are left to the library, not splitting the copy\n")
+			return false;
+		}
+
+		if (split->ctx.filters[i] == H5Z_FILTER_DEFLATE) {
+			unsigned flags = 0;
+			unsigned cd_values[8];
+			size_t cd_nelmts = 8;
+
+			dcpl = H5Dget_create_plist(dset);
+
+			if (H5Pget_filter_by_id2(dcpl, H5Z_FILTER_DEFLATE, &flags, &cd_nelmts, cd_values, 0, NULL, NULL) < 0) {
+				FUNC_GOTO_ERROR("Failed to get deflate level")
 			}
 
-			break;
+			split->deflate_level = (cd_nelmts > 0) ? (int)cd_values[0] : 6;
+			H5Pclose(dcpl);
 		}
+	}
 
-		/* yaml_parser_parse allocates memory for event that must be freed */
-		yaml_event_delete(&event);
+	split->row_bytes = split->ctx.elem_size;
 
-		/* If this is a recursion, return to next layer up */
-		if (type != CONFIG_UNKNOWN_T) {
+	for (int i = 1; i < split->ctx.ndims; i++)
+		split->row_bytes *= split->ctx.dims[i];
+
+	chunks_per_piece = SPLIT_COPY_PIECE_BYTES / (split->row_bytes * split->ctx.chunk_dims[0]);
+	split->piece_rows = ((chunks_per_piece > 0) ? chunks_per_piece : 1) * split->ctx.chunk_dims[0];
+	split->piece_bytes = split->piece_rows * split->row_bytes;
+	split->out_bytes = DEFLATE_BOUND(split->piece_bytes);
+
+	if (data_bytes < SPLIT_COPY_MIN_PIECES * split->piece_bytes)
+		return false;
+
+	/* One piece with its encoding buffers and the raw chunks being decoded into it */
+	slot_bytes = split->piece_bytes + 2 * split->out_bytes;
+
+	if (slot_bytes + 3 * split->ctx.chunk_bytes > budget_available() / 2) {
+		PRINT_DEBUG("Pieces of %zu bytes don't fit in the memory budget, not splitting the copy\n", split->piece_bytes)
+		return false;
+	}
+
+	return true;
+}
+
+/* Place a decoded source chunk into every segment of the wave it overlaps */
+void place_split_rows(SplitCopy *split, const hsize_t *chunk_offset, const unsigned char *decoded) {
+	for (size_t i = 0; i < split->num_segments; i++) {
+		SplitSegment *segment = &split->segments[i];
+		DecodeContext ctx;
+
+		if (segment->rows.max <= chunk_offset[0] || segment->rows.min >= chunk_offset[0] + split->ctx.chunk_dims[0])
+			continue;
+
+		ctx = split->ctx;
+		ctx.range = segment->rows;
+		ctx.dest = segment->dest;
+		place_chunk(&ctx, chunk_offset, decoded);
+	}
+}
+
+void split_decode_task(void *arg) {
+	SplitChunk *task = (SplitChunk *)arg;
+	RawChunk *chunk = task->chunk;
+	void *decoded = decode_chunk(chunk);
+
+	place_split_rows(task->split, chunk->offset, decoded);
+
+	free(decoded);
+	free(chunk->data);
+	budget_release(chunk->reserved, true);
+	free(chunk);
+	free(task);
+}
+
+/* Run the source's filters over a piece, in pipeline order */
+void encode_piece_task(void *arg) {
+	CopyPiece *piece = (CopyPiece *)arg;
+	SplitCopy *split = piece->split;
+	unsigned char *buf = piece->data;
+	unsigned char *bufs[2] = {piece->out, piece->scratch};
+	size_t nbytes = split->piece_bytes;
+	int next = 0;
+
+	for (int i = 0; i < split->ctx.nfilters; i++) {
+		switch (split->ctx.filters[i]) {
+		case H5Z_FILTER_SHUFFLE:
+			shuffle_bytes(buf, bufs[next], nbytes, split->ctx.shuffle_elem_size);
 			break;
+		case H5Z_FILTER_DEFLATE:
+			nbytes = deflate_piece(buf, nbytes, bufs[next], split->out_bytes, split->deflate_level);
+			break;
+		default:
+			continue;
 		}
 
-		yaml_parser_parse(parser, &event);
-		value = event.data.scalar.value;
+		buf = bufs[next];
+		next = 1 - next;
 	}
+
+	piece->encoded = buf;
+	piece->encoded_bytes = nbytes;
 }
 
-/* Allocate internal memory for config and begin parsing the yaml file. */
-ConfigValues *get_config_values(char *yaml_config_filename, ConfigValues *config) {
-	config->loglevel = malloc(FILEPATH_BUFFER_SIZE);
-	config->logfile = malloc(FILEPATH_BUFFER_SIZE);
-	config->input_foldername = malloc(FILEPATH_BUFFER_SIZE);
-	config->input_filename = malloc(FILEPATH_BUFFER_SIZE);
-	config->output_foldername = malloc(FILEPATH_BUFFER_SIZE);
-	config->output_filename = malloc(FILEPATH_BUFFER_SIZE);
+/* Cut the next rows of the runs, from row *run_row of run *run_idx on, into segments that fill a piece from dest */
+void add_piece_segments(SplitCopy *split, Range_Runs *runs, size_t *run_idx, size_t *run_row, unsigned char *dest, size_t rows) {
+	while (rows > 0) {
+		Range_Indices run = runs->runs[*run_idx];
+		size_t count = (run.max - *run_row < rows) ? run.max - *run_row : rows;
+		SplitSegment *segment = NULL;
 
-	yaml_parser_t parser;
-	yaml_parser_initialize(&parser);
+		if (split->num_segments == split->max_segments) {
+			split->max_segments = (split->max_segments) ? split->max_segments * 2 : 16;
 
-	FILE *config_input = fopen(yaml_config_filename, "r");
+			if ((split->segments = realloc(split->segments, split->max_segments * sizeof(SplitSegment))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate split segments")
+			}
+		}
 
-	if (config_input == NULL)
-	{
-		FUNC_GOTO_ERROR("failed to open config.yml");
+		segment = &split->segments[split->num_segments++];
+		segment->rows.min = *run_row;
+		segment->rows.max = *run_row + count;
+		segment->dest = dest;
+
+		dest += count * split->row_bytes;
+		rows -= count;
+		*run_row += count;
+
+		if (*run_row == run.max && *run_idx + 1 < runs->num_runs) {
+			(*run_idx)++;
+			*run_row = runs->runs[*run_idx].min;
+		}
 	}
+}
 
-	yaml_parser_set_input_file(&parser, config_input);
+/* Copy the runs of src to dst, whose chunks are split->piece_rows rows, one wave of pieces at a time.
+ * The main thread fetches the raw chunks under each wave and the pool decodes them straight into the pieces.
+ * Then the pool runs the filters over the pieces, and the main thread writes them in order with H5Dwrite_chunk.
+ * A source chunk under two pieces of a wave is fetched and decoded once; one under two waves, once per wave. */
+void copy_runs_split(hid_t src, hid_t dst, hid_t mem_type, SplitCopy *split, Range_Runs *runs, size_t extent) {
+	DecodeContext *ctx = &split->ctx;
+	CopyPiece *pieces = NULL;
+	unsigned char *fill_chunk = NULL;
+	size_t num_pieces = (extent + split->piece_rows - 1) / split->piece_rows;
+	size_t num_slots = 2 * thread_pool->num_threads;
+	size_t slot_bytes = split->piece_bytes;
+	bool encode = !readonly && ctx->nfilters > 0;
+	size_t run_idx = 0;
+	size_t run_row = runs->runs[0].min;
+	hsize_t offset[H5S_MAX_RANK];
+
+	/* A piece being encoded also holds the filter output and a scratch buffer */
+	if (encode)
+		slot_bytes += 2 * split->out_bytes;
+
+	if (num_slots > num_pieces)
+		num_slots = num_pieces;
+
+	/* Half of what's left stays free for the raw chunks in flight */
+	while (num_slots > 1 && num_slots * slot_bytes > budget_available() / 2)
+		num_slots--;
+
+	if ((pieces = calloc(num_slots, sizeof(CopyPiece))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate copy pieces")
+	}
 
-	/* Get values */
-	process_layer(&parser, (void *)config, CONFIG_UNKNOWN_T);
+	/* fetch_raw_chunk counts raw chunks against the budget when they have somewhere to go */
+	ctx->dest = pieces;
 
-	/* Cleanup */
-	yaml_parser_delete(&parser);
-	fclose(config_input);
+	for (size_t s = 0; s < num_slots; s++) {
+		pieces[s].split = split;
+		pieces[s].data = budget_calloc(split->piece_bytes, 1);
 
-	return config;
+		if (encode) {
+			pieces[s].out = budget_calloc(split->out_bytes, 1);
+			pieces[s].scratch = budget_calloc(split->out_bytes, 1);
+		}
+	}
+
+	PRINT_DEBUG("Copying %zu rows in %zu pieces of %llu rows, %zu at a time\n", extent, num_pieces, (unsigned long long)split->piece_rows, num_slots)
+
+	for (size_t first = 0; first < num_pieces; first += num_slots) {
+		size_t wave = (num_pieces - first < num_slots) ? num_pieces - first : num_slots;
+		hsize_t fetched_to = 0;
+
+		split->num_segments = 0;
+
+		for (size_t s = 0; s < wave; s++) {
+			size_t out_row = (first + s) * split->piece_rows;
+			size_t rows = (extent - out_row < split->piece_rows) ? extent - out_row : split->piece_rows;
+
+			/* The last piece is padded to a whole chunk */
+			if (rows < split->piece_rows)
+				memset(pieces[s].data + rows * split->row_bytes, 0, (split->piece_rows - rows) * split->row_bytes);
+
+			add_piece_segments(split, runs, &run_idx, &run_row, pieces[s].data, rows);
+		}
+
+		/* HDF5 calls stay on this thread. Chunks of rows below fetched_to were placed in every segment they overlap. */
+		for (size_t g = 0; g < split->num_segments; g++) {
+			Range_Indices rows = split->segments[g].rows;
+
+			memset(offset, 0, sizeof(offset));
+			offset[0] = rows.min - rows.min % ctx->chunk_dims[0];
+
+			do {
+				RawChunk *chunk = NULL;
+
+				if (offset[0] < fetched_to)
+					continue;
+
+				if ((chunk = fetch_raw_chunk(src, ctx, offset))) {
+					SplitChunk *task = NULL;
+
+					if ((task = malloc(sizeof(*task))) == NULL) {
+						FUNC_GOTO_ERROR("Failed to allocate split chunk")
+					}
+
+					task->split = split;
+					task->chunk = chunk;
+					thread_pool_submit(thread_pool, split_decode_task, task);
+					split_chunks++;
+					continue;
+				}
+
+				if (!fill_chunk)
+					fill_chunk = create_fill_chunk(src, mem_type, ctx);
+
+				place_split_rows(split, offset, fill_chunk);
+			} while (next_chunk_offset(ctx, rows.min, rows.max, offset));
+
+			fetched_to = (rows.max + ctx->chunk_dims[0] - 1) / ctx->chunk_dims[0] * ctx->chunk_dims[0];
+		}
+
+		thread_pool_wait(thread_pool);
+
+		if (encode) {
+			for (size_t s = 0; s < wave; s++)
+				thread_pool_submit(thread_pool, encode_piece_task, &pieces[s]);
+
+			thread_pool_wait(thread_pool);
+		}
+
+		for (size_t s = 0; s < wave && !readonly; s++) {
+			const void *data = (encode) ? pieces[s].encoded : pieces[s].data;
+			size_t nbytes = (encode) ? pieces[s].encoded_bytes : split->piece_bytes;
+
+			memset(offset, 0, sizeof(offset));
+			offset[0] = (first + s) * split->piece_rows;
+
+			if (H5Dwrite_chunk(dst, H5P_DEFAULT, 0, offset, nbytes, data) < 0) {
+				FUNC_GOTO_ERROR("Failed to write piece")
+			}
+		}
+
+		split_pieces += wave;
+	}
+
+	for (size_t s = 0; s < num_slots; s++) {
+		budget_free(pieces[s].data, split->piece_bytes);
+
+		if (encode) {
+			budget_free(pieces[s].out, split->out_bytes);
+			budget_free(pieces[s].scratch, split->out_bytes);
+		}
+	}
+
+	split_datasets++;
+	free(split->segments);
+	free(fill_chunk);
+	free(pieces);
 }
 
-int main(int argc, char **argv) {
+/* Measure decode throughput of the photon datasets on the first ground track against the thread count.
+ * Raw chunks are fetched once up front so only decoding is timed. */
+void run_decode_bench(hid_t fin) {
+	RawChunk **chunks = NULL;
+	DecodeContext ctx[NUM_PHOTON_COUNT_DATASETS];
+	size_t num_chunks = 0;
+	size_t capacity = 0;
+	size_t decoded_bytes = 0;
+	size_t max_threads = get_num_threads();
+	char h5path[FILEPATH_BUFFER_SIZE];
+
+	for (size_t i = 0; i < NUM_PHOTON_COUNT_DATASETS; i++) {
+		hid_t dset = H5I_INVALID_HID;
+		hid_t dtype = H5I_INVALID_HID;
+		hsize_t offset[H5S_MAX_RANK];
+
+		snprintf(h5path, FILEPATH_BUFFER_SIZE, "%s/%s", ground_tracks[0], ph_count_datasets[i]);
+
+		if ((dset = H5Dopen(fin, h5path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open dataset for decode benchmark")
+		}
+
+		dtype = H5Dget_type(dset);
+
+		if (!init_decode_context(dset, dtype, &ctx[i])) {
+			PRINT_DEBUG("Skipping %s in decode benchmark\n", h5path)
+			H5Tclose(dtype);
+			H5Dclose(dset);
+			continue;
+		}
+
+		ctx[i].range.min = 0;
+		ctx[i].range.max = ctx[i].dims[0];
+		memset(offset, 0, sizeof(offset));
+
+		do {
+			RawChunk *chunk = fetch_raw_chunk(dset, &ctx[i], offset);
+
+			if (!chunk)
+				continue;
+
+			if (num_chunks == capacity) {
+				capacity = (capacity) ? capacity * 2 : 1024;
+
+				if ((chunks = realloc(chunks, capacity * sizeof(RawChunk *))) == NULL) {
+					FUNC_GOTO_ERROR("Failed to allocate chunk list for decode benchmark")
+				}
+			}
+
+			chunks[num_chunks++] = chunk;
+			decoded_bytes += ctx[i].chunk_bytes;
+		} while (next_chunk_offset(&ctx[i], 0, ctx[i].dims[0], offset));
+
+		H5Tclose(dtype);
+		H5Dclose(dset);
+	}
+
+	printf("decode, threads, chunks, seconds, chunks_per_sec, mib_per_sec\n");
+
+	/* Double the thread count each round, always finishing with the full count */
+	for (size_t threads = 1; threads <= max_threads;
+		 threads = (threads < max_threads && threads * 2 > max_threads) ? max_threads : threads * 2) {
+		ThreadPool *pool = thread_pool_create(threads);
+		double start_time = get_time();
+		double elapsed = 0.0;
+
+		for (size_t c = 0; c < num_chunks; c++) {
+			RawChunk *copy = NULL;
+
+			/* decode_task consumes its chunk, so hand it a copy */
+			if ((copy = malloc(sizeof(*copy))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to copy raw chunk for decode benchmark")
+			}
+
+			memcpy(copy, chunks[c], sizeof(*copy));
+
+			if ((copy->data = malloc(copy->nbytes)) == NULL) {
+				FUNC_GOTO_ERROR("Failed to copy raw chunk for decode benchmark")
+			}
+
+			memcpy(copy->data, chunks[c]->data, copy->nbytes);
+			thread_pool_submit(pool, decode_task, copy);
+		}
+
+		thread_pool_wait(pool);
+		elapsed = get_time() - start_time;
+		thread_pool_destroy(pool);
+
+		printf("decode, %zu, %zu, %.6f, %.1f, %.1f\n", threads, num_chunks, elapsed,
+			   num_chunks / elapsed, decoded_bytes / elapsed / (1024.0 * 1024.0));
+	}
+
+	for (size_t c = 0; c < num_chunks; c++) {
+		free(chunks[c]->data);
+		free(chunks[c]);
+	}
+
+	free(chunks);
+}
+
+/* libcurl write callback, appends the response body to the ResponseBuffer in userdata */
+size_t write_response(char *ptr, size_t size, size_t nmemb, void *userdata) {
+	ResponseBuffer *response = (ResponseBuffer *)userdata;
+	size_t nbytes = size * nmemb;
+
+	if (response->size + nbytes > response->capacity) {
+		size_t capacity = (response->capacity) ? response->capacity : 65536;
+
+		while (capacity < response->size + nbytes)
+			capacity *= 2;
+
+		if ((response->data = realloc(response->data, capacity)) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate response buffer")
+		}
+
+		response->capacity = capacity;
+	}
+
+	memcpy(response->data + response->size, ptr, nbytes);
+	response->size += nbytes;
+
+	return nbytes;
+}
+
+/* Point curl at location, or only the bytes in range ("<first>-<last>") if it isn't NULL, with the body going to response.
+ * The request fails as a timeout after the policy's timeout_ms, or once it has stalled for a quarter of it. */
+void setup_get(CURL *curl, const char *location, const char *range, ResponseBuffer *response) {
+	long stall_s = (request_policy.timeout_ms / 4 + 999) / 1000;
+
+	curl_easy_setopt(curl, CURLOPT_URL, location);
+	curl_easy_setopt(curl, CURLOPT_RANGE, range);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, request_policy.timeout_ms);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (request_policy.timeout_ms > 0) ? (long)REQUEST_LOW_SPEED_BYTES : 0L);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, stall_s);
+}
+
+/* GET location, or only the bytes in range ("<first>-<last>") if it isn't NULL */
+ResponseBuffer http_get(CURL *curl, const char *location, const char *range) {
+	ResponseBuffer response = {NULL, 0, 0};
+	long status = 0;
+
+	setup_get(curl, location, range, &response);
+
+	if (curl_easy_perform(curl) != CURLE_OK) {
+		FUNC_GOTO_ERROR("Failed to GET from input url")
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+	if (status != 200 && status != 206) {
+		FUNC_GOTO_ERROR("Unexpected HTTP status from input url")
+	}
+
+	return response;
+}
+
+int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Size bucket of a request of nbytes */
+int get_request_bucket(size_t nbytes) {
+	int bucket = 0;
+
+	for (size_t limit = REQUEST_BUCKET_MIN_BYTES; nbytes >= limit && bucket < REQUEST_SIZE_BUCKETS - 1; limit *= 4) {
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/* The given percentile of the latencies in the window of bucket, or of every bucket if it is negative,
+ * 0 when there are none */
+double get_latency_percentile(int bucket, double percentile) {
+	double latencies[REQUEST_SIZE_BUCKETS * REQUEST_LATENCY_WINDOW];
+	size_t count = 0;
+	size_t idx = 0;
+
+	pthread_mutex_lock(&request_policy.lock);
+
+	for (int b = 0; b < REQUEST_SIZE_BUCKETS; b++) {
+		size_t num = request_policy.num_latencies[b];
+
+		if (bucket >= 0 && b != bucket)
+			continue;
+
+		num = (num < REQUEST_LATENCY_WINDOW) ? num : REQUEST_LATENCY_WINDOW;
+		memcpy(latencies + count, request_policy.latencies[b], num * sizeof(double));
+		count += num;
+	}
+
+	pthread_mutex_unlock(&request_policy.lock);
+
+	if (count == 0)
+		return 0.0;
+
+	qsort(latencies, count, sizeof(double), compare_double);
+	idx = (size_t)ceil(percentile / 100.0 * count);
+
+	return latencies[(idx > 0) ? idx - 1 : 0];
+}
+
+/* Seconds after which a request of the size bucket is hedged, 0 while it never is */
+double get_hedge_threshold(int bucket) {
+	size_t samples = 0;
+
+	pthread_mutex_lock(&request_policy.lock);
+	samples = request_policy.num_latencies[bucket];
+	pthread_mutex_unlock(&request_policy.lock);
+
+	if (request_policy.hedge_percentile <= 0 || samples < REQUEST_MIN_SAMPLES)
+		return 0.0;
+
+	return get_latency_percentile(bucket, request_policy.hedge_percentile);
+}
+
+/* One attempt at a GET of range, nbytes long, from the source. Once it has taken longer than the hedge threshold
+ * of its size the same request is made on the hedge connection, and the response that completes first is kept.
+ * A failed response is only kept when the other request has failed too. Returns its curl result, with the HTTP
+ * status in *status. */
+CURLcode hedged_get(RangeSource *source, const char *range, size_t nbytes, ResponseBuffer *response, long *status) {
+	CURL *handles[2] = {source->curl, source->hedge};
+	ResponseBuffer responses[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+	bool active[2] = {true, false};
+	bool hedged = false;
+	int bucket = get_request_bucket(nbytes);
+	double threshold = get_hedge_threshold(bucket);
+	double start_time = get_time();
+	CURLcode result = CURLE_OK;
+	int winner = -1;
+
+	setup_get(handles[0], source->location, range, &responses[0]);
+	curl_multi_add_handle(source->multi, handles[0]);
+
+	while (winner < 0) {
+		CURLMsg *msg = NULL;
+		int running = 0;
+		int queued = 0;
+		int wait_ms = REQUEST_POLL_MS;
+
+		if (curl_multi_perform(source->multi, &running) != CURLM_OK) {
+			FUNC_GOTO_ERROR("Failed to run range request")
+		}
+
+		while (winner < 0 && (msg = curl_multi_info_read(source->multi, &queued)) != NULL) {
+			int h = (msg->easy_handle == handles[1]);
+			CURLcode done_result = msg->data.result;
+			long code = 0;
+
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			curl_easy_getinfo(handles[h], CURLINFO_RESPONSE_CODE, &code);
+			curl_multi_remove_handle(source->multi, handles[h]);
+			active[h] = false;
+
+			/* Keep waiting on the other request while it may still succeed */
+			if ((done_result != CURLE_OK || (code != 200 && code != 206)) && active[1 - h])
+				continue;
+
+			winner = h;
+			result = done_result;
+			*status = code;
+		}
+
+		if (winner >= 0)
+			break;
+
+		if (!hedged && threshold > 0) {
+			double elapsed = get_time() - start_time;
+
+			if (elapsed >= threshold) {
+				setup_get(handles[1], source->location, range, &responses[1]);
+				curl_multi_add_handle(source->multi, handles[1]);
+				active[1] = true;
+				hedged = true;
+
+				pthread_mutex_lock(&request_policy.lock);
+				request_policy.num_hedges++;
+				pthread_mutex_unlock(&request_policy.lock);
+				continue;
+			}
+
+			if ((threshold - elapsed) * 1000 + 1 < wait_ms)
+				wait_ms = (int)((threshold - elapsed) * 1000) + 1;
+		}
+
+		curl_multi_wait(source->multi, NULL, 0, wait_ms, NULL);
+	}
+
+	/* The slower request is abandoned */
+	for (int h = 0; h < 2; h++) {
+		if (active[h])
+			curl_multi_remove_handle(source->multi, handles[h]);
+
+		if (h != winner)
+			free(responses[h].data);
+	}
+
+	pthread_mutex_lock(&request_policy.lock);
+
+	if (result == CURLE_OK && (*status == 200 || *status == 206)) {
+		request_policy.latencies[bucket][request_policy.num_latencies[bucket]++ % REQUEST_LATENCY_WINDOW] = get_time() - start_time;
+	}
+
+	request_policy.hedges_won += (winner == 1);
+	pthread_mutex_unlock(&request_policy.lock);
+
+	*response = responses[winner];
+
+	return result;
+}
+
+/* Failures a repeated request may not hit: dropped or refused connections, timeouts, throttling and server errors */
+bool is_transient_failure(CURLcode result, long status) {
+	if (result != CURLE_OK) {
+		return result == CURLE_COULDNT_CONNECT || result == CURLE_OPERATION_TIMEDOUT || result == CURLE_SEND_ERROR ||
+			   result == CURLE_RECV_ERROR || result == CURLE_GOT_NOTHING || result == CURLE_PARTIAL_FILE;
+	}
+
+	return status == 429 || status >= 500;
+}
+
+/* GET range, nbytes long, from the source under the request policy. Transient failures are retried up to max_retries times,
+ * after a backoff that starts at retry_backoff and doubles each time up to REQUEST_MAX_BACKOFF_S, with up to half
+ * of it taken off at random so that parallel requests don't retry in step. */
+ResponseBuffer policy_get(RangeSource *source, const char *range, size_t nbytes) {
+	unsigned int seed = (unsigned int)(get_time() * 1e6);
+
+	pthread_mutex_lock(&request_policy.lock);
+	request_policy.num_requests++;
+	pthread_mutex_unlock(&request_policy.lock);
+
+	for (int attempt = 0;; attempt++) {
+		ResponseBuffer response = {NULL, 0, 0};
+		long status = 0;
+		CURLcode result = hedged_get(source, range, nbytes, &response, &status);
+		double backoff = 0.0;
+
+		if (result == CURLE_OK && (status == 200 || status == 206))
+			return response;
+
+		free(response.data);
+
+		if (!is_transient_failure(result, status) || attempt >= request_policy.max_retries) {
+			fprintf(stderr, "GET %s bytes %s: %s, HTTP status %ld after %d attempts\n", source->location, range,
+					curl_easy_strerror(result), status, attempt + 1);
+			FUNC_GOTO_ERROR("Failed to GET from input url")
+		}
+
+		backoff = fmin(ldexp(request_policy.retry_backoff, (attempt < 20) ? attempt : 20), REQUEST_MAX_BACKOFF_S);
+		backoff *= 1.0 - 0.5 * rand_r(&seed) / RAND_MAX;
+
+		pthread_mutex_lock(&request_policy.lock);
+		request_policy.num_retries++;
+		pthread_mutex_unlock(&request_policy.lock);
+
+		PRINT_DEBUG("Retrying GET of bytes %s in %.3f s\n", range, backoff)
+		nanosleep(&(struct timespec){(time_t)backoff, (long)((backoff - (time_t)backoff) * 1e9)}, NULL);
+	}
+}
+
+/* "requests, <range requests>, <retries>, <hedged requests>, <hedges that answered first>, <p50 ms>, <p95 ms>" */
+void print_request_stats(void) {
+	printf("requests, %zu, %zu, %zu, %zu, %.1f, %.1f\n", request_policy.num_requests, request_policy.num_retries,
+		   request_policy.num_hedges, request_policy.hedges_won, get_latency_percentile(-1, 50) * 1000,
+		   get_latency_percentile(-1, 95) * 1000);
+}
+
+bool is_url(const char *location) {
+	return !strncmp(location, "http://", strlen("http://")) || !strncmp(location, "https://", strlen("https://"));
+}
+
+void open_range_source(RangeSource *source, const char *location) {
+	memset(source, 0, sizeof(*source));
+	source->location = location;
+	source->fd = -1;
+
+	if (is_url(location)) {
+		curl_global_init(CURL_GLOBAL_DEFAULT);
+
+		if ((source->curl = curl_easy_init()) == NULL || (source->hedge = curl_easy_init()) == NULL ||
+			(source->multi = curl_multi_init()) == NULL) {
+			FUNC_GOTO_ERROR("Failed to initialize libcurl")
+		}
+	}
+	else if ((source->fd = open(location, O_RDONLY)) < 0) {
+		FUNC_GOTO_ERROR("Failed to open input file for range reads")
+	}
+}
+
+void close_range_source(RangeSource *source) {
+	if (source->curl) {
+		curl_multi_cleanup(source->multi);
+		curl_easy_cleanup(source->hedge);
+		curl_easy_cleanup(source->curl);
+		curl_global_cleanup();
+	}
+
+	if (source->fd >= 0)
+		close(source->fd);
+}
+
+/* Read nbytes at addr of the input into buf with one pread, or one ranged GET under the request policy */
+void read_source_range(RangeSource *source, uint64_t addr, size_t nbytes, void *buf) {
+	source->num_requests++;
+	source->bytes_fetched += nbytes;
+
+	if (source->curl) {
+		char range[64];
+		ResponseBuffer response;
+
+		snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long)addr, (unsigned long long)(addr + nbytes - 1));
+		response = policy_get(source, range, nbytes);
+
+		/* Servers without range support answer with the whole object */
+		if (response.size == nbytes) {
+			memcpy(buf, response.data, nbytes);
+		}
+		else if (response.size >= addr + nbytes) {
+			memcpy(buf, response.data + addr, nbytes);
+		}
+		else {
+			FUNC_GOTO_ERROR("Short range read from input url")
+		}
+
+		free(response.data);
+	}
+	else {
+		size_t done = 0;
+
+		while (done < nbytes) {
+			ssize_t n = pread(source->fd, (unsigned char *)buf + done, nbytes - done, addr + done);
+
+			if (n <= 0) {
+				FUNC_GOTO_ERROR("Short range read from input file")
+			}
+
+			done += n;
+		}
+	}
+}
+
+/* Return the next comma separated field of a manifest line */
+char *next_field(char **line) {
+	char *field = strsep(line, ",");
+
+	if (field == NULL) {
+		FUNC_GOTO_ERROR("Truncated line in manifest")
+	}
+
+	while (*field == ' ')
+		field++;
+
+	return field;
+}
+
+/* Parse "dataset, <path>, <dtype>, <ndims>, <dims...>, <chunk dims...>, <filters>, <fill value hex>".
+ * Filters are space separated <filter id>[:<first client value>], or "-" for none. */
+void parse_manifest_dataset(Manifest *manifest, char *line) {
+	ManifestDataset *md = NULL;
+	DecodeContext *ctx = NULL;
+	char *filters = NULL;
+	char *fill_hex = NULL;
+	char *filter = NULL;
+
+	if (manifest->num_dsets == manifest->max_dsets) {
+		manifest->max_dsets = (manifest->max_dsets) ? manifest->max_dsets * 2 : 64;
+
+		if ((manifest->dsets = realloc(manifest->dsets, manifest->max_dsets * sizeof(ManifestDataset))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate manifest datasets")
+		}
+	}
+
+	md = &manifest->dsets[manifest->num_dsets++];
+	memset(md, 0, sizeof(*md));
+	ctx = &md->ctx;
+
+	md->path = strdup(next_field(&line));
+	snprintf(md->dtype, sizeof(md->dtype), "%s", next_field(&line));
+	ctx->elem_size = strtoul(md->dtype + 2, NULL, 10);
+	ctx->ndims = atoi(next_field(&line));
+
+	if (ctx->ndims < 1 || ctx->ndims > H5S_MAX_RANK || ctx->elem_size == 0) {
+		FUNC_GOTO_ERROR("Bad dataset line in manifest")
+	}
+
+	for (int i = 0; i < ctx->ndims; i++)
+		ctx->dims[i] = strtoull(next_field(&line), NULL, 10);
+
+	ctx->chunk_bytes = ctx->elem_size;
+
+	for (int i = 0; i < ctx->ndims; i++) {
+		ctx->chunk_dims[i] = strtoull(next_field(&line), NULL, 10);
+		ctx->chunk_bytes *= ctx->chunk_dims[i];
+	}
+
+	filters = next_field(&line);
+	fill_hex = next_field(&line);
+	fill_hex[strcspn(fill_hex, " \r\n")] = '\0';
+
+	while ((filter = strsep(&filters, " ")) != NULL) {
+		unsigned cd_value = 0;
+		char *colon = strchr(filter, ':');
+
+		if (*filter == '\0' || *filter == '-')
+			continue;
+
+		if (ctx->nfilters == H5Z_MAX_NFILTERS) {
+			FUNC_GOTO_ERROR("Too many filters in manifest")
+		}
+
+		if (colon)
+			cd_value = strtoul(colon + 1, NULL, 10);
+
+		ctx->filters[ctx->nfilters] = atoi(filter);
+
+		switch (ctx->filters[ctx->nfilters]) {
+		case H5Z_FILTER_SHUFFLE:
+			ctx->shuffle_elem_size = (colon) ? cd_value : (unsigned)ctx->elem_size;
+			break;
+		case H5Z_FILTER_DEFLATE:
+		case H5Z_FILTER_FLETCHER32:
+			break;
+		default:
+			FUNC_GOTO_ERROR("Manifest dataset uses a filter that can't be decoded outside the library")
+		}
+
+		ctx->nfilters++;
+	}
+
+	if ((md->fill_value = calloc(1, ctx->elem_size)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate fill value")
+	}
+
+	for (size_t i = 0; i < ctx->elem_size && fill_hex[2 * i] && fill_hex[2 * i + 1]; i++) {
+		char byte[3] = {fill_hex[2 * i], fill_hex[2 * i + 1], '\0'};
+
+		md->fill_value[i] = strtoul(byte, NULL, 16);
+	}
+}
+
+/* Parse "chunk, <logical offset...>, <file address>, <bytes>, <filter mask>" into the last dataset */
+void parse_manifest_chunk(Manifest *manifest, char *line) {
+	ManifestDataset *md = NULL;
+	ManifestChunk *chunk = NULL;
+
+	if (manifest->num_dsets == 0) {
+		FUNC_GOTO_ERROR("Chunk line before any dataset in manifest")
+	}
+
+	md = &manifest->dsets[manifest->num_dsets - 1];
+
+	if (md->num_chunks == md->max_chunks) {
+		md->max_chunks = (md->max_chunks) ? md->max_chunks * 2 : 64;
+
+		if ((md->chunks = realloc(md->chunks, md->max_chunks * sizeof(ManifestChunk))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate manifest chunks")
+		}
+	}
+
+	chunk = &md->chunks[md->num_chunks++];
+
+	for (int i = 0; i < md->ctx.ndims; i++)
+		chunk->offset[i] = strtoull(next_field(&line), NULL, 10);
+
+	chunk->addr = strtoull(next_field(&line), NULL, 10);
+	chunk->nbytes = strtoull(next_field(&line), NULL, 10);
+	chunk->filter_mask = strtoul(next_field(&line), NULL, 10);
+}
+
+/* Fetch the manifest written by python/make_manifest.py with one read or GET and parse it */
+Manifest *load_manifest(const char *location) {
+	Manifest *manifest = NULL;
+	ResponseBuffer contents = {NULL, 0, 0};
+	char *text = NULL;
+	char *line = NULL;
+
+	if (is_url(location)) {
+		CURL *curl = curl_easy_init();
+
+		contents = http_get(curl, location, NULL);
+		curl_easy_cleanup(curl);
+	}
+	else {
+		FILE *fp = fopen(location, "rb");
+
+		if (fp == NULL) {
+			FUNC_GOTO_ERROR("Failed to open manifest")
+		}
+
+		fseek(fp, 0, SEEK_END);
+		contents.size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		if ((contents.data = malloc(contents.size)) == NULL || fread(contents.data, 1, contents.size, fp) != contents.size) {
+			FUNC_GOTO_ERROR("Failed to read manifest")
+		}
+
+		fclose(fp);
+	}
+
+	if ((manifest = calloc(1, sizeof(*manifest))) == NULL || (text = malloc(contents.size + 1)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate manifest")
+	}
+
+	memcpy(text, contents.data, contents.size);
+	text[contents.size] = '\0';
+	free(contents.data);
+
+	if (strncmp(text, "manifest, 1,", strlen("manifest, 1,"))) {
+		FUNC_GOTO_ERROR("Unsupported manifest version")
+	}
+
+	for (char *rest = text; (line = strsep(&rest, "\n")) != NULL;) {
+		char *kind = NULL;
+
+		if (*line == '\0')
+			continue;
+
+		kind = next_field(&line);
+
+		if (!strcmp(kind, "dataset"))
+			parse_manifest_dataset(manifest, line);
+		else if (!strcmp(kind, "chunk"))
+			parse_manifest_chunk(manifest, line);
+	}
+
+	free(text);
+
+	PRINT_DEBUG("Manifest lists %zu datasets\n", manifest->num_dsets)
+
+	return manifest;
+}
+
+void free_manifest(Manifest *manifest) {
+	for (size_t i = 0; i < manifest->num_dsets; i++) {
+		free(manifest->dsets[i].path);
+		free(manifest->dsets[i].fill_value);
+		free(manifest->dsets[i].chunks);
+	}
+
+	free(manifest->dsets);
+	free(manifest);
+}
+
+/* Look up a dataset by path, with or without the leading slash. Its type must be expected_dtype,
+ * e.g. "<f8", since decoded chunks are placed in memory as-is. */
+ManifestDataset *get_manifest_dataset(Manifest *manifest, const char *h5path, const char *expected_dtype) {
+	h5path += (*h5path == '/');
+
+	for (size_t i = 0; i < manifest->num_dsets; i++) {
+		ManifestDataset *md = &manifest->dsets[i];
+		const char *path = md->path + (*md->path == '/');
+
+		if (strcmp(path, h5path))
+			continue;
+
+		if (expected_dtype && strcmp(md->dtype, expected_dtype)) {
+			FUNC_GOTO_ERROR("Manifest dataset has an unexpected type")
+		}
+
+		return md;
+	}
+
+	FUNC_GOTO_ERROR("Dataset not found in manifest")
+}
+
+int compare_chunk_addr(const void *a, const void *b) {
+	const ManifestChunk *chunk_a = *(const ManifestChunk **)a;
+	const ManifestChunk *chunk_b = *(const ManifestChunk **)b;
+
+	return (chunk_a->addr > chunk_b->addr) - (chunk_a->addr < chunk_b->addr);
+}
+
+/* Index past the last of the address sorted chunks from first on that one range request covers, with [*start, *end)
+ * set to its bytes. Chunks are joined while they are at most MANIFEST_MAX_GAP apart and the request stays under
+ * max_request. */
+size_t coalesce_chunks(ManifestChunk **sorted, size_t first, size_t num_chunks, size_t max_request, uint64_t *start, uint64_t *end) {
+	size_t last = first;
+
+	*start = sorted[first]->addr;
+	*end = sorted[first]->addr + sorted[first]->nbytes;
+
+	while (last + 1 < num_chunks) {
+		ManifestChunk *next = sorted[last + 1];
+
+		if (next->addr > *end + MANIFEST_MAX_GAP || next->addr + next->nbytes - *start > max_request)
+			break;
+
+		if (next->addr + next->nbytes > *end)
+			*end = next->addr + next->nbytes;
+
+		last++;
+	}
+
+	return last + 1;
+}
+
+/* Largest range request, keeping most of a memory budget for the chunks being decoded */
+size_t get_max_request(void) {
+	if (memory_budget.limit > 0 && memory_budget.limit / 4 < MANIFEST_MAX_REQUEST)
+		return memory_budget.limit / 4;
+
+	return MANIFEST_MAX_REQUEST;
+}
+
+/* Decode the stored bytes of one manifest chunk into ctx->dest, on the thread pool if there is one */
+void submit_manifest_chunk(DecodeContext *ctx, ManifestChunk *mc, const unsigned char *bytes) {
+	RawChunk *chunk = NULL;
+
+	if ((chunk = calloc(1, sizeof(*chunk))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate raw chunk")
+	}
+
+	chunk->reserved = reserve_decode_memory(ctx, mc->nbytes);
+
+	if ((chunk->data = malloc(mc->nbytes)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate raw chunk")
+	}
+
+	chunk->ctx = ctx;
+	chunk->nbytes = mc->nbytes;
+	chunk->filter_mask = mc->filter_mask;
+	memcpy(chunk->offset, mc->offset, sizeof(chunk->offset));
+	memcpy(chunk->data, bytes, chunk->nbytes);
+
+	if (thread_pool)
+		thread_pool_submit(thread_pool, decode_task, chunk);
+	else
+		decode_task(chunk);
+}
+
+/* Select the chunks of md that overlap any of the runs, sorted by file address. Returns how many there are. */
+size_t select_manifest_chunks(ManifestDataset *md, Range_Runs *runs, ManifestChunk **selected) {
+	size_t num_selected = 0;
+
+	for (size_t i = 0; i < md->num_chunks; i++) {
+		ManifestChunk *chunk = &md->chunks[i];
+
+		for (size_t r = 0; r < runs->num_runs; r++) {
+			if (chunk->offset[0] < runs->runs[r].max && chunk->offset[0] + md->ctx.chunk_dims[0] > runs->runs[r].min) {
+				selected[num_selected++] = chunk;
+				break;
+			}
+		}
+	}
+
+	qsort(selected, num_selected, sizeof(ManifestChunk *), compare_chunk_addr);
+
+	return num_selected;
+}
+
+Prefetcher *create_prefetcher(const char *location) {
+	Prefetcher *prefetcher = NULL;
+
+	if ((prefetcher = calloc(1, sizeof(*prefetcher))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate prefetcher")
+	}
+
+	for (size_t i = 0; i < PREFETCH_THREADS; i++) {
+		open_range_source(&prefetcher->sources[i], location);
+	}
+
+	pthread_mutex_init(&prefetcher->lock, NULL);
+	pthread_cond_init(&prefetcher->fetched, NULL);
+	prefetcher->pool = thread_pool_create(PREFETCH_THREADS);
+
+	return prefetcher;
+}
+
+/* Fetch one range on a connection of its own, unless it was trimmed while it waited */
+void prefetch_task(void *arg) {
+	PrefetchRange *range = (PrefetchRange *)arg;
+	Prefetcher *prefetcher = range->prefetcher;
+	size_t s = 0;
+
+	pthread_mutex_lock(&prefetcher->lock);
+
+	if (range->state == PREFETCH_TRIMMED) {
+		pthread_mutex_unlock(&prefetcher->lock);
+		return;
+	}
+
+	/* There are as many sources as threads, so one is always free */
+	while (prefetcher->busy[s])
+		s++;
+
+	prefetcher->busy[s] = true;
+	range->state = PREFETCH_FETCHING;
+	pthread_mutex_unlock(&prefetcher->lock);
+
+	read_source_range(&prefetcher->sources[s], range->addr, range->nbytes, range->data);
+
+	pthread_mutex_lock(&prefetcher->lock);
+	prefetcher->busy[s] = false;
+	prefetcher->bytes_prefetched += range->nbytes;
+	range->state = PREFETCH_DONE;
+	pthread_cond_broadcast(&prefetcher->fetched);
+	pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/* Start fetching the chunks of md that cover the estimated rows. Returns the bytes requested, which stop short
+ * of allowance. */
+size_t prefetch_rows(Prefetcher *prefetcher, ManifestDataset *md, Range_Runs *rows, size_t allowance) {
+	ManifestChunk **selected = NULL;
+	size_t num_selected = 0;
+	size_t requested = 0;
+	size_t max_request = get_max_request();
+
+	if ((selected = malloc(md->num_chunks * sizeof(ManifestChunk *))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate prefetch chunks")
+	}
+
+	num_selected = select_manifest_chunks(md, rows, selected);
+
+	for (size_t first = 0; first < num_selected;) {
+		PrefetchRange *range = NULL;
+		uint64_t range_start = 0;
+		uint64_t range_end = 0;
+		size_t next = coalesce_chunks(selected, first, num_selected, max_request, &range_start, &range_end);
+
+		if (requested + (range_end - range_start) > allowance)
+			break;
+
+		if ((range = calloc(1, sizeof(*range))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate prefetch range")
+		}
+
+		/* Prefetching is only a guess, so it stops where the budget runs out rather than failing the run */
+		if ((range->data = budget_try_calloc(range_end - range_start, 1)) == NULL) {
+			PRINT_DEBUG("Prefetch of %llu bytes doesn't fit in the memory budget, stopping\n", (unsigned long long)(range_end - range_start))
+			free(range);
+			break;
+		}
+
+		range->prefetcher = prefetcher;
+		range->md = md;
+		range->addr = range_start;
+		range->nbytes = range_end - range_start;
+		range->state = PREFETCH_PENDING;
+
+		if (prefetcher->num_ranges == prefetcher->max_ranges) {
+			prefetcher->max_ranges = (prefetcher->max_ranges) ? prefetcher->max_ranges * 2 : 64;
+
+			if ((prefetcher->ranges = realloc(prefetcher->ranges, prefetcher->max_ranges * sizeof(PrefetchRange *))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate prefetch ranges")
+			}
+		}
+
+		prefetcher->ranges[prefetcher->num_ranges++] = range;
+		prefetcher->num_requested++;
+		requested += range->nbytes;
+
+		thread_pool_submit(prefetcher->pool, prefetch_task, range);
+		first = next;
+	}
+
+	free(selected);
+
+	return requested;
+}
+
+/* Once the exact photon runs are known, drop the ranges that haven't started and hold none of their chunks */
+void trim_prefetch(Prefetcher *prefetcher, Range_Runs *photon_runs) {
+	ManifestChunk **selected = NULL;
+	ManifestDataset *md = NULL;
+	size_t num_selected = 0;
+
+	pthread_mutex_lock(&prefetcher->lock);
+
+	for (size_t i = 0; i < prefetcher->num_ranges; i++) {
+		PrefetchRange *range = prefetcher->ranges[i];
+		bool needed = false;
+
+		if (range->state != PREFETCH_PENDING)
+			continue;
+
+		if (range->md != md) {
+			md = range->md;
+
+			if ((selected = realloc(selected, md->num_chunks * sizeof(ManifestChunk *))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate prefetch chunks")
+			}
+
+			num_selected = select_manifest_chunks(md, photon_runs, selected);
+		}
+
+		for (size_t c = 0; c < num_selected && !needed; c++) {
+			needed = selected[c]->addr >= range->addr && selected[c]->addr + selected[c]->nbytes <= range->addr + range->nbytes;
+		}
+
+		if (!needed) {
+			range->state = PREFETCH_TRIMMED;
+			prefetcher->num_trimmed++;
+			free(range->data);
+			range->data = NULL;
+			budget_release(range->nbytes, false);
+		}
+	}
+
+	pthread_mutex_unlock(&prefetcher->lock);
+	free(selected);
+}
+
+/* The prefetched range of md holding all of the chunk, waiting for it to arrive, or NULL if the chunk wasn't
+ * prefetched. Sets *prefetched when any range of md was. */
+PrefetchRange *find_prefetched(Prefetcher *prefetcher, ManifestDataset *md, ManifestChunk *chunk, bool *prefetched) {
+	PrefetchRange *found = NULL;
+
+	pthread_mutex_lock(&prefetcher->lock);
+
+	for (size_t i = 0; i < prefetcher->num_ranges && !found; i++) {
+		PrefetchRange *range = prefetcher->ranges[i];
+
+		if (range->md != md)
+			continue;
+
+		*prefetched = true;
+
+		if (range->state != PREFETCH_TRIMMED && chunk->addr >= range->addr && chunk->addr + chunk->nbytes <= range->addr + range->nbytes)
+			found = range;
+	}
+
+	while (found && found->state != PREFETCH_DONE) {
+		pthread_cond_wait(&prefetcher->fetched, &prefetcher->lock);
+	}
+
+	pthread_mutex_unlock(&prefetcher->lock);
+
+	return found;
+}
+
+/* Wait for the ranges of the track still being fetched and free them all */
+void release_prefetch(Prefetcher *prefetcher) {
+	thread_pool_wait(prefetcher->pool);
+
+	for (size_t i = 0; i < prefetcher->num_ranges; i++) {
+		PrefetchRange *range = prefetcher->ranges[i];
+
+		if (range->state != PREFETCH_TRIMMED) {
+			free(range->data);
+			budget_release(range->nbytes, false);
+		}
+
+		free(range);
+	}
+
+	prefetcher->num_ranges = 0;
+}
+
+/* "prefetch, <ranges requested>, <ranges trimmed>, <bytes prefetched>, <bytes of chunks used>, <chunks topped up>" */
+void destroy_prefetcher(Prefetcher *prefetcher) {
+	release_prefetch(prefetcher);
+	thread_pool_destroy(prefetcher->pool);
+
+	printf("prefetch, %zu, %zu, %zu, %zu, %zu\n", prefetcher->num_requested, prefetcher->num_trimmed,
+		   prefetcher->bytes_prefetched, prefetcher->bytes_used, prefetcher->num_topped_up);
+
+	for (size_t i = 0; i < PREFETCH_THREADS; i++) {
+		close_range_source(&prefetcher->sources[i]);
+	}
+
+	pthread_mutex_destroy(&prefetcher->lock);
+	pthread_cond_destroy(&prefetcher->fetched);
+	free(prefetcher->ranges);
+	free(prefetcher);
+}
+
+/* Read rows [range.min, range.max) of a manifest dataset into buf. The chunks overlapping the rows are
+ * sorted by file address and fetched with as few range requests as MANIFEST_MAX_GAP and
+ * MANIFEST_MAX_REQUEST allow, then decoded on the thread pool if there is one. Chunks that -prefetch
+ * already fetched are decoded from its ranges. */
+void read_range_manifest(RangeSource *source, ManifestDataset *md, Range_Indices range, void *buf) {
+	DecodeContext *ctx = NULL;
+	ManifestChunk **selected = NULL;
+	Range_Runs rows = {1, 1, &range};
+	size_t num_selected = 0;
+	size_t expected_chunks = 1;
+	size_t row_bytes = md->ctx.elem_size;
+	size_t max_request = get_max_request();
+
+	if (range.max <= range.min)
+		return;
+
+	if ((ctx = malloc(sizeof(*ctx))) == NULL || (selected = malloc(md->num_chunks * sizeof(ManifestChunk *))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate manifest read")
+	}
+
+	*ctx = md->ctx;
+	ctx->range = range;
+	ctx->dest = buf;
+
+	num_selected = select_manifest_chunks(md, &rows, selected);
+
+	/* Chunks missing from the manifest were never written and read as the fill value */
+	expected_chunks = (range.max - 1) / ctx->chunk_dims[0] - range.min / ctx->chunk_dims[0] + 1;
+
+	for (int i = 1; i < ctx->ndims; i++) {
+		expected_chunks *= (ctx->dims[i] + ctx->chunk_dims[i] - 1) / ctx->chunk_dims[i];
+		row_bytes *= ctx->dims[i];
+	}
+
+	if (num_selected < expected_chunks) {
+		for (size_t i = 0; i < (range.max - range.min) * row_bytes / ctx->elem_size; i++)
+			memcpy((unsigned char *)buf + i * ctx->elem_size, md->fill_value, ctx->elem_size);
+	}
+
+	/* Decode what was prefetched and keep only the rest to fetch */
+	if (prefetcher) {
+		size_t num_missing = 0;
+
+		for (size_t i = 0; i < num_selected; i++) {
+			bool prefetched = false;
+			PrefetchRange *found = find_prefetched(prefetcher, md, selected[i], &prefetched);
+
+			if (found) {
+				submit_manifest_chunk(ctx, selected[i], found->data + (selected[i]->addr - found->addr));
+				prefetcher->bytes_used += selected[i]->nbytes;
+			}
+			else {
+				prefetcher->num_topped_up += prefetched;
+				selected[num_missing++] = selected[i];
+			}
+		}
+
+		num_selected = num_missing;
+	}
+
+	for (size_t first = 0; first < num_selected;) {
+		uint64_t run_start = 0;
+		uint64_t run_end = 0;
+		size_t next = coalesce_chunks(selected, first, num_selected, max_request, &run_start, &run_end);
+		unsigned char *run = NULL;
+
+		budget_acquire(run_end - run_start, false);
+
+		if ((run = malloc(run_end - run_start)) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate range buffer")
+		}
+
+		read_source_range(source, run_start, run_end - run_start, run);
+
+		for (size_t i = first; i < next; i++) {
+			submit_manifest_chunk(ctx, selected[i], run + (selected[i]->addr - run_start));
+		}
+
+		free(run);
+		budget_release(run_end - run_start, false);
+		first = next;
+	}
+
+	if (thread_pool)
+		thread_pool_wait(thread_pool);
+
+	PRINT_DEBUG("Read %s rows %zu-%zu from %zu chunks\n", md->path, range.min, range.max, num_selected)
+
+	free(selected);
+	free(ctx);
+}
+
+/* Copy each attribute from fin to the file whose hid_t is pointed to by fout_data */
+herr_t copy_attr_callback(hid_t fin, const char *attr_name, const H5A_info_t *ainfo, void *fout_data) {
+	herr_t ret_value = SUCCEED;
+
+	hid_t fout = *((hid_t *)fout_data);
+	hid_t fin_aapl_id = H5I_INVALID_HID;
+	hid_t fin_attr = H5I_INVALID_HID;
+
+	hid_t acpl_id = H5I_INVALID_HID;
+	hid_t dtype_id = H5I_INVALID_HID;
+	hid_t dstype_id = H5I_INVALID_HID;
+	hid_t fout_attr = H5I_INVALID_HID;
+
+	size_t dtype_size = 0;
+	size_t num_elems = 0;
+
+	void *attr_data = NULL;
+
+	if ((fin_attr = H5Aopen(fin, attr_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+	{
+		FUNC_GOTO_ERROR("can't open file attribute in copy callback");
+	}
+
+	if ((dtype_id = H5Aget_type(fin_attr)) == H5I_INVALID_HID)
+	{
+		FUNC_GOTO_ERROR("Failed to get datatype of attribute")
+	}
+
+	if ((dstype_id = H5Aget_space(fin_attr)) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to get dataspace of attribute")
+	}
+
+	if ((acpl_id = H5Aget_create_plist(fin_attr)) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to get acpl")
+	}
+
+	if ((dtype_size = H5Tget_size(dtype_id)) == 0)
+	{
+		FUNC_GOTO_ERROR("Failed to get size of datatype")
+	}
+
+	if ((num_elems = H5Sget_simple_extent_npoints(dstype_id)) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to get number of elements")
+	}
+
+	if ((attr_data = malloc(dtype_size * num_elems)) == 0)
+	{
+		FUNC_GOTO_ERROR("Failed to allocate memory for dtype")
+	}
+
+	if (H5Aread(fin_attr, dtype_id, attr_data) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to read from attribute")
+	}
+
+	if (!readonly)
+	{
+		if ((fout_attr = H5Acreate(fout, attr_name, dtype_id, dstype_id, acpl_id, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create attribute in output file")
+		}
+
+		if (H5Awrite(fout_attr, dtype_id, attr_data) < 0) {
+			FUNC_GOTO_ERROR("Failed to write to copied attribute")
+		}
+
+		if (H5Aclose(fout_attr) < 0) {
+			FUNC_GOTO_ERROR("Failed to close output attribute")
+		}
+	}
+
+	free(attr_data);
+
+	if (H5Aclose(fin_attr) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to close input attribute")
+	}
+
+	return ret_value;
+}
+
+/* Copy datasets and their paths from file fin to file fout */
+herr_t copy_scalar_datasets(hid_t fin, hid_t fout) {
+#define NUM_SCALAR_DATASETS 3
+
+	hid_t parent_group = H5I_INVALID_HID;
+	hid_t child_group = H5I_INVALID_HID;
+
+	hid_t dset[NUM_SCALAR_DATASETS];
+	hid_t dtype[NUM_SCALAR_DATASETS];
+	hid_t dstype[NUM_SCALAR_DATASETS];
+	hid_t dcpl = H5I_INVALID_HID;
+	hid_t dapl = H5I_INVALID_HID;
+	hid_t copied_scalar_dataset[NUM_SCALAR_DATASETS];
+
+	hid_t select_all_arr[NUM_SCALAR_DATASETS];
+	size_t num_elems = 0;
+	size_t elem_size = 0;
+	size_t dset_idx = 0;
+
+	char *prev_group_name;
+	char *group_name;
+	char *dset_name;
+	char *dset_path;
+	char dset_path_buffer[FILEPATH_BUFFER_SIZE];
+		
+	void *data[NUM_SCALAR_DATASETS];
+
+	for (dset_idx = 0; dset_idx < NUM_SCALAR_DATASETS; dset_idx++) {
+		select_all_arr[dset_idx] = H5S_ALL;
+	}
+
+	const char **current_dset = scalar_datasets;
+
+	dset_idx = 0;
+
+	/* Iterate over path to make sure all parent groups exist and get dset name */
+	while (*current_dset != 0)
+	{
+
+		/* Copy the dataset path for strtok */
+		dset_path = &(dset_path_buffer[0]);
+		strncpy(dset_path, *current_dset, strlen(*current_dset) + 1);
+
+		PRINT_DEBUG("Copying scalar dset %s\n", dset_path);
+
+		/* Separate filepath into groups */
+		group_name = strtok_r(dset_path, PATH_DELIMITER, &dset_path);
+
+		parent_group = fout;
+
+		/* Until end of path */
+		if (!readonly) {
+			while (group_name != NULL)
+			{
+				/* If the end of the path is reached, keep track of dset name and do not create it as a group*/
+				prev_group_name = group_name;
+				if ((group_name = strtok_r(NULL, PATH_DELIMITER, &dset_path)) == NULL)
+				{
+					dset_name = prev_group_name;
+					break;
+				}
+
+				/* If this group does not exist, attempt to create it */
+				H5E_BEGIN_TRY
+				{
+					if ((child_group = H5Gopen(parent_group, prev_group_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+					{
+						if ((child_group = H5Gcreate(parent_group, prev_group_name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID)
+						{
+							FUNC_GOTO_ERROR("Failed to create child group")
+						}
+					}
+				}
+				H5E_END_TRY
+
+				/* Only close intermediate groups that were just created, not the file itself */
+				if (parent_group != fout)
+				{
+					if (H5Gclose(parent_group) < 0)
+					{
+						FUNC_GOTO_ERROR("Failed to create group")
+					}
+				}
+
+				parent_group = child_group;
+			}
+		}
+
+		/* Access information about dset */
+		if ((dset[dset_idx] = open_dataset(fin, *current_dset, 0, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open dset")
+		}
+
+		if ((dtype[dset_idx] = H5Dget_type(dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dtype")
+		}
+
+		if ((dstype[dset_idx] = H5Dget_space(dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dstype")
+		}
+
+		if ((dcpl = H5Dget_create_plist(dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dcpl")
+		}
+
+		if ((dapl = H5Dget_access_plist(dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dapl")
+		}
+
+		if ((num_elems = H5Sget_simple_extent_npoints(dstype[dset_idx])) < 0) {
+			FUNC_GOTO_ERROR("Failed to get number of elements")
+		}
+
+		if ((elem_size = H5Tget_size(dtype[dset_idx])) == 0) {
+			FUNC_GOTO_ERROR("Failed to get dtype size")
+		}
+
+		data[dset_idx] = calloc(num_elems, elem_size);
+
+		if (!readonly) {
+			if ((copied_scalar_dataset[dset_idx] = H5Dcreate(parent_group, dset_name, dtype[dset_idx], dstype[dset_idx], H5P_DEFAULT, dcpl, dapl)) == H5I_INVALID_HID)
+			{
+				FUNC_GOTO_ERROR("Failed to create dset")
+			}
+		}
+
+		dset_idx++;
+		++current_dset;
+	}
+
+	if (use_multi) {
+		PRINT_DEBUG("Using _multi API to copy scalar datasets\n");
+
+		read_multi_batched("scalar_read", NUM_SCALAR_DATASETS, dset, dtype, select_all_arr, select_all_arr, data);
+
+		write_multi_batched("scalar_write", NUM_SCALAR_DATASETS, copied_scalar_dataset, dtype, select_all_arr, select_all_arr, (const void **) data);
+	} else {
+		for (dset_idx = 0; dset_idx < NUM_SCALAR_DATASETS; dset_idx++) {
+			if (H5Dread(dset[dset_idx], dtype[dset_idx], select_all_arr[dset_idx], select_all_arr[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0)
+			{
+				FUNC_GOTO_ERROR("Failed to read dataset while copying scalar")
+			}
+
+			if (!readonly && H5Dwrite(copied_scalar_dataset[dset_idx], dtype[dset_idx], select_all_arr[dset_idx], select_all_arr[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0)
+			{
+				FUNC_GOTO_ERROR("Failed to write to dataset while copying scalar")
+			}
+		}
+	}
+		
+	/* Clean up*/
+	if (H5Pclose(dcpl) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to close dcpl")
+	}
+
+	if (H5Pclose(dapl) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to close dapl")
+	}
+
+	for (dset_idx = 0; dset_idx < NUM_SCALAR_DATASETS; dset_idx++) {
+		if (!readonly && H5Dclose(copied_scalar_dataset[dset_idx]) < 0)
+			{
+				FUNC_GOTO_ERROR("Failed to close copied scalar dataset")
+			}
+		free(data[dset_idx]);
+
+		if (close_dataset(dset[dset_idx]) < 0) {
+			FUNC_GOTO_ERROR("Failed to close scalar dset")
+		}
+
+
+	}
+}
+
+/* Copy any attributes from input root group to output root group
+ * Return non-negative on success, negative on failure. */
+herr_t copy_root_attrs(hid_t fin, hid_t fout) {
+	herr_t ret_value = SUCCEED;
+	H5Aiterate(fin, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_attr_callback, &fout);
+	return ret_value;
+}
+
+/* Get min and max values for the given array within the given range*/
+Range_Doubles get_minmax(double arr[], Range_Indices range) {
+	Range_Doubles out_range;
+
+	PRINT_DEBUG("Minmax search range is %ld - %ld\n", range.min, range.max)
+
+	/* Initialize fields */
+	out_range.min = arr[range.min];
+	out_range.max = arr[range.min];
+
+	for (size_t i = range.min; i < range.max; i++)
+	{
+		double elem = arr[i];
+
+		if (elem < out_range.min) {
+			out_range.min = elem;
+		}
+
+		if (elem > out_range.max) {
+			out_range.max = elem;
+		}
+	}
+
+	PRINT_DEBUG("Minmax values of array in the range are %lf, %lf\n", out_range.min, out_range.max)
+
+	return out_range;
+}
+
+void append_run(Range_Runs *runs, Range_Indices run) {
+	if (run.max <= run.min)
+		return;
+
+	if (runs->num_runs > 0 && runs->runs[runs->num_runs - 1].max == run.min) {
+		runs->runs[runs->num_runs - 1].max = run.max;
+		return;
+	}
+
+	if (runs->num_runs == runs->max_runs) {
+		runs->max_runs = (runs->max_runs) ? runs->max_runs * 2 : 4;
+
+		if ((runs->runs = realloc(runs->runs, runs->max_runs * sizeof(Range_Indices))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate memory for range runs")
+		}
+	}
+
+	runs->runs[runs->num_runs++] = run;
+}
+
+void free_runs(Range_Runs *runs) {
+	if (runs) {
+		free(runs->runs);
+		free(runs);
+	}
+}
+
+size_t count_run_rows(Range_Runs *runs) {
+	size_t rows = 0;
+
+	for (size_t r = 0; r < runs->num_runs; r++)
+		rows += runs->runs[r].max - runs->runs[r].min;
+
+	return rows;
+}
+
+/* First index of the first run to the end of the last */
+Range_Indices run_envelope(Range_Runs *runs) {
+	Range_Indices envelope = {0, 0};
+
+	if (runs->num_runs > 0) {
+		envelope.min = runs->runs[0].min;
+		envelope.max = runs->runs[runs->num_runs - 1].max;
+	}
+
+	return envelope;
+}
+
+/* Map segment runs to photon runs, where photon_index[i] is the first photon of segment i */
+Range_Runs *map_photon_runs(Range_Runs *index_runs, const size_t *photon_index) {
+	Range_Runs *photon_runs = NULL;
+
+	if ((photon_runs = calloc(1, sizeof(*photon_runs))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate memory for photon runs")
+	}
+
+	for (size_t r = 0; r < index_runs->num_runs; r++) {
+		Range_Indices run;
+
+		run.min = photon_index[index_runs->runs[r].min];
+		run.max = photon_index[index_runs->runs[r].max];
+		append_run(photon_runs, run);
+	}
+
+	return photon_runs;
+}
+
+/* Running sum of num_segments photon counts, with num_segments + 1 entries, freed with budget_free */
+size_t *get_photon_index(const int *counts, size_t num_segments) {
+	size_t *photon_index = NULL;
+
+	photon_index = budget_calloc(num_segments + 1, sizeof(size_t));
+
+	photon_index[0] = 0;
+
+	for (size_t j = 0; j < num_segments; j++) {
+		if (counts[j] < 0) {
+			FUNC_GOTO_ERROR("Photon count cannot be negative!");
+		}
+
+		photon_index[j + 1] = photon_index[j] + counts[j];
+	}
+
+	return photon_index;
+}
+
+/* Append the runs of indices in range whose lat/lon values fall within the given bounding box to runs, in increasing order */
+void get_range(double lat_arr[], size_t lat_size, double lon_arr[], size_t lon_size,
+						 BBox *bbox, Range_Indices *range, Range_Runs *runs) {
+	Range_Indices default_range;
+	default_range.min = 0;
+	default_range.max = lat_size;
+
+	if (lat_size != lon_size)
+	{
+		FUNC_GOTO_ERROR("expected lat and lon arrays to have same shape")
+	}
+
+	if (range == NULL)
+	{
+		range = &default_range;
+	}
+
+	if (range->max <= range->min)
+	{
+		return;
+	}
+
+	PRINT_DEBUG("get_range range has min %zu and max %zu\n", range->min, range->max)
+
+	Range_Doubles lat_range = get_minmax(lat_arr, *range);
+	Range_Doubles lon_range = get_minmax(lon_arr, *range);
+
+	/* If entirely outside bbox, there is nothing to add */
+	if (lat_range.min > bbox->max_lat ||
+		lat_range.max < bbox->min_lat ||
+		lon_range.min > bbox->max_lon ||
+		lon_range.max < bbox->min_lon)
+	{
+		PRINT_DEBUG("%s\n", "Entirely outside bbox")
+	}
+	else if (lat_range.min >= bbox->min_lat &&
+			 lat_range.max <= bbox->max_lat &&
+			 lon_range.min >= bbox->min_lon &&
+			 lon_range.max <= bbox->max_lon)
+	{
+		PRINT_DEBUG("%s\n", "Entirely within bbox")
+		append_run(runs, *range);
+	}
+	else
+	{
+		/* Otherwise search both halves, low first so the runs stay in order */
+		size_t middle_index = (size_t)((range->min + range->max) / 2);
+
+		Range_Indices range_select_low;
+		range_select_low.min = range->min;
+		range_select_low.max = middle_index;
+		get_range(lat_arr, lat_size, lon_arr, lon_size, bbox, &range_select_low, runs);
+
+		Range_Indices range_select_high;
+		range_select_high.min = middle_index;
+		range_select_high.max = range->max;
+		get_range(lat_arr, lat_size, lon_arr, lon_size, bbox, &range_select_high, runs);
+	}
+}
+
+/* Return the runs of the whole array that fall within the bounding box, NULL if none do */
+Range_Runs *get_range_runs(double lat_arr[], double lon_arr[], size_t size, BBox *bbox) {
+	Range_Runs *runs = NULL;
+
+	if ((runs = calloc(1, sizeof(*runs))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate memory for range runs")
+	}
+
+	get_range(lat_arr, size, lon_arr, size, bbox, NULL, runs);
+
+	if (runs->num_runs == 0) {
+		free_runs(runs);
+		return NULL;
+	}
+
+	PRINT_DEBUG("Range search found %zu runs from %zu to %zu\n", runs->num_runs, runs->runs[0].min, runs->runs[runs->num_runs - 1].max)
+
+	return runs;
+}
+
+/* Append the runs within the bounding box of a slice of count rows that starts at row offset of its track */
+void append_slice_runs(Range_Runs *runs, double lat_arr[], double lon_arr[], size_t count, size_t offset, BBox *bbox) {
+	Range_Runs slice_runs = {0, 0, NULL};
+
+	get_range(lat_arr, count, lon_arr, count, bbox, NULL, &slice_runs);
+
+	for (size_t r = 0; r < slice_runs.num_runs; r++) {
+		Range_Indices run = {slice_runs.runs[r].min + offset, slice_runs.runs[r].max + offset};
+
+		append_run(runs, run);
+	}
+
+	free(slice_runs.runs);
+}
+
+/* Grow the footprint's blocks with a slice of count rows that starts at row offset of its track */
+void add_footprint_rows(TrackFootprint *footprint, double lat_arr[], double lon_arr[], size_t count, size_t offset) {
+	size_t num_blocks = (offset + count + FOOTPRINT_BLOCK_ROWS - 1) / FOOTPRINT_BLOCK_ROWS;
+
+	if (num_blocks > footprint->max_blocks) {
+		footprint->max_blocks = (num_blocks > 2 * footprint->max_blocks) ? num_blocks : 2 * footprint->max_blocks;
+
+		if ((footprint->blocks = realloc(footprint->blocks, footprint->max_blocks * sizeof(BBox))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate footprint blocks")
+		}
+	}
+
+	for (size_t b = footprint->num_blocks; b < num_blocks; b++) {
+		footprint->blocks[b] = (BBox){INFINITY, -INFINITY, INFINITY, -INFINITY};
+	}
+
+	if (num_blocks > footprint->num_blocks) {
+		footprint->num_blocks = num_blocks;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		BBox *block = &footprint->blocks[(offset + i) / FOOTPRINT_BLOCK_ROWS];
+
+		if (isnan(lat_arr[i]) || isnan(lon_arr[i])) {
+			continue;
+		}
+
+		block->min_lon = fmin(block->min_lon, lon_arr[i]);
+		block->max_lon = fmax(block->max_lon, lon_arr[i]);
+		block->min_lat = fmin(block->min_lat, lat_arr[i]);
+		block->max_lat = fmax(block->max_lat, lat_arr[i]);
+	}
+}
+
+/* Rows of lat/lon searched at a time to keep their buffers within nbytes */
+size_t get_index_slice_rows(size_t num_elems, size_t nbytes) {
+	size_t slice_rows = nbytes / (2 * sizeof(double));
+
+	if (slice_rows == 0) {
+		FUNC_GOTO_ERROR("Memory budget too small for one row")
+	}
+
+	return (slice_rows < num_elems) ? slice_rows : num_elems;
+}
+
+/* Rows searched as one block by find_bound when the dataset isn't chunked */
+#define BOUND_SEARCH_BLOCK_ROWS (64 * 1024)
+
+/* Evenly spaced rows of lat probed to decide whether a track can be binary searched */
+#define MONOTONIC_PROBES 9
+
+size_t get_num_rows(hid_t dset) {
+	hid_t space = H5Dget_space(dset);
+	hssize_t npoints = H5Sget_simple_extent_npoints(space);
+
+	H5Sclose(space);
+
+	if (npoints < 0) {
+		FUNC_GOTO_ERROR("Failed to get number of rows")
+	}
+
+	return (size_t)npoints;
+}
+
+/* Rows of the dataset's chunks, or BOUND_SEARCH_BLOCK_ROWS if it isn't chunked */
+size_t get_block_rows(hid_t dset) {
+	hid_t dcpl = H5Dget_create_plist(dset);
+	hsize_t chunk_dims[H5S_MAX_RANK];
+	size_t block_rows = BOUND_SEARCH_BLOCK_ROWS;
+
+	if (H5Pget_layout(dcpl) == H5D_CHUNKED && H5Pget_chunk(dcpl, H5S_MAX_RANK, chunk_dims) > 0) {
+		block_rows = chunk_dims[0];
+	}
+
+	H5Pclose(dcpl);
+
+	return block_rows;
+}
+
+/* Read one row of a 1D dataset as a double */
+double read_row(hid_t dset, hsize_t row) {
+	hsize_t count = 1;
+	hid_t mem_space = H5Screate_simple(1, &count, NULL);
+	hid_t file_space = H5Dget_space(dset);
+	double value = 0;
+
+	if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &row, NULL, &count, NULL)) {
+		FUNC_GOTO_ERROR("Failed to select probe row")
+	}
+
+	if (H5Dread(dset, H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, &value) < 0) {
+		FUNC_GOTO_ERROR("Failed to read probe row")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+	bound_probes++;
+
+	return value;
+}
+
+/* Whether value is past t in the direction the dataset is sorted in, or reaches t if inclusive */
+bool is_past_bound(double value, double t, bool inclusive, bool descending) {
+	if (descending) {
+		return (inclusive) ? value <= t : value < t;
+	}
+
+	return (inclusive) ? value >= t : value > t;
+}
+
+/* Return the first row of the sorted 1D dataset whose value is past t, or reaches t if inclusive. descending is for
+ * a non-increasing dataset. The first row of each block of block_rows is probed to find the block holding the bound,
+ * which is then read whole and searched in memory. */
+size_t find_bound(hid_t dset, size_t num_rows, size_t block_rows, double t, bool inclusive, bool descending) {
+	size_t num_blocks = (num_rows + block_rows - 1) / block_rows;
+	size_t lo = 0;
+	size_t hi = num_blocks;
+	hsize_t start = 0;
+	hsize_t count = 0;
+	double *block = NULL;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		double value = read_row(dset, mid * block_rows);
+
+		if (is_past_bound(value, t, inclusive, descending)) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+
+	/* The first row of block lo is past the bound, so it lies in the block before */
+	if (lo == 0) {
+		return 0;
+	}
+
+	start = (lo - 1) * block_rows;
+	count = (num_rows - start < block_rows) ? num_rows - start : block_rows;
+	block = budget_calloc(count, sizeof(double));
+
+	hid_t mem_space = H5Screate_simple(1, &count, NULL);
+	hid_t file_space = H5Dget_space(dset);
+
+	if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &start, NULL, &count, NULL)) {
+		FUNC_GOTO_ERROR("Failed to select search block")
+	}
+
+	if (H5Dread(dset, H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, block) < 0) {
+		FUNC_GOTO_ERROR("Failed to read search block")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+	bound_blocks++;
+
+	lo = 0;
+	hi = count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (is_past_bound(block[mid], t, inclusive, descending)) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+
+	budget_free(block, count * sizeof(double));
+
+	return start + lo;
+}
+
+/* Whether value follows prev in a track whose lat is ascending when order > 0, or descending when order < 0 */
+bool in_lat_order(double prev, double value, int order) {
+	return (order > 0) ? value >= prev : value <= prev;
+}
+
+/* Search rows of a track of num_elems rows for runs within the bounding box, reading its lat/lon in slices that fit
+ * in the memory budget. Runs are exact, so they come out the same however the track is sliced. NULL if none are
+ * found. The slices are also added to footprint, unless it is NULL. Unless order is NULL, the lat read, with the
+ * rows just outside rows, is checked to be in the order *order gives, and *order is set to 0 if it isn't. */
+Range_Runs *read_index_runs(hid_t lat_dset, hid_t lon_dset, hid_t mem_type, size_t num_elems, Range_Indices rows,
+							BBox *bbox, TrackFootprint *footprint, int *order) {
+	Range_Runs *runs = NULL;
+	size_t slice_rows = get_index_slice_rows(rows.max - rows.min, budget_available());
+	double *lat_arr = NULL;
+	double *lon_arr = NULL;
+	double prev = 0;
+	bool has_prev = false;
+
+	if ((runs = calloc(1, sizeof(*runs))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate memory for range runs")
+	}
+
+	lat_arr = budget_calloc(slice_rows, sizeof(double));
+	lon_arr = budget_calloc(slice_rows, sizeof(double));
+
+	if (order && rows.min > 0) {
+		prev = read_row(lat_dset, rows.min - 1);
+		has_prev = true;
+	}
+
+	for (hsize_t start = rows.min; start < rows.max && (order == NULL || *order != 0); start += slice_rows) {
+		hsize_t count = (rows.max - start < slice_rows) ? rows.max - start : slice_rows;
+		hid_t mem_space = H5S_ALL;
+		hid_t file_space = H5S_ALL;
+
+		/* A track that fits is read whole, as before there was a budget */
+		if (count < num_elems) {
+			mem_space = H5Screate_simple(1, &count, NULL);
+			file_space = H5Dget_space(lat_dset);
+
+			if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &start, NULL, &count, NULL)) {
+				FUNC_GOTO_ERROR("Failed to select lat/lon slice")
+			}
+		}
+
+		if (H5Dread(lat_dset, mem_type, mem_space, file_space, H5P_DEFAULT, lat_arr) < 0) {
+			FUNC_GOTO_ERROR("Failed to read from lat dataset")
+		}
+
+		if (H5Dread(lon_dset, mem_type, mem_space, file_space, H5P_DEFAULT, lon_arr) < 0) {
+			FUNC_GOTO_ERROR("Failed to read from lon dataset")
+		}
+
+		for (hsize_t j = 0; order && j < count; j++) {
+			if (has_prev && !in_lat_order(prev, lat_arr[j], *order)) {
+				*order = 0;
+				break;
+			}
+
+			prev = lat_arr[j];
+			has_prev = true;
+		}
+
+		append_slice_runs(runs, lat_arr, lon_arr, count, start, bbox);
+
+		if (footprint) {
+			add_footprint_rows(footprint, lat_arr, lon_arr, count, start);
+		}
+
+		if (count < num_elems) {
+			H5Sclose(mem_space);
+			H5Sclose(file_space);
+		}
+	}
+
+	budget_free(lat_arr, slice_rows * sizeof(double));
+	budget_free(lon_arr, slice_rows * sizeof(double));
+
+	if (order && *order != 0 && has_prev && rows.max < num_elems && !in_lat_order(prev, read_row(lat_dset, rows.max), *order)) {
+		*order = 0;
+	}
+
+	if (runs->num_runs == 0 || (order && *order == 0)) {
+		free_runs(runs);
+		return NULL;
+	}
+
+	PRINT_DEBUG("Range search found %zu runs from %zu to %zu\n", runs->num_runs, runs->runs[0].min, runs->runs[runs->num_runs - 1].max)
+
+	return runs;
+}
+
+/* Search a track by binary search of its lat, for a track that is one ascending or descending pass. MONOTONIC_PROBES
+ * evenly spaced rows are probed first, and false is returned without setting runs if they aren't in order. Otherwise
+ * only the rows between the bbox's latitude bounds are read, and read_index_runs checks them against the whole bbox.
+ * The band it reads, with the rows at its bounds, must also be in order, or false is returned for a full scan. */
+bool search_monotonic_runs(hid_t lat_dset, hid_t lon_dset, hid_t mem_type, size_t num_elems, BBox *bbox, Range_Runs **runs) {
+	size_t block_rows = get_block_rows(lat_dset);
+	bool ascending = true;
+	bool descending = true;
+	double prev = 0;
+	int order = 0;
+	Range_Indices rows;
+
+	if (num_elems == 0) {
+		*runs = NULL;
+		return true;
+	}
+
+	for (size_t p = 0; p < MONOTONIC_PROBES; p++) {
+		double value = read_row(lat_dset, p * (num_elems - 1) / (MONOTONIC_PROBES - 1));
+
+		if (p > 0) {
+			ascending = ascending && value >= prev;
+			descending = descending && value <= prev;
+		}
+
+		prev = value;
+	}
+
+	if (!ascending && !descending) {
+		return false;
+	}
+
+	order = (ascending) ? 1 : -1;
+
+	if (ascending) {
+		rows.min = find_bound(lat_dset, num_elems, block_rows, bbox->min_lat, true, false);
+		rows.max = find_bound(lat_dset, num_elems, block_rows, bbox->max_lat, false, false);
+	}
+	else {
+		rows.min = find_bound(lat_dset, num_elems, block_rows, bbox->max_lat, true, true);
+		rows.max = find_bound(lat_dset, num_elems, block_rows, bbox->min_lat, false, true);
+	}
+
+	PRINT_DEBUG("Latitude band holds rows %zu to %zu of %zu\n", rows.min, rows.max, num_elems)
+
+	/* An empty band has only its bounds to check */
+	if (rows.max <= rows.min) {
+		*runs = NULL;
+
+		if (rows.min > 0 && rows.min < num_elems) {
+			return in_lat_order(read_row(lat_dset, rows.min - 1), read_row(lat_dset, rows.min), order);
+		}
+
+		return true;
+	}
+
+	*runs = read_index_runs(lat_dset, lon_dset, mem_type, num_elems, rows, bbox, NULL, &order);
+
+	return order != 0;
+}
+
+/* Get the runs of indices within the given lat/lon bounds, NULL for a track that misses them.
+ * Each track's footprint is recorded in footprints, unless it is NULL. */
+Range_Runs **get_index_range(hid_t fin, char **ground_track, BBox *bbox, TrackFootprint *footprints) {
+	Range_Runs **ret_ranges = calloc(NUM_GROUND_TRACKS, sizeof(Range_Runs*));
+
+	hid_t lat_dset[NUM_GROUND_TRACKS];
+	hid_t lon_dset[NUM_GROUND_TRACKS];
+	hid_t lat_dspace_id[NUM_GROUND_TRACKS];
+	hid_t lon_dspace_id[NUM_GROUND_TRACKS];
+	hid_t select_all_arr[NUM_GROUND_TRACKS];
+	hid_t dtype_id[NUM_GROUND_TRACKS];
+
+	double *lat_arrs[NUM_GROUND_TRACKS];
+	double *lon_arrs[NUM_GROUND_TRACKS];
+
+	char *lat_dset_names[NUM_GROUND_TRACKS];
+	char *lon_dset_names[NUM_GROUND_TRACKS];
+
+	size_t num_elems_lat[NUM_GROUND_TRACKS];
+	size_t num_elems_lon[NUM_GROUND_TRACKS];
+	size_t total_bytes = 0;
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		select_all_arr[i] = H5S_ALL;
+	}
+
+	/* Set up lat/lon information for H5Dread(_multi) */
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		PRINT_DEBUG("get_index_range with ground_track = %s\n", ground_track[i])
+
+		lat_dset_names[i] = arena_printf(&run_arena, "%s%s", ground_track[i], geolocation_lat);
+
+		if ((lat_dset[i] = open_dataset(fin, lat_dset_names[i], 0, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open lat datset")
+		}
+
+		lat_dspace_id[i] = H5Dget_space(lat_dset[i]);
+		dtype_id[i] = H5Dget_type(lat_dset[i]);
+
+		num_elems_lat[i] = H5Sget_simple_extent_npoints(lat_dspace_id[i]);
+		PRINT_DEBUG("Number of elements in lat dataset is %zu\n", num_elems_lat[i])
+
+		lon_dset_names[i] = arena_printf(&run_arena, "%s%s", ground_track[i], geolocation_lon);
+
+		if ((lon_dset[i] = open_dataset(fin, lon_dset_names[i], 0, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open lon dataset")
+		}
+
+		lon_dspace_id[i] = H5Dget_space(lon_dset[i]);
+		num_elems_lon[i] = H5Sget_simple_extent_npoints(lon_dspace_id[i]);
+
+		if (num_elems_lat[i] != num_elems_lon[i]) {
+			FUNC_GOTO_ERROR("expected lat and lon arrays to have same shape")
+		}
+
+		total_bytes += 2 * num_elems_lat[i] * sizeof(double);
+	}
+
+	/* Tracks that are one pass in latitude are binary searched, the others read one at a time */
+	if (monotonic_search && footprints == NULL) {
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			if (search_monotonic_runs(lat_dset[i], lon_dset[i], dtype_id[i], num_elems_lat[i], bbox, &ret_ranges[i])) {
+				monotonic_tracks++;
+				continue;
+			}
+
+			PRINT_DEBUG("Latitude of %s isn't monotonic, scanning the whole track\n", ground_track[i])
+			ret_ranges[i] = read_index_runs(lat_dset[i], lon_dset[i], dtype_id[i], num_elems_lat[i],
+											(Range_Indices){0, num_elems_lat[i]}, bbox, NULL, NULL);
+		}
+	}
+	/* Perform H5Dread(_multi) for lat/lon. _multi holds every track at once, so it gives way
+	 * to reading one track at a time when they don't fit in the memory budget. */
+	else if (use_multi && total_bytes <= budget_available()) {
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			lat_arrs[i] = budget_calloc(num_elems_lat[i], sizeof(double));
+			lon_arrs[i] = budget_calloc(num_elems_lon[i], sizeof(double));
+		}
+
+		read_multi_batched("lat_read", NUM_GROUND_TRACKS, lat_dset, dtype_id, select_all_arr, select_all_arr, (void **) lat_arrs);
+
+		read_multi_batched("lon_read", NUM_GROUND_TRACKS, lon_dset, dtype_id, select_all_arr, select_all_arr, (void **) lon_arrs);
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			ret_ranges[i] = get_range_runs(lat_arrs[i], lon_arrs[i], num_elems_lat[i], bbox);
+
+			if (footprints) {
+				add_footprint_rows(&footprints[i], lat_arrs[i], lon_arrs[i], num_elems_lat[i], 0);
+			}
+
+			budget_free(lat_arrs[i], num_elems_lat[i] * sizeof(double));
+			budget_free(lon_arrs[i], num_elems_lon[i] * sizeof(double));
+		}
+	} else {
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			ret_ranges[i] = read_index_runs(lat_dset[i], lon_dset[i], dtype_id[i], num_elems_lat[i],
+											(Range_Indices){0, num_elems_lat[i]}, bbox, (footprints) ? &footprints[i] : NULL, NULL);
+		}
+	}
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		close_dataset(lon_dset[i]);
+		close_dataset(lat_dset[i]);
+	}
+
+	return ret_ranges;
+}
+
+/* Find the segments holding photons [photons.min, photons.max) by summing segment_ph_cnt one block at a time,
+ * reading only as far as the segment holding the last photon */
+Range_Indices find_photon_segments(hid_t count_dset, size_t num_segments, Range_Indices photons) {
+	Range_Indices segments = {num_segments, num_segments};
+	size_t block_rows = get_block_rows(count_dset);
+	hid_t file_space = H5Dget_space(count_dset);
+	hid_t mem_space = H5I_INVALID_HID;
+	size_t photon_start = 0;
+	int *counts = NULL;
+	bool found = false;
+
+	counts = budget_calloc(block_rows, sizeof(int));
+
+	for (size_t block_start = 0; block_start < num_segments && !found; block_start += block_rows) {
+		hsize_t start = block_start;
+		hsize_t count = (num_segments - block_start < block_rows) ? num_segments - block_start : block_rows;
+
+		mem_space = H5Screate_simple(1, &count, NULL);
+
+		if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &start, NULL, &count, NULL)) {
+			FUNC_GOTO_ERROR("Failed to select photon counts")
+		}
+
+		if (H5Dread(count_dset, H5T_NATIVE_INT, mem_space, file_space, H5P_DEFAULT, counts) < 0) {
+			FUNC_GOTO_ERROR("Failed to read photon counts")
+		}
+
+		H5Sclose(mem_space);
+
+		for (size_t j = 0; j < count; j++) {
+			size_t segment = block_start + j;
+
+			if (photon_start >= photons.max) {
+				segments.max = segment;
+				found = true;
+				break;
+			}
+
+			photon_start += counts[j];
+
+			if (segments.min == num_segments && photon_start > photons.min) {
+				segments.min = segment;
+			}
+		}
+	}
+
+	budget_free(counts, block_rows * sizeof(int));
+	H5Sclose(file_space);
+
+	return segments;
+}
+
+/* Get the segments of each track whose photons fall in the delta_time window. The photon bounds are found by
+ * binary search of heights/delta_time, which is non-decreasing along track, and widened to whole segments through
+ * segment_ph_cnt. If bbox is given, only the rows of that segment range are searched for it. NULL for a track with
+ * no rows left. */
+Range_Runs **get_time_range(hid_t fin, char **ground_track, Range_Doubles *window, BBox *bbox) {
+	Range_Runs **ret_ranges = calloc(NUM_GROUND_TRACKS, sizeof(Range_Runs*));
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		char *time_name = arena_printf(&run_arena, "%s%s", ground_track[i], HEIGHTS_DELTA_TIME_DSET);
+		char *count_name = arena_printf(&run_arena, "%s%s", ground_track[i], GEOLOCATION_PHOTON_DSET);
+		hid_t time_dset = H5I_INVALID_HID;
+		hid_t count_dset = H5I_INVALID_HID;
+		size_t block_rows = 0;
+		size_t num_photons = 0;
+		size_t num_segments = 0;
+		Range_Indices photons;
+		Range_Indices segments;
+
+		if ((time_dset = open_dataset(fin, time_name, 0, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open delta_time dataset")
+		}
+
+		num_photons = get_num_rows(time_dset);
+		block_rows = get_block_rows(time_dset);
+
+		photons.min = find_bound(time_dset, num_photons, block_rows, window->min, true, false);
+		photons.max = find_bound(time_dset, num_photons, block_rows, window->max, false, false);
+		close_dataset(time_dset);
+
+		if (photons.max <= photons.min) {
+			PRINT_DEBUG("No photons in the time window for %s\n", ground_track[i])
+			continue;
+		}
+
+		/* From the segment holding the first photon to the one holding the last */
+		if ((count_dset = open_dataset(fin, count_name, 0, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open photon count dataset")
+		}
+
+		num_segments = get_num_rows(count_dset);
+		segments = find_photon_segments(count_dset, num_segments, photons);
+		close_dataset(count_dset);
+
+		PRINT_DEBUG("Time window holds photons %zu to %zu, segments %zu to %zu of %s\n", photons.min, photons.max, segments.min, segments.max, ground_track[i])
+
+		if (segments.max <= segments.min) {
+			continue;
+		}
+
+		if (bbox) {
+			char *lat_name = arena_printf(&run_arena, "%s%s", ground_track[i], geolocation_lat);
+			char *lon_name = arena_printf(&run_arena, "%s%s", ground_track[i], geolocation_lon);
+			hid_t lat_dset = open_dataset(fin, lat_name, 0, NULL);
+			hid_t lon_dset = open_dataset(fin, lon_name, 0, NULL);
+
+			if (lat_dset == H5I_INVALID_HID || lon_dset == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to open lat/lon datasets")
+			}
+
+			ret_ranges[i] = read_index_runs(lat_dset, lon_dset, H5T_NATIVE_DOUBLE, num_segments, segments, bbox, NULL, NULL);
+			close_dataset(lon_dset);
+			close_dataset(lat_dset);
+		}
+		else {
+			if ((ret_ranges[i] = calloc(1, sizeof(Range_Runs))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate memory for range runs")
+			}
+
+			append_run(ret_ranges[i], segments);
+		}
+	}
+
+	return ret_ranges;
+}
+
+/* Copy the runs of src to dst back to back through a buffer of buf_rows rows, for selections that don't fit
+ * in the memory budget. dims is the shape of dst. */
+void copy_runs_in_slabs(hid_t src, hid_t dst, hid_t mem_type, Range_Runs *runs, int ndims, const hsize_t *dims, size_t row_bytes, size_t buf_rows) {
+	hid_t file_space = H5I_INVALID_HID;
+	hid_t copy_space = H5I_INVALID_HID;
+	hsize_t start[H5S_MAX_RANK];
+	hsize_t count[H5S_MAX_RANK];
+	hsize_t out_row = 0;
+	void *buf = NULL;
+
+	if (buf_rows == 0) {
+		FUNC_GOTO_ERROR("Memory budget too small for one row")
+	}
+
+	PRINT_DEBUG("Copying %zu rows in slabs of %zu rows\n", count_run_rows(runs), buf_rows)
+
+	memset(start, 0, sizeof(start));
+	memcpy(count, dims, ndims * sizeof(hsize_t));
+
+	file_space = H5Dget_space(src);
+
+	if (!readonly)
+		copy_space = H5Dget_space(dst);
+
+	buf = budget_calloc(buf_rows, row_bytes);
+
+	for (size_t r = 0; r < runs->num_runs; r++) {
+		Range_Indices piece;
+
+		for (piece.min = runs->runs[r].min; piece.min < runs->runs[r].max; piece.min = piece.max) {
+			hid_t mem_space = H5I_INVALID_HID;
+
+			piece.max = (runs->runs[r].max - piece.min > buf_rows) ? piece.min + buf_rows : runs->runs[r].max;
+			count[0] = piece.max - piece.min;
+
+			if ((mem_space = H5Screate_simple(ndims, count, NULL)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to create slab dataspace")
+			}
+
+			if (parallel_decode && read_range_parallel(src, mem_type, piece, buf)) {
+				PRINT_DEBUG("Read slab %zu-%zu with parallel decode\n", piece.min, piece.max)
+			}
+			else {
+				start[0] = piece.min;
+
+				if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL)) {
+					FUNC_GOTO_ERROR("Failed to select slab")
+				}
+
+				if (H5Dread(src, mem_type, mem_space, file_space, H5P_DEFAULT, buf) < 0) {
+					FUNC_GOTO_ERROR("Failed to read slab")
+				}
+			}
+
+			if (!readonly) {
+				start[0] = out_row;
+
+				if (0 > H5Sselect_hyperslab(copy_space, H5S_SELECT_SET, start, NULL, count, NULL)) {
+					FUNC_GOTO_ERROR("Failed to select slab in copy")
+				}
+
+				if (H5Dwrite(dst, mem_type, mem_space, copy_space, H5P_DEFAULT, buf) < 0) {
+					FUNC_GOTO_ERROR("Failed to write slab")
+				}
+			}
+
+			out_row += count[0];
+			H5Sclose(mem_space);
+		}
+	}
+
+	budget_free(buf, buf_rows * row_bytes);
+	H5Sclose(file_space);
+
+	if (!readonly)
+		H5Sclose(copy_space);
+}
+
+/* Create a dataset whose rows map to the given runs of h5path in virtual_source, back to back as a copy would hold them.
+ * space is the shape of the new dataset and source_space that of the source dataset. */
+hid_t create_virtual_dataset(hid_t parent, const char *name, const char *h5path, hid_t dtype, hid_t space, hid_t source_space, Range_Runs *runs) {
+	hid_t dcpl = H5I_INVALID_HID;
+	hid_t vspace = H5I_INVALID_HID;
+	hid_t src_space = H5I_INVALID_HID;
+	hid_t dset = H5I_INVALID_HID;
+	hsize_t start[H5S_MAX_RANK];
+	hsize_t count[H5S_MAX_RANK];
+	hsize_t out_row = 0;
+	size_t row_bytes = H5Tget_size(dtype);
+	int ndims = 0;
+
+	/* Mapped by absolute path so the source is found wherever the subset is opened from */
+	char *source_dset = arena_printf(&run_arena, "/%s", h5path);
+
+	if ((ndims = H5Sget_simple_extent_dims(space, count, NULL)) < 0) {
+		FUNC_GOTO_ERROR("Failed to get dataspace dim size")
+	}
+
+	for (int i = 1; i < ndims; i++)
+		row_bytes *= count[i];
+
+	memset(start, 0, sizeof(start));
+
+	if ((dcpl = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID || (vspace = H5Scopy(space)) == H5I_INVALID_HID ||
+		(src_space = H5Scopy(source_space)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to set up virtual dataset")
+	}
+
+	for (size_t r = 0; r < runs->num_runs; r++) {
+		count[0] = runs->runs[r].max - runs->runs[r].min;
+
+		start[0] = out_row;
+
+		if (0 > H5Sselect_hyperslab(vspace, H5S_SELECT_SET, start, NULL, count, NULL)) {
+			FUNC_GOTO_ERROR("Failed to select rows of virtual dataset")
+		}
+
+		start[0] = runs->runs[r].min;
+
+		if (0 > H5Sselect_hyperslab(src_space, H5S_SELECT_SET, start, NULL, count, NULL)) {
+			FUNC_GOTO_ERROR("Failed to select rows of source dataset")
+		}
+
+		if (H5Pset_virtual(dcpl, vspace, virtual_source, source_dset, src_space) < 0) {
+			FUNC_GOTO_ERROR("Failed to add virtual mapping")
+		}
+
+		out_row += count[0];
+		num_mappings++;
+	}
+
+	bytes_mapped += out_row * row_bytes;
+
+	if ((dset = H5Dcreate(parent, name, dtype, space, H5P_DEFAULT, dcpl, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create virtual dataset")
+	}
+
+	H5Sclose(src_space);
+	H5Sclose(vspace);
+	H5Pclose(dcpl);
+
+	return dset;
+}
+
+/* Copy the given runs of each source dataset to a destination dataset holding them back to back */
+void copy_dataset_range(hid_t fin, hid_t fout, size_t num_dsets, char **h5path, Range_Runs **index_range) {
+	hid_t source_dset[NUM_COPY_RANGE_DATASETS];
+	hid_t child_group = H5I_INVALID_HID;
+	hid_t parent_group = H5I_INVALID_HID;
+	hid_t copy_dset[NUM_COPY_RANGE_DATASETS];
+	hid_t native_dtype[NUM_COPY_RANGE_DATASETS];
+
+	hid_t dtype[NUM_COPY_RANGE_DATASETS];
+	hid_t file_dataspace[NUM_COPY_RANGE_DATASETS];
+	hid_t memory_dataspace[NUM_COPY_RANGE_DATASETS];
+	hid_t dcpl = H5I_INVALID_HID;
+	hid_t dapl = H5I_INVALID_HID;
+
+	hsize_t *stride_arr = NULL;
+	hsize_t *block_size_arr = NULL;
+	hsize_t *start_arr = NULL;
+	hsize_t *count_arr = NULL;
+
+	int ndims = 0;
+	hsize_t *dims = NULL;
+
+	/* Shape and buffer size of each selection, allocated when it's read */
+	int dset_ndims[NUM_COPY_RANGE_DATASETS];
+	hsize_t *dset_dims[NUM_COPY_RANGE_DATASETS];
+	size_t data_bytes[NUM_COPY_RANGE_DATASETS];
+	size_t row_bytes[NUM_COPY_RANGE_DATASETS];
+
+	/* Selections copied in pieces with -split_copy, and how */
+	bool split[NUM_COPY_RANGE_DATASETS];
+	SplitCopy split_plan[NUM_COPY_RANGE_DATASETS];
+	size_t total_bytes = 0;
+	size_t buffer_limit = 0;
+
+	char *prev_group_name;
+	char *group_name;
+	char *dset_name;
+	char *dset_path;
+	char dset_path_buffer[FILEPATH_BUFFER_SIZE];
+
+	void *data[NUM_COPY_RANGE_DATASETS];
+
+	hid_t select_all_arr[NUM_COPY_RANGE_DATASETS];
+
+	for (size_t dset_idx = 0; dset_idx < num_dsets; dset_idx++) {
+		select_all_arr[dset_idx] = H5S_ALL;
+	}
+
+	for (size_t dset_idx = 0; dset_idx < num_dsets; dset_idx++) {
+		size_t extent = count_run_rows(index_range[dset_idx]);
+		size_t total_num_elems = 1;
+		size_t elem_size = 0;
+
+		PRINT_DEBUG("Creating dataset %s with extent %lu\n", h5path[dset_idx], extent)
+
+		/* Copy scalar dataset paths to stack for strtok */
+		dset_path = &(dset_path_buffer[0]);
+		strncpy(dset_path, h5path[dset_idx], strlen(h5path[dset_idx]) + 1);
+
+		parent_group = fout;
+
+		/* Separate filepath into groups */
+		group_name = strtok_r(dset_path, PATH_DELIMITER, &dset_path);
+
+		if (!readonly) {
+			while (group_name != NULL)
+			{
+
+				/* If the end of the path is reached, keep track of dset name and don't create it as a group */
+				prev_group_name = group_name;
+
+				if ((group_name = strtok_r(NULL, PATH_DELIMITER, &dset_path)) == NULL)
+				{
+					dset_name = prev_group_name;
+					break;
+				}
+
+				H5E_BEGIN_TRY
+				{
+					if ((child_group = H5Gopen(parent_group, prev_group_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+					{
+						if ((child_group = H5Gcreate(parent_group, prev_group_name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID)
+						{
+							FUNC_GOTO_ERROR("Failed to create child group")
+						}
+					}
+				}
+				H5E_END_TRY
+
+				/* Only close intermediate groups that were just created, not the file itself */
+				if (parent_group != fout)
+				{
+					if (H5Gclose(parent_group) < 0)
+					{
+						FUNC_GOTO_ERROR("Failed to close parent group")
+					}
+				}
+
+				parent_group = child_group;
+			}
+		}
+
+		/* Copy the data in the source dataset to a new dataset*/
+
+		/* Access data from old dset */
+		if ((source_dset[dset_idx] = open_dataset(fin, h5path[dset_idx], index_range[dset_idx]->num_runs, index_range[dset_idx]->runs)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open source dataset")
+		}
+
+		if ((dtype[dset_idx] = H5Dget_type(source_dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dtype")
+		}
+
+		if ((file_dataspace[dset_idx] = H5Dget_space(source_dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dataspace from source")
+		}
+
+		if ((ndims = H5Sget_simple_extent_ndims(file_dataspace[dset_idx])) < 0) {
+			FUNC_GOTO_ERROR("Failed to get number of dims")
+		}
+
+		/* Create memory dataspace */
+
+		dims = arena_alloc(&run_arena, ndims * sizeof(hsize_t));
+
+		// TODO - should be possible for this to be multidimensional?
+		if (H5Sget_simple_extent_dims(file_dataspace[dset_idx], dims, NULL) <= 0) {
+			FUNC_GOTO_ERROR("Failed to get dataspace dim size")
+		}
+
+		dims[0] = extent;
+
+		if ((memory_dataspace[dset_idx] = H5Screate_simple(ndims, dims, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create simple dataspace")
+		}
+
+		/* Create file dataspace, the union of one hyperslab per run */
+		start_arr = arena_alloc(&run_arena, ndims * sizeof(hsize_t));
+		stride_arr = arena_alloc(&run_arena, ndims * sizeof(hsize_t));
+		block_size_arr = arena_alloc(&run_arena, ndims * sizeof(hsize_t));
+		count_arr = arena_alloc(&run_arena, ndims * sizeof(hsize_t));
+
+		for (size_t i = 0; i < ndims; i++) {
+			start_arr[i] = 0;
+			stride_arr[i] = 1;
+			block_size_arr[i] = 1;
+			count_arr[i] = dims[i];
+		}
+
+		for (size_t r = 0; r < index_range[dset_idx]->num_runs; r++) {
+			Range_Indices run = index_range[dset_idx]->runs[r];
+
+			start_arr[0] = run.min;
+			count_arr[0] = run.max - run.min;
+
+			if (0 > H5Sselect_hyperslab(file_dataspace[dset_idx], (r == 0) ? H5S_SELECT_SET : H5S_SELECT_OR, start_arr, stride_arr, count_arr, block_size_arr)) {
+				FUNC_GOTO_ERROR("Failed to select hyperslab in copy_dataset_range")
+			}
+		}
+
+		/* Get remaining plists */
+		if ((dcpl = H5Dget_create_plist(source_dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dcpl")
+		}
+
+		if ((dapl = H5Dget_access_plist(source_dset[dset_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dapl")
+		}
+
+		/*
+		if (H5Pset_layout(dcpl, H5D_CONTIGUOUS) < 0) {
+			FUNC_GOTO_ERROR("Failed to make layout contiguous")
+		}
+		*/
+		
+		for (size_t i = 0; i < ndims; i++) {
+			total_num_elems *= dims[i];
+		}
+
+		native_dtype[dset_idx] = H5Tget_native_type(dtype[dset_idx], H5T_DIR_DEFAULT);
+
+		if ((elem_size = H5Tget_size(native_dtype[dset_idx])) == 0) {
+			FUNC_GOTO_ERROR("Failed to get size of dtype")
+		}
+
+		split[dset_idx] = !virtual_source && plan_split_copy(source_dset[dset_idx], native_dtype[dset_idx], total_num_elems * elem_size, &split_plan[dset_idx]);
+
+		/* Store entire dataset as one chunk, or a split selection as one chunk per piece */
+		if (split[dset_idx]) {
+			hsize_t chunk_dims[H5S_MAX_RANK];
+
+			memcpy(chunk_dims, dims, ndims * sizeof(hsize_t));
+			chunk_dims[0] = split_plan[dset_idx].piece_rows;
+
+			if (H5Pset_chunk(dcpl, ndims, chunk_dims) < 0) {
+				FUNC_GOTO_ERROR("Failed to set chunk size")
+			}
+		}
+		else if (H5Pset_chunk(dcpl, ndims, dims) < 0) {
+			FUNC_GOTO_ERROR("Failed to set chunk size")
+		}
+
+		dset_ndims[dset_idx] = ndims;
+		dset_dims[dset_idx] = dims;
+		data_bytes[dset_idx] = total_num_elems * elem_size;
+		row_bytes[dset_idx] = elem_size;
+
+		for (size_t i = 1; i < ndims; i++) {
+			row_bytes[dset_idx] *= dims[i];
+		}
+
+		data[dset_idx] = NULL;
+
+		/* A virtual subset maps the selection instead of holding it */
+		if (virtual_source) {
+			copy_dset[dset_idx] = create_virtual_dataset(parent_group, dset_name, h5path[dset_idx], dtype[dset_idx], memory_dataspace[dset_idx], file_dataspace[dset_idx], index_range[dset_idx]);
+			continue;
+		}
+
+		total_bytes += data_bytes[dset_idx];
+		bytes_copied += total_num_elems * elem_size;
+
+		if ((copy_dset[dset_idx] = H5Dcreate(parent_group, dset_name, dtype[dset_idx], memory_dataspace[dset_idx], H5P_DEFAULT, dcpl, dapl)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create copy dset")
+		}
+	}
+
+	/* Parallel decoding takes its chunks out of the same budget, so it gets half of it */
+	buffer_limit = (parallel_decode) ? budget_available() / 2 : budget_available();
+	
+	/* Read and copy selected data. Parallel decoding and split copies read one dataset at a time, so they take precedence
+	 * over _multi. _multi holds every selection in memory at once, so it also gives way when they don't fit in the budget. */
+	if (virtual_source) {
+		PRINT_DEBUG("Mapped %zu datasets to %s\n", num_dsets, virtual_source)
+	}
+	else if (use_multi && !parallel_decode && !split_copy && total_bytes <= buffer_limit) {
+		for (size_t dset_idx = 0; dset_idx < num_dsets; dset_idx++) {
+			data[dset_idx] = budget_calloc(data_bytes[dset_idx], 1);
+		}
+
+		PRINT_DEBUG("Attempting multi read of ranges\n");
+
+		read_multi_batched("copy_read", num_dsets, source_dset, native_dtype, memory_dataspace, file_dataspace, data);
+
+		PRINT_DEBUG("Attempting multi write of ranges\n");
+		/* mem_space_id is H5S_ALL so that memory_dataspace is used for filespace and memory space */
+		if (!readonly) {
+			write_multi_batched("copy_write", num_dsets, copy_dset, native_dtype, select_all_arr, memory_dataspace, (const void**) data);
+		}
+
+		for (size_t dset_idx = 0; dset_idx < num_dsets; dset_idx++) {
+			budget_free(data[dset_idx], data_bytes[dset_idx]);
+		}
+
+	} else {
+		if (use_multi && !parallel_decode && !split_copy) {
+			PRINT_DEBUG("%zu bytes of selections don't fit in the memory budget, copying one dataset at a time\n", total_bytes)
+		}
+
+		for (size_t dset_idx = 0; dset_idx < num_dsets; dset_idx++) {
+			if (split[dset_idx]) {
+				copy_runs_split(source_dset[dset_idx], copy_dset[dset_idx], native_dtype[dset_idx], &split_plan[dset_idx], index_range[dset_idx], dset_dims[dset_idx][0]);
+				continue;
+			}
+
+			/* Spill a selection larger than the budget through a smaller buffer */
+			if (data_bytes[dset_idx] > buffer_limit) {
+				copy_runs_in_slabs(source_dset[dset_idx], copy_dset[dset_idx], native_dtype[dset_idx], index_range[dset_idx],
+								   dset_ndims[dset_idx], dset_dims[dset_idx], row_bytes[dset_idx], buffer_limit / row_bytes[dset_idx]);
+				continue;
+			}
+
+			data[dset_idx] = budget_calloc(data_bytes[dset_idx], 1);
+
+			if (parallel_decode && read_runs_parallel(source_dset[dset_idx], native_dtype[dset_idx], index_range[dset_idx], data[dset_idx])) {
+				PRINT_DEBUG("Read %s with parallel decode\n", h5path[dset_idx])
+			}
+			else if (H5Dread(source_dset[dset_idx], native_dtype[dset_idx], memory_dataspace[dset_idx], file_dataspace[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0) {
+				FUNC_GOTO_ERROR("Failed to read from dset with hyperslab selection")
+			}
+			
+			/* mem_space_id is H5S_ALL so that memory_dataspace is used for filespace and memory space */
+			if (!readonly && H5Dwrite(copy_dset[dset_idx], native_dtype[dset_idx], select_all_arr[dset_idx], memory_dataspace[dset_idx], H5P_DEFAULT, data[dset_idx]) < 0)
+			{
+				FUNC_GOTO_ERROR("Failed to write data when copying range")
+			}
+
+			budget_free(data[dset_idx], data_bytes[dset_idx]);
+		}
+	}
+
+	for (size_t dset_idx = 0; dset_idx < num_dsets; dset_idx++) {
+
+		if (!readonly && H5Dclose(copy_dset[dset_idx]) < 0)
+			{
+				FUNC_GOTO_ERROR("Failed to close copy dset")
+			}
+
+		if (close_dataset(source_dset[dset_idx]) < 0) {
+			FUNC_GOTO_ERROR("Failed to close source dset")
+		}
+	}
+
+	if (H5Pclose(dcpl) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to close dcpl")
+	}
+
+	if (H5Pclose(dapl) < 0)
+	{
+		FUNC_GOTO_ERROR("Failed to close dapl")
+	}
+}
+
+/* Reduce one block of photons into its own stats, in plain loops over the block that the compiler can vectorize */
+void aggregate_task(void *arg) {
+	AggregateBlock *block = (AggregateBlock *)arg;
+	PhotonStats *stats = &block->stats;
+	float min_h = INFINITY;
+	float max_h = -INFINITY;
+	double sum_h = 0;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (size_t i = 0; i < block->rows; i++) {
+		min_h = (block->h[i] < min_h) ? block->h[i] : min_h;
+		max_h = (block->h[i] > max_h) ? block->h[i] : max_h;
+		sum_h += block->h[i];
+	}
+
+	for (size_t i = 0; i < block->rows; i++) {
+		for (size_t c = 0; c < block->conf_cols && c < NUM_SURFACE_TYPES; c++) {
+			int conf = block->conf[i * block->conf_cols + c] - MIN_SIGNAL_CONF;
+
+			if (conf >= 0 && conf < NUM_SIGNAL_CONF)
+				stats->conf_counts[c][conf]++;
+		}
+	}
+
+	stats->count = block->rows;
+	stats->min_h = min_h;
+	stats->max_h = max_h;
+	stats->sum_h = sum_h;
+}
+
+void merge_stats(PhotonStats *total, PhotonStats *part) {
+	if (part->count == 0)
+		return;
+
+	total->min_h = (total->count == 0 || part->min_h < total->min_h) ? part->min_h : total->min_h;
+	total->max_h = (total->count == 0 || part->max_h > total->max_h) ? part->max_h : total->max_h;
+	total->count += part->count;
+	total->sum_h += part->sum_h;
+
+	for (size_t c = 0; c < NUM_SURFACE_TYPES; c++) {
+		for (size_t v = 0; v < NUM_SIGNAL_CONF; v++) {
+			total->conf_counts[c][v] += part->conf_counts[c][v];
+		}
+	}
+}
+
+/* "aggregate, <track>, <photons>, <min h_ph>, <max h_ph>, <mean h_ph>" followed by
+ * "histogram, <track>, <surface type>, <signal_conf_ph>, <photons>" for each count that isn't 0 */
+void print_stats(const char *track, PhotonStats *stats) {
+	printf("aggregate, %s, %zu, %.6f, %.6f, %.6f\n", track, stats->count, (stats->count) ? stats->min_h : NAN,
+		   (stats->count) ? stats->max_h : NAN, (stats->count) ? stats->sum_h / stats->count : NAN);
+
+	for (size_t c = 0; c < NUM_SURFACE_TYPES; c++) {
+		for (size_t v = 0; v < NUM_SIGNAL_CONF; v++) {
+			if (stats->conf_counts[c][v] > 0) {
+				printf("histogram, %s, %zu, %d, %zu\n", track, c, (int)v + MIN_SIGNAL_CONF, stats->conf_counts[c][v]);
+			}
+		}
+	}
+}
+
+/* Read block of rows [start, start + rows) of h_ph and signal_conf_ph */
+void read_aggregate_block(hid_t h_dset, hid_t conf_dset, hsize_t start, AggregateBlock *block) {
+	hsize_t h_start = start;
+	hsize_t h_count = block->rows;
+	hsize_t conf_start[2] = {start, 0};
+	hsize_t conf_count[2] = {block->rows, block->conf_cols};
+	hid_t mem_space = H5Screate_simple(1, &h_count, NULL);
+	hid_t file_space = H5Dget_space(h_dset);
+
+	if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &h_start, NULL, &h_count, NULL) ||
+		H5Dread(h_dset, H5T_NATIVE_FLOAT, mem_space, file_space, H5P_DEFAULT, block->h) < 0) {
+		FUNC_GOTO_ERROR("Failed to read h_ph block")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+
+	mem_space = H5Screate_simple(2, conf_count, NULL);
+	file_space = H5Dget_space(conf_dset);
+
+	if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, conf_start, NULL, conf_count, NULL) ||
+		H5Dread(conf_dset, H5T_NATIVE_SCHAR, mem_space, file_space, H5P_DEFAULT, block->conf) < 0) {
+		FUNC_GOTO_ERROR("Failed to read signal_conf_ph block")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+
+	bytes_copied += block->rows * (sizeof(float) + block->conf_cols);
+}
+
+/* Stream the selected photons of every track through the reducers and print only their stats. Blocks are read on
+ * this thread in waves of one block per worker. Each wave is reduced on the pool while the next is read, so two
+ * waves of buffers are all the memory used, however many photons are selected. */
+void aggregate_photons(hid_t fin, Range_Runs **photon_runs) {
+	size_t num_slots = 2 * thread_pool->num_threads;
+	size_t block_rows = AGGREGATE_BLOCK_ROWS;
+	size_t conf_cols = NUM_SURFACE_TYPES;
+	size_t row_bytes = sizeof(float) + conf_cols;
+	AggregateBlock *blocks = NULL;
+	PhotonStats total;
+
+	/* Smaller blocks when both waves don't fit in half the budget */
+	if (num_slots * block_rows * row_bytes > budget_available() / 2) {
+		block_rows = budget_available() / (2 * num_slots * row_bytes);
+
+		if (block_rows == 0) {
+			FUNC_GOTO_ERROR("Memory budget too small for aggregation blocks")
+		}
+	}
+
+	blocks = arena_alloc(&run_arena, num_slots * sizeof(AggregateBlock));
+
+	for (size_t s = 0; s < num_slots; s++) {
+		blocks[s].h = budget_calloc(block_rows, sizeof(float));
+		blocks[s].conf = budget_calloc(block_rows, conf_cols);
+	}
+
+	memset(&total, 0, sizeof(total));
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		char *h_path = arena_printf(&run_arena, "%s/heights/h_ph", ground_tracks[i]);
+		char *conf_path = arena_printf(&run_arena, "%s/heights/signal_conf_ph", ground_tracks[i]);
+		hid_t h_dset = H5I_INVALID_HID;
+		hid_t conf_dset = H5I_INVALID_HID;
+		hid_t conf_space = H5I_INVALID_HID;
+		hsize_t conf_dims[2] = {0, 1};
+		Range_Runs *runs = photon_runs[i];
+		PhotonStats track_stats;
+		size_t wave = 0;
+		size_t filled = 0;
+		size_t pending = 0;
+
+		memset(&track_stats, 0, sizeof(track_stats));
+
+		if (runs == NULL) {
+			print_stats(ground_tracks[i], &track_stats);
+			continue;
+		}
+
+		if ((h_dset = open_dataset(fin, h_path, runs->num_runs, runs->runs)) == H5I_INVALID_HID ||
+			(conf_dset = open_dataset(fin, conf_path, runs->num_runs, runs->runs)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open datasets to aggregate")
+		}
+
+		conf_space = H5Dget_space(conf_dset);
+		H5Sget_simple_extent_dims(conf_space, conf_dims, NULL);
+		H5Sclose(conf_space);
+
+		if (conf_dims[1] > NUM_SURFACE_TYPES) {
+			FUNC_GOTO_ERROR("signal_conf_ph has more surface types than expected")
+		}
+
+		for (size_t r = 0; r <= runs->num_runs; r++) {
+			size_t start = (r < runs->num_runs) ? runs->runs[r].min : 0;
+			size_t end = (r < runs->num_runs) ? runs->runs[r].max : 0;
+
+			while (start < end || (r == runs->num_runs && filled > 0)) {
+				/* A full wave, or the last one, goes to the pool once the wave before it is reduced */
+				if (filled == num_slots / 2 || start >= end) {
+					thread_pool_wait(thread_pool);
+
+					for (size_t s = 0; s < pending; s++) {
+						merge_stats(&track_stats, &blocks[(1 - wave) * num_slots / 2 + s].stats);
+					}
+
+					for (size_t s = 0; s < filled; s++) {
+						thread_pool_submit(thread_pool, aggregate_task, &blocks[wave * num_slots / 2 + s]);
+					}
+
+					pending = filled;
+					filled = 0;
+					wave = 1 - wave;
+
+					if (start >= end)
+						break;
+				}
+
+				AggregateBlock *block = &blocks[wave * num_slots / 2 + filled];
+
+				block->rows = (end - start < block_rows) ? end - start : block_rows;
+				block->conf_cols = conf_dims[1];
+				read_aggregate_block(h_dset, conf_dset, start, block);
+
+				start += block->rows;
+				filled++;
+			}
+		}
+
+		thread_pool_wait(thread_pool);
+
+		for (size_t s = 0; s < pending; s++) {
+			merge_stats(&track_stats, &blocks[(1 - wave) * num_slots / 2 + s].stats);
+		}
+
+		close_dataset(h_dset);
+		close_dataset(conf_dset);
+
+		print_stats(ground_tracks[i], &track_stats);
+		merge_stats(&total, &track_stats);
+	}
+
+	print_stats("all", &total);
+
+	for (size_t s = 0; s < num_slots; s++) {
+		budget_free(blocks[s].h, block_rows * sizeof(float));
+		budget_free(blocks[s].conf, block_rows * conf_cols);
+	}
+}
+
+/* Open every source dataset the mappings of a virtual dataset read from, and return the dcpl of the first one.
+ * A relative source file is found next to the subset, as the library would look for it. Returns H5I_INVALID_HID
+ * when a source file or dataset is missing, since the library would quietly read the fill value in its place. */
+hid_t check_virtual_sources(hid_t dset, hid_t vdcpl, const char *path) {
+	hid_t source_dcpl = H5I_INVALID_HID;
+	hid_t src_file = H5I_INVALID_HID;
+	size_t count = 0;
+	bool missing = false;
+	char subset_dir[FILEPATH_BUFFER_SIZE] = "";
+	char open_name[FILEPATH_BUFFER_SIZE] = "";
+	char *slash = NULL;
+
+	if (H5Pget_virtual_count(vdcpl, &count) < 0) {
+		FUNC_GOTO_ERROR("Failed to get virtual mapping count")
+	}
+
+	if (H5Fget_name(dset, subset_dir, sizeof(subset_dir)) < 0) {
+		FUNC_GOTO_ERROR("Failed to get name of virtual subset")
+	}
+
+	slash = strrchr(subset_dir, '/');
+	*((slash) ? slash + 1 : subset_dir) = '\0';
+
+	for (size_t i = 0; i < count && !missing; i++) {
+		char file_name[FILEPATH_BUFFER_SIZE];
+		char dset_name[FILEPATH_BUFFER_SIZE];
+		char source_path[FILEPATH_BUFFER_SIZE];
+		hid_t src_dset = H5I_INVALID_HID;
+		ssize_t len = 0;
+
+		if ((len = H5Pget_virtual_filename(vdcpl, i, file_name, sizeof(file_name))) < 0 || (size_t)len >= sizeof(file_name) ||
+			(len = H5Pget_virtual_dsetname(vdcpl, i, dset_name, sizeof(dset_name))) < 0 || (size_t)len >= sizeof(dset_name)) {
+			FUNC_GOTO_ERROR("Failed to get source of virtual mapping")
+		}
+
+		if (!strcmp(file_name, "."))
+			snprintf(source_path, sizeof(source_path), "%s", ".");
+		else if (file_name[0] == '/')
+			snprintf(source_path, sizeof(source_path), "%s", file_name);
+		else if ((size_t)snprintf(source_path, sizeof(source_path), "%s%s", subset_dir, file_name) >= sizeof(source_path)) {
+			FUNC_GOTO_ERROR("Source path of virtual mapping is too long")
+		}
+
+		/* Runs of one dataset usually map to the same file */
+		if (strcmp(source_path, open_name)) {
+			if (src_file != H5I_INVALID_HID)
+				H5Fclose(src_file);
+
+			H5E_BEGIN_TRY
+			{
+				src_file = (!strcmp(source_path, ".")) ? H5Iget_file_id(dset) : H5Fopen(source_path, H5F_ACC_RDONLY, H5P_DEFAULT);
+			}
+			H5E_END_TRY
+
+			if (src_file == H5I_INVALID_HID) {
+				fprintf(stderr, "%s: source file %s is missing\n", path, source_path);
+				missing = true;
+				continue;
+			}
+
+			snprintf(open_name, sizeof(open_name), "%s", source_path);
+		}
+
+		H5E_BEGIN_TRY
+		{
+			src_dset = H5Dopen(src_file, dset_name, H5P_DEFAULT);
+		}
+		H5E_END_TRY
+
+		if (src_dset == H5I_INVALID_HID) {
+			fprintf(stderr, "%s: source dataset %s in %s is missing\n", path, dset_name, source_path);
+			missing = true;
+			continue;
+		}
+
+		if (i == 0 && (source_dcpl = H5Dget_create_plist(src_dset)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dcpl of virtual source")
+		}
+
+		H5Dclose(src_dset);
+	}
+
+	if (src_file != H5I_INVALID_HID)
+		H5Fclose(src_file);
+
+	if (missing) {
+		if (source_dcpl != H5I_INVALID_HID)
+			H5Pclose(source_dcpl);
+
+		return H5I_INVALID_HID;
+	}
+
+	/* A dataset without mappings has no rows and is created contiguous */
+	if (count == 0 && (source_dcpl = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create dcpl")
+	}
+
+	return source_dcpl;
+}
+
+/* Write a dataset of the virtual subset with its own data, stored as one chunk as copy_dataset_range would.
+ * A virtual dcpl can't hold filters, so the dataset gets the dcpl and filters of its first source.
+ * Returns false without creating it if a source is missing. */
+bool materialize_dataset(hid_t dset, hid_t vdcpl, hid_t fout, const char *path) {
+	hid_t dtype = H5I_INVALID_HID;
+	hid_t mem_type = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t dcpl = H5I_INVALID_HID;
+	hid_t out_dset = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	hsize_t chunk_dims[H5S_MAX_RANK];
+	size_t row_bytes = 0;
+	int ndims = 0;
+	Range_Runs runs = {0, 0, NULL};
+	Range_Indices all_rows = {0, 0};
+
+	if ((dcpl = check_virtual_sources(dset, vdcpl, path)) == H5I_INVALID_HID)
+		return false;
+
+	dtype = H5Dget_type(dset);
+	mem_type = H5Tget_native_type(dtype, H5T_DIR_DEFAULT);
+	space = H5Dget_space(dset);
+
+	if ((ndims = H5Sget_simple_extent_dims(space, dims, NULL)) < 1) {
+		FUNC_GOTO_ERROR("Expected a virtual dataset with at least one dimension")
+	}
+
+	row_bytes = H5Tget_size(mem_type);
+
+	for (int i = 1; i < ndims; i++)
+		row_bytes *= dims[i];
+
+	/* One chunk, unless that is over the library's chunk size limit */
+	memcpy(chunk_dims, dims, ndims * sizeof(hsize_t));
+
+	if (row_bytes > MAX_CHUNK_BYTES) {
+		FUNC_GOTO_ERROR("A row of the virtual dataset is larger than the largest chunk")
+	}
+
+	if (chunk_dims[0] > MAX_CHUNK_BYTES / row_bytes)
+		chunk_dims[0] = MAX_CHUNK_BYTES / row_bytes;
+
+	if (H5Sget_simple_extent_npoints(space) > 0 && H5Pset_chunk(dcpl, ndims, chunk_dims) < 0) {
+		FUNC_GOTO_ERROR("Failed to set chunk size")
+	}
+
+	if ((out_dset = H5Dcreate(fout, path, dtype, space, H5P_DEFAULT, dcpl, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create materialized dataset")
+	}
+
+	H5Aiterate(dset, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_attr_callback, &out_dset);
+
+	/* The rows are read through the mappings, in slabs when they don't fit in the memory budget */
+	all_rows.max = dims[0];
+	append_run(&runs, all_rows);
+
+	if (runs.num_runs > 0) {
+		size_t buf_rows = budget_available() / row_bytes;
+
+		copy_runs_in_slabs(dset, out_dset, mem_type, &runs, ndims, dims, row_bytes, (buf_rows < dims[0]) ? buf_rows : dims[0]);
+		bytes_copied += dims[0] * row_bytes;
+	}
+
+	free(runs.runs);
+	H5Dclose(out_dset);
+	H5Pclose(dcpl);
+	H5Sclose(space);
+	H5Tclose(mem_type);
+	H5Tclose(dtype);
+
+	return true;
+}
+
+/* Recreate the groups under path in fout, materializing virtual datasets and copying the rest as they are.
+ * Returns false if a virtual dataset has a missing source. */
+bool materialize_group(hid_t fin, hid_t fout, const char *path) {
+	hid_t group = H5I_INVALID_HID;
+	H5G_info_t ginfo;
+	char name[FILEPATH_BUFFER_SIZE];
+	char child_path[FILEPATH_BUFFER_SIZE];
+	bool complete = true;
+
+	if ((group = H5Gopen2(fin, path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open group of virtual subset")
+	}
+
+	if (H5Gget_info(group, &ginfo) < 0) {
+		FUNC_GOTO_ERROR("Failed to get group info")
+	}
+
+	for (hsize_t i = 0; i < ginfo.nlinks && complete; i++) {
+		hid_t obj = H5I_INVALID_HID;
+
+		if (H5Lget_name_by_idx(group, ".", H5_INDEX_NAME, H5_ITER_INC, i, name, sizeof(name), H5P_DEFAULT) < 0) {
+			FUNC_GOTO_ERROR("Failed to get link name")
+		}
+
+		if ((size_t)snprintf(child_path, sizeof(child_path), "%s%s%s", path, (strcmp(path, PATH_DELIMITER)) ? PATH_DELIMITER : "", name) >= sizeof(child_path)) {
+			FUNC_GOTO_ERROR("Object path in virtual subset is too long")
+		}
+
+		if ((obj = H5Oopen(fin, child_path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open object of virtual subset")
+		}
+
+		if (H5Iget_type(obj) == H5I_GROUP) {
+			hid_t out_group = H5I_INVALID_HID;
+
+			if ((out_group = H5Gcreate2(fout, child_path, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to create group in materialized subset")
+			}
+
+			H5Aiterate(obj, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_attr_callback, &out_group);
+			H5Gclose(out_group);
+
+			complete = materialize_group(fin, fout, child_path);
+		}
+		else {
+			hid_t dcpl = (H5Iget_type(obj) == H5I_DATASET) ? H5Dget_create_plist(obj) : H5I_INVALID_HID;
+
+			if (dcpl != H5I_INVALID_HID && H5Pget_layout(dcpl) == H5D_VIRTUAL) {
+				complete = materialize_dataset(obj, dcpl, fout, child_path);
+			}
+			else if (H5Ocopy(fin, child_path, fout, child_path, H5P_DEFAULT, H5P_DEFAULT) < 0) {
+				FUNC_GOTO_ERROR("Failed to copy object of virtual subset")
+			}
+
+			if (dcpl != H5I_INVALID_HID)
+				H5Pclose(dcpl);
+		}
+
+		H5Oclose(obj);
+	}
+
+	H5Gclose(group);
+
+	return complete;
+}
+
+/* Run "-materialize <path>" in a process of its own, so the run that wrote the virtual subset returns without waiting
+ * for the data to be copied. The process prints its materialize line when it is done. */
+void start_materialize(const char *config_filename, const char *path) {
+	pid_t pid = 0;
+	char *child_argv[] = {"icesat2_selection", "-config", (char *)config_filename, "-materialize", (char *)path, NULL};
+
+	fflush(stdout);
+
+	if (posix_spawn(&pid, "/proc/self/exe", NULL, NULL, child_argv, environ) != 0) {
+		FUNC_GOTO_ERROR("Failed to start materialize process")
+	}
+
+	/* "materialize, started, <pid>" */
+	printf("materialize, started, %d\n", (int)pid);
+}
+
+/* Replace a -virtual subset with one holding its own data. The copy is written next to it and renamed over it,
+ * so readers that already have the virtual subset open keep reading it through its mappings. */
+void materialize_subset(const char *path, hid_t fapl_id) {
+	hid_t fin = H5I_INVALID_HID;
+	hid_t fout = H5I_INVALID_HID;
+	char *tmp_path = arena_printf(&run_arena, "%s.tmp", path);
+	double start_time = get_time();
+
+	if ((fin = H5Fopen(path, H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open virtual subset")
+	}
+
+	if ((fout = H5Fcreate(tmp_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create materialized subset")
+	}
+
+	copy_root_attrs(fin, fout);
+
+	/* The subset is left virtual rather than replaced by one with fill values where a source was */
+	if (!materialize_group(fin, fout, PATH_DELIMITER)) {
+		H5Fclose(fout);
+		unlink(tmp_path);
+		FUNC_GOTO_ERROR("Virtual subset has a missing source, left as it is")
+	}
+
+	H5Fclose(fout);
+	H5Fclose(fin);
+
+	if (rename(tmp_path, path) < 0) {
+		FUNC_GOTO_ERROR("Failed to replace virtual subset")
+	}
+
+	/* "materialize, <seconds>, <bytes>" */
+	printf("materialize, %.3f, %zu\n", get_time() - start_time, bytes_copied);
+}
+
+/* Build the pyramid levels of one track's photons. Each level has ceil(photons / factor) bins, and each bin holds
+ * the first photon of its LOD_FACTOR^level photons and the min, max and mean of their h_ph. All levels are computed
+ * from the same slabs of photons, which start on bins of the coarsest level, each from the level below it. Returns
+ * the number of levels. */
+size_t build_track_pyramid(hid_t fin, hid_t fout, const char *track) {
+	hid_t src_dset[NUM_LOD_SOURCE_DATASETS];
+	hid_t dst_dset[MAX_LOD_LEVELS][NUM_LOD_DATASETS];
+	hid_t group = H5I_INVALID_HID;
+	size_t factor[MAX_LOD_LEVELS];
+	size_t num_levels = 0;
+	size_t num_photons = 0;
+	size_t slab_rows = 0;
+	size_t max_rows = 0;
+	double *src[NUM_LOD_SOURCE_DATASETS];
+	double *dst[NUM_LOD_DATASETS];
+
+	for (size_t d = 0; d < NUM_LOD_SOURCE_DATASETS; d++) {
+		char *path = arena_printf(&run_arena, "%s/heights/%s", track, lod_datasets[d]);
+
+		if ((src_dset[d] = open_dataset(fin, path, 0, NULL)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open photon dataset for pyramid")
+		}
+	}
+
+	num_photons = get_num_rows(src_dset[0]);
+
+	for (size_t f = LOD_FACTOR; num_photons > 0 && num_levels < MAX_LOD_LEVELS; f *= LOD_FACTOR) {
+		factor[num_levels++] = f;
+
+		if ((num_photons + f - 1) / f <= LOD_MIN_BINS)
+			break;
+	}
+
+	if ((group = H5Gcreate(fout, track, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create pyramid track group")
+	}
+
+	H5Gclose(group);
+
+	/* Create every level before writing, so the metadata comes first */
+	for (size_t k = 0; k < num_levels; k++) {
+		char *level_path = arena_printf(&run_arena, "%s/lod_%zu", track, k + 1);
+		hsize_t bins = (num_photons + factor[k] - 1) / factor[k];
+		hsize_t chunk = (bins < LOD_CHUNK_BINS) ? bins : LOD_CHUNK_BINS;
+		hsize_t level_factor = factor[k];
+		hid_t space = H5Screate_simple(1, &bins, NULL);
+		hid_t scalar = H5Screate(H5S_SCALAR);
+		hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+		hid_t attr = H5I_INVALID_HID;
+
+		if ((group = H5Gcreate(fout, level_path, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create pyramid level group")
+		}
+
+		if ((attr = H5Acreate(group, "factor", H5T_NATIVE_HSIZE, scalar, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID ||
+			H5Awrite(attr, H5T_NATIVE_HSIZE, &level_factor) < 0) {
+			FUNC_GOTO_ERROR("Failed to write pyramid level factor")
+		}
+
+		if (H5Pset_chunk(dcpl, 1, &chunk) < 0 || H5Pset_shuffle(dcpl) < 0 || H5Pset_deflate(dcpl, 4) < 0) {
+			FUNC_GOTO_ERROR("Failed to set pyramid dataset filters")
+		}
+
+		for (size_t d = 0; d < NUM_LOD_DATASETS; d++) {
+			hid_t file_type = (d < 2) ? H5T_IEEE_F64LE : H5T_IEEE_F32LE;
+
+			if ((dst_dset[k][d] = H5Dcreate(group, lod_datasets[d], file_type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to create pyramid dataset")
+			}
+		}
+
+		H5Aclose(attr);
+		H5Pclose(dcpl);
+		H5Sclose(scalar);
+		H5Sclose(space);
+		H5Gclose(group);
+	}
+
+	if (num_levels == 0) {
+		for (size_t d = 0; d < NUM_LOD_SOURCE_DATASETS; d++) {
+			close_dataset(src_dset[d]);
+		}
+
+		return 0;
+	}
+
+	/* Slabs are whole bins of the coarsest level, as many as fit in half the memory budget up to LOD_SLAB_ROWS */
+	slab_rows = factor[num_levels - 1];
+	max_rows = budget_available() / (2 * (NUM_LOD_SOURCE_DATASETS + NUM_LOD_DATASETS / LOD_FACTOR + 1) * sizeof(double));
+	max_rows = (max_rows < LOD_SLAB_ROWS) ? max_rows : LOD_SLAB_ROWS;
+
+	if (max_rows > slab_rows)
+		slab_rows *= max_rows / slab_rows;
+
+	for (size_t d = 0; d < NUM_LOD_SOURCE_DATASETS; d++) {
+		src[d] = budget_calloc(slab_rows, sizeof(double));
+	}
+
+	for (size_t d = 0; d < NUM_LOD_DATASETS; d++) {
+		dst[d] = budget_calloc(slab_rows / LOD_FACTOR, sizeof(double));
+	}
+
+	for (hsize_t start = 0; start < num_photons; start += slab_rows) {
+		hsize_t count = (num_photons - start < slab_rows) ? num_photons - start : slab_rows;
+		hid_t mem_space = H5Screate_simple(1, &count, NULL);
+
+		for (size_t d = 0; d < NUM_LOD_SOURCE_DATASETS; d++) {
+			hid_t file_space = H5Dget_space(src_dset[d]);
+
+			if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &start, NULL, &count, NULL) ||
+				H5Dread(src_dset[d], H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, src[d]) < 0) {
+				FUNC_GOTO_ERROR("Failed to read photons for pyramid")
+			}
+
+			H5Sclose(file_space);
+		}
+
+		H5Sclose(mem_space);
+		bytes_copied += count * NUM_LOD_SOURCE_DATASETS * sizeof(double);
+
+		/* Level 1 bins the photons, and each level above bins the one below it in place, as bin b only reads
+		 * bins from b * LOD_FACTOR on. A bin's mean weighs the means below it by their photons. */
+		size_t below_rows = count;
+		size_t below_size = 1;
+
+		for (size_t k = 0; k < num_levels; k++) {
+			hsize_t bins = (below_rows + LOD_FACTOR - 1) / LOD_FACTOR;
+			hsize_t bin_start = start / factor[k];
+			double *below_first[NUM_LOD_SOURCE_DATASETS];
+			double *below_min = (k == 0) ? src[2] : dst[3];
+			double *below_max = (k == 0) ? src[2] : dst[4];
+			double *below_mean = (k == 0) ? src[2] : dst[5];
+
+			for (size_t d = 0; d < NUM_LOD_SOURCE_DATASETS; d++) {
+				below_first[d] = (k == 0) ? src[d] : dst[d];
+			}
+
+			for (size_t b = 0; b < bins; b++) {
+				size_t first = b * LOD_FACTOR;
+				size_t last = (first + LOD_FACTOR < below_rows) ? first + LOD_FACTOR : below_rows;
+				double h_min = below_min[first];
+				double h_max = below_max[first];
+				double sum = 0;
+				size_t photons = 0;
+
+				for (size_t i = first; i < last; i++) {
+					size_t below_photons = (count - i * below_size < below_size) ? count - i * below_size : below_size;
+
+					h_min = fmin(h_min, below_min[i]);
+					h_max = fmax(h_max, below_max[i]);
+					sum += below_mean[i] * below_photons;
+					photons += below_photons;
+				}
+
+				dst[0][b] = below_first[0][first];
+				dst[1][b] = below_first[1][first];
+				dst[2][b] = below_first[2][first];
+				dst[3][b] = h_min;
+				dst[4][b] = h_max;
+				dst[5][b] = sum / photons;
+			}
+
+			below_rows = bins;
+			below_size = factor[k];
+
+			mem_space = H5Screate_simple(1, &bins, NULL);
+
+			for (size_t d = 0; d < NUM_LOD_DATASETS; d++) {
+				hid_t file_space = H5Dget_space(dst_dset[k][d]);
+
+				if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &bin_start, NULL, &bins, NULL) ||
+					H5Dwrite(dst_dset[k][d], H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, dst[d]) < 0) {
+					FUNC_GOTO_ERROR("Failed to write pyramid level")
+				}
+
+				H5Sclose(file_space);
+			}
+
+			H5Sclose(mem_space);
+		}
+	}
+
+	for (size_t d = 0; d < NUM_LOD_SOURCE_DATASETS; d++) {
+		budget_free(src[d], slab_rows * sizeof(double));
+		close_dataset(src_dset[d]);
+	}
+
+	for (size_t d = 0; d < NUM_LOD_DATASETS; d++) {
+		budget_free(dst[d], slab_rows / LOD_FACTOR * sizeof(double));
+	}
+
+	for (size_t k = 0; k < num_levels; k++) {
+		for (size_t d = 0; d < NUM_LOD_DATASETS; d++) {
+			H5Dclose(dst_dset[k][d]);
+		}
+	}
+
+	PRINT_DEBUG("Built %zu pyramid levels of %zu photons for %s\n", num_levels, num_photons, track)
+
+	return num_levels;
+}
+
+/* Write the level-of-detail pyramid of every track of the input to lod_path, through <lod_path>.tmp */
+void build_pyramid(const char *input_path, const char *lod_path, hid_t fapl_id) {
+	hid_t fin = H5I_INVALID_HID;
+	hid_t fout = H5I_INVALID_HID;
+	char *tmp_path = arena_printf(&run_arena, "%s.tmp", lod_path);
+	double start_time = get_time();
+	size_t num_levels = 0;
+
+	if ((fin = H5Fopen(input_path, H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input file for pyramid")
+	}
+
+	if ((fout = H5Fcreate(tmp_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create pyramid file")
+	}
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		num_levels += build_track_pyramid(fin, fout, ground_tracks[i]);
+	}
+
+	H5Fclose(fout);
+	H5Fclose(fin);
+
+	if (rename(tmp_path, lod_path) < 0) {
+		FUNC_GOTO_ERROR("Failed to replace pyramid file")
+	}
+
+	/* "pyramid, <seconds>, <levels of all tracks>, <bytes read>" */
+	printf("pyramid, %.3f, %zu, %zu\n", get_time() - start_time, num_levels, bytes_copied);
+}
+
+/* Return the level of the track's pyramid to copy its photon runs from, the finest one whose bins touched by the runs
+ * fit in point_budget, or the coarsest if none do. 0 means the runs themselves fit. The bins are returned in
+ * bin_runs for a level above 0. */
+size_t plan_lod_level(hid_t lod_fin, const char *track, Range_Runs *photon_runs, size_t point_budget, Range_Runs **bin_runs) {
+	size_t level = 0;
+	Range_Runs *below = photon_runs;
+
+	*bin_runs = NULL;
+
+	if (photon_runs == NULL || count_run_rows(photon_runs) <= point_budget) {
+		return 0;
+	}
+
+	while (true) {
+		char *level_path = arena_printf(&run_arena, "%s/lod_%zu", track, level + 1);
+		Range_Runs *bins = NULL;
+
+		if (H5Lexists(lod_fin, track, H5P_DEFAULT) <= 0 || H5Lexists(lod_fin, level_path, H5P_DEFAULT) <= 0) {
+			break;
+		}
+
+		level++;
+
+		if ((bins = calloc(1, sizeof(*bins))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate bin runs")
+		}
+
+		/* Each level's bins come from the runs of the level below, and runs that share a bin take it once */
+		for (size_t r = 0; r < below->num_runs; r++) {
+			Range_Indices bin = {below->runs[r].min / LOD_FACTOR, (below->runs[r].max + LOD_FACTOR - 1) / LOD_FACTOR};
+
+			if (bins->num_runs > 0 && bin.min < bins->runs[bins->num_runs - 1].max)
+				bin.min = bins->runs[bins->num_runs - 1].max;
+
+			if (bin.max > bin.min)
+				append_run(bins, bin);
+		}
+
+		free_runs(*bin_runs);
+		*bin_runs = bins;
+		below = bins;
+
+		if (count_run_rows(bins) <= point_budget)
+			break;
+	}
+
+	PRINT_DEBUG("Copying %s from pyramid level %zu, %zu points\n", track, level, (*bin_runs) ? count_run_rows(*bin_runs) : 0)
+
+	return level;
+}
+
+/* Map segment runs to photon runs given the photon counts of every segment up to the end of the last run */
+Range_Runs *count_photon_runs(const int *counts, Range_Runs *index_runs) {
+	Range_Runs *photon_runs = NULL;
+	size_t *photon_index = get_photon_index(counts, run_envelope(index_runs).max);
+
+	photon_runs = map_photon_runs(index_runs, photon_index);
+	budget_free(photon_index, (run_envelope(index_runs).max + 1) * sizeof(size_t));
+
+	return photon_runs;
+}
+
+/* Sum up photon counts up to the end of the last run and map each segment run to its photons.
+ * The datasets are left open in count_dset so the copy of the same runs can be served from their chunk caches;
+ * the caller closes them with close_dataset. */
+Range_Runs **get_photon_count_range(hid_t fin, char **h5path, Range_Runs **range, hid_t *count_dset) {
+	Range_Runs **ret_ranges;
+	hid_t *dset = count_dset;
+	hid_t fspace[NUM_GROUND_TRACKS];
+	hid_t dtype[NUM_GROUND_TRACKS];
+	hid_t native_dtype[NUM_GROUND_TRACKS];
+	hid_t select_all_arr[NUM_GROUND_TRACKS];
+	int *data[NUM_GROUND_TRACKS];
+	Range_Indices envelope[NUM_GROUND_TRACKS];
+	Range_Indices *planned_reads = NULL;
+	size_t data_bytes[NUM_GROUND_TRACKS];
+	size_t total_bytes = 0;
+	size_t index_bytes = 0;
+	
+	if ((ret_ranges = calloc(NUM_GROUND_TRACKS, sizeof(Range_Runs*))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate memory for photon count ranges");
+	}
+	
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		select_all_arr[i] = H5S_ALL;
+	}
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		envelope[i] = run_envelope(range[i]);
+
+		PRINT_DEBUG("Counting photons for dataset %zu : %s in %zu runs from %zu to %zu\n", i, h5path[i], range[i]->num_runs, envelope[i].min, envelope[i].max)
+
+		/* Counting reads [0, max), then the copy reads each run again */
+		planned_reads = arena_alloc(&run_arena, (range[i]->num_runs + 1) * sizeof(Range_Indices));
+
+		planned_reads[0].min = 0;
+		planned_reads[0].max = envelope[i].max;
+		memcpy(&planned_reads[1], range[i]->runs, range[i]->num_runs * sizeof(Range_Indices));
+
+		if (H5I_INVALID_HID == (dset[i] = open_dataset(fin, h5path[i], range[i]->num_runs + 1, planned_reads))) {
+			FUNC_GOTO_ERROR("Failed to open dset in get_photon_count_range")
+		}
+
+		/* Create hyperslab selection to read up to range max */
+		if ((fspace[i] = H5Dget_space(dset[i])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get filespace")
+		}
+
+		if (0 > H5Sselect_hyperslab(fspace[i], H5S_SELECT_SET, (hsize_t[]) {0},
+									(hsize_t[]) {1},
+									(hsize_t[]) {envelope[i].max},
+									(hsize_t[]) {1})) {
+			FUNC_GOTO_ERROR("Failed to select hyperslab in get_photon_count_range")
+		}
+
+		if ((dtype[i] = H5Dget_type(dset[i])) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get dtype")
+		}
+
+		if ((native_dtype[i] = H5Tget_native_type(dtype[i], H5T_DIR_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to get native dtype")
+		}
+
+		data_bytes[i] = envelope[i].max * H5Tget_size(native_dtype[i]);
+		total_bytes += data_bytes[i];
+
+		if ((envelope[i].max + 1) * sizeof(size_t) > index_bytes)
+			index_bytes = (envelope[i].max + 1) * sizeof(size_t);
+	}
+
+	/* As for lat/lon, _multi gives way to one track at a time when the counts and the
+	 * largest photon index don't fit in the budget */
+	if (use_multi && total_bytes + index_bytes <= budget_available()) {
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			data[i] = budget_calloc(data_bytes[i], 1);
+		}
+
+		PRINT_DEBUG("Attempting multi-read for photon counting\n");
+		read_multi_batched("count_read", NUM_GROUND_TRACKS, dset, dtype, select_all_arr, fspace, (void**) data);
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			ret_ranges[i] = count_photon_runs(data[i], range[i]);
+			budget_free(data[i], data_bytes[i]);
+		}
+	} else {
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			data[i] = budget_calloc(data_bytes[i], 1);
+
+			if (0 > H5Dread(dset[i], dtype[i], H5S_ALL, fspace[i], H5P_DEFAULT, data[i]))
+			{
+				FUNC_GOTO_ERROR("Failed to read from data in get_photon_count_range")
+			}
+
+			ret_ranges[i] = count_photon_runs(data[i], range[i]);
+			budget_free(data[i], data_bytes[i]);
+		}
+	}
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		PRINT_DEBUG("Got %zu photon runs %s for (%zu, %zu), %zu photons\n", ret_ranges[i]->num_runs, h5path[i], envelope[i].min, envelope[i].max, count_run_rows(ret_ranges[i]))
+	}
+
+	return ret_ranges;
+}
+
+/* Read all of a 1-d dataset, or its first rows when rows isn't 0, into buf */
+void read_kernel_input(hid_t dset, hid_t mem_type, size_t rows, void *buf) {
+	hid_t file_space = H5S_ALL;
+	hid_t mem_space = H5S_ALL;
+
+	if (rows > 0) {
+		hsize_t count = rows;
+
+		file_space = H5Dget_space(dset);
+		mem_space = H5Screate_simple(1, &count, NULL);
+
+		if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, (hsize_t[]) {0}, NULL, &count, NULL)) {
+			FUNC_GOTO_ERROR("Failed to select kernel input rows")
+		}
+	}
+
+	if (H5Dread(dset, mem_type, mem_space, file_space, H5P_DEFAULT, buf) < 0) {
+		FUNC_GOTO_ERROR("Failed to read kernel input")
+	}
+
+	if (rows > 0) {
+		H5Sclose(mem_space);
+		H5Sclose(file_space);
+	}
+}
+
+/* Copy the runs of src into the first rows of dst through a budget buffer, the way copy_dataset_range does */
+void copy_kernel_runs(hid_t src, hid_t dst, Range_Runs *runs) {
+	hsize_t rows = count_run_rows(runs);
+	hid_t file_space = H5Dget_space(src);
+	hid_t out_space = H5Dget_space(dst);
+	hid_t mem_space = H5Screate_simple(1, &rows, NULL);
+	double *buf = budget_calloc(rows, sizeof(double));
+
+	for (size_t r = 0; r < runs->num_runs; r++) {
+		hsize_t start = runs->runs[r].min;
+		hsize_t count = runs->runs[r].max - runs->runs[r].min;
+
+		if (0 > H5Sselect_hyperslab(file_space, (r == 0) ? H5S_SELECT_SET : H5S_SELECT_OR, &start, NULL, &count, NULL)) {
+			FUNC_GOTO_ERROR("Failed to select kernel copy runs")
+		}
+	}
+
+	if (0 > H5Sselect_hyperslab(out_space, H5S_SELECT_SET, (hsize_t[]) {0}, NULL, &rows, NULL)) {
+		FUNC_GOTO_ERROR("Failed to select kernel copy output")
+	}
+
+	if (H5Dread(src, H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, buf) < 0 ||
+		H5Dwrite(dst, H5T_NATIVE_DOUBLE, mem_space, out_space, H5P_DEFAULT, buf) < 0) {
+		FUNC_GOTO_ERROR("Failed to copy kernel runs")
+	}
+
+	budget_free(buf, rows * sizeof(double));
+	H5Sclose(mem_space);
+	H5Sclose(out_space);
+	H5Sclose(file_space);
+}
+
+/* Run one repetition of kernel k, iterations times over the inputs held in memory or in the file */
+void run_kernel(KernelId k, KernelInputs *in, int source, BBox *bbox, Range_Runs *runs, size_t iterations) {
+	size_t n = in->num_rows;
+	size_t env = run_envelope(runs).max;
+	double *lat = in->lat;
+	double *lon = in->lon;
+	int *counts = in->counts;
+
+	if (source == KERNEL_FILE) {
+		lat = in->file_lat;
+		lon = in->file_lon;
+		counts = in->file_counts;
+	}
+
+	for (size_t it = 0; it < iterations; it++) {
+		switch (k) {
+			case KERNEL_MINMAX:
+				if (source == KERNEL_FILE)
+					read_kernel_input(in->lat_dset[source], H5T_NATIVE_DOUBLE, 0, lat);
+
+				kernel_sink += get_minmax(lat, (Range_Indices){0, n}).max;
+				break;
+			case KERNEL_RANGE:
+				if (source == KERNEL_FILE) {
+					read_kernel_input(in->lat_dset[source], H5T_NATIVE_DOUBLE, 0, lat);
+					read_kernel_input(in->lon_dset[source], H5T_NATIVE_DOUBLE, 0, lon);
+				}
+
+				free_runs(get_range_runs(lat, lon, n, bbox));
+				break;
+			case KERNEL_COUNT:
+				if (source == KERNEL_FILE)
+					read_kernel_input(in->count_dset[source], H5T_NATIVE_INT, env, counts);
+
+				free_runs(count_photon_runs(counts, runs));
+				break;
+			case KERNEL_COPY:
+				copy_kernel_runs(in->lat_dset[source], in->out_dset, runs);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+/* A synthetic track of num_rows segments: latitude rises from -80 to 80 with a few rows of noise so the bbox
+ * edges are ragged, longitude wanders, and each segment has 0 to 39 photons. The same arrays are written to an
+ * in-memory file and to a local file, chunked as in a granule. */
+void create_kernel_inputs(KernelInputs *in, size_t num_rows, const char *file_path) {
+	uint64_t seed = 0x9E3779B97F4A7C15ULL;
+	hsize_t dims = num_rows;
+	hsize_t chunk = (num_rows < KERNEL_BENCH_CHUNK_ROWS) ? num_rows : KERNEL_BENCH_CHUNK_ROWS;
+	hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+	hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+	hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+	hid_t space = H5Screate_simple(1, &dims, NULL);
+
+	memset(in, 0, sizeof(*in));
+	in->num_rows = num_rows;
+	in->lat = budget_calloc(num_rows, sizeof(double));
+	in->lon = budget_calloc(num_rows, sizeof(double));
+	in->counts = budget_calloc(num_rows, sizeof(int));
+	in->file_lat = budget_calloc(num_rows, sizeof(double));
+	in->file_lon = budget_calloc(num_rows, sizeof(double));
+	in->file_counts = budget_calloc(num_rows, sizeof(int));
+
+	for (size_t i = 0; i < num_rows; i++) {
+		double noise = 0.0;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		noise = ((double)(seed >> 11) / (double)(1ULL << 53) - 0.5) * KERNEL_BENCH_NOISE_ROWS;
+
+		in->lat[i] = -80.0 + 160.0 * (i + noise) / num_rows;
+		in->lon[i] = 10.0 * sin(8.0 * M_PI * i / num_rows);
+		in->counts[i] = (int)((seed >> 33) % 40);
+	}
+
+	/* No chunk cache, so every read of the inputs goes to the file driver */
+	H5Pset_chunk(dcpl, 1, &chunk);
+	H5Pset_chunk_cache(dapl, 0, 0, 1.0);
+	H5Pset_fapl_core(fapl, 64 * 1024 * 1024, false);
+
+	in->files[KERNEL_MEMORY] = H5Fcreate("kernel_bench_memory.h5", H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+	in->files[KERNEL_FILE] = H5Fcreate(file_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	in->out_file = H5Fcreate("kernel_bench_out.h5", H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+
+	if (in->files[KERNEL_MEMORY] == H5I_INVALID_HID || in->files[KERNEL_FILE] == H5I_INVALID_HID || in->out_file == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create kernel benchmark files")
+	}
+
+	for (int source = 0; source < NUM_KERNEL_SOURCES; source++) {
+		in->lat_dset[source] = H5Dcreate(in->files[source], "lat", H5T_IEEE_F64LE, space, H5P_DEFAULT, dcpl, dapl);
+		in->lon_dset[source] = H5Dcreate(in->files[source], "lon", H5T_IEEE_F64LE, space, H5P_DEFAULT, dcpl, dapl);
+		in->count_dset[source] = H5Dcreate(in->files[source], "counts", H5T_STD_I32LE, space, H5P_DEFAULT, dcpl, dapl);
+
+		if (H5Dwrite(in->lat_dset[source], H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, in->lat) < 0 ||
+			H5Dwrite(in->lon_dset[source], H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, in->lon) < 0 ||
+			H5Dwrite(in->count_dset[source], H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, in->counts) < 0) {
+			FUNC_GOTO_ERROR("Failed to write kernel benchmark inputs")
+		}
+	}
+
+	/* Flush so the local file is read back from the page cache rather than HDF5's metadata and chunk caches */
+	H5Fflush(in->files[KERNEL_FILE], H5F_SCOPE_GLOBAL);
+
+	in->out_dset = H5Dcreate(in->out_file, "copy", H5T_IEEE_F64LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+	H5Sclose(space);
+	H5Pclose(dapl);
+	H5Pclose(dcpl);
+	H5Pclose(fapl);
+}
+
+void free_kernel_inputs(KernelInputs *in, const char *file_path) {
+	for (int source = 0; source < NUM_KERNEL_SOURCES; source++) {
+		H5Dclose(in->lat_dset[source]);
+		H5Dclose(in->lon_dset[source]);
+		H5Dclose(in->count_dset[source]);
+		H5Fclose(in->files[source]);
+	}
+
+	H5Dclose(in->out_dset);
+	H5Fclose(in->out_file);
+	remove(file_path);
+
+	budget_free(in->lat, in->num_rows * sizeof(double));
+	budget_free(in->lon, in->num_rows * sizeof(double));
+	budget_free(in->counts, in->num_rows * sizeof(int));
+	budget_free(in->file_lat, in->num_rows * sizeof(double));
+	budget_free(in->file_lon, in->num_rows * sizeof(double));
+	budget_free(in->file_counts, in->num_rows * sizeof(int));
+}
+
+/* Median ns/element of each case in a previous -kernel_bench output, keyed by "<kernel>, <input>, <elements>, <selectivity>" */
+KernelBaseline *load_kernel_baseline(const char *path, size_t *num_entries) {
+	KernelBaseline *entries = NULL;
+	size_t max_entries = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	FILE *f = NULL;
+
+	*num_entries = 0;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		FUNC_GOTO_ERROR("Failed to open kernel baseline")
+	}
+
+	while (getline(&line, &line_size, f) > 0) {
+		char *cursor = line;
+		char *fields[7];
+
+		line[strcspn(line, "\n")] = '\0';
+
+		if (strncmp(line, "kernel, ", 8) || strchr(line, ',') == NULL)
+			continue;
+
+		for (size_t i = 0; i < 7; i++) {
+			fields[i] = (cursor) ? next_field(&cursor) : "";
+		}
+
+		/* Skip the header */
+		if (!isdigit((unsigned char)fields[3][0]))
+			continue;
+
+		if (*num_entries == max_entries) {
+			max_entries = (max_entries) ? max_entries * 2 : 64;
+
+			if ((entries = realloc(entries, max_entries * sizeof(KernelBaseline))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate kernel baseline")
+			}
+		}
+
+		snprintf(entries[*num_entries].key, sizeof(entries[*num_entries].key), "%s, %s, %s, %s", fields[1], fields[2], fields[3], fields[4]);
+		entries[*num_entries].median_ns = strtod(fields[6], NULL);
+		(*num_entries)++;
+	}
+
+	free(line);
+	fclose(f);
+
+	return entries;
+}
+
+/* Time get_minmax, get_range, the photon count summation and the copy buffers on synthetic tracks, away from
+ * any network. Each case is run KERNEL_BENCH_REPS times after a warm-up, every repetition covering at least
+ * KERNEL_BENCH_MIN_ELEMENTS elements. Returns the number of cases slower than the baseline by more than
+ * KERNEL_REGRESSION_TOLERANCE, 0 without a baseline. */
+size_t run_kernel_bench(const char *baseline_path) {
+	const size_t sizes[] = KERNEL_BENCH_SIZES;
+	const double selectivities[] = KERNEL_BENCH_SELECTIVITIES;
+	const char *kernel_names[] = {"minmax", "range", "count", "copy"};
+	const char *source_names[] = {"memory", "file"};
+	const char *file_path = KERNEL_BENCH_FILENAME;
+	KernelBaseline *baseline = NULL;
+	size_t num_baseline = 0;
+	size_t compared = 0;
+	size_t regressions = 0;
+
+	if (baseline_path) {
+		baseline = load_kernel_baseline(baseline_path, &num_baseline);
+	}
+
+	printf("kernel, name, input, elements, selectivity, reps, median_ns_per_elem, min_ns_per_elem, max_ns_per_elem, gb_per_sec\n");
+
+	for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+		KernelInputs in;
+
+		create_kernel_inputs(&in, sizes[z], file_path);
+
+		for (size_t sel = 0; sel < sizeof(selectivities) / sizeof(selectivities[0]); sel++) {
+			/* A latitude band around the equator that holds the given share of the rows */
+			BBox bbox = {-180.0, 180.0, -80.0 * selectivities[sel], 80.0 * selectivities[sel]};
+			Range_Runs *runs = get_range_runs(in.lat, in.lon, in.num_rows, &bbox);
+
+			if (runs == NULL)
+				continue;
+
+			for (KernelId k = 0; k < NUM_KERNELS; k++) {
+				size_t elements = in.num_rows;
+				size_t elem_bytes = sizeof(double);
+
+				/* get_minmax doesn't depend on the bbox */
+				if (k == KERNEL_MINMAX && sel > 0)
+					continue;
+
+				if (k == KERNEL_RANGE)
+					elem_bytes = 2 * sizeof(double);
+
+				if (k == KERNEL_COUNT) {
+					elements = run_envelope(runs).max;
+					elem_bytes = sizeof(int);
+				}
+
+				if (k == KERNEL_COPY)
+					elements = count_run_rows(runs);
+
+				for (int source = 0; source < NUM_KERNEL_SOURCES; source++) {
+					size_t iterations = (KERNEL_BENCH_MIN_ELEMENTS + elements - 1) / elements;
+					double ns[KERNEL_BENCH_REPS];
+					char key[KERNEL_KEY_SIZE];
+
+					run_kernel(k, &in, source, &bbox, runs, 1);
+
+					for (size_t rep = 0; rep < KERNEL_BENCH_REPS; rep++) {
+						double start_time = get_time();
+
+						run_kernel(k, &in, source, &bbox, runs, iterations);
+						ns[rep] = (get_time() - start_time) * 1e9 / ((double)iterations * elements);
+					}
+
+					qsort(ns, KERNEL_BENCH_REPS, sizeof(double), compare_double);
+
+					snprintf(key, sizeof(key), "%s, %s, %zu, %g", kernel_names[k], source_names[source], elements,
+							 (k == KERNEL_MINMAX) ? 1.0 : selectivities[sel]);
+
+					printf("kernel, %s, %d, %.4f, %.4f, %.4f, %.3f\n", key, KERNEL_BENCH_REPS, ns[KERNEL_BENCH_REPS / 2],
+						   ns[0], ns[KERNEL_BENCH_REPS - 1], elem_bytes / ns[KERNEL_BENCH_REPS / 2]);
+
+					for (size_t b = 0; b < num_baseline; b++) {
+						if (strcmp(baseline[b].key, key))
+							continue;
+
+						double ratio = ns[KERNEL_BENCH_REPS / 2] / baseline[b].median_ns;
+						double tolerance = (baseline[b].median_ns * elements < KERNEL_SMALL_CASE_NS) ? KERNEL_SMALL_REGRESSION_TOLERANCE : KERNEL_REGRESSION_TOLERANCE;
+						/* Even the fastest repetition has to be slower, so one noisy run isn't a regression */
+						bool regressed = ratio > 1.0 + tolerance && ns[0] > baseline[b].median_ns;
+
+						printf("compare, %s, %.4f, %.4f, %.3f, %s\n", key, baseline[b].median_ns, ns[KERNEL_BENCH_REPS / 2],
+							   ratio, (regressed) ? "regression" : "ok");
+
+						compared++;
+						regressions += regressed;
+						break;
+					}
+				}
+			}
+
+			free_runs(runs);
+		}
+
+		free_kernel_inputs(&in, file_path);
+	}
+
+	if (baseline_path) {
+		printf("regressions, %zu, %zu\n", compared, regressions);
+	}
+
+	free(baseline);
+
+	return regressions;
+}
+
+/* Guess the photon runs of a track's segment runs from its mean photons per segment, widened by PREFETCH_MARGIN,
+ * and start fetching them for every photon dataset. Up to a quarter of the available budget is used. */
+void prefetch_photon_rows(Prefetcher *prefetcher, Manifest *manifest, const char *ground_track, Range_Runs *index_runs, size_t num_segments) {
+	char h5path[FILEPATH_BUFFER_SIZE];
+	size_t allowance = budget_available() / 4;
+
+	for (size_t d = 0; d < NUM_PHOTON_COUNT_DATASETS; d++) {
+		ManifestDataset *md = NULL;
+		Range_Runs estimate = {0, 0, NULL};
+		double per_segment = 0.0;
+
+		snprintf(h5path, sizeof(h5path), "%s/%s", ground_track, ph_count_datasets[d]);
+		md = get_manifest_dataset(manifest, h5path, NULL);
+		per_segment = (num_segments > 0) ? (double)md->ctx.dims[0] / num_segments : 0.0;
+
+		for (size_t r = 0; r < index_runs->num_runs; r++) {
+			double first = index_runs->runs[r].min * per_segment;
+			double last = index_runs->runs[r].max * per_segment;
+			double margin = (last - first) * PREFETCH_MARGIN;
+			Range_Indices run;
+
+			run.min = (first - margin > 0) ? (size_t)(first - margin) : 0;
+			run.max = (last + margin < md->ctx.dims[0]) ? (size_t)(last + margin) + 1 : md->ctx.dims[0];
+			append_run(&estimate, run);
+		}
+
+		allowance -= prefetch_rows(prefetcher, md, &estimate, allowance);
+		free(estimate.runs);
+	}
+}
+
+/* Run the three phases of the selection from the manifest alone: find the index range of each ground track
+ * from lat/lon, sum the photon counts, then read the selected rows of every dataset. The input file is only
+ * read by byte range and no HDF5 metadata is touched. Nothing is written, as with -readonly. */
+void run_manifest_selection(const char *manifest_location, const char *input_path, BBox *bbox) {
+	RangeSource source;
+	Manifest *manifest = NULL;
+	char h5path[FILEPATH_BUFFER_SIZE];
+	double load_time = get_time();
+
+	manifest = load_manifest(manifest_location);
+	load_time = get_time() - load_time;
+
+	open_range_source(&source, input_path);
+
+	for (size_t track = 0; track < NUM_GROUND_TRACKS; track++) {
+		ManifestDataset *lat = NULL;
+		ManifestDataset *lon = NULL;
+		ManifestDataset *count = NULL;
+		Range_Runs *index_runs = NULL;
+		Range_Runs *photon_runs = NULL;
+		Range_Indices envelope;
+		Range_Indices all_rows;
+		double *lat_arr = NULL;
+		double *lon_arr = NULL;
+		int *count_arr = NULL;
+		size_t *photon_index = NULL;
+		size_t slice_rows = 0;
+
+		snprintf(h5path, sizeof(h5path), "%s%s", ground_tracks[track], geolocation_lat);
+		lat = get_manifest_dataset(manifest, h5path, "<f8");
+
+		snprintf(h5path, sizeof(h5path), "%s%s", ground_tracks[track], geolocation_lon);
+		lon = get_manifest_dataset(manifest, h5path, "<f8");
+
+		if (lat->ctx.dims[0] != lon->ctx.dims[0]) {
+			FUNC_GOTO_ERROR("expected lat and lon arrays to have same shape")
+		}
+
+		/* Searched in slices like read_index_runs, leaving half the budget for range requests and decoding */
+		slice_rows = get_index_slice_rows(lat->ctx.dims[0], budget_available() / 2);
+		lat_arr = budget_calloc(slice_rows, sizeof(double));
+		lon_arr = budget_calloc(slice_rows, sizeof(double));
+
+		if ((index_runs = calloc(1, sizeof(*index_runs))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate memory for range runs")
+		}
+
+		for (all_rows.min = 0; all_rows.min < lat->ctx.dims[0]; all_rows.min = all_rows.max) {
+			all_rows.max = (lat->ctx.dims[0] - all_rows.min > slice_rows) ? all_rows.min + slice_rows : lat->ctx.dims[0];
+
+			read_range_manifest(&source, lat, all_rows, lat_arr);
+			read_range_manifest(&source, lon, all_rows, lon_arr);
+			append_slice_runs(index_runs, lat_arr, lon_arr, all_rows.max - all_rows.min, all_rows.min, bbox);
+		}
+
+		budget_free(lat_arr, slice_rows * sizeof(double));
+		budget_free(lon_arr, slice_rows * sizeof(double));
+
+		if (index_runs->num_runs == 0) {
+			free_runs(index_runs);
+			index_runs = NULL;
+		}
+
+		if (index_runs == NULL) {
+			PRINT_DEBUG("No index range found for ground track: %s, moving to next\n", ground_tracks[track])
+			continue;
+		}
+
+		/* Photons before each run give its first photon index, photons inside it the count */
+		snprintf(h5path, sizeof(h5path), "%s%s", ground_tracks[track], GEOLOCATION_PHOTON_DSET);
+		count = get_manifest_dataset(manifest, h5path, "<i4");
+
+		/* The photon reads start on a guess while the counts are read and summed */
+		if (prefetcher) {
+			prefetch_photon_rows(prefetcher, manifest, ground_tracks[track], index_runs, count->ctx.dims[0]);
+		}
+
+		envelope = run_envelope(index_runs);
+		count_arr = budget_calloc(envelope.max, sizeof(int));
+		all_rows.min = 0;
+		all_rows.max = envelope.max;
+		read_range_manifest(&source, count, all_rows, count_arr);
+
+		photon_index = get_photon_index(count_arr, envelope.max);
+		photon_runs = map_photon_runs(index_runs, photon_index);
+
+		budget_free(photon_index, (envelope.max + 1) * sizeof(size_t));
+		budget_free(count_arr, envelope.max * sizeof(int));
+
+		if (prefetcher) {
+			trim_prefetch(prefetcher, photon_runs);
+		}
+
+		PRINT_DEBUG("Got %zu index runs from %zu to %zu, %zu photons for %s\n", index_runs->num_runs, envelope.min, envelope.max, count_run_rows(photon_runs), ground_tracks[track])
+
+		for (size_t r_idx = 0; r_idx < NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS; r_idx++) {
+			bool is_reference = r_idx < NUM_REFERENCE_DATASETS;
+			const char *dset_name = (is_reference) ? reference_datasets[r_idx] : ph_count_datasets[r_idx - NUM_REFERENCE_DATASETS];
+			Range_Runs *runs = (is_reference) ? index_runs : photon_runs;
+			size_t num_rows = count_run_rows(runs);
+			ManifestDataset *md = NULL;
+			size_t row_bytes = 0;
+			size_t buf_rows = 0;
+			unsigned char *data = NULL;
+
+			snprintf(h5path, sizeof(h5path), "%s/%s", ground_tracks[track], dset_name);
+			md = get_manifest_dataset(manifest, h5path, NULL);
+
+			row_bytes = md->ctx.elem_size;
+
+			for (int i = 1; i < md->ctx.ndims; i++)
+				row_bytes *= md->ctx.dims[i];
+
+			/* Nothing is kept, so rows that don't fit in half the remaining budget are read in pieces */
+			buf_rows = budget_available() / 2 / row_bytes;
+
+			if (buf_rows == 0) {
+				FUNC_GOTO_ERROR("Memory budget too small for one row")
+			}
+
+			if (buf_rows > num_rows + 1)
+				buf_rows = num_rows + 1;
+
+			data = budget_calloc(buf_rows, row_bytes);
+
+			for (size_t r = 0; r < runs->num_runs; r++) {
+				Range_Indices piece;
+
+				for (piece.min = runs->runs[r].min; piece.min < runs->runs[r].max; piece.min = piece.max) {
+					piece.max = (runs->runs[r].max - piece.min > buf_rows) ? piece.min + buf_rows : runs->runs[r].max;
+					read_range_manifest(&source, md, piece, data);
+				}
+			}
+
+			bytes_copied += num_rows * row_bytes;
+			budget_free(data, buf_rows * row_bytes);
+		}
+
+		if (prefetcher) {
+			release_prefetch(prefetcher);
+		}
+
+		free_runs(index_runs);
+		free_runs(photon_runs);
+	}
+
+	/* "manifest, <seconds to load the manifest>, <range requests>, <bytes fetched>" */
+	printf("manifest, %.3f, %zu, %zu\n", load_time, source.num_requests, source.bytes_fetched);
+
+	close_range_source(&source);
+	free_manifest(manifest);
+}
+
+/* Open a dataset held by -serve, H5I_INVALID_HID on failure. Its chunk cache is an even share of the budget across every dataset
+ * of every granule that may be open at once, so repeat requests are served from decoded chunks. */
+hid_t open_served_dataset(hid_t fin, const char *h5path, size_t max_granules) {
+	hid_t dapl = H5I_INVALID_HID;
+	hid_t dset = H5I_INVALID_HID;
+	size_t nbytes = chunk_cache_budget / (max_granules * NUM_COPY_RANGE_DATASETS);
+
+	if ((dapl = H5Pcreate(H5P_DATASET_ACCESS)) == H5I_INVALID_HID)
+		return H5I_INVALID_HID;
+
+	if (get_backend() == BACKEND_REST_VOL || H5Pset_chunk_cache(dapl, CHUNK_CACHE_MIN_SLOTS, nbytes, 1.0) >= 0)
+		dset = H5Dopen(fin, h5path, dapl);
+
+	H5Pclose(dapl);
+
+	return dset;
+}
+
+/* Close what load_served_track opened, including a partly loaded track, and leave it empty */
+void close_served_track(ServedTrack *track) {
+	for (size_t r_idx = 0; r_idx < NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS; r_idx++) {
+		if (track->mem_types[r_idx] != H5I_INVALID_HID)
+			H5Tclose(track->mem_types[r_idx]);
+
+		if (track->dsets[r_idx] != H5I_INVALID_HID)
+			H5Dclose(track->dsets[r_idx]);
+
+		track->mem_types[r_idx] = H5I_INVALID_HID;
+		track->dsets[r_idx] = H5I_INVALID_HID;
+	}
+
+	if (track->lat)
+		budget_free(track->lat, track->num_segments * sizeof(double));
+
+	if (track->lon)
+		budget_free(track->lon, track->num_segments * sizeof(double));
+
+	if (track->photon_index)
+		budget_free(track->photon_index, (track->num_segments + 1) * sizeof(size_t));
+
+	track->lat = NULL;
+	track->lon = NULL;
+	track->photon_index = NULL;
+	track->num_segments = 0;
+}
+
+/* Read the geolocation of one ground track and open its datasets. A track missing from the granule is left empty.
+ * On failure the track is closed again and FAIL returned, so a bad granule doesn't end the server. */
+herr_t load_served_track(hid_t fin, const char *ground_track, size_t max_granules, ServedTrack *track) {
+	herr_t ret_value = SUCCEED;
+	char h5path[FILEPATH_BUFFER_SIZE];
+	hid_t lat_dset = H5I_INVALID_HID;
+	hid_t lon_dset = H5I_INVALID_HID;
+	hid_t count_dset = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hssize_t num_segments = 0;
+	int *counts = NULL;
+
+	memset(track, 0, sizeof(*track));
+
+	for (size_t r_idx = 0; r_idx < NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS; r_idx++) {
+		track->dsets[r_idx] = H5I_INVALID_HID;
+		track->mem_types[r_idx] = H5I_INVALID_HID;
+	}
+
+	snprintf(h5path, sizeof(h5path), "%s%s", ground_track, geolocation_lat);
+
+	H5E_BEGIN_TRY
+	{
+		lat_dset = H5Dopen(fin, h5path, H5P_DEFAULT);
+	}
+	H5E_END_TRY
+
+	if (lat_dset == H5I_INVALID_HID) {
+		PRINT_DEBUG("No ground track %s in granule\n", ground_track)
+		return SUCCEED;
+	}
+
+	snprintf(h5path, sizeof(h5path), "%s%s", ground_track, geolocation_lon);
+
+	if ((lon_dset = H5Dopen(fin, h5path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_FAIL("Failed to open lon dataset")
+	}
+
+	snprintf(h5path, sizeof(h5path), "%s%s", ground_track, GEOLOCATION_PHOTON_DSET);
+
+	if ((count_dset = H5Dopen(fin, h5path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_FAIL("Failed to open photon count dataset")
+	}
+
+	if ((space = H5Dget_space(lat_dset)) == H5I_INVALID_HID || (num_segments = H5Sget_simple_extent_npoints(space)) < 0) {
+		FUNC_GOTO_FAIL("Failed to get number of segments")
+	}
+
+	track->num_segments = num_segments;
+
+	/* Held against the memory budget for as long as the granule stays open */
+	if ((track->lat = budget_try_calloc(track->num_segments, sizeof(double))) == NULL ||
+		(track->lon = budget_try_calloc(track->num_segments, sizeof(double))) == NULL ||
+		(track->photon_index = budget_try_calloc(track->num_segments + 1, sizeof(size_t))) == NULL) {
+		FUNC_GOTO_FAIL("Geolocation of served track doesn't fit in the memory budget")
+	}
+
+	if ((counts = budget_try_calloc(track->num_segments, sizeof(int))) == NULL) {
+		FUNC_GOTO_FAIL("Photon counts of served track don't fit in the memory budget")
+	}
+
+	if (H5Dread(lat_dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, track->lat) < 0) {
+		FUNC_GOTO_FAIL("Failed to read from lat dataset")
+	}
+
+	if (H5Dread(lon_dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, track->lon) < 0) {
+		FUNC_GOTO_FAIL("Failed to read from lon dataset")
+	}
+
+	if (H5Dread(count_dset, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, counts) < 0) {
+		FUNC_GOTO_FAIL("Failed to read from photon count dataset")
+	}
+
+	track->photon_index[0] = 0;
+
+	for (size_t j = 0; j < track->num_segments; j++) {
+		if (counts[j] < 0) {
+			FUNC_GOTO_FAIL("Photon count cannot be negative!")
+		}
+
+		track->photon_index[j + 1] = track->photon_index[j] + counts[j];
+	}
+
+	for (size_t r_idx = 0; r_idx < NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS; r_idx++) {
+		const char *dset_name = (r_idx < NUM_REFERENCE_DATASETS) ? reference_datasets[r_idx] : ph_count_datasets[r_idx - NUM_REFERENCE_DATASETS];
+		hid_t dtype = H5I_INVALID_HID;
+
+		snprintf(h5path, sizeof(h5path), "%s/%s", ground_track, dset_name);
+
+		if ((track->dsets[r_idx] = open_served_dataset(fin, h5path, max_granules)) == H5I_INVALID_HID) {
+			FUNC_GOTO_FAIL("Failed to open dataset of served granule")
+		}
+
+		if ((dtype = H5Dget_type(track->dsets[r_idx])) == H5I_INVALID_HID) {
+			FUNC_GOTO_FAIL("Failed to get type of served dataset")
+		}
+
+		track->mem_types[r_idx] = H5Tget_native_type(dtype, H5T_DIR_DEFAULT);
+		H5Tclose(dtype);
+
+		if (track->mem_types[r_idx] == H5I_INVALID_HID) {
+			FUNC_GOTO_FAIL("Failed to get native type of served dataset")
+		}
+	}
+
+done:
+	if (counts)
+		budget_free(counts, track->num_segments * sizeof(int));
+
+	if (space != H5I_INVALID_HID)
+		H5Sclose(space);
+
+	if (count_dset != H5I_INVALID_HID)
+		H5Dclose(count_dset);
+
+	if (lon_dset != H5I_INVALID_HID)
+		H5Dclose(lon_dset);
+
+	H5Dclose(lat_dset);
+
+	if (ret_value < 0) {
+		fprintf(stderr, "Failed to load ground track %s\n", ground_track);
+		close_served_track(track);
+	}
+
+	return ret_value;
+}
+
+void close_served_granule(ServedGranule *granule) {
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		close_served_track(&granule->tracks[i]);
+	}
+
+	H5Fclose(granule->fin);
+	memset(granule, 0, sizeof(*granule));
+}
+
+/* Return the open granule at path, opening it in place of the least recently used one if it isn't open.
+ * hit tells which happened. NULL if the file can't be opened or its tracks can't be loaded. */
+ServedGranule *get_served_granule(GranuleCache *cache, const char *path, bool *hit) {
+	ServedGranule *granule = NULL;
+	ServedTrack tracks[NUM_GROUND_TRACKS];
+	PageLayout page_layout;
+	size_t page_buf_size = 0;
+	unsigned min_meta_perc = 0;
+	hid_t fin = H5I_INVALID_HID;
+
+	cache->clock++;
+
+	for (size_t i = 0; i < cache->count; i++) {
+		if (!strcmp(cache->granules[i].path, path)) {
+			*hit = true;
+			cache->granules[i].last_used = cache->clock;
+			return &cache->granules[i];
+		}
+	}
+
+	*hit = false;
+
+	/* Each granule gets a page buffer sized for its own layout. A bad path in a request must not end the server. */
+	if ((fin = open_input(path, cache->fapl_id, cache->config, &page_layout, &page_buf_size, &min_meta_perc)) == H5I_INVALID_HID)
+		return NULL;
+
+	/* Loaded before a granule is evicted, so a failed load leaves the cache as it was */
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		if (load_served_track(fin, ground_tracks[i], cache->capacity, &tracks[i]) < 0) {
+			for (size_t j = 0; j < i; j++)
+				close_served_track(&tracks[j]);
+
+			H5Fclose(fin);
+			return NULL;
+		}
+	}
+
+	if (cache->count < cache->capacity) {
+		granule = &cache->granules[cache->count++];
+	}
+	else {
+		granule = &cache->granules[0];
+
+		for (size_t i = 1; i < cache->count; i++) {
+			if (cache->granules[i].last_used < granule->last_used)
+				granule = &cache->granules[i];
+		}
+
+		PRINT_DEBUG("Closing least recently used granule %s\n", granule->path)
+		close_served_granule(granule);
+	}
+
+	snprintf(granule->path, sizeof(granule->path), "%s", path);
+	granule->fin = fin;
+	granule->last_used = cache->clock;
+	memcpy(granule->tracks, tracks, sizeof(tracks));
+
+	return granule;
+}
+
+/* Read the rows of every run of a dataset back to back, setting nbytes to the size of the returned buffer.
+ * NULL if they can't be read or don't fit in the memory budget. */
+void *read_served_rows(hid_t dset, hid_t mem_type, Range_Runs *runs, size_t *nbytes) {
+	herr_t ret_value = SUCCEED;
+	hid_t file_space = H5I_INVALID_HID;
+	hid_t mem_space = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	hsize_t start[H5S_MAX_RANK];
+	int ndims = 0;
+	size_t row_bytes = H5Tget_size(mem_type);
+	size_t num_rows = count_run_rows(runs);
+	void *buf = NULL;
+
+	*nbytes = 0;
+
+	if ((file_space = H5Dget_space(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_FAIL("Failed to get dataspace of served dataset")
+	}
+
+	if ((ndims = H5Sget_simple_extent_dims(file_space, dims, NULL)) < 0) {
+		FUNC_GOTO_FAIL("Failed to get dataspace dim size")
+	}
+
+	for (int i = 1; i < ndims; i++)
+		row_bytes *= dims[i];
+
+	*nbytes = num_rows * row_bytes;
+
+	if ((buf = budget_try_calloc(*nbytes + 1, 1)) == NULL) {
+		FUNC_GOTO_FAIL("Served rows don't fit in the memory budget")
+	}
+
+	if (*nbytes == 0)
+		goto done;
+
+	if (parallel_decode && read_runs_parallel(dset, mem_type, runs, buf))
+		goto done;
+
+	memset(start, 0, sizeof(start));
+
+	for (size_t r = 0; r < runs->num_runs; r++) {
+		start[0] = runs->runs[r].min;
+		dims[0] = runs->runs[r].max - runs->runs[r].min;
+
+		if (H5Sselect_hyperslab(file_space, (r == 0) ? H5S_SELECT_SET : H5S_SELECT_OR, start, NULL, dims, NULL) < 0) {
+			FUNC_GOTO_FAIL("Failed to select hyperslab of served rows")
+		}
+	}
+
+	dims[0] = num_rows;
+
+	if ((mem_space = H5Screate_simple(ndims, dims, NULL)) == H5I_INVALID_HID) {
+		FUNC_GOTO_FAIL("Failed to create simple dataspace")
+	}
+
+	if (H5Dread(dset, mem_type, mem_space, file_space, H5P_DEFAULT, buf) < 0) {
+		FUNC_GOTO_FAIL("Failed to read from dset with hyperslab selection")
+	}
+
+done:
+	if (mem_space != H5I_INVALID_HID)
+		H5Sclose(mem_space);
+
+	if (file_space != H5I_INVALID_HID)
+		H5Sclose(file_space);
+
+	if (ret_value < 0 && buf) {
+		budget_free(buf, *nbytes + 1);
+		buf = NULL;
+	}
+
+	return buf;
+}
+
+/* Answer one request line, "<subset|ranges> <granule> <min_lon> <max_lon> <min_lat> <max_lat>". Granule paths
+ * are relative to input_foldername unless absolute or a URL, "-" is input_filename. Returns false on "quit". */
+bool serve_request(GranuleCache *cache, char *line, FILE *out) {
+	char command[16];
+	char granule_name[FILEPATH_BUFFER_SIZE];
+	char path[FILEPATH_BUFFER_SIZE];
+	ServedGranule *granule = NULL;
+	BBox bbox;
+	bool send_data = false;
+	bool hit = false;
+	size_t bytes_sent = 0;
+	double start_time = get_time();
+
+	if (sscanf(line, "%15s", command) == 1 && !strcmp(command, "quit"))
+		return false;
+
+	if (sscanf(line, "%15s %1023s %lf %lf %lf %lf", command, granule_name, &bbox.min_lon, &bbox.max_lon, &bbox.min_lat, &bbox.max_lat) != 6 ||
+		(strcmp(command, "subset") && strcmp(command, "ranges"))) {
+		fprintf(out, "error, expected <subset|ranges> <granule> <min_lon> <max_lon> <min_lat> <max_lat>\n");
+		return true;
+	}
+
+	/* The searches compare lon against one interval, so a box across the antimeridian is sent as two */
+	if (bbox.min_lon > bbox.max_lon && bbox.min_lon <= 180.0 && bbox.max_lon >= -180.0) {
+		fprintf(out, "error, bounding box crosses the antimeridian, split it into two at 180\n");
+		return true;
+	}
+
+	if (bbox.min_lon < -180.0 || bbox.max_lon > 180.0 || bbox.max_lon <= bbox.min_lon ||
+		bbox.min_lat < -90.0 || bbox.max_lat > 90.0 || bbox.max_lat <= bbox.min_lat) {
+		fprintf(out, "error, invalid bounding box\n");
+		return true;
+	}
+
+	send_data = !strcmp(command, "subset");
+
+	if (!strcmp(granule_name, "-"))
+		snprintf(path, sizeof(path), "%s%s", cache->config->input_foldername, cache->config->input_filename);
+	else if (granule_name[0] == '/' || strstr(granule_name, "://"))
+		snprintf(path, sizeof(path), "%s", granule_name);
+	else
+		snprintf(path, sizeof(path), "%s%s", cache->config->input_foldername, granule_name);
+
+	if ((granule = get_served_granule(cache, path, &hit)) == NULL) {
+		fprintf(out, "error, failed to load %s\n", path);
+		return true;
+	}
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		ServedTrack *track = &granule->tracks[i];
+		Range_Runs *index_runs = NULL;
+		Range_Runs *photon_runs = NULL;
+		Range_Indices envelope;
+
+		if (track->num_segments > 0)
+			index_runs = get_range_runs(track->lat, track->lon, track->num_segments, &bbox);
+
+		/* "track, <ground track>, <first segment>, <end segment>, <first photon>, <end photon>", -1 when not hit */
+		if (index_runs == NULL) {
+			fprintf(out, "track, %s, -1, -1, -1, -1\n", ground_tracks[i]);
+			continue;
+		}
+
+		envelope = run_envelope(index_runs);
+		photon_runs = map_photon_runs(index_runs, track->photon_index);
+
+		fprintf(out, "track, %s, %zu, %zu, %zu, %zu\n", ground_tracks[i], envelope.min, envelope.max,
+				track->photon_index[envelope.min], track->photon_index[envelope.max]);
+
+		/* "run, <first segment>, <end segment>, <first photon>, <end photon>" for each run of the selection */
+		for (size_t r = 0; r < index_runs->num_runs; r++) {
+			Range_Indices run = index_runs->runs[r];
+
+			fprintf(out, "run, %zu, %zu, %zu, %zu\n", run.min, run.max, track->photon_index[run.min], track->photon_index[run.max]);
+		}
+
+		/* "data, <h5path>, <rows>, <bytes>" followed by the rows in native byte order */
+		for (size_t r_idx = 0; send_data && r_idx < NUM_REFERENCE_DATASETS + NUM_PHOTON_COUNT_DATASETS; r_idx++) {
+			bool is_reference = r_idx < NUM_REFERENCE_DATASETS;
+			const char *dset_name = (is_reference) ? reference_datasets[r_idx] : ph_count_datasets[r_idx - NUM_REFERENCE_DATASETS];
+			Range_Runs *runs = (is_reference) ? index_runs : photon_runs;
+			size_t nbytes = 0;
+			void *data = read_served_rows(track->dsets[r_idx], track->mem_types[r_idx], runs, &nbytes);
+
+			/* An error line ends the response in place of the result line */
+			if (data == NULL) {
+				fprintf(out, "error, failed to read %s/%s\n", ground_tracks[i], dset_name);
+				free_runs(index_runs);
+				free_runs(photon_runs);
+				return true;
+			}
+
+			fprintf(out, "data, %s/%s, %zu, %zu\n", ground_tracks[i], dset_name, count_run_rows(runs), nbytes);
+			fwrite(data, 1, nbytes, out);
+			bytes_sent += nbytes;
+			budget_free(data, nbytes + 1);
+		}
+
+		free_runs(index_runs);
+		free_runs(photon_runs);
+	}
+
+	/* "result, <seconds>, <bytes>, <hit|miss>" ends every response */
+	fprintf(out, "result, %.6f, %zu, %s\n", get_time() - start_time, bytes_sent, (hit) ? "hit" : "miss");
+
+	return true;
+}
+
+/* Keep granules open and answer subset requests from one client at a time on a Unix socket until "quit" */
+void run_server(const char *socket_path, ConfigValues *config, hid_t fapl_id) {
+	GranuleCache cache;
+	struct sockaddr_un addr;
+	int listen_fd = -1;
+	bool running = true;
+	char *line = NULL;
+	size_t line_size = 0;
+
+	memset(&cache, 0, sizeof(cache));
+	cache.capacity = (config->serve_max_granules > 0) ? config->serve_max_granules : 1;
+	cache.fapl_id = fapl_id;
+	cache.config = config;
+
+	if ((cache.granules = calloc(cache.capacity, sizeof(ServedGranule))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate granule cache")
+	}
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		FUNC_GOTO_ERROR("Socket path is too long")
+	}
+
+	/* A client hanging up mid-response must not end the server */
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	unlink(socket_path);
+
+	if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+		bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(listen_fd, 8) < 0) {
+		FUNC_GOTO_ERROR("Failed to listen on socket")
+	}
+
+	printf("serving, %s, %zu\n", socket_path, cache.capacity);
+	fflush(stdout);
+
+	while (running) {
+		int conn_fd = accept(listen_fd, NULL, NULL);
+		int out_fd = -1;
+		FILE *in = NULL;
+		FILE *out = NULL;
+
+		if (conn_fd < 0)
+			continue;
+
+		in = fdopen(conn_fd, "r");
+		out = ((out_fd = dup(conn_fd)) >= 0) ? fdopen(out_fd, "w") : NULL;
+
+		/* Without its streams the connection gets its error on the socket itself, and the server goes on */
+		if (in == NULL || out == NULL) {
+			dprintf(conn_fd, "error, failed to open connection streams\n");
+
+			if (out)
+				fclose(out);
+			else if (out_fd >= 0)
+				close(out_fd);
+
+			if (in)
+				fclose(in);
+			else
+				close(conn_fd);
+
+			continue;
+		}
+
+		while (running && getline(&line, &line_size, in) > 0) {
+			if (strlen(line) > SERVE_MAX_REQUEST) {
+				fprintf(out, "error, request too long\n");
+			}
+			else {
+				running = serve_request(&cache, line, out);
+			}
+
+			if (fflush(out) != 0)
+				break;
+		}
+
+		fclose(out);
+		fclose(in);
+	}
+
+	for (size_t i = 0; i < cache.count; i++) {
+		close_served_granule(&cache.granules[i]);
+	}
+
+	free(line);
+	free(cache.granules);
+	close(listen_fd);
+	unlink(socket_path);
+}
+
+#ifdef USE_MPI
+/* Read the granules of a distributed run, one per line of list_path resolved like the granule of a -serve request.
+ * Without a list the run is over input_filename alone. The array is freed by the caller. */
+char **read_granule_list(const char *list_path, ConfigValues *config, size_t *num_granules) {
+	char **granules = NULL;
+	size_t max_granules = 1;
+	char *line = NULL;
+	size_t line_size = 0;
+	FILE *f = NULL;
+
+	*num_granules = 0;
+
+	if ((granules = calloc(max_granules, sizeof(char *))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate granule list")
+	}
+
+	if (list_path == NULL) {
+		granules[(*num_granules)++] = arena_printf(&run_arena, "%s%s", config->input_foldername, config->input_filename);
+		return granules;
+	}
+
+	if ((f = fopen(list_path, "r")) == NULL) {
+		FUNC_GOTO_ERROR("Failed to open granule list")
+	}
+
+	while (getline(&line, &line_size, f) > 0) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		if (*num_granules == max_granules) {
+			max_granules *= 2;
+
+			if ((granules = realloc(granules, max_granules * sizeof(char *))) == NULL) {
+				FUNC_GOTO_ERROR("Failed to allocate granule list")
+			}
+		}
+
+		if (line[0] == '/' || strstr(line, "://"))
+			granules[(*num_granules)++] = arena_printf(&run_arena, "%s", line);
+		else
+			granules[(*num_granules)++] = arena_printf(&run_arena, "%s%s", config->input_foldername, line);
+	}
+
+	free(line);
+	fclose(f);
+
+	if (*num_granules == 0) {
+		FUNC_GOTO_ERROR("No granules in granule list")
+	}
+
+	return granules;
+}
+
+/* Rank that searches a track. Whole granules go to ranks while there are at least as many granules as ranks,
+ * otherwise the tracks of every granule are spread across them. */
+int get_track_owner(DistTrack *track, size_t num_granules, int size) {
+	if (num_granules >= (size_t)size)
+		return (int)(track->granule % size);
+
+	return (int)((track->granule * NUM_GROUND_TRACKS + track->track) % size);
+}
+
+/* Find the runs of the tracks this rank owns, opening each of their granules once */
+void find_dist_runs(char **granules, size_t num_granules, DistTrack *tracks, BBox *bbox, hid_t fapl_id, int rank, int size) {
+	for (size_t g = 0; g < num_granules; g++) {
+		hid_t fin = H5I_INVALID_HID;
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			DistTrack *track = &tracks[g * NUM_GROUND_TRACKS + i];
+			ServedTrack served;
+
+			if (get_track_owner(track, num_granules, size) != rank)
+				continue;
+
+			if (fin == H5I_INVALID_HID && (fin = H5Fopen(granules[g], H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to open granule of distributed run")
+			}
+
+			if (load_served_track(fin, ground_tracks[i], 1, &served) < 0) {
+				FUNC_GOTO_ERROR("Failed to load track of distributed run")
+			}
+
+			if (served.num_segments > 0)
+				track->index_runs = get_range_runs(served.lat, served.lon, served.num_segments, bbox);
+
+			if (track->index_runs)
+				track->photon_runs = map_photon_runs(track->index_runs, served.photon_index);
+
+			close_served_track(&served);
+		}
+
+		if (fin != H5I_INVALID_HID)
+			H5Fclose(fin);
+	}
+}
+
+/* Give every rank the runs that each rank found, sent as {track, kind, min, max} with kind 0 for segment runs and 1 for photon runs */
+void share_dist_runs(DistTrack *tracks, size_t num_tracks, size_t num_granules, int rank, int size) {
+	uint64_t *sent = NULL;
+	uint64_t *received = NULL;
+	size_t num_sent = 0;
+	int *counts = NULL;
+	int *displs = NULL;
+	int num_values = 0;
+	size_t num_received = 0;
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		if (tracks[t].index_runs)
+			num_sent += 4 * (tracks[t].index_runs->num_runs + tracks[t].photon_runs->num_runs);
+	}
+
+	if ((sent = calloc(num_sent + 1, sizeof(uint64_t))) == NULL || (counts = calloc(size, sizeof(int))) == NULL ||
+		(displs = calloc(size, sizeof(int))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate runs to share")
+	}
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		for (uint64_t kind = 0; tracks[t].index_runs && kind < 2; kind++) {
+			Range_Runs *runs = (kind) ? tracks[t].photon_runs : tracks[t].index_runs;
+
+			for (size_t r = 0; r < runs->num_runs; r++) {
+				sent[num_values++] = t;
+				sent[num_values++] = kind;
+				sent[num_values++] = runs->runs[r].min;
+				sent[num_values++] = runs->runs[r].max;
+			}
+		}
+	}
+
+	MPI_Allgather(&num_values, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+
+	for (int r = 0; r < size; r++) {
+		displs[r] = (int)num_received;
+		num_received += counts[r];
+	}
+
+	if ((received = calloc(num_received + 1, sizeof(uint64_t))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate shared runs")
+	}
+
+	MPI_Allgatherv(sent, num_values, MPI_UINT64_T, received, counts, displs, MPI_UINT64_T, MPI_COMM_WORLD);
+
+	for (size_t i = 0; i < num_received; i += 4) {
+		DistTrack *track = &tracks[received[i]];
+		Range_Runs **runs = (received[i + 1]) ? &track->photon_runs : &track->index_runs;
+
+		if (get_track_owner(track, num_granules, size) == rank)
+			continue;
+
+		if (*runs == NULL && (*runs = calloc(1, sizeof(**runs))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate memory for range runs")
+		}
+
+		append_run(*runs, (Range_Indices){received[i + 2], received[i + 3]});
+	}
+
+	/* Segments that hold no photons send no photon runs */
+	for (size_t t = 0; t < num_tracks; t++) {
+		if (tracks[t].index_runs && tracks[t].photon_runs == NULL && (tracks[t].photon_runs = calloc(1, sizeof(Range_Runs))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate memory for photon runs")
+		}
+	}
+
+	free(received);
+	free(displs);
+	free(counts);
+	free(sent);
+}
+
+/* Larger pieces first, then in track order so every rank sorts them the same */
+int compare_dist_pieces(const void *a, const void *b) {
+	const DistPiece *pa = *(const DistPiece **)a;
+	const DistPiece *pb = *(const DistPiece **)b;
+
+	if (pa->rows != pb->rows)
+		return (pa->rows > pb->rows) ? -1 : 1;
+
+	return (pa < pb) ? -1 : (pa > pb);
+}
+
+/* Cut the selected photons of each track into pieces and give the largest pieces first to the rank with the fewest
+ * rows so far. Every rank plans from the same shared runs, so they all agree on the plan without sending it. */
+DistPiece *plan_dist_pieces(DistTrack *tracks, size_t num_tracks, int size, size_t *num_pieces) {
+	DistPiece *pieces = NULL;
+	DistPiece **order = NULL;
+	size_t *rank_rows = NULL;
+	size_t total_rows = 0;
+	size_t piece_rows = 0;
+
+	*num_pieces = 0;
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		if (tracks[t].index_runs)
+			total_rows += count_run_rows(tracks[t].photon_runs);
+	}
+
+	piece_rows = (total_rows + size * DIST_PIECES_PER_RANK - 1) / (size * DIST_PIECES_PER_RANK);
+
+	if (piece_rows < DIST_MIN_PIECE_ROWS)
+		piece_rows = DIST_MIN_PIECE_ROWS;
+
+	if (piece_rows > DIST_MAX_PIECE_ROWS)
+		piece_rows = DIST_MAX_PIECE_ROWS;
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		if (tracks[t].index_runs == NULL)
+			continue;
+
+		tracks[t].first_piece = *num_pieces;
+		tracks[t].num_pieces = (count_run_rows(tracks[t].photon_runs) + piece_rows - 1) / piece_rows;
+
+		/* A track whose segments hold no photons still copies its reference datasets */
+		if (tracks[t].num_pieces == 0)
+			tracks[t].num_pieces = 1;
+
+		*num_pieces += tracks[t].num_pieces;
+	}
+
+	if ((pieces = calloc(*num_pieces + 1, sizeof(DistPiece))) == NULL || (order = calloc(*num_pieces + 1, sizeof(DistPiece *))) == NULL ||
+		(rank_rows = calloc(size, sizeof(size_t))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate pieces of distributed run")
+	}
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		size_t photons = (tracks[t].index_runs) ? count_run_rows(tracks[t].photon_runs) : 0;
+
+		for (size_t j = 0; j < tracks[t].num_pieces; j++) {
+			DistPiece *piece = &pieces[tracks[t].first_piece + j];
+
+			piece->track = t;
+			piece->index = j;
+			piece->first_row = j * piece_rows;
+			piece->end_row = (photons - piece->first_row > piece_rows) ? piece->first_row + piece_rows : photons;
+			piece->rows = piece->end_row - piece->first_row;
+
+			if (j == 0)
+				piece->rows += count_run_rows(tracks[t].index_runs);
+
+			order[tracks[t].first_piece + j] = piece;
+		}
+	}
+
+	qsort(order, *num_pieces, sizeof(DistPiece *), compare_dist_pieces);
+
+	for (size_t p = 0; p < *num_pieces; p++) {
+		int least = 0;
+
+		for (int r = 1; r < size; r++) {
+			if (rank_rows[r] < rank_rows[least])
+				least = r;
+		}
+
+		order[p]->rank = least;
+		rank_rows[least] += order[p]->rows;
+	}
+
+	PRINT_DEBUG("Cut %zu photons into %zu pieces of up to %zu rows\n", total_rows, *num_pieces, piece_rows)
+
+	free(rank_rows);
+	free(order);
+
+	return pieces;
+}
+
+/* Runs of the rows [first, end) of the rows of runs taken back to back */
+Range_Runs *slice_runs(Range_Runs *runs, size_t first, size_t end) {
+	Range_Runs *slice = NULL;
+	size_t row = 0;
+
+	if ((slice = calloc(1, sizeof(*slice))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate memory for range runs")
+	}
+
+	for (size_t r = 0; r < runs->num_runs && row < end; r++) {
+		Range_Indices run = runs->runs[r];
+		size_t len = run.max - run.min;
+
+		if (row + len > first) {
+			run.min += (first > row) ? first - row : 0;
+			run.max -= (row + len > end) ? row + len - end : 0;
+			append_run(slice, run);
+		}
+
+		row += len;
+	}
+
+	return slice;
+}
+
+/* Create a dataset of rows rows, typed and shaped like the rows of src, creating any missing groups of path */
+hid_t create_dist_dataset(hid_t loc, const char *path, hid_t src, size_t rows, hid_t dcpl) {
+	hid_t src_space = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t dtype = H5I_INVALID_HID;
+	hid_t lcpl = H5I_INVALID_HID;
+	hid_t dset = H5I_INVALID_HID;
+	hsize_t dims[H5S_MAX_RANK];
+	int ndims = 0;
+
+	src_space = H5Dget_space(src);
+
+	if ((ndims = H5Sget_simple_extent_dims(src_space, dims, NULL)) < 0) {
+		FUNC_GOTO_ERROR("Failed to get dataspace dim size")
+	}
+
+	dims[0] = rows;
+
+	if ((space = H5Screate_simple(ndims, dims, NULL)) == H5I_INVALID_HID || (dtype = H5Dget_type(src)) == H5I_INVALID_HID ||
+		(lcpl = H5Pcreate(H5P_LINK_CREATE)) == H5I_INVALID_HID || H5Pset_create_intermediate_group(lcpl, 1) < 0) {
+		FUNC_GOTO_ERROR("Failed to set up dataset of distributed run")
+	}
+
+	if ((dset = H5Dcreate(loc, path, dtype, space, lcpl, dcpl, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create dataset of distributed run")
+	}
+
+	H5Pclose(lcpl);
+	H5Tclose(dtype);
+	H5Sclose(space);
+	H5Sclose(src_space);
+
+	return dset;
+}
+
+/* Create a group for each granule with its path as the "source" attribute, and one for each track with a selection
+ * with its runs as the "index_runs" attribute, like a selection run writes */
+void create_dist_groups(hid_t fout, char **granules, size_t num_granules, DistTrack *tracks) {
+	hid_t scalar = H5Screate(H5S_SCALAR);
+
+	for (size_t g = 0; g < num_granules; g++) {
+		char *name = arena_printf(&run_arena, "granule_%zu", g);
+		hid_t group = H5I_INVALID_HID;
+		hid_t str_type = H5Tcopy(H5T_C_S1);
+		hid_t attr = H5I_INVALID_HID;
+
+		if ((group = H5Gcreate(fout, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create granule group")
+		}
+
+		H5Tset_size(str_type, strlen(granules[g]) + 1);
+
+		if ((attr = H5Acreate(group, "source", str_type, scalar, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID ||
+			H5Awrite(attr, str_type, granules[g]) < 0) {
+			FUNC_GOTO_ERROR("Failed to write granule source attribute")
+		}
+
+		H5Aclose(attr);
+		H5Tclose(str_type);
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			Range_Runs *runs = tracks[g * NUM_GROUND_TRACKS + i].index_runs;
+			hsize_t runs_dims[2];
+			hsize_t *runs_data = NULL;
+			hid_t track_group = H5I_INVALID_HID;
+			hid_t runs_space = H5I_INVALID_HID;
+
+			if (runs == NULL)
+				continue;
+
+			if ((track_group = H5Gcreate(group, ground_tracks[i], H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to create track group")
+			}
+
+			runs_dims[0] = runs->num_runs;
+			runs_dims[1] = 2;
+			runs_data = arena_alloc(&run_arena, runs->num_runs * 2 * sizeof(hsize_t));
+
+			for (size_t r = 0; r < runs->num_runs; r++) {
+				runs_data[2 * r] = runs->runs[r].min;
+				runs_data[2 * r + 1] = runs->runs[r].max;
+			}
+
+			runs_space = H5Screate_simple(2, runs_dims, NULL);
+
+			if ((attr = H5Acreate(track_group, "index_runs", H5T_NATIVE_HSIZE, runs_space, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID ||
+				H5Awrite(attr, H5T_NATIVE_HSIZE, runs_data) < 0) {
+				FUNC_GOTO_ERROR("Failed to write index runs attribute")
+			}
+
+			H5Aclose(attr);
+			H5Sclose(runs_space);
+			H5Gclose(track_group);
+		}
+
+		H5Gclose(group);
+	}
+
+	H5Sclose(scalar);
+}
+
+/* Create the datasets of the subset of every track with a selection, NUM_DIST_DATASETS per track in dsets. When
+ * rank_prefix is given, each is a virtual dataset mapping the pieces in the rank files named after it. */
+void create_dist_datasets(hid_t fout, char **granules, DistTrack *tracks, size_t num_tracks, DistPiece *pieces,
+						  const char *rank_prefix, hid_t fapl_id, hid_t *dsets) {
+	char h5path[FILEPATH_BUFFER_SIZE];
+	hid_t fin = H5I_INVALID_HID;
+	size_t open_granule = SIZE_MAX;
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		DistTrack *track = &tracks[t];
+
+		if (track->index_runs == NULL)
+			continue;
+
+		if (track->granule != open_granule) {
+			if (fin != H5I_INVALID_HID)
+				H5Fclose(fin);
+
+			if ((fin = H5Fopen(granules[track->granule], H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to open granule of distributed run")
+			}
+
+			open_granule = track->granule;
+		}
+
+		for (size_t r_idx = 0; r_idx < NUM_DIST_DATASETS; r_idx++) {
+			bool is_reference = r_idx < NUM_REFERENCE_DATASETS;
+			const char *dset_name = (is_reference) ? reference_datasets[r_idx] : ph_count_datasets[r_idx - NUM_REFERENCE_DATASETS];
+			Range_Runs *runs = (is_reference) ? track->index_runs : track->photon_runs;
+			size_t rows = count_run_rows(runs);
+			hid_t src = H5I_INVALID_HID;
+			hid_t dcpl = H5P_DEFAULT;
+
+			snprintf(h5path, sizeof(h5path), "%s/%s", ground_tracks[track->track], dset_name);
+
+			if ((src = H5Dopen(fin, h5path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to open dataset of distributed run")
+			}
+
+			if (rank_prefix) {
+				hid_t space = H5Dget_space(src);
+				hid_t vspace = H5I_INVALID_HID;
+				hid_t src_space = H5I_INVALID_HID;
+				hsize_t start[H5S_MAX_RANK];
+				hsize_t count[H5S_MAX_RANK];
+				int ndims = H5Sget_simple_extent_dims(space, count, NULL);
+
+				memset(start, 0, sizeof(start));
+				count[0] = rows;
+
+				if ((dcpl = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID || (vspace = H5Screate_simple(ndims, count, NULL)) == H5I_INVALID_HID) {
+					FUNC_GOTO_ERROR("Failed to set up virtual dataset")
+				}
+
+				for (size_t j = 0; j < track->num_pieces; j++) {
+					DistPiece *piece = &pieces[track->first_piece + j];
+					char *src_file = NULL;
+					char *src_dset = NULL;
+
+					if (is_reference && j > 0)
+						break;
+
+					start[0] = (is_reference) ? 0 : piece->first_row;
+					count[0] = (is_reference) ? rows : piece->end_row - piece->first_row;
+
+					if (count[0] == 0)
+						continue;
+
+					/* Named relative to the output, so the rank files are found next to it */
+					src_file = arena_printf(&run_arena, "%s.rank%d.h5", rank_prefix, piece->rank);
+					src_dset = arena_printf(&run_arena, "/granule_%zu/%s/piece_%zu/%s", track->granule, ground_tracks[track->track], j, dset_name);
+
+					if (0 > H5Sselect_hyperslab(vspace, H5S_SELECT_SET, start, NULL, count, NULL) ||
+						(src_space = H5Screate_simple(ndims, count, NULL)) == H5I_INVALID_HID) {
+						FUNC_GOTO_ERROR("Failed to select rows of virtual dataset")
+					}
+
+					if (H5Pset_virtual(dcpl, vspace, src_file, src_dset, src_space) < 0) {
+						FUNC_GOTO_ERROR("Failed to add virtual mapping")
+					}
+
+					H5Sclose(src_space);
+				}
+
+				H5Sclose(vspace);
+				H5Sclose(space);
+			}
+
+			snprintf(h5path, sizeof(h5path), "granule_%zu/%s/%s", track->granule, ground_tracks[track->track], dset_name);
+			dsets[t * NUM_DIST_DATASETS + r_idx] = create_dist_dataset(fout, h5path, src, rows, dcpl);
+
+			if (dcpl != H5P_DEFAULT)
+				H5Pclose(dcpl);
+
+			H5Dclose(src);
+		}
+	}
+
+	if (fin != H5I_INVALID_HID)
+		H5Fclose(fin);
+}
+
+/* Copy the rows of a piece of each dataset of its track. With dsets they are written at the piece's rows of the
+ * track's datasets in the shared output, otherwise to datasets of their own in the rank's file. Returns the bytes copied.
+ * Writes to the shared output are independent: ranks copy different numbers of pieces, so a collective write would
+ * hold every rank at each piece of every other, and the datasets are contiguous, so no chunk is shared between ranks. */
+size_t copy_dist_piece(hid_t fin, DistTrack *track, DistPiece *piece, hid_t fout, hid_t *dsets) {
+	char h5path[FILEPATH_BUFFER_SIZE];
+	size_t piece_bytes = 0;
+
+	for (size_t r_idx = 0; r_idx < NUM_DIST_DATASETS; r_idx++) {
+		bool is_reference = r_idx < NUM_REFERENCE_DATASETS;
+		const char *dset_name = (is_reference) ? reference_datasets[r_idx] : ph_count_datasets[r_idx - NUM_REFERENCE_DATASETS];
+		Range_Runs *runs = NULL;
+		size_t out_row = 0;
+		size_t rows = 0;
+		size_t nbytes = 0;
+		hid_t src = H5I_INVALID_HID;
+		hid_t dtype = H5I_INVALID_HID;
+		hid_t mem_type = H5I_INVALID_HID;
+		hid_t dst = H5I_INVALID_HID;
+		void *data = NULL;
+
+		if (is_reference && piece->index > 0)
+			continue;
+
+		runs = (is_reference) ? track->index_runs : slice_runs(track->photon_runs, piece->first_row, piece->end_row);
+		out_row = (is_reference || dsets == NULL) ? 0 : piece->first_row;
+		rows = count_run_rows(runs);
+
+		snprintf(h5path, sizeof(h5path), "%s/%s", ground_tracks[track->track], dset_name);
+
+		if ((src = open_dataset(fin, h5path, runs->num_runs, runs->runs)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open dataset of distributed run")
+		}
+
+		dtype = H5Dget_type(src);
+		mem_type = H5Tget_native_type(dtype, H5T_DIR_DEFAULT);
+		if ((data = read_served_rows(src, mem_type, runs, &nbytes)) == NULL) {
+			FUNC_GOTO_ERROR("Failed to read rows of piece")
+		}
+
+		if (dsets) {
+			dst = dsets[r_idx];
+		}
+		else {
+			snprintf(h5path, sizeof(h5path), "granule_%zu/%s/piece_%zu/%s", track->granule, ground_tracks[track->track], piece->index, dset_name);
+			dst = create_dist_dataset(fout, h5path, src, rows, H5P_DEFAULT);
+		}
+
+		if (rows > 0) {
+			hid_t file_space = H5Dget_space(dst);
+			hid_t mem_space = H5I_INVALID_HID;
+			hsize_t start[H5S_MAX_RANK];
+			hsize_t count[H5S_MAX_RANK];
+			int ndims = H5Sget_simple_extent_dims(file_space, count, NULL);
+
+			memset(start, 0, sizeof(start));
+			start[0] = out_row;
+			count[0] = rows;
+
+			if (0 > H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL) ||
+				(mem_space = H5Screate_simple(ndims, count, NULL)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to select rows of piece")
+			}
+
+			if (H5Dwrite(dst, mem_type, mem_space, file_space, H5P_DEFAULT, data) < 0) {
+				FUNC_GOTO_ERROR("Failed to write rows of piece")
+			}
+
+			H5Sclose(mem_space);
+			H5Sclose(file_space);
+		}
+
+		if (dsets == NULL)
+			H5Dclose(dst);
+
+		piece_bytes += nbytes;
+		budget_free(data, nbytes + 1);
+		H5Tclose(mem_type);
+		H5Tclose(dtype);
+		close_dataset(src);
+
+		if (!is_reference)
+			free_runs(runs);
+	}
+
+	return piece_bytes;
+}
+
+/* Select the bbox from every granule across the MPI ranks. Whole granules, or the tracks of too few granules, are
+ * searched by separate ranks, and the selected photons of each track are copied in pieces spread across the ranks.
+ * The pieces are written to one output with parallel HDF5, or with -rank_files each rank writes its own file and
+ * rank 0 stitches them into the output with virtual datasets. */
+void run_distributed_selection(char **granules, size_t num_granules, const char *output_path, BBox *bbox, hid_t fapl_id) {
+	DistTrack *tracks = NULL;
+	DistPiece *pieces = NULL;
+	size_t num_tracks = num_granules * NUM_GROUND_TRACKS;
+	size_t num_pieces = 0;
+	size_t num_selected = 0;
+	size_t rank_pieces = 0;
+	size_t open_granule = SIZE_MAX;
+	hid_t fin = H5I_INVALID_HID;
+	hid_t fout = H5I_INVALID_HID;
+	hid_t *dsets = NULL;
+	char *rank_path = NULL;
+	double rank_stats[3];
+	double *all_stats = NULL;
+	double start_time = 0;
+	double plan_time = 0;
+	double copy_time = 0;
+	int rank = 0;
+	int size = 0;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	if ((tracks = calloc(num_tracks, sizeof(DistTrack))) == NULL || (all_stats = calloc(3 * size, sizeof(double))) == NULL ||
+		(dsets = calloc(num_tracks * NUM_DIST_DATASETS, sizeof(hid_t))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate tracks of distributed run")
+	}
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		tracks[t].granule = t / NUM_GROUND_TRACKS;
+		tracks[t].track = t % NUM_GROUND_TRACKS;
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start_time = MPI_Wtime();
+
+	find_dist_runs(granules, num_granules, tracks, bbox, fapl_id, rank, size);
+	share_dist_runs(tracks, num_tracks, num_granules, rank, size);
+	pieces = plan_dist_pieces(tracks, num_tracks, size, &num_pieces);
+
+	plan_time = MPI_Wtime() - start_time;
+
+#ifdef H5_HAVE_PARALLEL
+	if (!rank_files) {
+		hid_t fapl_out = H5Pcreate(H5P_FILE_ACCESS);
+
+		if (H5Pset_fapl_mpio(fapl_out, MPI_COMM_WORLD, MPI_INFO_NULL) < 0) {
+			FUNC_GOTO_ERROR("Failed to set MPI-IO in FAPL")
+		}
+
+		/* Every rank creates every object, parallel HDF5 needs them created collectively */
+		if ((fout = H5Fcreate(output_path, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_out)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create output file")
+		}
+
+		H5Pclose(fapl_out);
+		create_dist_groups(fout, granules, num_granules, tracks);
+		create_dist_datasets(fout, granules, tracks, num_tracks, pieces, NULL, fapl_id, dsets);
+	}
+#endif
+
+	if (fout == H5I_INVALID_HID) {
+		rank_path = arena_printf(&run_arena, "%s.rank%d.h5", output_path, rank);
+
+		if ((fout = H5Fcreate(rank_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create rank output file")
+		}
+	}
+
+	/* Pieces are in track order, so each granule is opened once */
+	for (size_t p = 0; p < num_pieces; p++) {
+		DistTrack *track = &tracks[pieces[p].track];
+
+		if (pieces[p].rank != rank)
+			continue;
+
+		if (track->granule != open_granule) {
+			if (fin != H5I_INVALID_HID)
+				H5Fclose(fin);
+
+			if ((fin = H5Fopen(granules[track->granule], H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to open granule of distributed run")
+			}
+
+			open_granule = track->granule;
+		}
+
+		PRINT_DEBUG("Rank %d copying photons %zu to %zu of %s in %s\n", rank, pieces[p].first_row, pieces[p].end_row, ground_tracks[track->track], granules[track->granule])
+
+		bytes_copied += copy_dist_piece(fin, track, &pieces[p], fout, (rank_path) ? NULL : &dsets[pieces[p].track * NUM_DIST_DATASETS]);
+		rank_pieces++;
+	}
+
+	if (fin != H5I_INVALID_HID)
+		H5Fclose(fin);
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		for (size_t r_idx = 0; tracks[t].index_runs && rank_path == NULL && r_idx < NUM_DIST_DATASETS; r_idx++) {
+			H5Dclose(dsets[t * NUM_DIST_DATASETS + r_idx]);
+		}
+	}
+
+	H5Fclose(fout);
+	copy_time = MPI_Wtime() - start_time - plan_time;
+
+	/* Every rank file is complete once every rank has closed its own */
+	if (rank_path) {
+		MPI_Barrier(MPI_COMM_WORLD);
+
+		if (rank == 0) {
+			const char *prefix = strrchr(output_path, '/');
+
+			if ((fout = H5Fcreate(output_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+				FUNC_GOTO_ERROR("Failed to create output file")
+			}
+
+			create_dist_groups(fout, granules, num_granules, tracks);
+			create_dist_datasets(fout, granules, tracks, num_tracks, pieces, (prefix) ? prefix + 1 : output_path, fapl_id, dsets);
+
+			for (size_t t = 0; t < num_tracks; t++) {
+				for (size_t r_idx = 0; tracks[t].index_runs && r_idx < NUM_DIST_DATASETS; r_idx++) {
+					H5Dclose(dsets[t * NUM_DIST_DATASETS + r_idx]);
+				}
+			}
+
+			H5Fclose(fout);
+		}
+	}
+
+	rank_stats[0] = (double)rank_pieces;
+	rank_stats[1] = (double)bytes_copied;
+	rank_stats[2] = copy_time;
+	MPI_Gather(rank_stats, 3, MPI_DOUBLE, all_stats, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+	if (rank == 0) {
+		double elapsed = MPI_Wtime() - start_time;
+		size_t total_bytes = 0;
+
+		for (size_t t = 0; t < num_tracks; t++) {
+			if (tracks[t].index_runs)
+				num_selected++;
+		}
+
+		/* "rank, <rank>, <pieces>, <bytes>, <copy seconds>" */
+		for (int r = 0; r < size; r++) {
+			printf("rank, %d, %.0f, %.0f, %.3f\n", r, all_stats[3 * r], all_stats[3 * r + 1], all_stats[3 * r + 2]);
+			total_bytes += (size_t)all_stats[3 * r + 1];
+		}
+
+		/* "mpi, <ranks>, <granules>, <tracks selected>, <pieces>, <shared|stitched>, <plan seconds>" */
+		printf("mpi, %d, %zu, %zu, %zu, %s, %.3f\n", size, num_granules, num_selected, num_pieces, (rank_path) ? "stitched" : "shared", plan_time);
+		printf("result, %.3f, %zu\n", elapsed, total_bytes);
+	}
+
+	for (size_t t = 0; t < num_tracks; t++) {
+		free_runs(tracks[t].index_runs);
+		free_runs(tracks[t].photon_runs);
+	}
+
+	free(dsets);
+	free(all_stats);
+	free(pieces);
+	free(tracks);
+}
+#endif
+
+// TODO Move process_layer and get_config_values to another file
+
+/* Process one value from the yaml file. If the value is determined to be a keyname,
+ *	this will recurse to assign the next parsed value as its keyvalue.
+ *
+ *	If type is CONFIG_UNKNOWN_T, then it expects to be the outermost layer, and for the next value to be a keyname.
+ *	Otherwise, it expects to be a recursion, and for the next value to be a keyvalue of ConfigType type.
+ */
+void process_layer(yaml_parser_t *parser, void *storage_location, ConfigType type) {
+	ConfigValues *config2;
+	ConfigType new_type;
+	yaml_event_t event;
+	yaml_char_t *value;
+
+	if (type == CONFIG_UNKNOWN_T)
+		config2 = (ConfigValues *)storage_location;
+
+	yaml_parser_parse(parser, &event);
+	value = event.data.scalar.value;
+
+	while (event.type != YAML_STREAM_END_EVENT)
+	{
+
+		switch (event.type) {
+		case YAML_SCALAR_EVENT:
+			switch (type)
+			{
+			case CONFIG_STRING_T:
+			{
+				char *storage_loc = (char *)storage_location;
+				strcpy(storage_loc, value);
+
+				PRINT_DEBUG("Key assigned value %s from original %s\n", storage_loc, value)
+				break;
+			}
+			case CONFIG_DOUBLE_T:
+			{
+				double dval = strtod((char *)value, NULL);
+
+				double *storage_loc = (double *)storage_location;
+				*storage_loc = dval;
+
+				PRINT_DEBUG("Key assigned value %lf\n", *((double *)storage_location))
+				break;
+			}
+			case CONFIG_INT_T:
+			{
+				int intval = strtod((char *)value, NULL);
+
+				int *storage_loc = (int *)storage_location;
+				*storage_loc = intval;
+				PRINT_DEBUG("Key assigned value %d\n", *((int *)storage_location))
+
+				break;
+			}
+			default:
+			{
+				void *next_storage_location = NULL;
+
+				if (!strcmp("loglevel", value))
+				{
+					next_storage_location = config2->loglevel;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("logfile", value))
+				{
+					next_storage_location = config2->logfile;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("input_foldername", value))
+				{
+					next_storage_location = config2->input_foldername;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("input_filename", value))
+				{
+					next_storage_location = config2->input_filename;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("output_foldername", value))
+				{
+					next_storage_location = config2->output_foldername;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("output_filename", value))
+				{
+					next_storage_location = config2->output_filename;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("min_lat", value))
+				{
+					next_storage_location = (void *)&(config2->min_lat);
+					new_type = CONFIG_DOUBLE_T;
+				}
+				else if (!strcmp("max_lat", value))
+				{
+					next_storage_location = (void *)&(config2->max_lat);
+					new_type = CONFIG_DOUBLE_T;
+				}
+				else if (!strcmp("min_lon", value))
+				{
+					next_storage_location = (void *)&(config2->min_lon);
+					new_type = CONFIG_DOUBLE_T;
+				}
+				else if (!strcmp("max_lon", value))
+				{
+					next_storage_location = (void *)&(config2->max_lon);
+					new_type = CONFIG_DOUBLE_T;
+				}
+				else if (!strcmp("selection_mode", value))
+				{
+					next_storage_location = config2->selection_mode;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("min_delta_time", value))
+				{
+					next_storage_location = (void *)&(config2->min_delta_time);
+					new_type = CONFIG_DOUBLE_T;
+				}
+				else if (!strcmp("max_delta_time", value))
+				{
+					next_storage_location = (void *)&(config2->max_delta_time);
+					new_type = CONFIG_DOUBLE_T;
+				}
+				else if (!strcmp("page_buf_size_exp", value))
+				{
+					next_storage_location = (void *)&(config2->page_buf_size_exp);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("batch_max_mib", value))
+				{
+					next_storage_location = (void *)&(config2->batch_max_mib);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("batch_max_count", value))
+				{
+					next_storage_location = (void *)&(config2->batch_max_count);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("batch_max_gap_mib", value))
+				{
+					next_storage_location = (void *)&(config2->batch_max_gap_mib);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("chunk_cache_budget_mib", value))
+				{
+					next_storage_location = (void *)&(config2->chunk_cache_budget_mib);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("page_buf_meta_mib", value))
+				{
+					next_storage_location = (void *)&(config2->page_buf_meta_mib);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("manifest_filename", value))
+				{
+					next_storage_location = config2->manifest_filename;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("serve_max_granules", value))
+				{
+					next_storage_location = (void *)&(config2->serve_max_granules);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("memory_budget_mib", value))
+				{
+					next_storage_location = (void *)&(config2->memory_budget_mib);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("lod_point_budget", value))
+				{
+					next_storage_location = (void *)&(config2->lod_point_budget);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("lod_filename", value))
+				{
+					next_storage_location = config2->lod_filename;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("catalog_filename", value))
+				{
+					next_storage_location = config2->catalog_filename;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("result_cache_dir", value))
+				{
+					next_storage_location = config2->result_cache_dir;
+					new_type = CONFIG_STRING_T;
+				}
+				else if (!strcmp("result_cache_max_mib", value))
+				{
+					next_storage_location = (void *)&(config2->result_cache_max_mib);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("request_hedge_percentile", value))
+				{
+					next_storage_location = (void *)&(config2->request_hedge_percentile);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("request_max_retries", value))
+				{
+					next_storage_location = (void *)&(config2->request_max_retries);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("request_retry_backoff_ms", value))
+				{
+					next_storage_location = (void *)&(config2->request_retry_backoff_ms);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("request_timeout_ms", value))
+				{
+					next_storage_location = (void *)&(config2->request_timeout_ms);
+					new_type = CONFIG_INT_T;
+				}
+				else if (!strcmp("result_cache_max_age_s", value))
+				{
+					next_storage_location = (void *)&(config2->result_cache_max_age_s);
+					new_type = CONFIG_INT_T;
+				}
+				else
+				{
+					PRINT_DEBUG("Key named %s not found, skipping\n", value)
+					break;
+				}
+
+				PRINT_DEBUG("%s%s\n", "Recursing in yaml parsing to assign key ", value)
+				process_layer(parser, next_storage_location, new_type);
+				break;
+			}
+			}
+
+			break;
+		}
+
+		/* yaml_parser_parse allocates memory for event that must be freed */
+		yaml_event_delete(&event);
+
+		/* If this is a recursion, return to next layer up */
+		if (type != CONFIG_UNKNOWN_T) {
+			break;
+		}
+
+		yaml_parser_parse(parser, &event);
+		value = event.data.scalar.value;
+	}
+}
+
+/* Allocate internal memory for config from the run arena and begin parsing the yaml file. */
+ConfigValues *get_config_values(char *yaml_config_filename, ConfigValues *config) {
+	config->loglevel = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->logfile = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->input_foldername = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->input_filename = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->output_foldername = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->output_filename = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->manifest_filename = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->selection_mode = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->lod_filename = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->catalog_filename = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+	config->result_cache_dir = arena_alloc(&run_arena, FILEPATH_BUFFER_SIZE);
+
+	/* Keep the backend's batch policy unless overridden */
+	config->batch_max_mib = -1;
+	config->batch_max_count = -1;
+	config->batch_max_gap_mib = -1;
+
+	config->chunk_cache_budget_mib = 256;
+
+	strcpy(config->selection_mode, "bbox");
+
+	config->page_buf_size_exp = 0;
+	config->page_buf_meta_mib = 20;
+
+	config->serve_max_granules = 4;
+
+	config->memory_budget_mib = 0;
+
+	config->result_cache_max_mib = 1024;
+	config->result_cache_max_age_s = 86400;
+
+	config->request_hedge_percentile = 95;
+	config->request_max_retries = 3;
+	config->request_retry_backoff_ms = 100;
+	config->request_timeout_ms = 30000;
+
+	yaml_parser_t parser;
+	yaml_parser_initialize(&parser);
+
+	FILE *config_input = fopen(yaml_config_filename, "r");
+
+	if (config_input == NULL)
+	{
+		FUNC_GOTO_ERROR("failed to open config.yml");
+	}
+
+	yaml_parser_set_input_file(&parser, config_input);
+
+	/* Get values */
+	process_layer(&parser, (void *)config, CONFIG_UNKNOWN_T);
+
+	/* Cleanup */
+	yaml_parser_delete(&parser);
+	fclose(config_input);
+
+	return config;
+}
+
+/* Validate the bounding box given in the config */
+BBox get_bbox(ConfigValues *config) {
+	BBox bbox;
+
+	double min_lon = config->min_lon;
+
+	if (min_lon < -180.0 || min_lon > 180.0)
+	{
+		PRINT_DEBUG("Invalid min_lon value: %lf\n", min_lon)
+		exit(1);
+	}
+
+	double max_lon = config->max_lon;
+
+	if (max_lon < -180.0 || max_lon > 180.0 || max_lon <= min_lon)
+	{
+		PRINT_DEBUG("Invalid max_lon value: %lf\n", max_lon)
+		exit(1);
+	}
+
+	double min_lat = config->min_lat;
+
+	if (min_lat < -90.0 || min_lat > 90.0)
+	{
+		PRINT_DEBUG("Invalid min_lat value: %lf\n", min_lat)
+		exit(1);
+	}
+
+	double max_lat = config->max_lat;
+
+	if (max_lat < -90.0 || max_lat > 90.0 || max_lat <= min_lat)
+	{
+		PRINT_DEBUG("Invalid max_lat error: %lf\n", max_lat)
+		exit(1);
+	}
+
+	bbox.min_lon = min_lon;
+	bbox.max_lon = max_lon;
+	bbox.min_lat = min_lat;
+	bbox.max_lat = max_lat;
+
+	PRINT_DEBUG("Lat Range: %lf - %lf\n", bbox.min_lat, bbox.max_lat)
+	PRINT_DEBUG("Lon Range: %lf - %lf\n", bbox.min_lon, bbox.max_lon)
+
+	return bbox;
+}
+
+/* Validate the selection mode given in the config, and the delta_time window if it uses one */
+SelectionMode get_selection_mode(ConfigValues *config, Range_Doubles *window) {
+	SelectionMode mode;
+
+	if (!strcmp(config->selection_mode, "bbox")) {
+		return SELECT_BBOX;
+	}
+	else if (!strcmp(config->selection_mode, "time")) {
+		mode = SELECT_TIME;
+	}
+	else if (!strcmp(config->selection_mode, "time_bbox")) {
+		mode = SELECT_TIME_BBOX;
+	}
+	else {
+		PRINT_DEBUG("Invalid selection_mode: %s\n", config->selection_mode)
+		exit(1);
+	}
+
+	if (config->max_delta_time <= config->min_delta_time) {
+		PRINT_DEBUG("Invalid delta_time window: %lf - %lf\n", config->min_delta_time, config->max_delta_time)
+		exit(1);
+	}
+
+	window->min = config->min_delta_time;
+	window->max = config->max_delta_time;
+
+	PRINT_DEBUG("Time Range: %lf - %lf\n", window->min, window->max)
+
+	return mode;
+}
+
+/* FNV-1a, folded into hash */
+uint64_t hash_string(uint64_t hash, const char *str) {
+	for (; *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/* Identify a granule by its path, size and modification time, so a rewritten file misses.
+ * Remote paths can't be stat'ed and are identified by path alone. */
+uint64_t get_granule_id(const char *path) {
+	struct stat st;
+	char buf[64];
+	uint64_t hash = hash_string(14695981039346656037ULL, path);
+
+	if (stat(path, &st) == 0) {
+		snprintf(buf, sizeof(buf), "%lld:%lld", (long long)st.st_size, (long long)st.st_mtime);
+		hash = hash_string(hash, buf);
+	}
+
+	return hash;
+}
+
+/* Identify the datasets a subset holds */
+uint64_t get_dataset_list_id(void) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < NUM_REFERENCE_DATASETS; i++) {
+		hash = hash_string(hash_string(hash, reference_datasets[i]), ",");
+	}
+
+	for (size_t i = 0; i < NUM_PHOTON_COUNT_DATASETS; i++) {
+		hash = hash_string(hash_string(hash, ph_count_datasets[i]), ",");
+	}
+
+	return hash;
+}
+
+void add_cached_result(ResultCache *cache, CachedResult *entry) {
+	if (cache->num_entries == cache->max_entries) {
+		cache->max_entries = (cache->max_entries) ? cache->max_entries * 2 : 16;
+
+		if ((cache->entries = realloc(cache->entries, cache->max_entries * sizeof(CachedResult))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate result cache entries")
+		}
+	}
+
+	cache->entries[cache->num_entries++] = *entry;
+}
+
+/* Replace the entries and counts of cache with those in the index open on fd, which the caller has locked.
+ * Lines are "cache, <hits>, <misses>" and
+ * "entry, <file>, <granule>, <datasets>, <min_lon>, <max_lon>, <min_lat>, <max_lat>, <bytes>, <created>". */
+void read_result_index(ResultCache *cache, int fd) {
+	char *line = NULL;
+	size_t line_size = 0;
+	FILE *f = NULL;
+
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->num_entries = 0;
+
+	if (lseek(fd, 0, SEEK_SET) < 0 || (f = fdopen(dup(fd), "r")) == NULL) {
+		FUNC_GOTO_ERROR("Failed to read result cache index")
+	}
+
+	while (getline(&line, &line_size, f) > 0) {
+		char *cursor = line;
+		char *kind = NULL;
+		CachedResult entry;
+
+		line[strcspn(line, "\n")] = '\0';
+		kind = next_field(&cursor);
+
+		if (!strcmp(kind, "cache")) {
+			cache->hits = strtoull(next_field(&cursor), NULL, 10);
+			cache->misses = strtoull(next_field(&cursor), NULL, 10);
+		}
+		else if (!strcmp(kind, "entry")) {
+			snprintf(entry.file, sizeof(entry.file), "%s", next_field(&cursor));
+			entry.granule = strtoull(next_field(&cursor), NULL, 16);
+			entry.datasets = strtoull(next_field(&cursor), NULL, 16);
+			entry.bbox.min_lon = strtod(next_field(&cursor), NULL);
+			entry.bbox.max_lon = strtod(next_field(&cursor), NULL);
+			entry.bbox.min_lat = strtod(next_field(&cursor), NULL);
+			entry.bbox.max_lat = strtod(next_field(&cursor), NULL);
+			entry.nbytes = strtoull(next_field(&cursor), NULL, 10);
+			entry.created = (time_t)strtoll(next_field(&cursor), NULL, 10);
+			add_cached_result(cache, &entry);
+		}
+	}
+
+	free(line);
+	fclose(f);
+}
+
+/* Read the index of the result cache in dir, holding its lock only while it is read */
+void open_result_cache(ResultCache *cache, ConfigValues *config) {
+	int fd = -1;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->dir = config->result_cache_dir;
+	cache->index_path = arena_printf(&run_arena, "%s/%s", config->result_cache_dir, RESULT_CACHE_INDEX);
+	cache->max_bytes = (size_t)config->result_cache_max_mib * 1024 * 1024;
+	cache->max_age = config->result_cache_max_age_s;
+
+	if (mkdir(cache->dir, 0755) < 0 && errno != EEXIST) {
+		FUNC_GOTO_ERROR("Failed to create result cache directory")
+	}
+
+	if ((fd = open(cache->index_path, O_RDWR | O_CREAT, 0644)) < 0) {
+		FUNC_GOTO_ERROR("Failed to open result cache index")
+	}
+
+	if (flock(fd, LOCK_SH) < 0) {
+		FUNC_GOTO_ERROR("Failed to lock result cache index")
+	}
+
+	read_result_index(cache, fd);
+
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+size_t get_result_cache_bytes(ResultCache *cache) {
+	size_t nbytes = 0;
+
+	for (size_t i = 0; i < cache->num_entries; i++) {
+		nbytes += cache->entries[i].nbytes;
+	}
+
+	return nbytes;
+}
+
+void remove_cached_result(ResultCache *cache, size_t idx) {
+	char *path = arena_printf(&run_arena, "%s/%s", cache->dir, cache->entries[idx].file);
+
+	PRINT_DEBUG("Evicting cached result %s\n", path)
+	unlink(path);
+	memmove(&cache->entries[idx], &cache->entries[idx + 1], (cache->num_entries - idx - 1) * sizeof(CachedResult));
+	cache->num_entries--;
+}
+
+/* Drop entries older than max_age or whose file is gone, then the oldest until the rest fit in max_bytes.
+ * Entries are kept in the order they were stored, so the oldest is first. */
+void evict_results(ResultCache *cache) {
+	time_t now = time(NULL);
+
+	for (size_t i = 0; i < cache->num_entries;) {
+		char *path = arena_printf(&run_arena, "%s/%s", cache->dir, cache->entries[i].file);
+
+		if (now - cache->entries[i].created >= cache->max_age || access(path, F_OK) < 0) {
+			remove_cached_result(cache, i);
+		}
+		else {
+			i++;
+		}
+	}
+
+	while (cache->num_entries > 0 && get_result_cache_bytes(cache) > cache->max_bytes) {
+		remove_cached_result(cache, 0);
+	}
+}
+
+/* Under the index lock, reread the index, add this run's counts and stored entry, evict and rewrite it.
+ * Entries stored by other runs since open_result_cache are kept. */
+void close_result_cache(ResultCache *cache) {
+	FILE *f = NULL;
+	int fd = -1;
+
+	if ((fd = open(cache->index_path, O_RDWR | O_CREAT, 0644)) < 0) {
+		FUNC_GOTO_ERROR("Failed to open result cache index")
+	}
+
+	if (flock(fd, LOCK_EX) < 0) {
+		FUNC_GOTO_ERROR("Failed to lock result cache index")
+	}
+
+	read_result_index(cache, fd);
+
+	cache->hits += cache->run_hits;
+	cache->misses += cache->run_misses;
+
+	if (cache->stored)
+		add_cached_result(cache, &cache->stored_entry);
+
+	evict_results(cache);
+
+	if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+		FUNC_GOTO_ERROR("Failed to rewrite result cache index")
+	}
+
+	if ((f = fdopen(dup(fd), "w")) == NULL) {
+		FUNC_GOTO_ERROR("Failed to rewrite result cache index")
+	}
+
+	fprintf(f, "cache, %zu, %zu\n", cache->hits, cache->misses);
+
+	for (size_t i = 0; i < cache->num_entries; i++) {
+		CachedResult *entry = &cache->entries[i];
+
+		fprintf(f, "entry, %s, %016" PRIx64 ", %016" PRIx64 ", %.17g, %.17g, %.17g, %.17g, %zu, %lld\n", entry->file,
+				entry->granule, entry->datasets, entry->bbox.min_lon, entry->bbox.max_lon, entry->bbox.min_lat,
+				entry->bbox.max_lat, entry->nbytes, (long long)entry->created);
+	}
+
+	if (fclose(f) != 0) {
+		FUNC_GOTO_ERROR("Failed to write result cache index")
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+void free_result_cache(ResultCache *cache) {
+	free(cache->entries);
+}
+
+bool bbox_contains(BBox *outer, BBox *inner) {
+	return outer->min_lon <= inner->min_lon && outer->max_lon >= inner->max_lon &&
+		outer->min_lat <= inner->min_lat && outer->max_lat >= inner->max_lat;
+}
+
+/* Return the smallest live subset of the same granule and datasets whose bbox contains bbox, or NULL */
+CachedResult *find_result(ResultCache *cache, uint64_t granule, uint64_t datasets, BBox *bbox) {
+	CachedResult *found = NULL;
+	time_t now = time(NULL);
+
+	for (size_t i = 0; i < cache->num_entries; i++) {
+		CachedResult *entry = &cache->entries[i];
+
+		if (entry->granule != granule || entry->datasets != datasets || !bbox_contains(&entry->bbox, bbox) ||
+			now - entry->created >= cache->max_age) {
+			continue;
+		}
+
+		if (found == NULL || entry->nbytes < found->nbytes) {
+			found = entry;
+		}
+	}
+
+	return found;
+}
+
+/* Copy the subset at path into the cache. The output is truncated by the next run, so it can't be linked.
+ * The subset must be closed, and a local file. The entry joins the index in close_result_cache. */
+void store_result(ResultCache *cache, const char *path, uint64_t granule, uint64_t datasets, BBox *bbox) {
+	CachedResult entry;
+	char *dst_path = NULL;
+	char *tmp_path = NULL;
+	char *buf = NULL;
+	size_t buf_size = 1024 * 1024;
+	ssize_t nread = 0;
+	int src = -1;
+	int dst = -1;
+
+	memset(&entry, 0, sizeof(entry));
+	snprintf(entry.file, sizeof(entry.file), "%016" PRIx64 "_%lld_%d.h5", granule, (long long)time(NULL), (int)getpid());
+	entry.granule = granule;
+	entry.datasets = datasets;
+	entry.bbox = *bbox;
+	entry.created = time(NULL);
+
+	dst_path = arena_printf(&run_arena, "%s/%s", cache->dir, entry.file);
+	tmp_path = arena_printf(&run_arena, "%s.tmp", dst_path);
+
+	if ((src = open(path, O_RDONLY)) < 0) {
+		FUNC_GOTO_ERROR("Failed to open subset for the result cache")
+	}
+
+	if ((dst = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		FUNC_GOTO_ERROR("Failed to create result cache file")
+	}
+
+	buf = budget_calloc(buf_size, 1);
+
+	while ((nread = read(src, buf, buf_size)) > 0) {
+		if (write(dst, buf, nread) != nread) {
+			FUNC_GOTO_ERROR("Failed to write result cache file")
+		}
+
+		entry.nbytes += nread;
+	}
+
+	if (nread < 0) {
+		FUNC_GOTO_ERROR("Failed to read subset for the result cache")
+	}
+
+	budget_free(buf, buf_size);
+	close(src);
+
+	if (close(dst) < 0 || rename(tmp_path, dst_path) < 0) {
+		FUNC_GOTO_ERROR("Failed to store result cache file")
+	}
+
+	cache->stored = true;
+	cache->stored_entry = entry;
+}
+
+/* Close every object still open in the file of fid, so that closing fid closes the file itself */
+void close_file_objects(hid_t fid) {
+	unsigned types = H5F_OBJ_DATASET | H5F_OBJ_GROUP | H5F_OBJ_DATATYPE | H5F_OBJ_ATTR;
+	ssize_t count = 0;
+	hid_t *ids = NULL;
+
+	if ((count = H5Fget_obj_count(fid, types)) <= 0)
+		return;
+
+	if ((ids = calloc(count, sizeof(hid_t))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate open object list")
+	}
+
+	count = H5Fget_obj_ids(fid, types, count, ids);
+
+	for (ssize_t i = 0; i < count; i++) {
+		if (H5Iget_type(ids[i]) == H5I_ATTR)
+			H5Aclose(ids[i]);
+		else
+			H5Oclose(ids[i]);
+	}
+
+	free(ids);
+}
+
+/* Return the rows of the source that the subset's track was cut from, from its index_runs attribute or, failing
+ * that, its [index_range_min, index_range_max) envelope. NULL if the track had no rows. */
+Range_Runs *read_cached_runs(hid_t fin, const char *track) {
+	Range_Runs *runs = NULL;
+	hid_t group = H5I_INVALID_HID;
+	hid_t attr = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hsize_t dims[2];
+	int index_min = -1;
+	int index_max = -1;
+
+	if ((group = H5Gopen(fin, track, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open track in cached result")
+	}
+
+	if ((runs = calloc(1, sizeof(*runs))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate cached runs")
+	}
+
+	if (H5Aexists(group, "index_runs") > 0) {
+		hsize_t *runs_data = NULL;
+
+		attr = H5Aopen(group, "index_runs", H5P_DEFAULT);
+		space = H5Aget_space(attr);
+		H5Sget_simple_extent_dims(space, dims, NULL);
+		runs_data = arena_alloc(&run_arena, dims[0] * 2 * sizeof(hsize_t));
+
+		if (H5Aread(attr, H5T_NATIVE_HSIZE, runs_data) < 0) {
+			FUNC_GOTO_ERROR("Failed to read index runs of cached result")
+		}
+
+		for (size_t r = 0; r < dims[0]; r++) {
+			append_run(runs, (Range_Indices){runs_data[2 * r], runs_data[2 * r + 1]});
+		}
+
+		H5Sclose(space);
+		H5Aclose(attr);
+	}
+	else {
+		attr = H5Aopen(group, "index_range_min", H5P_DEFAULT);
+		H5Aread(attr, H5T_NATIVE_INT, &index_min);
+		H5Aclose(attr);
+
+		attr = H5Aopen(group, "index_range_max", H5P_DEFAULT);
+		H5Aread(attr, H5T_NATIVE_INT, &index_max);
+		H5Aclose(attr);
+
+		if (index_min >= 0 && index_max > index_min) {
+			append_run(runs, (Range_Indices){index_min, index_max});
+		}
+	}
+
+	H5Gclose(group);
+
+	if (runs->num_runs == 0) {
+		free_runs(runs);
+		return NULL;
+	}
+
+	return runs;
+}
+
+/* Map runs of a cached subset's rows to rows of its source. The subset holds cached->runs back to back,
+ * so row k of the subset is k rows past the start of the cached run holding it. */
+Range_Runs *rebase_runs(Range_Runs *runs, Range_Runs *cached) {
+	Range_Runs *source = NULL;
+	size_t c = 0;
+	size_t offset = 0;
+
+	if (runs == NULL || cached == NULL) {
+		return NULL;
+	}
+
+	if ((source = calloc(1, sizeof(*source))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate rebased runs")
+	}
+
+	for (size_t r = 0; r < runs->num_runs; r++) {
+		size_t min = runs->runs[r].min;
+		size_t max = runs->runs[r].max;
+
+		while (min < max && c < cached->num_runs) {
+			size_t length = cached->runs[c].max - cached->runs[c].min;
+
+			if (min >= offset + length) {
+				offset += length;
+				c++;
+				continue;
+			}
+
+			size_t end = (max < offset + length) ? max : offset + length;
+
+			append_run(source, (Range_Indices){cached->runs[c].min + min - offset, cached->runs[c].min + end - offset});
+			min = end;
+		}
+	}
+
+	return source;
+}
+
+/* Return the catalog's entry for path, adding an empty one if it has none */
+CatalogGranule *get_catalog_granule(Catalog *catalog, const char *path) {
+	CatalogGranule *granule = NULL;
+
+	for (size_t i = 0; i < catalog->num_granules; i++) {
+		if (!strcmp(catalog->granules[i].path, path)) {
+			return &catalog->granules[i];
+		}
+	}
+
+	if (catalog->num_granules == catalog->max_granules) {
+		catalog->max_granules = (catalog->max_granules) ? catalog->max_granules * 2 : 64;
+
+		if ((catalog->granules = realloc(catalog->granules, catalog->max_granules * sizeof(CatalogGranule))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate catalog granules")
+		}
+	}
+
+	granule = &catalog->granules[catalog->num_granules++];
+	memset(granule, 0, sizeof(*granule));
+
+	if ((granule->path = strdup(path)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate catalog path")
+	}
+
+	return granule;
+}
+
+void add_catalog_block(CatalogGranule *granule, BBox *block) {
+	if (granule->num_blocks == granule->max_blocks) {
+		granule->max_blocks = (granule->max_blocks) ? granule->max_blocks * 2 : 64;
+
+		if ((granule->blocks = realloc(granule->blocks, granule->max_blocks * sizeof(BBox))) == NULL) {
+			FUNC_GOTO_ERROR("Failed to allocate catalog blocks")
+		}
+	}
+
+	granule->blocks[granule->num_blocks++] = *block;
+}
+
+/* Read the footprint catalog at path, which is empty if it doesn't exist yet. Lines are
+ * "granule, <id>, <path>" followed by "block, <track>, <min_lon>, <max_lon>, <min_lat>, <max_lat>" for each block
+ * of its tracks. The path is the rest of the line, so it may hold commas. */
+void load_catalog(Catalog *catalog, const char *path) {
+	CatalogGranule *granule = NULL;
+	char *line = NULL;
+	size_t line_size = 0;
+	FILE *f = NULL;
+
+	memset(catalog, 0, sizeof(*catalog));
+
+	if ((f = fopen(path, "r")) == NULL) {
+		if (errno == ENOENT) {
+			return;
+		}
+
+		FUNC_GOTO_ERROR("Failed to open footprint catalog")
+	}
+
+	flock(fileno(f), LOCK_SH);
+
+	while (getline(&line, &line_size, f) > 0) {
+		char *cursor = line;
+		char *kind = NULL;
+
+		line[strcspn(line, "\n")] = '\0';
+		kind = next_field(&cursor);
+
+		if (!strcmp(kind, "granule")) {
+			uint64_t id = strtoull(next_field(&cursor), NULL, 16);
+
+			while (*cursor == ' ')
+				cursor++;
+
+			granule = get_catalog_granule(catalog, cursor);
+			granule->id = id;
+			granule->num_blocks = 0;
+		}
+		else if (!strcmp(kind, "block") && granule) {
+			BBox block;
+
+			next_field(&cursor);
+			block.min_lon = strtod(next_field(&cursor), NULL);
+			block.max_lon = strtod(next_field(&cursor), NULL);
+			block.min_lat = strtod(next_field(&cursor), NULL);
+			block.max_lat = strtod(next_field(&cursor), NULL);
+			add_catalog_block(granule, &block);
+		}
+	}
+
+	free(line);
+	fclose(f);
+}
+
+void free_catalog(Catalog *catalog) {
+	for (size_t i = 0; i < catalog->num_granules; i++) {
+		free(catalog->granules[i].path);
+		free(catalog->granules[i].blocks);
+	}
+
+	free(catalog->granules);
+}
+
+/* Append a granule's track footprints to the catalog at path. Runs indexing granules at the same time append
+ * whole entries under the lock. */
+void append_catalog(const char *path, const char *granule_path, uint64_t id, TrackFootprint *footprints) {
+	FILE *f = NULL;
+
+	if ((f = fopen(path, "a")) == NULL) {
+		FUNC_GOTO_ERROR("Failed to open footprint catalog for appending")
+	}
+
+	flock(fileno(f), LOCK_EX);
+	fprintf(f, "granule, %016" PRIx64 ", %s\n", id, granule_path);
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		for (size_t b = 0; b < footprints[i].num_blocks; b++) {
+			BBox *block = &footprints[i].blocks[b];
+
+			fprintf(f, "block, %s, %.17g, %.17g, %.17g, %.17g\n", ground_tracks[i], block->min_lon, block->max_lon,
+					block->min_lat, block->max_lat);
+		}
+	}
+
+	if (fclose(f) != 0) {
+		FUNC_GOTO_ERROR("Failed to write footprint catalog")
+	}
+}
+
+/* Whether any block of the granule overlaps bbox, with the same inclusive bounds as get_range */
+bool granule_intersects(CatalogGranule *granule, BBox *bbox) {
+	for (size_t b = 0; b < granule->num_blocks; b++) {
+		BBox *block = &granule->blocks[b];
+
+		if (block->min_lat <= bbox->max_lat && block->max_lat >= bbox->min_lat &&
+			block->min_lon <= bbox->max_lon && block->max_lon >= bbox->min_lon) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Print "granule, <path>" for each granule in the catalog that may intersect bbox, then
+ * "catalog, <granules>, <intersecting>". Nothing is opened but the catalog. */
+void query_catalog(const char *path, BBox *bbox) {
+	Catalog catalog;
+	size_t num_intersecting = 0;
+
+	load_catalog(&catalog, path);
+
+	for (size_t i = 0; i < catalog.num_granules; i++) {
+		if (granule_intersects(&catalog.granules[i], bbox)) {
+			printf("granule, %s\n", catalog.granules[i].path);
+			num_intersecting++;
+		}
+	}
+
+	printf("catalog, %zu, %zu\n", catalog.num_granules, num_intersecting);
+	free_catalog(&catalog);
+}
+
+int main(int argc, char **argv) {
+
+	hid_t fapl_id_in = H5I_INVALID_HID;
+	hid_t fapl_id_out = H5I_INVALID_HID;
+	hid_t fcpl_id = H5I_INVALID_HID;
+	hid_t fin = H5I_INVALID_HID;
+	hid_t fout = H5I_INVALID_HID;
+
+	char *input_path = NULL;
+	char *output_path = NULL;
+
+	ConfigValues *config = NULL;
+	char *config_filename = CONFIG_FILENAME;
+
+	PageLayout page_layout;
+	size_t page_buf_size = 0;
+	unsigned min_meta_perc = 0;
+
+	BBox bbox;
+	char *lod_path = NULL;
+	hid_t lod_fin = H5I_INVALID_HID;
+	SelectionMode selection_mode = SELECT_BBOX;
+	Range_Doubles time_window = {0, 0};
+
+	char *catalog_path = NULL;
+	CatalogGranule *catalog_granule = NULL;
+	TrackFootprint *footprints = NULL;
+	Catalog catalog;
+
+	ResultCache result_cache;
+	CachedResult *cached_result = NULL;
+	bool use_result_cache = false;
+	uint64_t granule_id = 0;
+	uint64_t dataset_list_id = 0;
+
+	double start_time = get_time();
+
+	for (size_t optind = 1; optind < argc; optind++)
+	{
+		if (strcmp(argv[optind], "-debug") == 0) {
+			debug = true;
+		}
+
+		if (strcmp(argv[optind], "-readonly") == 0) {
+			readonly = true;
+		}
+
+		if (strcmp(argv[optind], "-use_ros3") == 0) {
+			use_ros3 = true;
+		}
+
+		if (strcmp(argv[optind], "-use_rest_vol") == 0) {
+			use_rest_vol = true;
+		}
+
+		if (strcmp(argv[optind], "-use_multi") == 0) {
+			use_multi = true;
+		}
+
+		if (strcmp(argv[optind], "-parallel_decode") == 0) {
+			parallel_decode = true;
+		}
+
+		if (strcmp(argv[optind], "-split_copy") == 0) {
+			split_copy = true;
+		}
+
+		if (strcmp(argv[optind], "-decode_bench") == 0) {
+			decode_bench = true;
+		}
+
+		if (strcmp(argv[optind], "-use_manifest") == 0) {
+			use_manifest = true;
+			readonly = true;
+		}
+
+		if (strcmp(argv[optind], "-prefetch") == 0) {
+			use_prefetch = true;
+		}
+
+		if (strcmp(argv[optind], "-virtual") == 0) {
+			virtual_output = true;
+		}
+
+		if (strcmp(argv[optind], "-build_pyramid") == 0) {
+			build_lod = true;
+		}
+
+		if (strcmp(argv[optind], "-aggregate") == 0) {
+			aggregate = true;
+			readonly = true;
+		}
 
-	hid_t fapl_id_in = H5I_INVALID_HID;
-	hid_t fapl_id_out = H5I_INVALID_HID;
-	hid_t fcpl_id = H5I_INVALID_HID;
-	hid_t fin = H5I_INVALID_HID;
-	hid_t fout = H5I_INVALID_HID;
+		if (strcmp(argv[optind], "-kernel_bench") == 0) {
+			kernel_bench = true;
+		}
 
-	char *input_path = NULL;
-	char *output_path = NULL;
+		if (strcmp(argv[optind], "-kernel_baseline") == 0 && optind + 1 < argc) {
+			kernel_baseline_path = argv[++optind];
+		}
 
-	ConfigValues *config = NULL;
+		if (strcmp(argv[optind], "-monotonic_search") == 0) {
+			monotonic_search = true;
+		}
 
-	BBox bbox;
+		if (strcmp(argv[optind], "-catalog_query") == 0) {
+			catalog_query = true;
+		}
 
-	for (size_t optind = 1; optind < argc; optind++)
-	{
-		if (strcmp(argv[optind], "-debug") == 0) {
-			debug = true;
+		if (strcmp(argv[optind], "-materialize") == 0 && optind + 1 < argc) {
+			materialize_path = argv[++optind];
 		}
 
-		if (strcmp(argv[optind], "-readonly") == 0) {
+		if (strcmp(argv[optind], "-materialize_later") == 0) {
+			materialize_later = true;
+		}
+
+		if (strcmp(argv[optind], "-serve") == 0 && optind + 1 < argc) {
+			serve_path = argv[++optind];
 			readonly = true;
 		}
 
-		if (strcmp(argv[optind], "-use_ros3") == 0) {
-			use_ros3 = true;
+#ifdef USE_MPI
+		if (strcmp(argv[optind], "-granule_list") == 0 && optind + 1 < argc) {
+			granule_list_path = argv[++optind];
 		}
 
-		if (strcmp(argv[optind], "-use_rest_vol") == 0) {
-			use_rest_vol = true;
+		if (strcmp(argv[optind], "-rank_files") == 0) {
+			rank_files = true;
+		}
+#endif
+
+		if (strcmp(argv[optind], "-threads") == 0 && optind + 1 < argc) {
+			num_threads = strtoul(argv[++optind], NULL, 10);
 		}
 
-		if (strcmp(argv[optind], "-use_multi") == 0) {
-			use_multi = true;
+		if (strcmp(argv[optind], "-config") == 0 && optind + 1 < argc) {
+			config_filename = argv[++optind];
 		}
 	}
 
@@ -1188,106 +8907,353 @@ int main(int argc, char **argv) {
 		H5Pset_fapl_rest_vol(fapl_id_in);
 	}
 
-	config = malloc(sizeof(*config));
-	config = get_config_values(CONFIG_FILENAME, config);
+	config = arena_alloc(&run_arena, sizeof(*config));
+	config = get_config_values(config_filename, config);
 
-	if (!strncmp(config->input_filename, "PAGE10MiB", strlen("PAGE10MiB")))
-	{
-		size_t page_buf_size = pow(2, config->page_buf_size_exp);
+	set_batch_policy(config);
+	set_chunk_cache_budget(config);
+	set_memory_budget(config);
+	set_request_policy(config);
+	selection_mode = get_selection_mode(config, &time_window);
 
-		if (H5Pset_page_buffer_size(fapl_id_in, page_buf_size, 0, 0) < 0) {
-			FUNC_GOTO_ERROR("Failed to set page buffer size")
+	input_path = arena_printf(&run_arena, "%s%s", config->input_foldername, config->input_filename);
+
+	/* The kernels run on synthetic tracks, so the input isn't opened */
+	if (kernel_bench) {
+		size_t regressions = run_kernel_bench(kernel_baseline_path);
+
+		arena_release(&run_arena);
+		return (regressions > 0) ? 1 : 0;
+	}
+
+	/* Only the subset is touched, so the input isn't opened */
+	if (materialize_path) {
+		materialize_subset(materialize_path, H5P_DEFAULT);
+		arena_release(&run_arena);
+		return 0;
+	}
+
+	if (config->lod_filename[0] != '\0' && strcmp(config->lod_filename, "null")) {
+		lod_path = config->lod_filename;
+	}
+	else {
+		lod_path = arena_printf(&run_arena, "%s.lod.h5", input_path);
+	}
+
+	if (build_lod) {
+		build_pyramid(input_path, lod_path, fapl_id_in);
+		arena_release(&run_arena);
+		return 0;
+	}
+
+	if (config->catalog_filename[0] != '\0' && strcmp(config->catalog_filename, "null")) {
+		catalog_path = config->catalog_filename;
+	}
+
+	/* Only the catalog is read, to list the granules a batch job needs to open */
+	if (catalog_query) {
+		if (catalog_path == NULL) {
+			FUNC_GOTO_ERROR("-catalog_query needs catalog_filename in the config")
 		}
 
-		if (!readonly) {
-			if (H5Pset_page_buffer_size(fapl_id_out, page_buf_size, 0, 0) < 0)
-			{
-				FUNC_GOTO_ERROR("Failed to set page buffer size")
-			}
+		bbox = get_bbox(config);
+		query_catalog(catalog_path, &bbox);
+		arena_release(&run_arena);
+		return 0;
+	}
 
-			if (H5Pset_file_space_strategy(fcpl_id, H5F_FSPACE_STRATEGY_PAGE, 0, 0) < 0)
-			{
-				FUNC_GOTO_ERROR("Failed to set page strategy for output file")
-			}
+	if (virtual_output) {
+		if (readonly || use_ros3 || use_rest_vol) {
+			FUNC_GOTO_ERROR("-virtual writes a subset that maps to a local input file")
+		}
+
+		if (config->lod_point_budget > 0) {
+			FUNC_GOTO_ERROR("-virtual maps every selected photon and can't be used with lod_point_budget")
+		}
+
+		if ((virtual_source = realpath(input_path, NULL)) == NULL) {
+			FUNC_GOTO_ERROR("Failed to resolve input path for -virtual")
 		}
 	}
+	else if (materialize_later) {
+		FUNC_GOTO_ERROR("-materialize_later materializes the subset written by -virtual")
+	}
 
-	input_path = malloc(strlen(config->input_filename) + strlen(config->input_foldername) + 1);
-	strcpy(input_path, config->input_foldername);
-	strcat(input_path, config->input_filename);
+	if (aggregate && (config->lod_point_budget > 0 || use_manifest || serve_path)) {
+		FUNC_GOTO_ERROR("-aggregate reduces every selected photon of the granule and can't be used with lod_point_budget, -use_manifest or -serve")
+	}
 
-	if ((fin = H5Fopen(input_path, H5F_ACC_RDONLY, fapl_id_in)) == H5I_INVALID_HID)
-	{
-		FUNC_GOTO_ERROR("Failed to open input file")
+	if (split_copy && (use_manifest || serve_path || aggregate)) {
+		FUNC_GOTO_ERROR("-split_copy splits the copy phase of a selection run and can't be used with -use_manifest, -serve or -aggregate")
 	}
 
-	output_path = malloc(strlen(config->output_filename) + strlen(config->output_foldername) + 1);
-	strcpy(output_path, config->output_foldername);
-	strcat(output_path, config->output_filename);
+	if (use_prefetch && !use_manifest) {
+		FUNC_GOTO_ERROR("-prefetch fetches ranges listed in the manifest and needs -use_manifest")
+	}
 
-	if (!readonly)
+	if ((selection_mode != SELECT_BBOX || config->lod_point_budget > 0) && (use_manifest || serve_path)) {
+		FUNC_GOTO_ERROR("-use_manifest and -serve only select every photon by bbox")
+	}
+
+#ifdef USE_MPI
+	/* The MPI build always runs distributed, over the granules of -granule_list or input_filename alone */
 	{
-		if ((fout = H5Fcreate(output_path, H5F_ACC_TRUNC, fcpl_id, fapl_id_out)) == H5I_INVALID_HID) {
-			FUNC_GOTO_ERROR("Failed to create output file")
+		char **granules = NULL;
+		size_t num_granules = 0;
+
+		if (readonly || use_manifest || serve_path || aggregate || split_copy || virtual_output || decode_bench ||
+			selection_mode != SELECT_BBOX || config->lod_point_budget > 0) {
+			FUNC_GOTO_ERROR("A distributed run selects every photon by bbox into its own output and can't be used with -readonly, -use_manifest, -serve, -aggregate, -split_copy, -virtual, -decode_bench, a time window or lod_point_budget")
+		}
+
+#ifndef H5_HAVE_PARALLEL
+		PRINT_DEBUG("HDF5 is built without parallel support, writing -rank_files\n")
+		rank_files = true;
+#endif
+
+		MPI_Init(&argc, &argv);
+
+		if (parallel_decode && !use_rest_vol) {
+			thread_pool = thread_pool_create(get_num_threads());
+		}
+
+		parallel_decode = parallel_decode && !use_rest_vol;
+		granules = read_granule_list(granule_list_path, config, &num_granules);
+		output_path = arena_printf(&run_arena, "%s%s", config->output_foldername, config->output_filename);
+		bbox = get_bbox(config);
+
+		run_distributed_selection(granules, num_granules, output_path, &bbox, fapl_id_in);
+
+		if (thread_pool) {
+			thread_pool_destroy(thread_pool);
 		}
+
+		free(granules);
+		MPI_Finalize();
+		arena_release(&run_arena);
+		return 0;
 	}
+#endif
 
-	PRINT_DEBUG("Input filepath = %s%s\n", config->input_foldername, config->input_filename)
-	if (!readonly)
-	{
-		PRINT_DEBUG("Output filepath = %s%s\n", config->output_foldername, config->output_filename)
+	/* The manifest replaces every metadata read of the input, so the file is never opened through HDF5 */
+	if (use_manifest) {
+		char *manifest_path = config->manifest_filename;
+
+		if (use_rest_vol) {
+			FUNC_GOTO_ERROR("-use_manifest reads HDF5 files by byte range and can't be used with the REST VOL")
+		}
+
+		if (manifest_path[0] == '\0' || !strcmp(manifest_path, "null")) {
+			snprintf(manifest_path, FILEPATH_BUFFER_SIZE, "%s.manifest", input_path);
+		}
+
+		if (parallel_decode) {
+			thread_pool = thread_pool_create(get_num_threads());
+		}
+
+		if (use_prefetch) {
+			prefetcher = create_prefetcher(input_path);
+		}
+
+		bbox = get_bbox(config);
+
+		budget_phase("manifest");
+		run_manifest_selection(manifest_path, input_path, &bbox);
+		budget_phase("done");
+
+		if (prefetcher) {
+			destroy_prefetcher(prefetcher);
+		}
+
+		if (is_url(input_path)) {
+			print_request_stats();
+		}
+
+		printf("result, %.3f, %zu\n", get_time() - start_time, bytes_copied);
+
+		if (thread_pool) {
+			thread_pool_destroy(thread_pool);
+		}
+
+		return 0;
 	}
 
-	double min_lon = config->min_lon;
+	/* Granules are opened per request, each with its own page buffer */
+	if (serve_path) {
+		if (parallel_decode && !use_rest_vol) {
+			thread_pool = thread_pool_create(get_num_threads());
+		}
 
-	if (min_lon < -180.0 || min_lon > 180.0)
-	{
-		PRINT_DEBUG("Invalid min_lon value: %lf\n", min_lon)
-		exit(1);
+		parallel_decode = parallel_decode && !use_rest_vol;
+		run_server(serve_path, config, fapl_id_in);
+
+		if (thread_pool) {
+			thread_pool_destroy(thread_pool);
+		}
+
+		return 0;
 	}
 
-	double max_lon = config->max_lon;
+	/* A granule the catalog shows missing the bbox isn't opened. One it doesn't know yet, or whose file changed
+	 * since, has its footprint recorded while its lat/lon are searched. */
+	if (catalog_path && selection_mode != SELECT_TIME) {
+		bbox = get_bbox(config);
+		load_catalog(&catalog, catalog_path);
 
-	if (max_lon < -180.0 || max_lon > 180.0 || max_lon <= min_lon)
+		for (size_t i = 0; i < catalog.num_granules; i++) {
+			if (!strcmp(catalog.granules[i].path, input_path) && catalog.granules[i].id == get_granule_id(input_path)) {
+				catalog_granule = &catalog.granules[i];
+			}
+		}
+
+		if (catalog_granule && !granule_intersects(catalog_granule, &bbox)) {
+			printf("catalog, skip, %zu\n", catalog.num_granules);
+			printf("result, %.3f, %zu\n", get_time() - start_time, bytes_copied);
+			free_catalog(&catalog);
+			arena_release(&run_arena);
+			free(virtual_source);
+			return 0;
+		}
+
+		/* A time window leaves rows of the tracks unread */
+		if (catalog_granule == NULL && selection_mode == SELECT_BBOX) {
+			footprints = arena_alloc(&run_arena, NUM_GROUND_TRACKS * sizeof(TrackFootprint));
+		}
+	}
+
+	/* A query contained in a cached subset is answered by selecting from that subset instead of the granule */
+	/* Subsets are stored by copying the output file's bytes, so the output must be a local file */
+	if (config->result_cache_dir[0] != '\0' && strcmp(config->result_cache_dir, "null") && !readonly && !virtual_output &&
+		selection_mode == SELECT_BBOX && config->lod_point_budget <= 0 && !use_rest_vol && !strstr(config->output_foldername, "://")) {
+		bbox = get_bbox(config);
+		granule_id = get_granule_id(input_path);
+		dataset_list_id = get_dataset_list_id();
+
+		open_result_cache(&result_cache, config);
+		use_result_cache = true;
+
+		if ((cached_result = find_result(&result_cache, granule_id, dataset_list_id, &bbox)) != NULL) {
+			char *cached_path = arena_printf(&run_arena, "%s/%s", result_cache.dir, cached_result->file);
+			hid_t cached_fapl = (use_ros3) ? H5Pcreate(H5P_FILE_ACCESS) : fapl_id_in;
+
+			/* The index isn't locked, so another run may have evicted the subset since it was read */
+			if ((fin = open_input(cached_path, cached_fapl, config, &page_layout, &page_buf_size, &min_meta_perc)) != H5I_INVALID_HID) {
+				PRINT_DEBUG("Answering from cached result %s\n", cached_path)
+				input_path = cached_path;
+				footprints = NULL;
+
+				/* The cached subset is a local file */
+				if (use_ros3) {
+					H5Pclose(fapl_id_in);
+					fapl_id_in = cached_fapl;
+					use_ros3 = false;
+				}
+			}
+			else {
+				PRINT_DEBUG("Cached result %s was evicted\n", cached_path)
+				cached_result = NULL;
+
+				if (cached_fapl != fapl_id_in)
+					H5Pclose(cached_fapl);
+			}
+		}
+
+		if (cached_result)
+			result_cache.run_hits++;
+		else
+			result_cache.run_misses++;
+	}
+
+	if (fin == H5I_INVALID_HID &&
+		(fin = open_input(input_path, fapl_id_in, config, &page_layout, &page_buf_size, &min_meta_perc)) == H5I_INVALID_HID)
 	{
-		PRINT_DEBUG("Invalid max_lon value: %lf\n", max_lon)
-		exit(1);
+		FUNC_GOTO_ERROR("Failed to open input file")
 	}
 
-	double min_lat = config->min_lat;
+	if (page_buf_size > 0 && !readonly)
+	{
+		if (H5Pset_page_buffer_size(fapl_id_out, page_buf_size, min_meta_perc, 0) < 0)
+		{
+			FUNC_GOTO_ERROR("Failed to set page buffer size")
+		}
+	}
 
-	if (min_lat < -90.0 || min_lat > 90.0)
+	/* Give the output the same file space layout as the input */
+	if (!readonly && page_layout.strategy == H5F_FSPACE_STRATEGY_PAGE)
 	{
-		PRINT_DEBUG("Invalid min_lat value: %lf\n", min_lat)
-		exit(1);
+		if (H5Pset_file_space_strategy(fcpl_id, H5F_FSPACE_STRATEGY_PAGE, page_layout.persist, page_layout.threshold) < 0)
+		{
+			FUNC_GOTO_ERROR("Failed to set page strategy for output file")
+		}
+
+		if (H5Pset_file_space_page_size(fcpl_id, page_layout.page_size) < 0)
+		{
+			FUNC_GOTO_ERROR("Failed to set page size for output file")
+		}
 	}
 
-	double max_lat = config->max_lat;
+	if (decode_bench) {
+		run_decode_bench(fin);
+		H5Fclose(fin);
+		return 0;
+	}
 
-	if (max_lat < -90.0 || max_lat > 90.0 || max_lat <= min_lat)
+	if (parallel_decode) {
+		if (use_rest_vol) {
+			PRINT_DEBUG("Raw chunk reads aren't available through the REST VOL, ignoring -parallel_decode\n")
+			parallel_decode = false;
+		}
+		else {
+			thread_pool = thread_pool_create(get_num_threads());
+		}
+	}
+
+	if (split_copy) {
+		if (use_rest_vol) {
+			PRINT_DEBUG("Raw chunk reads and writes aren't available through the REST VOL, ignoring -split_copy\n")
+			split_copy = false;
+		}
+		else if (thread_pool == NULL) {
+			thread_pool = thread_pool_create(get_num_threads());
+		}
+	}
+
+	output_path = arena_printf(&run_arena, "%s%s", config->output_foldername, config->output_filename);
+
+	if (!readonly)
 	{
-		PRINT_DEBUG("Invalid max_lat error: %lf\n", max_lat)
-		exit(1);
+		if ((fout = H5Fcreate(output_path, H5F_ACC_TRUNC, fcpl_id, fapl_id_out)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create output file")
+		}
 	}
 
-	bbox.min_lon = min_lon;
-	bbox.max_lon = max_lon;
-	bbox.min_lat = min_lat;
-	bbox.max_lat = max_lat;
+	PRINT_DEBUG("Input filepath = %s%s\n", config->input_foldername, config->input_filename)
+	if (!readonly)
+	{
+		PRINT_DEBUG("Output filepath = %s%s\n", config->output_foldername, config->output_filename)
+	}
 
-	PRINT_DEBUG("Lat Range: %lf - %lf\n", bbox.min_lat, bbox.max_lat)
-	PRINT_DEBUG("Lon Range: %lf - %lf\n", bbox.min_lon, bbox.max_lon)
+	if (selection_mode != SELECT_TIME) {
+		bbox = get_bbox(config);
+	}
 
 	char *current_ground_track = NULL;
 	char *current_dset_name = NULL;
 
 	char **paths_to_copy = NULL;
 	char **paths_to_count = NULL;
-	char *h5path = NULL;
 
-	Range_Indices **range_indices_for_copy = NULL;
-	Range_Indices **photon_count_ranges = NULL;
-	Range_Indices **ground_track_ranges = NULL;
+	Range_Runs **range_indices_for_copy = NULL;
+	Range_Runs **photon_count_ranges = NULL;
+	Range_Runs **ground_track_ranges = NULL;
+	Range_Runs **source_ranges = NULL;
+	Range_Runs *lod_runs[NUM_GROUND_TRACKS] = {NULL};
+	size_t lod_levels[NUM_GROUND_TRACKS] = {0};
+	char **lod_paths = NULL;
+	Range_Runs **range_indices_for_lod = NULL;
+	size_t lod_to_copy_idx = 0;
+
+	hid_t count_dsets[NUM_GROUND_TRACKS];
 
 	size_t dset_to_copy_idx = 0;
 
@@ -1297,17 +9263,11 @@ int main(int argc, char **argv) {
 
 	int bad_value = -1;
 	
-	if ((paths_to_count = calloc(NUM_PHOTON_COUNT_DATASETS, sizeof(char*))) == NULL) {
-		FUNC_GOTO_ERROR("Unable to allocate memory for dataset paths");
-	}
-
-	if ((paths_to_copy = calloc(NUM_COPY_RANGE_DATASETS, sizeof(char*))) == NULL) {
-		FUNC_GOTO_ERROR("Unable to allocate memory for dataset paths");
-	}
-
-	if ((range_indices_for_copy = calloc(NUM_COPY_RANGE_DATASETS, sizeof(Range_Indices*))) == NULL) {
-		FUNC_GOTO_ERROR("Unable to allocate memory for range indices");
-	}
+	paths_to_count = arena_alloc(&run_arena, NUM_GROUND_TRACKS * sizeof(char*));
+	paths_to_copy = arena_alloc(&run_arena, NUM_COPY_RANGE_DATASETS * sizeof(char*));
+	range_indices_for_copy = arena_alloc(&run_arena, NUM_COPY_RANGE_DATASETS * sizeof(Range_Runs*));
+	lod_paths = arena_alloc(&run_arena, NUM_GROUND_TRACKS * NUM_LOD_DATASETS * sizeof(char*));
+	range_indices_for_lod = arena_alloc(&run_arena, NUM_GROUND_TRACKS * NUM_LOD_DATASETS * sizeof(Range_Runs*));
 
 	copy_root_attrs(fin, fout);
 	copy_scalar_datasets(fin, fout);
@@ -1315,17 +9275,62 @@ int main(int argc, char **argv) {
 	for (size_t ground_idx = 0; ground_idx < NUM_GROUND_TRACKS; ground_idx++) {
 		current_ground_track = ground_tracks[ground_idx];
 		/* Set up ranges/paths for get_photon_count_range */
-		
-		h5path = malloc(strlen(current_ground_track) + strlen(GEOLOCATION_PHOTON_DSET) + 1);
-		snprintf(h5path, strlen(GEOLOCATION_PHOTON_DSET) + strlen(current_ground_track) + 1, "%s%s", current_ground_track, GEOLOCATION_PHOTON_DSET);
-		paths_to_count[ground_idx] = h5path;
+		paths_to_count[ground_idx] = arena_printf(&run_arena, "%s%s", current_ground_track, GEOLOCATION_PHOTON_DSET);
 	}
 
 	/* Get the index ranges implied by bounding box on each ground path*/
-	ground_track_ranges = get_index_range(fin, ground_tracks, &bbox);
+	budget_phase("index");
+	if (selection_mode == SELECT_BBOX) {
+		ground_track_ranges = get_index_range(fin, ground_tracks, &bbox, footprints);
+
+		/* "lat_search, <tracks binary searched>, <rows probed>, <chunks read>" */
+		if (monotonic_search) {
+			printf("lat_search, %zu, %zu, %zu\n", monotonic_tracks, bound_probes, bound_blocks);
+		}
+	}
+	else {
+		ground_track_ranges = get_time_range(fin, ground_tracks, &time_window, (selection_mode == SELECT_TIME_BBOX) ? &bbox : NULL);
+
+		/* "time, <delta_time rows probed>, <delta_time blocks read>" */
+		printf("time, %zu, %zu\n", bound_probes, bound_blocks);
+	}
+
+	if (footprints) {
+		append_catalog(catalog_path, input_path, get_granule_id(input_path), footprints);
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			free(footprints[i].blocks);
+		}
+	}
+
+	/* Runs found in a cached subset are rows of the subset. They select what is copied, while the attributes
+	 * record the rows of the granule they came from. */
+	if (cached_result) {
+		source_ranges = arena_alloc(&run_arena, NUM_GROUND_TRACKS * sizeof(Range_Runs*));
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			Range_Runs *cached_runs = read_cached_runs(fin, ground_tracks[i]);
+
+			source_ranges[i] = rebase_runs(ground_track_ranges[i], cached_runs);
+			free_runs(cached_runs);
+		}
+	}
 
 	/* Compute photon counts for each ground path */
-	photon_count_ranges = get_photon_count_range(fin, paths_to_count, ground_track_ranges);
+	budget_phase("count");
+	photon_count_ranges = get_photon_count_range(fin, paths_to_count, ground_track_ranges, count_dsets);
+
+	/* Tracks with more selected photons than lod_point_budget are copied from a level of their pyramid */
+	if (config->lod_point_budget > 0) {
+		/* The page buffer was set for the granule alone, so the pyramid gets none */
+		if ((lod_fin = H5Fopen(lod_path, H5F_ACC_RDONLY, fapl_id_in)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open pyramid, build it with -build_pyramid")
+		}
+
+		for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+			lod_levels[i] = plan_lod_level(lod_fin, ground_tracks[i], photon_count_ranges[i], config->lod_point_budget, &lod_runs[i]);
+		}
+	}
 
 	/* Set up ranges/paths for copy_dataset_range */
 	for (size_t ground_idx = 0; ground_idx < NUM_GROUND_TRACKS; ground_idx++) {
@@ -1337,10 +9342,14 @@ int main(int argc, char **argv) {
 			}
 		}
 
-		Range_Indices *index_range = ground_track_ranges[ground_idx];
+		Range_Runs *index_range = ground_track_ranges[ground_idx];
+		Range_Runs *source_range = (source_ranges) ? source_ranges[ground_idx] : index_range;
+		Range_Indices envelope = (source_range) ? run_envelope(source_range) : (Range_Indices){0, 0};
+		int index_min = (int)envelope.min;
+		int index_max = (int)envelope.max;
 
-		void *min_to_write = (index_range) ? (void*)&index_range->min : (void*)&bad_value;
-		void *max_to_write = (index_range) ? (void*)&index_range->max : (void*)&bad_value;
+		void *min_to_write = (source_range) ? (void*)&index_min : (void*)&bad_value;
+		void *max_to_write = (source_range) ? (void*)&index_max : (void*)&bad_value;
 		
 		if (!readonly) {
 			if (0 > (attr_id = H5Acreate(group, "index_range_min", H5T_NATIVE_INT, dspace_scalar, H5P_DEFAULT, H5P_DEFAULT))) {
@@ -1359,6 +9368,46 @@ int main(int argc, char **argv) {
 				FUNC_GOTO_ERROR("Failed to write to attribute on no index range")
 			}
 
+			/* The copied rows are these runs back to back, one [min, max) row per run */
+			if (source_range) {
+				hsize_t runs_dims[2] = {source_range->num_runs, 2};
+				hsize_t *runs_data = arena_alloc(&run_arena, source_range->num_runs * 2 * sizeof(hsize_t));
+				hid_t runs_space = H5Screate_simple(2, runs_dims, NULL);
+				hid_t runs_attr = H5I_INVALID_HID;
+
+				for (size_t r = 0; r < source_range->num_runs; r++) {
+					runs_data[2 * r] = source_range->runs[r].min;
+					runs_data[2 * r + 1] = source_range->runs[r].max;
+				}
+
+				if (0 > (runs_attr = H5Acreate(group, "index_runs", H5T_NATIVE_HSIZE, runs_space, H5P_DEFAULT, H5P_DEFAULT))) {
+					FUNC_GOTO_ERROR("Failed to create index runs attribute")
+				}
+
+				if (0 > H5Awrite(runs_attr, H5T_NATIVE_HSIZE, runs_data)) {
+					FUNC_GOTO_ERROR("Failed to write index runs attribute")
+				}
+
+				H5Aclose(runs_attr);
+				H5Sclose(runs_space);
+			}
+
+			/* 0 when every selected photon was copied, otherwise the pyramid level copied to lod_<level> */
+			if (lod_fin != H5I_INVALID_HID) {
+				hid_t lod_attr = H5I_INVALID_HID;
+				int lod_level = (int)lod_levels[ground_idx];
+
+				if (0 > (lod_attr = H5Acreate(group, "lod_level", H5T_NATIVE_INT, dspace_scalar, H5P_DEFAULT, H5P_DEFAULT))) {
+					FUNC_GOTO_ERROR("Failed to create lod level attribute")
+				}
+
+				if (0 > H5Awrite(lod_attr, H5T_NATIVE_INT, &lod_level)) {
+					FUNC_GOTO_ERROR("Failed to write lod level attribute")
+				}
+
+				H5Aclose(lod_attr);
+			}
+
 			if (H5Gclose(group) < 0) {
 				FUNC_GOTO_ERROR("Failed to close group");
 			}
@@ -1369,26 +9418,32 @@ int main(int argc, char **argv) {
 			continue;
 		}
 
-		PRINT_DEBUG("Got index_range (%zu, %zu)\n", index_range->min, index_range->max)
+		PRINT_DEBUG("Got %zu index runs from %zu to %zu\n", index_range->num_runs, envelope.min, envelope.max)
 		
 		/* Copy lat, lon, and photo count markers */
 		for (size_t r_idx = 0; r_idx < NUM_REFERENCE_DATASETS; r_idx++) {
 			current_dset_name = reference_datasets[r_idx];
 			/* Add slash between path names */
-			h5path = malloc(strlen(current_ground_track) + strlen(current_dset_name) + 2);
-
-			snprintf(h5path, strlen(current_ground_track) + strlen(current_dset_name) + 2, "%s/%s", current_ground_track, current_dset_name);
-			paths_to_copy[dset_to_copy_idx] = h5path;
+			paths_to_copy[dset_to_copy_idx] = arena_printf(&run_arena, "%s/%s", current_ground_track, current_dset_name);
 			range_indices_for_copy[dset_to_copy_idx] = index_range; 
 
 			dset_to_copy_idx++;
 		}
 
+		if (lod_levels[ground_idx] > 0) {
+			for (size_t d = 0; d < NUM_LOD_DATASETS; d++) {
+				lod_paths[lod_to_copy_idx] = arena_printf(&run_arena, "%s/lod_%zu/%s", current_ground_track, lod_levels[ground_idx], lod_datasets[d]);
+				range_indices_for_lod[lod_to_copy_idx] = lod_runs[ground_idx];
+
+				lod_to_copy_idx++;
+			}
+
+			continue;
+		}
+
 		for (size_t r_idx = 0; r_idx < NUM_PHOTON_COUNT_DATASETS; r_idx++) {
 			current_dset_name = ph_count_datasets[r_idx];
-			h5path = malloc(strlen(current_ground_track) + strlen(current_dset_name) + 2);
-			snprintf(h5path, strlen(current_ground_track) + strlen(current_dset_name) + 2, "%s/%s", current_ground_track, current_dset_name);
-			paths_to_copy[dset_to_copy_idx] = h5path;
+			paths_to_copy[dset_to_copy_idx] = arena_printf(&run_arena, "%s/%s", current_ground_track, current_dset_name);
 			range_indices_for_copy[dset_to_copy_idx] = photon_count_ranges[ground_idx];
 
 			dset_to_copy_idx++;
@@ -1396,31 +9451,83 @@ int main(int argc, char **argv) {
 	}
 
 	/* Perform the copying of the given range of each dataset */
-	copy_dataset_range(fin, fout, paths_to_copy, range_indices_for_copy);
+	budget_phase("copy");
+	if (aggregate) {
+		if (thread_pool == NULL) {
+			thread_pool = thread_pool_create(get_num_threads());
+		}
+
+		aggregate_photons(fin, photon_count_ranges);
+	}
+	else {
+		copy_dataset_range(fin, fout, dset_to_copy_idx, paths_to_copy, range_indices_for_copy);
+	}
+
+	if (lod_to_copy_idx > 0) {
+		copy_dataset_range(lod_fin, fout, lod_to_copy_idx, lod_paths, range_indices_for_lod);
+	}
+
+	budget_phase("done");
+
+	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
+		close_dataset(count_dsets[i]);
+	}
 
 	PRINT_DEBUG("Selection test complete\n");
 
-	/* Clean up */
-	for (size_t i = 0; i < NUM_COPY_RANGE_DATASETS; i++) {
-		free(paths_to_copy[i]);
+	if (page_buf_size > 0) {
+		print_page_buffer_stats(fin);
+	}
+
+	/* "split_copy, <datasets>, <pieces>, <source chunks>" */
+	if (split_copy) {
+		printf("split_copy, %zu, %zu, %zu\n", split_datasets, split_pieces, split_chunks);
+	}
+
+	/* "virtual, <mappings>, <bytes mapped>", the data stays in the input */
+	if (virtual_source) {
+		printf("virtual, %zu, %zu\n", num_mappings, bytes_mapped);
+	}
+
+	/* "catalog, <opened|indexed>, <granules in the catalog before the run>" */
+	if (catalog_path && selection_mode != SELECT_TIME) {
+		printf("catalog, %s, %zu\n", (footprints) ? "indexed" : "opened", catalog.num_granules);
+		free_catalog(&catalog);
 	}
 
+	/* "arena, <bytes of small allocations>, <blocks>" */
+	printf("arena, %zu, %zu\n", run_arena.bytes, run_arena.num_blocks);
+
+	/* Machine-readable result for python/sweep.py */
+	printf("result, %.3f, %zu\n", get_time() - start_time, bytes_copied);
+
+	/* Clean up */
 	for (size_t i = 0; i < NUM_GROUND_TRACKS; i++) {
-		free(paths_to_count[i]);
-		free(ground_track_ranges[i]);
-		free(photon_count_ranges[i]);
+		free_runs(ground_track_ranges[i]);
+		free_runs(photon_count_ranges[i]);
+
+		if (source_ranges) {
+			free_runs(source_ranges[i]);
+		}
+
+		free_runs(lod_runs[i]);
+	}
+
+	if (lod_fin != H5I_INVALID_HID) {
+		H5Fclose(lod_fin);
 	}
 
 	free(ground_track_ranges);
 	free(photon_count_ranges);
-	free(paths_to_count);
-	free(paths_to_copy);
-	free(range_indices_for_copy);
 
 #ifdef USE_REST_VOL
 	H5rest_term();
 #endif
 
+	if (thread_pool) {
+		thread_pool_destroy(thread_pool);
+	}
+
 	H5Pclose(fapl_id_in);
 	H5Pclose(fapl_id_out);
 	H5Pclose(fcpl_id);
@@ -1428,23 +9535,35 @@ int main(int argc, char **argv) {
 
 	if (!readonly)
 	{
+		/* Objects left open would keep the file open, and its bytes incomplete, after H5Fclose. The cache copies
+		 * the bytes and the materialize process opens the file, so both need it really closed. */
+		if (use_result_cache || materialize_later) {
+			close_file_objects(fout);
+		}
+
 		H5Fclose(fout);
 	}
 
-	free(input_path);
-	free(output_path);
+	/* "cache, <hit|miss>, <hits>, <misses>, <entries>, <bytes>", counted across runs sharing the cache */
+	if (use_result_cache) {
+		if (cached_result == NULL) {
+			store_result(&result_cache, output_path, granule_id, dataset_list_id, &bbox);
+		}
 
-	free(config->loglevel);
-	free(config->logfile);
+		close_result_cache(&result_cache);
+		printf("cache, %s, %zu, %zu, %zu, %zu\n", (cached_result) ? "hit" : "miss", result_cache.hits, result_cache.misses,
+				result_cache.num_entries, get_result_cache_bytes(&result_cache));
+		free_result_cache(&result_cache);
+	}
 
-#ifndef USE_REST_VOL
-	free(config->input_foldername);
-	free(config->output_foldername);
-#endif
+	/* The subset is complete as a virtual one, so the copy can happen after the run returns */
+	if (materialize_later) {
+		start_materialize(config_filename, output_path);
+	}
 
-	free(config->input_filename);
-	free(config->output_filename);
-	free(config);
+	/* Paths, dims and config strings all came from the arena */
+	arena_release(&run_arena);
+	free(virtual_source);
 
 	return 0;
 }
@@ -0,0 +1,631 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <yaml.h>
+
+#include "hdf5.h"
+
+#define SUCCEED 0
+#define FAIL (-1)
+
+#define FILEPATH_BUFFER_SIZE 1024
+
+#include "rest_vol_public.h"
+
+/*
+ * Macro to push the current function to the current error stack
+ * and then goto the "done" label, which should appear inside the
+ * function. (compatible with v1 and v2 errors)
+ */
+#define FUNC_GOTO_ERROR(err_msg)      \
+	fprintf(stderr, "%s\n", err_msg); \
+	fprintf(stderr, "\n");            \
+	exit(1);
+
+/* Print if program is run with debug flag */
+#define PRINT_DEBUG(...)              \
+	if (debug)                        \
+	{                                 \
+		fprintf(stderr, __VA_ARGS__); \
+	}
+
+#define CONFIG_FILENAME "../config/config.yml"
+
+/* Target size of one chunk of the transposed cache, each holding whole time series of a few sites */
+#define CACHE_CHUNK_BYTES (1024 * 1024)
+
+bool debug = false;
+bool use_ros3 = false;
+bool use_rest_vol = false;
+bool use_cache = false;
+bool build_cache = false;
+
+/* Time-major copy of the dataset, filled one band of site columns at a time.
+ * A band is one chunk of the copy, rounded to whole source chunks, so building it reads and writes only whole chunks. */
+typedef struct TransposedCache{
+	hid_t file;
+	hid_t dset;
+	hid_t built_dset;
+	hsize_t band_width;
+	hsize_t num_bands;
+	unsigned char *built;
+} TransposedCache;
+
+double get_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Return a malloc'd copy of the value of a top level key in the yaml config, NULL if it isn't there */
+char *get_config_value(const char *yaml_config_filename, const char *key) {
+	yaml_parser_t parser;
+	yaml_event_t event;
+	FILE *config_input = NULL;
+	char *value = NULL;
+	bool is_key = true;
+	bool found = false;
+	int depth = 0;
+
+	if ((config_input = fopen(yaml_config_filename, "r")) == NULL) {
+		FUNC_GOTO_ERROR("failed to open config.yml");
+	}
+
+	yaml_parser_initialize(&parser);
+	yaml_parser_set_input_file(&parser, config_input);
+
+	while (value == NULL) {
+		if (!yaml_parser_parse(&parser, &event)) {
+			FUNC_GOTO_ERROR("Failed to parse config")
+		}
+
+		if (event.type == YAML_STREAM_END_EVENT) {
+			yaml_event_delete(&event);
+			break;
+		}
+
+		if (event.type == YAML_MAPPING_START_EVENT || event.type == YAML_SEQUENCE_START_EVENT) {
+			depth++;
+		}
+		else if (event.type == YAML_MAPPING_END_EVENT || event.type == YAML_SEQUENCE_END_EVENT) {
+			depth--;
+			is_key = true;
+		}
+		else if (event.type == YAML_SCALAR_EVENT && depth == 1) {
+			const char *scalar = (const char *)event.data.scalar.value;
+
+			if (!is_key && found)
+				value = strdup(scalar);
+
+			found = is_key && !strcmp(scalar, key);
+			is_key = !is_key;
+		}
+
+		yaml_event_delete(&event);
+	}
+
+	yaml_parser_delete(&parser);
+	fclose(config_input);
+
+	return value;
+}
+
+/* Read rows [row_start, row_start + num_rows) of columns [col_start, col_start + num_cols) as doubles */
+void read_block(hid_t dset, hsize_t row_start, hsize_t num_rows, hsize_t col_start, hsize_t num_cols, double *buf) {
+	hid_t file_space = H5I_INVALID_HID;
+	hid_t mem_space = H5I_INVALID_HID;
+	hsize_t start[2] = {row_start, col_start};
+	hsize_t count[2] = {num_rows, num_cols};
+
+	if ((file_space = H5Dget_space(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataspace")
+	}
+
+	if (H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL) < 0) {
+		FUNC_GOTO_ERROR("Failed to select hyperslab")
+	}
+
+	if ((mem_space = H5Screate_simple(2, count, NULL)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create memory dataspace")
+	}
+
+	if (H5Dread(dset, H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, buf) < 0) {
+		FUNC_GOTO_ERROR("Failed to read from dataset")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+}
+
+void write_block(hid_t dset, hsize_t row_start, hsize_t num_rows, hsize_t col_start, hsize_t num_cols, const double *buf) {
+	hid_t file_space = H5I_INVALID_HID;
+	hid_t mem_space = H5I_INVALID_HID;
+	hsize_t start[2] = {row_start, col_start};
+	hsize_t count[2] = {num_rows, num_cols};
+
+	if ((file_space = H5Dget_space(dset)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to get dataspace")
+	}
+
+	if (H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL) < 0) {
+		FUNC_GOTO_ERROR("Failed to select hyperslab")
+	}
+
+	if ((mem_space = H5Screate_simple(2, count, NULL)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create memory dataspace")
+	}
+
+	if (H5Dwrite(dset, H5T_NATIVE_DOUBLE, mem_space, file_space, H5P_DEFAULT, buf) < 0) {
+		FUNC_GOTO_ERROR("Failed to write to dataset")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(file_space);
+}
+
+/* Print min, max and mean of values in the same form as python/nrel_selection.py */
+void print_stats(const char *h5path, const char *selection, const double *values, size_t count) {
+	double min = values[0];
+	double max = values[0];
+	double sum = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (values[i] < min)
+			min = values[i];
+
+		if (values[i] > max)
+			max = values[i];
+
+		sum += values[i];
+	}
+
+	printf("%s%s - min: %g max: %g mean: %.2f\n", h5path, selection, min, max, sum / count);
+}
+
+/* Open the transposed cache at cache_path, creating it if it doesn't exist or was made from another source */
+TransposedCache *open_transposed_cache(const char *cache_path, const char *source_path, hid_t source_dset) {
+	TransposedCache *cache = NULL;
+	hid_t source_type = H5I_INVALID_HID;
+	hid_t source_dcpl = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+	hid_t dcpl = H5I_INVALID_HID;
+	hsize_t dims[2];
+	hsize_t source_chunk[2] = {0, 0};
+	hsize_t cache_chunk[2];
+	char stored_source[FILEPATH_BUFFER_SIZE] = "";
+
+	if ((cache = calloc(1, sizeof(*cache))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate cache")
+	}
+
+	space = H5Dget_space(source_dset);
+	H5Sget_simple_extent_dims(space, dims, NULL);
+	source_type = H5Dget_type(source_dset);
+	source_dcpl = H5Dget_create_plist(source_dset);
+
+	/* Contiguous sources are built a cache chunk at a time */
+	if (H5Pget_layout(source_dcpl) == H5D_CHUNKED)
+		H5Pget_chunk(source_dcpl, 2, source_chunk);
+
+	cache_chunk[0] = dims[0];
+	cache_chunk[1] = CACHE_CHUNK_BYTES / (dims[0] * H5Tget_size(source_type));
+
+	if (cache_chunk[1] == 0)
+		cache_chunk[1] = 1;
+
+	/* Round to the nearest multiple of the source chunk width, at least one source chunk */
+	if (source_chunk[1] > 0) {
+		hsize_t source_chunks = (cache_chunk[1] + source_chunk[1] / 2) / source_chunk[1];
+
+		cache_chunk[1] = ((source_chunks > 0) ? source_chunks : 1) * source_chunk[1];
+	}
+
+	if (cache_chunk[1] > dims[1])
+		cache_chunk[1] = dims[1];
+
+	cache->band_width = cache_chunk[1];
+	cache->num_bands = (dims[1] + cache->band_width - 1) / cache->band_width;
+
+	if ((cache->built = calloc(cache->num_bands, 1)) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate cache band map")
+	}
+
+	/* Reuse an existing cache of the same source */
+	H5E_BEGIN_TRY
+	{
+		cache->file = H5Fopen(cache_path, H5F_ACC_RDWR, H5P_DEFAULT);
+	}
+	H5E_END_TRY
+
+	if (cache->file != H5I_INVALID_HID) {
+		hid_t attr = H5Aopen(cache->file, "source", H5P_DEFAULT);
+		hid_t str_type = H5Tcopy(H5T_C_S1);
+
+		H5Tset_size(str_type, sizeof(stored_source));
+
+		if (attr == H5I_INVALID_HID || H5Aread(attr, str_type, stored_source) < 0) {
+			stored_source[0] = '\0';
+		}
+
+		H5Tclose(str_type);
+		H5Aclose(attr);
+
+		if (strcmp(stored_source, source_path)) {
+			PRINT_DEBUG("Cache %s was made from %s, rebuilding\n", cache_path, stored_source)
+			H5Fclose(cache->file);
+			cache->file = H5I_INVALID_HID;
+		}
+	}
+
+	if (cache->file != H5I_INVALID_HID) {
+		hid_t built_space = H5I_INVALID_HID;
+		hsize_t stored_bands = 0;
+
+		cache->dset = H5Dopen2(cache->file, "transposed", H5P_DEFAULT);
+		cache->built_dset = H5Dopen2(cache->file, "built", H5P_DEFAULT);
+
+		if (cache->dset == H5I_INVALID_HID || cache->built_dset == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to open cache datasets")
+		}
+
+		built_space = H5Dget_space(cache->built_dset);
+		H5Sget_simple_extent_dims(built_space, &stored_bands, NULL);
+		H5Sclose(built_space);
+
+		/* Made with other bands, so its band map doesn't apply */
+		if (stored_bands != cache->num_bands) {
+			PRINT_DEBUG("Cache %s has %llu bands instead of %llu, rebuilding\n", cache_path, (unsigned long long)stored_bands,
+						(unsigned long long)cache->num_bands)
+			H5Dclose(cache->built_dset);
+			H5Dclose(cache->dset);
+			H5Fclose(cache->file);
+			cache->file = H5I_INVALID_HID;
+		}
+	}
+
+	if (cache->file != H5I_INVALID_HID) {
+
+		if (H5Dread(cache->built_dset, H5T_NATIVE_UCHAR, H5S_ALL, H5S_ALL, H5P_DEFAULT, cache->built) < 0) {
+			FUNC_GOTO_ERROR("Failed to read cache band map")
+		}
+	}
+	else {
+		hid_t attr_space = H5Screate(H5S_SCALAR);
+		hid_t str_type = H5Tcopy(H5T_C_S1);
+		hid_t attr = H5I_INVALID_HID;
+		hid_t built_space = H5Screate_simple(1, &cache->num_bands, NULL);
+
+		if ((cache->file = H5Fcreate(cache_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create cache file")
+		}
+
+		H5Tset_size(str_type, strlen(source_path) + 1);
+
+		if ((attr = H5Acreate(cache->file, "source", str_type, attr_space, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID ||
+			H5Awrite(attr, str_type, source_path) < 0) {
+			FUNC_GOTO_ERROR("Failed to record cache source")
+		}
+
+		dcpl = H5Pcreate(H5P_DATASET_CREATE);
+
+		if (H5Pset_chunk(dcpl, 2, cache_chunk) < 0) {
+			FUNC_GOTO_ERROR("Failed to set cache chunk size")
+		}
+
+		if ((cache->dset = H5Dcreate2(cache->file, "transposed", source_type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create cache dataset")
+		}
+
+		if ((cache->built_dset = H5Dcreate2(cache->file, "built", H5T_NATIVE_UCHAR, built_space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID) {
+			FUNC_GOTO_ERROR("Failed to create cache band map")
+		}
+
+		if (H5Dwrite(cache->built_dset, H5T_NATIVE_UCHAR, H5S_ALL, H5S_ALL, H5P_DEFAULT, cache->built) < 0) {
+			FUNC_GOTO_ERROR("Failed to write cache band map")
+		}
+
+		H5Pclose(dcpl);
+		H5Sclose(built_space);
+		H5Aclose(attr);
+		H5Tclose(str_type);
+		H5Sclose(attr_space);
+	}
+
+	PRINT_DEBUG("Transposed cache: %llu bands of %llu columns, chunks of %llu x %llu\n", (unsigned long long)cache->num_bands,
+				(unsigned long long)cache->band_width, (unsigned long long)cache_chunk[0], (unsigned long long)cache_chunk[1])
+
+	H5Pclose(source_dcpl);
+	H5Tclose(source_type);
+	H5Sclose(space);
+
+	return cache;
+}
+
+void close_transposed_cache(TransposedCache *cache) {
+	H5Dclose(cache->built_dset);
+	H5Dclose(cache->dset);
+	H5Fclose(cache->file);
+	free(cache->built);
+	free(cache);
+}
+
+/* Copy one band of columns from the source into the cache. If column is inside the band, also return its time series. */
+void build_cache_band(TransposedCache *cache, hid_t source_dset, hsize_t band, hsize_t num_rows, hsize_t num_cols, hsize_t column, double *col_buf) {
+	hsize_t col_start = band * cache->band_width;
+	hsize_t width = cache->band_width;
+	double *band_buf = NULL;
+	hid_t built_space = H5I_INVALID_HID;
+	hid_t mem_space = H5I_INVALID_HID;
+	hsize_t one = 1;
+
+	if (col_start + width > num_cols)
+		width = num_cols - col_start;
+
+	if ((band_buf = malloc(num_rows * width * sizeof(double))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate band buffer")
+	}
+
+	read_block(source_dset, 0, num_rows, col_start, width, band_buf);
+	write_block(cache->dset, 0, num_rows, col_start, width, band_buf);
+
+	if (col_buf && column >= col_start && column < col_start + width) {
+		for (hsize_t row = 0; row < num_rows; row++)
+			col_buf[row] = band_buf[row * width + (column - col_start)];
+	}
+
+	/* Mark the band built only once its data is written */
+	cache->built[band] = 1;
+	built_space = H5Dget_space(cache->built_dset);
+	mem_space = H5Screate_simple(1, &one, NULL);
+	H5Sselect_hyperslab(built_space, H5S_SELECT_SET, &band, NULL, &one, NULL);
+
+	if (H5Dwrite(cache->built_dset, H5T_NATIVE_UCHAR, mem_space, built_space, H5P_DEFAULT, &cache->built[band]) < 0) {
+		FUNC_GOTO_ERROR("Failed to update cache band map")
+	}
+
+	H5Sclose(mem_space);
+	H5Sclose(built_space);
+	free(band_buf);
+}
+
+/* Read the time series of one column, from the cache if its band is built, otherwise from the source,
+ * adding the band to the cache on the way. Return true on a cache hit. */
+bool read_col_cached(TransposedCache *cache, hid_t source_dset, hsize_t num_rows, hsize_t num_cols, hsize_t column, double *buf) {
+	hsize_t band = column / cache->band_width;
+
+	if (cache->built[band]) {
+		read_block(cache->dset, 0, num_rows, column, 1, buf);
+		return true;
+	}
+
+	build_cache_band(cache, source_dset, band, num_rows, num_cols, column, buf);
+
+	return false;
+}
+
+bool cache_complete(TransposedCache *cache) {
+	for (hsize_t band = 0; band < cache->num_bands; band++) {
+		if (!cache->built[band])
+			return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv) {
+	hid_t fapl_id = H5I_INVALID_HID;
+	hid_t fin = H5I_INVALID_HID;
+	hid_t dset = H5I_INVALID_HID;
+	hid_t space = H5I_INVALID_HID;
+
+	char *config_filename = CONFIG_FILENAME;
+	char *nrel_foldername = NULL;
+	char *nrel_filename = NULL;
+	char *nrel_h5path = NULL;
+	char *cache_filename = NULL;
+	char *machine = NULL;
+	char nrel_filepath[FILEPATH_BUFFER_SIZE];
+	char cache_path[FILEPATH_BUFFER_SIZE];
+	char selection[64];
+
+	TransposedCache *cache = NULL;
+	hsize_t dims[2];
+	double *col_buf = NULL;
+	double *row_buf = NULL;
+	int run_number = 1;
+	int num_reads = 1;
+	unsigned seed = (unsigned)time(NULL);
+
+	double start_time = get_time();
+
+	for (int optind = 1; optind < argc; optind++)
+	{
+		if (strcmp(argv[optind], "-debug") == 0) {
+			debug = true;
+		}
+		else if (strcmp(argv[optind], "-use_ros3") == 0) {
+			use_ros3 = true;
+		}
+		else if (strcmp(argv[optind], "-use_rest_vol") == 0) {
+			use_rest_vol = true;
+		}
+		else if (strcmp(argv[optind], "-transposed_cache") == 0) {
+			use_cache = true;
+		}
+		else if (strcmp(argv[optind], "-build_cache") == 0) {
+			use_cache = true;
+			build_cache = true;
+		}
+		else if (strcmp(argv[optind], "-reads") == 0 && optind + 1 < argc) {
+			num_reads = atoi(argv[++optind]);
+		}
+		else if (strcmp(argv[optind], "-seed") == 0 && optind + 1 < argc) {
+			seed = strtoul(argv[++optind], NULL, 10);
+		}
+		else if (strcmp(argv[optind], "-config") == 0 && optind + 1 < argc) {
+			config_filename = argv[++optind];
+		}
+		else {
+			run_number = atoi(argv[optind]);
+		}
+	}
+
+	srand(seed);
+
+	nrel_foldername = get_config_value(config_filename, "nrel_foldername");
+	nrel_filename = get_config_value(config_filename, "nrel_filename");
+	nrel_h5path = get_config_value(config_filename, "nrel_h5path");
+	cache_filename = get_config_value(config_filename, "nrel_cache_filename");
+	machine = get_config_value(config_filename, "machine");
+
+	if (!nrel_foldername || !nrel_filename || !nrel_h5path) {
+		FUNC_GOTO_ERROR("nrel_foldername, nrel_filename and nrel_h5path must be set in the config")
+	}
+
+	if (nrel_foldername[strlen(nrel_foldername) - 1] != '/') {
+		FUNC_GOTO_ERROR("expected nrel_foldername to end with '/'")
+	}
+
+	snprintf(nrel_filepath, sizeof(nrel_filepath), "%s%s", nrel_foldername, nrel_filename);
+
+	if (cache_filename == NULL || !strcmp(cache_filename, "null") || cache_filename[0] == '\0')
+		snprintf(cache_path, sizeof(cache_path), "%s.transposed.h5", nrel_filename);
+	else
+		snprintf(cache_path, sizeof(cache_path), "%s", cache_filename);
+
+	printf("filepath: %s\n", nrel_filepath);
+
+	if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to create FAPL")
+	}
+
+	if (use_ros3) {
+		H5FD_ros3_fapl_t param;
+
+		memset(&param, 0, sizeof(param));
+		strcpy(param.aws_region, "us-west-2");
+		param.version = 1;
+		param.authenticate = 0;
+
+		if (H5Pset_fapl_ros3(fapl_id, &param) < 0) {
+			FUNC_GOTO_ERROR("Failed to set ros3 in FAPL")
+		}
+	}
+	else if (use_rest_vol) {
+		H5rest_init();
+		H5Pset_fapl_rest_vol(fapl_id);
+		PRINT_DEBUG("== Using REST VOL == \n")
+	}
+
+	if ((fin = H5Fopen(nrel_filepath, H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open input file")
+	}
+
+	if ((dset = H5Dopen2(fin, nrel_h5path, H5P_DEFAULT)) == H5I_INVALID_HID) {
+		FUNC_GOTO_ERROR("Failed to open dataset")
+	}
+
+	space = H5Dget_space(dset);
+
+	if (H5Sget_simple_extent_ndims(space) != 2) {
+		FUNC_GOTO_ERROR("Expected a two dimensional dataset")
+	}
+
+	H5Sget_simple_extent_dims(space, dims, NULL);
+	printf("%s\n", nrel_h5path);
+
+	if ((col_buf = malloc(dims[0] * sizeof(double))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate column buffer")
+	}
+
+	if ((row_buf = malloc(dims[1] * sizeof(double))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate row buffer")
+	}
+
+	if (use_cache) {
+		cache = open_transposed_cache(cache_path, nrel_filepath, dset);
+
+		if (build_cache) {
+			double build_time = get_time();
+			hsize_t num_built = 0;
+
+			for (hsize_t band = 0; band < cache->num_bands; band++) {
+				if (!cache->built[band]) {
+					build_cache_band(cache, dset, band, dims[0], dims[1], 0, NULL);
+					num_built++;
+				}
+			}
+
+			/* "build, <bands built>, <seconds>" */
+			printf("build, %llu, %.3f\n", (unsigned long long)num_built, get_time() - build_time);
+		}
+	}
+
+	/* Each read prints "read, <orientation>, <layout>, <index>, <seconds>" after its stats */
+	for (int i = 0; i < num_reads; i++) {
+		hsize_t col_index = (hsize_t)rand() % dims[1];
+		hsize_t row_index = (hsize_t)rand() % dims[0];
+		double t = 0;
+
+		t = get_time();
+		read_block(dset, 0, dims[0], col_index, 1, col_buf);
+		t = get_time() - t;
+		snprintf(selection, sizeof(selection), "[:, %llu]", (unsigned long long)col_index);
+		print_stats(nrel_h5path, selection, col_buf, dims[0]);
+		printf("read, col, source, %llu, %.6f\n", (unsigned long long)col_index, t);
+
+		t = get_time();
+		read_block(dset, row_index, 1, 0, dims[1], row_buf);
+		t = get_time() - t;
+		snprintf(selection, sizeof(selection), "[%llu, :]", (unsigned long long)row_index);
+		print_stats(nrel_h5path, selection, row_buf, dims[1]);
+		printf("read, row, source, %llu, %.6f\n", (unsigned long long)row_index, t);
+
+		if (cache) {
+			bool hit = false;
+
+			t = get_time();
+			hit = read_col_cached(cache, dset, dims[0], dims[1], col_index, col_buf);
+			t = get_time() - t;
+			printf("read, col, %s, %llu, %.6f\n", (hit) ? "cache_hit" : "cache_miss", (unsigned long long)col_index, t);
+
+			/* Row reads touch every cache chunk, time them for comparison once the cache is whole */
+			if (cache_complete(cache)) {
+				t = get_time();
+				read_block(cache->dset, row_index, 1, 0, dims[1], row_buf);
+				t = get_time() - t;
+				printf("read, row, cache_hit, %llu, %.6f\n", (unsigned long long)row_index, t);
+			}
+		}
+	}
+
+	/* print result for inclusion in benchmark csv, as python/nrel_selection.py does */
+	printf("%d, , , %5.1f, c, %s, %s, , %s,    , , , , , , %s\n", run_number, get_time() - start_time, (machine) ? machine : "",
+		   nrel_foldername, nrel_filename, (cache) ? "transposed_cache" : "");
+
+	if (cache)
+		close_transposed_cache(cache);
+
+	free(col_buf);
+	free(row_buf);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(fin);
+	H5Pclose(fapl_id);
+
+#ifdef USE_REST_VOL
+	H5rest_term();
+#endif
+
+	free(nrel_foldername);
+	free(nrel_filename);
+	free(nrel_h5path);
+	free(cache_filename);
+	free(machine);
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include "thread_pool.h"
+
+/* As in icesat2_selection.c, a distributed run is aborted as a whole */
+#ifdef USE_MPI
+#define EXIT_FAILURE_RUN()                       \
+	{                                            \
+		int mpi_started = 0;                     \
+		int mpi_finished = 0;                    \
+		MPI_Initialized(&mpi_started);           \
+		MPI_Finalized(&mpi_finished);            \
+		if (mpi_started && !mpi_finished)        \
+			MPI_Abort(MPI_COMM_WORLD, 1);        \
+		exit(1);                                 \
+	}
+#else
+#define EXIT_FAILURE_RUN() exit(1);
+#endif
+
+/*
+ * Macro to push the current function to the current error stack
+ * and then goto the "done" label, which should appear inside the
+ * function. (compatible with v1 and v2 errors)
+ */
+#define FUNC_GOTO_ERROR(err_msg)      \
+	fprintf(stderr, "%s\n", err_msg); \
+	fprintf(stderr, "\n");            \
+	EXIT_FAILURE_RUN()
+
+/* Return a monotonic timestamp in seconds */
+double get_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void *thread_pool_worker(void *arg) {
+	ThreadPool *pool = (ThreadPool *)arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (true) {
+		Task *task = NULL;
+
+		while (pool->head == NULL && !pool->shutdown) {
+			pthread_cond_wait(&pool->task_ready, &pool->lock);
+		}
+
+		if (pool->head == NULL && pool->shutdown)
+			break;
+
+		task = pool->head;
+		pool->head = task->next;
+
+		if (pool->head == NULL)
+			pool->tail = NULL;
+
+		pthread_mutex_unlock(&pool->lock);
+
+		task->func(task->arg);
+		free(task);
+
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->all_done);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+ThreadPool *thread_pool_create(size_t count) {
+	ThreadPool *pool = NULL;
+
+	if ((pool = calloc(1, sizeof(*pool))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate thread pool")
+	}
+
+	if ((pool->threads = calloc(count, sizeof(pthread_t))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate thread pool threads")
+	}
+
+	pool->num_threads = count;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->task_ready, NULL);
+	pthread_cond_init(&pool->all_done, NULL);
+
+	for (size_t i = 0; i < count; i++) {
+		if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) != 0) {
+			FUNC_GOTO_ERROR("Failed to create worker thread")
+		}
+	}
+
+	return pool;
+}
+
+void thread_pool_submit(ThreadPool *pool, void (*func)(void *arg), void *arg) {
+	Task *task = NULL;
+
+	if ((task = malloc(sizeof(*task))) == NULL) {
+		FUNC_GOTO_ERROR("Failed to allocate task")
+	}
+
+	task->func = func;
+	task->arg = arg;
+	task->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->tail)
+		pool->tail->next = task;
+	else
+		pool->head = task;
+
+	pool->tail = task;
+	pool->pending++;
+
+	pthread_cond_signal(&pool->task_ready);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Block until every submitted task has finished */
+void thread_pool_wait(ThreadPool *pool) {
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->all_done, &pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(ThreadPool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->task_ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->num_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->task_ready);
+	pthread_cond_destroy(&pool->all_done);
+	free(pool->threads);
+	free(pool);
+}
+
+size_t get_num_threads(void) {
+	long online_cpus = 0;
+
+	if (num_threads > 0)
+		return num_threads;
+
+	online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (online_cpus > 0) ? (size_t)online_cpus : 1;
+}
@@ -0,0 +1,40 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* A unit of work queued on the thread pool */
+typedef struct Task{
+	void (*func)(void *arg);
+	void *arg;
+	struct Task *next;
+} Task;
+
+/* Fixed set of worker threads consuming a FIFO of tasks */
+typedef struct ThreadPool{
+	pthread_t *threads;
+	size_t num_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t task_ready;
+	pthread_cond_t all_done;
+	Task *head;
+	Task *tail;
+	size_t pending;
+	bool shutdown;
+} ThreadPool;
+
+/* Worker threads from -threads, 0 for one per online CPU. Defined by each program. */
+extern size_t num_threads;
+
+double get_time(void);
+
+ThreadPool *thread_pool_create(size_t count);
+void thread_pool_submit(ThreadPool *pool, void (*func)(void *arg), void *arg);
+void thread_pool_wait(ThreadPool *pool);
+void thread_pool_destroy(ThreadPool *pool);
+
+size_t get_num_threads(void);
+
+#endif
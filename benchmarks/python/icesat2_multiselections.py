@@ -1,5 +1,6 @@
 from collections import namedtuple
 import sys
+import time
 import logging
 import s3fs
 import h5py
@@ -310,11 +311,15 @@ def process(fin, fout, bbox):
     copy_scalar_datasets(fin, fout)
     save_georegion(fout, bbox)
 
-    mm_in = ObjectManager(fin, ground_tracks)
-    mm_out = ObjectManager(fout)
+    # number of selections the managers have in flight at once
+    max_workers = config.get("max_workers", 8)
+    mm_in = ObjectManager(fin, ground_tracks, max_workers=max_workers)
+    mm_out = ObjectManager(fout, max_workers=max_workers)
     mm_out.create_groups(ground_tracks)
+    start_time = time.time()
     ranges = get_index_ranges(mm_in, bbox)
     print("ranges:", ranges)
+    print(f"get_index_ranges: {time.time() - start_time:.2f}s with max_workers: {max_workers}")
 
 
     """
@@ -0,0 +1,162 @@
+import sys
+import logging
+import numpy as np
+import s3fs
+import h5py
+import config
+
+ground_tracks = ("gt1l", "gt1r", "gt2l", "gt2r", "gt3l", "gt3r")
+reference_datasets = ("geolocation/reference_photon_lat",
+                    "geolocation/reference_photon_lon",
+                    "geolocation/segment_ph_cnt")
+
+ph_count_datasets = ("heights/dist_ph_along",
+                    "heights/h_ph",
+                    "heights/signal_conf_ph",
+                    "heights/quality_ph",
+                    "heights/lat_ph",
+                    "heights/lon_ph",
+                    "heights/delta_time",
+                    )
+
+MANIFEST_VERSION = 1
+
+# check if hdf5 library version supports chunk iteration
+hdf_library_version  = h5py.version.hdf5_version_tuple
+library_has_chunk_iter = hdf_library_version >= (1, 14, 0)
+
+
+def get_loglevel():
+    val = config.get("loglevel")
+    val = val.upper()
+    if val == "DEBUG":
+        loglevel = logging.DEBUG
+    elif val == "INFO":
+        loglevel = logging.INFO
+    elif val in ("WARN", "WARNING"):
+        loglevel = logging.WARNING
+    elif val == "ERROR":
+        loglevel = logging.ERROR
+    else:
+        choices = ("DEBUG", "INFO", "WARNING", "ERROR")
+
+        raise ValueError(f"loglevel must be one of {choices}")
+    return loglevel
+
+
+# open a local file, s3 object (s3fs) or http url (ros3) with h5py
+# the manifest records byte offsets, so HSDS domains can't be used
+def h5File(filepath):
+    kwargs = {'mode': 'r'}
+    if filepath.startswith("hdf5://"):
+        raise ValueError("manifests can only be made for HDF5 files, not HSDS domains")
+    elif filepath.startswith("s3://"):
+        s3 = s3fs.S3FileSystem()
+        f = h5py.File(s3.open(filepath, 'rb'), **kwargs)
+    elif filepath.startswith("http"):
+        # use ros3 driver
+        kwargs['driver'] = "ros3"
+        kwargs['aws_region'] = config.get("aws_region").encode("utf-8")
+        kwargs['secret_id'] = config.get("aws_access_key_id").encode("utf-8")
+        kwargs['secret_key'] = config.get("aws_secret_access_key").encode("utf-8")
+        f = h5py.File(filepath, **kwargs)
+    else:
+        f = h5py.File(filepath, **kwargs)
+
+    return f
+
+
+# filter pipeline as space separated <filter id>:<first client value>, "-" if unfiltered
+def get_filters(dset):
+    dcpl = dset.id.get_create_plist()
+    filters = []
+    for i in range(dcpl.get_nfilters()):
+        filter_id, _, cd_values, _ = dcpl.get_filter(i)
+        if cd_values:
+            filters.append(f"{filter_id}:{cd_values[0]}")
+        else:
+            filters.append(f"{filter_id}")
+    if not filters:
+        return "-"
+    return " ".join(filters)
+
+
+# return (logical offset, byte offset, size, filter mask) of each allocated chunk,
+# a contiguous dataset is recorded as one unfiltered chunk
+def get_chunks(dset):
+    chunks = []
+    if dset.chunks is None:
+        byte_offset = dset.id.get_offset()
+        if byte_offset is None:
+            raise ValueError(f"{dset.name} has no contiguous storage to read by range")
+        chunks.append(((0,) * len(dset.shape), byte_offset, dset.id.get_storage_size(), 0))
+    elif library_has_chunk_iter:
+        def chunk_callback(chunk_info):
+            chunks.append((chunk_info.chunk_offset, chunk_info.byte_offset, chunk_info.size, chunk_info.filter_mask))
+        dset.id.chunk_iter(chunk_callback)
+    else:
+        # Using old HDF5 version without H5Dchunk_iter
+        spaceid = dset.id.get_space()
+        for i in range(dset.id.get_num_chunks(spaceid)):
+            chunk_info = dset.id.get_chunk_info(i, spaceid)
+            chunks.append((chunk_info.chunk_offset, chunk_info.byte_offset, chunk_info.size, chunk_info.filter_mask))
+    return chunks
+
+
+# write the dataset line followed by one line per chunk
+def write_dataset(dset, out):
+    chunk_dims = dset.chunks if dset.chunks is not None else dset.shape
+    fill_value = np.array(dset.fillvalue, dtype=dset.dtype).tobytes().hex()
+    fields = ["dataset", dset.name, dset.dtype.str, str(len(dset.shape))]
+    fields.extend(str(dim) for dim in dset.shape)
+    fields.extend(str(dim) for dim in chunk_dims)
+    fields.extend([get_filters(dset), fill_value])
+    out.write(", ".join(fields) + "\n")
+
+    chunks = get_chunks(dset)
+    for chunk_offset, byte_offset, size, filter_mask in chunks:
+        fields = ["chunk"]
+        fields.extend(str(coord) for coord in chunk_offset)
+        fields.extend([str(byte_offset), str(size), str(filter_mask)])
+        out.write(", ".join(fields) + "\n")
+
+    logging.info(f"{dset.name}: {len(chunks)} chunks")
+    return len(chunks)
+
+
+#
+# main
+#
+
+# setup logging
+logfname = config.get("log_file")
+loglevel = get_loglevel()
+logging.basicConfig(filename=logfname, format='%(levelname)s %(asctime)s %(message)s', level=loglevel)
+logging.debug(f"set log_level to {loglevel}")
+
+input_dirname = config.get("input_foldername")
+if not input_dirname or input_dirname[-1] != '/':
+    sys.exit("expected input_foldername to end with '/'")
+input_filename = config.get("input_filename")
+input_filepath = f"{input_dirname}{input_filename}"
+
+# use "--output=<path>" to write somewhere other than <input path>.manifest, where the benchmark looks for it
+output_filepath = config.getCmdLineArg("output")
+if not output_filepath:
+    if input_filepath.startswith("http"):
+        sys.exit("can't write next to an http input, use --output=<path>")
+    output_filepath = f"{input_filepath}.manifest"
+
+if output_filepath.startswith("s3://"):
+    output_file = s3fs.S3FileSystem().open(output_filepath, "w")
+else:
+    output_file = open(output_filepath, "w")
+
+num_chunks = 0
+with h5File(input_filepath) as f, output_file as out:
+    out.write(f"manifest, {MANIFEST_VERSION}, {input_filepath}\n")
+    for ground_track in ground_tracks:
+        for h5path in reference_datasets + ph_count_datasets:
+            num_chunks += write_dataset(f[f"{ground_track}/{h5path}"], out)
+
+print(f"wrote {num_chunks} chunks to {output_filepath}")
@@ -0,0 +1,115 @@
+import argparse
+import logging
+import os
+import subprocess
+import sys
+import tempfile
+
+# run the MPI build of the C benchmark at each rank count and report strong and weak scaling
+#
+# strong scaling selects from every granule of --granules at each rank count, weak scaling from
+# --weak_granules granules per rank, taken from the list in order and wrapping around when it runs out
+
+# columns of the results table, one row per run
+columns = ("scaling", "ranks", "granules", "elapsed", "bytes", "mib_per_sec", "speedup", "efficiency")
+
+
+# granule paths of a list file, skipping blank lines and comments like the benchmark does
+def read_granules(filepath):
+    with open(filepath, "r") as f:
+        lines = [line.strip() for line in f]
+    return [line for line in lines if line and not line.startswith("#")]
+
+
+# get elapsed seconds and bytes from the "result, <elapsed>, <bytes>" line
+def parse_result(output):
+    for line in output.splitlines():
+        if line.startswith("result,"):
+            fields = [field.strip() for field in line.split(",")]
+            return float(fields[1]), int(fields[2])
+    raise ValueError("no result line in benchmark output")
+
+
+# run the benchmark on ranks ranks over the granules, return elapsed seconds and bytes
+def run_once(args, scaling, ranks, granules, tmpdir):
+    list_filepath = os.path.join(tmpdir, f"{scaling}_{ranks}.txt")
+    with open(list_filepath, "w") as f:
+        f.write("\n".join(granules) + "\n")
+
+    binary = os.path.abspath(args.binary)
+    cmd = args.mpirun.split() + ["-np", str(ranks), binary, "-config", os.path.abspath(args.config),
+                                 "-granule_list", list_filepath] + args.extra.split()
+    logging.info(f"running: {' '.join(cmd)}")
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, text=True, cwd=os.path.dirname(binary))
+    if proc.returncode != 0:
+        raise RuntimeError(f"benchmark exited with {proc.returncode}")
+    return parse_result(proc.stdout)
+
+
+# fill in speedup and efficiency relative to the run on the fewest ranks. Strong scaling divides the
+# speedup by the ranks, weak scaling does the same work per rank so its speedup is the efficiency.
+def add_scaling(rows):
+    for scaling in ("strong", "weak"):
+        runs = [row for row in rows if row["scaling"] == scaling]
+        if not runs:
+            continue
+        base = min(runs, key=lambda row: row["ranks"])
+        for row in runs:
+            speedup = base["elapsed"] / row["elapsed"] if row["elapsed"] > 0 else 0.0
+            if scaling == "strong":
+                row["speedup"] = f"{speedup:.2f}"
+                row["efficiency"] = f"{speedup * base['ranks'] / row['ranks']:.2f}"
+            else:
+                row["speedup"] = f"{speedup * row['ranks'] / base['ranks']:.2f}"
+                row["efficiency"] = f"{speedup:.2f}"
+
+
+#
+# main
+#
+parser = argparse.ArgumentParser()
+parser.add_argument("--granules", required=True, help="Granule list, one path per line")
+parser.add_argument("--ranks", default="1,2,4", help="Comma-separated rank counts to run")
+parser.add_argument("--weak_granules", type=int, default=1, help="Granules per rank for weak scaling, 0 to skip it")
+parser.add_argument("--binary", default="../C/icesat2_selection_mpi", help="MPI build of the benchmark")
+parser.add_argument("--config", default="../config/config.yml", help="Benchmark config file")
+parser.add_argument("--mpirun", default="mpirun", help="Launcher, with any options it needs")
+parser.add_argument("--extra", default="", help="Extra benchmark arguments, such as -rank_files")
+parser.add_argument("--output", default=None, help="Write the results table to this CSV file instead of stdout")
+args = parser.parse_args()
+
+logging.basicConfig(format='%(levelname)s %(asctime)s %(message)s', level=logging.INFO)
+
+granules = read_granules(args.granules)
+if not granules:
+    sys.exit(f"no granules in {args.granules}")
+rank_counts = [int(ranks) for ranks in args.ranks.split(",")]
+
+rows = []
+with tempfile.TemporaryDirectory() as tmpdir:
+    for ranks in rank_counts:
+        runs = [("strong", granules)]
+        if args.weak_granules > 0:
+            count = ranks * args.weak_granules
+            runs.append(("weak", [granules[i % len(granules)] for i in range(count)]))
+
+        for scaling, run_granules in runs:
+            elapsed, nbytes = run_once(args, scaling, ranks, run_granules, tmpdir)
+            rows.append({
+                "scaling": scaling,
+                "ranks": ranks,
+                "granules": len(run_granules),
+                "elapsed": elapsed,
+                "bytes": nbytes,
+                "mib_per_sec": f"{nbytes / elapsed / (1024 * 1024) if elapsed > 0 else 0.0:.2f}",
+            })
+            print(f"{scaling} {ranks} ranks: {len(run_granules)} granules {elapsed:.1f}s", file=sys.stderr)
+
+add_scaling(rows)
+
+out = open(args.output, "w") if args.output else sys.stdout
+out.write(", ".join(columns) + "\n")
+for row in rows:
+    out.write(", ".join(str(row[column]) for column in columns) + "\n")
+if args.output:
+    out.close()
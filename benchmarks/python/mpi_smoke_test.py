@@ -0,0 +1,98 @@
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+import h5py
+import numpy as np
+import yaml
+
+# run the MPI build of the C benchmark on 2 ranks over a granule list, once writing the shared output and once
+# with -rank_files, and check that both outputs hold the same tracks, attributes and data
+#
+# the shared output is only written when the benchmark is built against a parallel HDF5. Otherwise both runs are
+# stitched, which is reported, and the test still checks that the two runs agree.
+
+RANKS = 2
+
+
+# get the output mode from the "mpi, <ranks>, <granules>, <tracks>, <pieces>, <shared|stitched>, <seconds>" line
+def parse_mode(output):
+    for line in output.splitlines():
+        if line.startswith("mpi,"):
+            return line.split(",")[5].strip()
+    raise ValueError("no mpi line in benchmark output")
+
+
+# run the benchmark on RANKS ranks, writing output_filename in tmpdir, return the output mode
+def run_once(args, tmpdir, output_filename, extra):
+    with open(args.config, "r") as f:
+        config = yaml.safe_load(f)
+    config["output_foldername"] = tmpdir + "/"
+    config["output_filename"] = output_filename
+
+    config_filepath = os.path.join(tmpdir, f"{output_filename}.yml")
+    with open(config_filepath, "w") as f:
+        yaml.safe_dump(config, f)
+
+    binary = os.path.abspath(args.binary)
+    cmd = args.mpirun.split() + ["-np", str(RANKS), binary, "-config", config_filepath,
+                                 "-granule_list", os.path.abspath(args.granules)] + extra
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, text=True, cwd=os.path.dirname(binary))
+    if proc.returncode != 0:
+        raise RuntimeError(f"{' '.join(cmd)} exited with {proc.returncode}")
+    return parse_mode(proc.stdout)
+
+
+# every dataset and attribute of the granule groups, by path
+def read_contents(filepath):
+    contents = {}
+
+    def visit(name, obj):
+        for key, value in obj.attrs.items():
+            contents[f"{name}@{key}"] = np.asarray(value)
+        if isinstance(obj, h5py.Dataset):
+            contents[name] = obj[()]
+
+    with h5py.File(filepath, "r") as f:
+        f.visititems(visit)
+    return contents
+
+
+def compare(shared, stitched):
+    errors = []
+    for name in sorted(set(shared) | set(stitched)):
+        if name not in shared or name not in stitched:
+            errors.append(f"{name} is only in the {'shared' if name in shared else 'rank_files'} output")
+        elif not np.array_equal(shared[name], stitched[name]):
+            errors.append(f"{name} differs")
+    return errors
+
+
+#
+# main
+#
+parser = argparse.ArgumentParser()
+parser.add_argument("--granules", required=True, help="Granule list, one path per line")
+parser.add_argument("--binary", default="../C/icesat2_selection_mpi", help="MPI build of the benchmark")
+parser.add_argument("--config", default="../config/config.yml", help="Benchmark config file")
+parser.add_argument("--mpirun", default="mpirun", help="Launcher, with any options it needs")
+args = parser.parse_args()
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    mode = run_once(args, tmpdir, "shared.h5", [])
+    run_once(args, tmpdir, "stitched.h5", ["-rank_files"])
+
+    shared = read_contents(os.path.join(tmpdir, "shared.h5"))
+    stitched = read_contents(os.path.join(tmpdir, "stitched.h5"))
+
+errors = compare(shared, stitched)
+for error in errors:
+    print(error, file=sys.stderr)
+
+if mode != "shared":
+    print("HDF5 isn't parallel, so both runs were stitched and the shared output wasn't tested", file=sys.stderr)
+
+print(f"mpi_smoke, {RANKS}, {mode}, {len(shared)}, {len(errors)}")
+sys.exit(1 if errors or not shared else 0)
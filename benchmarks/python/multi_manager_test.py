@@ -75,7 +75,30 @@ def mm_test(f):
                 assert_equal(n, i+j)
 
 
-            
+
+def engine_test(f):
+    dset = f.create_dataset("engine", data=np.arange(100, dtype="i4").reshape(10, 10))
+
+    # several selections of one dataset are coalesced, results stay in request order
+    mm = MultiManager(f, ["engine", "engine", "engine", "g1/dset1"], max_workers=4)
+    selections = [(slice(0, 4), slice(2, 6)), slice(3, 5), (slice(2, 3),), slice(0, 10)]
+    arrs = mm.read_selections(selections)
+    assert_equal(len(arrs), 4)
+    assert_true(np.array_equal(arrs[0], dset[0:4, 2:6]))
+    assert_true(np.array_equal(arrs[1], dset[3:5]))
+    assert_true(np.array_equal(arrs[2], dset[2:3]))
+    assert_true(np.array_equal(arrs[3], f["g1/dset1"][0:10]))
+
+    # same answers without coalescing or threads
+    mm_serial = MultiManager(f, ["engine", "engine", "engine", "g1/dset1"], max_workers=1, coalesce=False)
+    for arr, serial_arr in zip(arrs, mm_serial.read_selections(selections)):
+        assert_true(np.array_equal(arr, serial_arr))
+
+    # overlapping writes to one dataset land in order
+    mm.write_selections([slice(0, 2), slice(1, 3), slice(5, 6)],
+                        [np.full((2, 10), 1, dtype="i4"), np.full((2, 10), 2, dtype="i4"), np.full((1, 10), 3, dtype="i4")])
+    assert_true(np.array_equal(dset[:, 0], [1, 2, 2, 30, 40, 3, 60, 70, 80, 90]))
+
 
 #
 # main
@@ -83,4 +106,5 @@ def mm_test(f):
 
 with h5py.File("mm_test.h5", "w") as f:
     mm_test(f)
+    engine_test(f)
 print("done")
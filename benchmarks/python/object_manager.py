@@ -1,10 +1,18 @@
+from selection_engine import SelectionEngine, DEFAULT_MAX_WORKERS
+
+
 class ObjectManager():
-    def __init__(self, parent, h5paths=[]):
+    def __init__(self, parent, h5paths=[], max_workers=None, coalesce=None):
         objs = []
         count = len(h5paths)
         
         if isinstance(parent, ObjectManager):
             self._file = parent._file
+            # children share the parent's settings unless given their own
+            if max_workers is None:
+                max_workers = parent._engine.max_workers
+            if coalesce is None:
+                coalesce = parent._engine.coalesce
             
             if count == 0:
                 # just clone this object
@@ -32,6 +40,12 @@ class ObjectManager():
                 objs.append(parent)
             
         self._objs = objs
+        if max_workers is None:
+            max_workers = DEFAULT_MAX_WORKERS
+        if coalesce is None:
+            coalesce = True
+        # runs the selection methods concurrently
+        self._engine = SelectionEngine(max_workers=max_workers, coalesce=coalesce)
                 
             
     @property 
@@ -68,7 +82,7 @@ class ObjectManager():
         else:
             raise ValueError("number of names doesn't match object count")
         # return an om instance with this group set
-        mm = ObjectManager(self._file, h5paths)
+        mm = ObjectManager(self._file, h5paths, max_workers=self._engine.max_workers, coalesce=self._engine.coalesce)
         return mm
                 
     def set_attrs(self, names, values):
@@ -118,50 +132,27 @@ class ObjectManager():
         else:
             raise ValueError("number of names doesn't match object count")
         # return an om instance with this group set
-        mm = ObjectManager(self._file, h5paths)
+        mm = ObjectManager(self._file, h5paths, max_workers=self._engine.max_workers, coalesce=self._engine.coalesce)
         return mm
        
                 
     def write_selections(self, selections, values):
         count = min(len(self._objs), len(selections), len(values))
         for i in range(count):
-            dset = self._objs[i]
-            print(dset.name)
-            selection = selections[i]
-            value = values[i]
-            dset.__setitem__(selection, value)
+            print(self._objs[i].name)
+        self._engine.write(self._objs, selections, values)
                 
     def read_selections(self, selections):
-        values = []
-        count = min(len(self._objs), len(selections))
-        for i in range(count):
-            dset = self._objs[i]
-            selection = selections[i]
-            value = dset.__getitem__(selection)
-            values.append(value)
-        return values
+        return self._engine.read(self._objs, selections)
     
     def read_all(self):
-        arrs = []
+        # scalar datasets read as None, everything else in full
+        dsets = []
+        selections = []
         for obj in self._objs:
             rank = len(obj.shape)
-            if rank == 0:
-                arr = None
-            elif rank == 1:
-                extent = obj.shape[0]
-                arr = obj.__getitem__(slice(0, extent))
-            else:
-                slices = []
-                for dim in range(rank):
-                    extent = obj.shape[dim]
-                    slices.append(slice(0, extent))
-                arr = obj.__getitem__(slices)
-            arrs.append(arr)
-        return arrs
-
-                    
-                
-            
-                
-    
-    
\ No newline at end of file
+            if rank > 0:
+                dsets.append(obj)
+                selections.append(tuple(slice(0, extent) for extent in obj.shape))
+        arrs = iter(self._engine.read(dsets, selections))
+        return [next(arrs) if len(obj.shape) > 0 else None for obj in self._objs]
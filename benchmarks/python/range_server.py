@@ -0,0 +1,120 @@
+import sys
+import os
+import re
+import time
+import random
+import logging
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+import config
+
+# serve files by byte range over HTTP, as S3 does, with stragglers and failures injected, to try out
+# the request policy of "icesat2_selection -use_manifest" with input_foldername set to http://localhost:<port>/
+#
+# use "--port=<n>" (default 8080), "--root=<dir>" for the directory served (default the current one),
+# "--delay=<s>" to add latency to every response, "--straggler_rate=<p>" to hold back that share of
+# responses by "--straggler_delay=<s>" more (default 2), "--error_rate=<p>" to answer that share with
+# a 503, and "--seed=<n>" to make the injected faults repeatable
+
+RANGE_PATTERN = re.compile(r"bytes=(\d+)-(\d*)$")
+
+
+class FaultPlan():
+    """ Decide which responses are delayed or fail, and count them """
+
+    def __init__(self, delay, straggler_rate, straggler_delay, error_rate, seed):
+        self.delay = delay
+        self.straggler_rate = straggler_rate
+        self.straggler_delay = straggler_delay
+        self.error_rate = error_rate
+        self.random = random.Random(seed)
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.stragglers = 0
+        self.errors = 0
+
+    # return (seconds to wait, whether to fail) for the next response
+    def next(self):
+        with self.lock:
+            self.requests += 1
+            if self.random.random() < self.error_rate:
+                self.errors += 1
+                return self.delay, True
+            if self.random.random() < self.straggler_rate:
+                self.stragglers += 1
+                return self.delay + self.straggler_delay, False
+            return self.delay, False
+
+
+class RangeHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        logging.debug(format % args)
+
+    def send_body(self, status, body, headers={}):
+        self.send_response(status)
+        for key, value in headers.items():
+            self.send_header(key, value)
+        self.send_header("Content-Length", str(len(body)))
+        try:
+            self.end_headers()
+            self.wfile.write(body)
+        except (BrokenPipeError, ConnectionResetError):
+            # the client gave up on a straggler after a hedged request answered first
+            logging.debug(f"client closed the connection before {self.path} was sent")
+            self.close_connection = True
+
+    def do_GET(self):
+        wait, fail = self.server.faults.next()
+        path = os.path.realpath(os.path.join(self.server.root, self.path.lstrip("/")))
+        if not path.startswith(self.server.root + os.sep) or not os.path.isfile(path):
+            self.send_body(404, b"not found\n")
+            return
+        time.sleep(wait)
+        if fail:
+            self.send_body(503, b"injected failure\n")
+            return
+
+        size = os.path.getsize(path)
+        match = RANGE_PATTERN.match(self.headers.get("Range", ""))
+        with open(path, "rb") as f:
+            if not match:
+                self.send_body(200, f.read())
+                return
+            first = int(match.group(1))
+            last = min(int(match.group(2)) if match.group(2) else size - 1, size - 1)
+            if first > last:
+                self.send_body(416, b"", {"Content-Range": f"bytes */{size}"})
+                return
+            f.seek(first)
+            body = f.read(last - first + 1)
+        self.send_body(206, body, {"Content-Range": f"bytes {first}-{last}/{size}"})
+
+
+#
+# main
+#
+
+logging.basicConfig(level=logging.DEBUG if config.getCmdLineArg("debug") else logging.INFO)
+
+port = int(config.getCmdLineArg("port") or 8080)
+faults = FaultPlan(float(config.getCmdLineArg("delay") or 0),
+                   float(config.getCmdLineArg("straggler_rate") or 0),
+                   float(config.getCmdLineArg("straggler_delay") or 2),
+                   float(config.getCmdLineArg("error_rate") or 0),
+                   config.getCmdLineArg("seed"))
+
+server = ThreadingHTTPServer(("", port), RangeHandler)
+server.daemon_threads = True
+server.root = os.path.realpath(config.getCmdLineArg("root") or ".")
+server.faults = faults
+logging.info(f"serving {server.root} on port {port}")
+
+try:
+    server.serve_forever()
+except KeyboardInterrupt:
+    pass
+
+# "faults, <requests>, <stragglers>, <errors>"
+print(f"faults, {faults.requests}, {faults.stragglers}, {faults.errors}")
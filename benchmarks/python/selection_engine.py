@@ -0,0 +1,159 @@
+from concurrent.futures import ThreadPoolExecutor
+import logging
+import numpy as np
+
+# concurrent requests when the caller doesn't say
+DEFAULT_MAX_WORKERS = 8
+
+# selections on one dataset are read as their bounding box when it's
+# at most this many times the number of elements they select
+DEFAULT_COALESCE_RATIO = 2.0
+
+
+# identify a dataset across separately opened handles
+def get_dataset_key(dset):
+    return (dset.file.filename, dset.name)
+
+
+# return the selection as a tuple of (start, stop) per dimension,
+# or None if it isn't a simple unit stride slice selection
+def normalize_selection(selection, shape):
+    if isinstance(selection, slice):
+        selection = (selection,)
+    elif isinstance(selection, list) and all(isinstance(s, slice) for s in selection):
+        selection = tuple(selection)
+    if not isinstance(selection, tuple) or len(selection) > len(shape):
+        return None
+    bounds = []
+    for dim in range(len(shape)):
+        s = selection[dim] if dim < len(selection) else slice(None)
+        if not isinstance(s, slice) or s.step not in (None, 1):
+            return None
+        start, stop, _ = s.indices(shape[dim])
+        bounds.append((start, max(start, stop)))
+    return tuple(bounds)
+
+
+def get_num_elements(bounds):
+    num_elements = 1
+    for start, stop in bounds:
+        num_elements *= stop - start
+    return num_elements
+
+
+class SelectionEngine():
+    """ Run dataset reads and writes concurrently on a bounded thread pool.
+
+    Results come back in the order of the requests. Reads of the same dataset
+    can be coalesced into one request; writes to the same dataset run one after
+    another in the order given, so overlapping writes land as they would serially.
+    h5py serializes calls into the library, so the gain is with h5pyd and ros3.
+    """
+
+    def __init__(self, max_workers=DEFAULT_MAX_WORKERS, coalesce=True, coalesce_ratio=DEFAULT_COALESCE_RATIO):
+        if max_workers is None or max_workers < 1:
+            raise ValueError("max_workers must be at least 1")
+        self.max_workers = max_workers
+        self.coalesce = coalesce
+        self.coalesce_ratio = coalesce_ratio
+
+    # call each task, concurrently when there's more than one, and return their results in order
+    def _run(self, tasks):
+        if self.max_workers == 1 or len(tasks) < 2:
+            return [task() for task in tasks]
+        with ThreadPoolExecutor(max_workers=min(self.max_workers, len(tasks))) as executor:
+            futures = [executor.submit(task) for task in tasks]
+            return [future.result() for future in futures]
+
+    # group request indices by dataset, keeping the order within each group
+    def _group(self, dsets):
+        groups = {}
+        for i, dset in enumerate(dsets):
+            groups.setdefault(get_dataset_key(dset), []).append(i)
+        return list(groups.values())
+
+    # split a group of reads into (indices, bounding box) requests,
+    # the box is None for a read that is made on its own
+    def _plan_reads(self, dsets, selections, indices):
+        if not self.coalesce or len(indices) < 2:
+            return [([i], None) for i in indices]
+
+        shape = dsets[indices[0]].shape
+        requests = []
+        coalesced = []
+        for i in indices:
+            bounds = normalize_selection(selections[i], shape)
+            if bounds is None or get_num_elements(bounds) == 0:
+                requests.append(([i], None))
+            else:
+                coalesced.append((i, bounds))
+
+        # grow a box in order of the selections' starts while it stays dense enough
+        coalesced.sort(key=lambda item: item[1])
+        rank = len(shape)
+        box = None
+        members = []
+        selected = 0
+        for i, bounds in coalesced:
+            if box is not None:
+                grown = tuple((min(box[dim][0], bounds[dim][0]), max(box[dim][1], bounds[dim][1])) for dim in range(rank))
+                if get_num_elements(grown) <= self.coalesce_ratio * (selected + get_num_elements(bounds)):
+                    box = grown
+                    members.append(i)
+                    selected += get_num_elements(bounds)
+                    continue
+                requests.append(self._make_request(dsets, members, box))
+            box = bounds
+            members = [i]
+            selected = get_num_elements(bounds)
+        if members:
+            requests.append(self._make_request(dsets, members, box))
+        return requests
+
+    def _make_request(self, dsets, members, box):
+        if len(members) == 1:
+            return (members, None)
+        logging.debug(f"coalescing {len(members)} reads of {dsets[members[0]].name} into {box}")
+        return (members, box)
+
+    def read(self, dsets, selections):
+        """ read selections[i] from dsets[i] for each i, return the arrays in order """
+        count = min(len(dsets), len(selections))
+        dsets = dsets[:count]
+        tasks = []
+        requests = []
+        for indices in self._group(dsets):
+            for request in self._plan_reads(dsets, selections, indices):
+                request_indices, box = request
+                dset = dsets[request_indices[0]]
+                if box is None:
+                    selection = selections[request_indices[0]]
+                else:
+                    selection = tuple(slice(start, stop) for start, stop in box)
+                tasks.append(lambda dset=dset, selection=selection: dset.__getitem__(selection))
+                requests.append(request)
+
+        results = self._run(tasks)
+
+        values = [None] * count
+        for (request_indices, box), arr in zip(requests, results):
+            if box is None:
+                values[request_indices[0]] = arr
+                continue
+            shape = dsets[request_indices[0]].shape
+            for i in request_indices:
+                bounds = normalize_selection(selections[i], shape)
+                # copy so that results of overlapping selections don't share memory
+                values[i] = np.array(arr[tuple(slice(b[0] - o[0], b[1] - o[0]) for b, o in zip(bounds, box))])
+        return values
+
+    def write(self, dsets, selections, values):
+        """ write values[i] to selections[i] of dsets[i] for each i """
+        count = min(len(dsets), len(selections), len(values))
+        dsets = dsets[:count]
+
+        def write_group(indices):
+            for i in indices:
+                dsets[i].__setitem__(selections[i], values[i])
+
+        self._run([lambda indices=indices: write_group(indices) for indices in self._group(dsets)])
@@ -0,0 +1,68 @@
+import sys
+import time
+import logging
+import socket
+import config
+
+# send bbox requests to "icesat2_selection -serve <socket>" and report the latency of each
+#
+# use "--socket=<path>" for the server's socket, "--granule=<name>" for a granule other than
+# input_filename, "--repeat=<n>" to send the request n times and "--ranges" to skip the data
+
+
+# read one response, return the track lines, the datasets with their data and the result fields
+def read_response(f):
+    tracks = []
+    runs = []
+    datasets = {}
+    while True:
+        line = f.readline().decode("utf-8")
+        if not line:
+            raise IOError("server closed the connection")
+        fields = [field.strip() for field in line.split(",")]
+        if fields[0] == "track":
+            tracks.append(fields[1:])
+        elif fields[0] == "run":
+            runs.append(fields[1:])
+        elif fields[0] == "data":
+            nbytes = int(fields[3])
+            datasets[fields[1]] = f.read(nbytes)
+        elif fields[0] == "result":
+            logging.debug(f"{len(runs)} runs in {len(tracks)} tracks")
+            return tracks, datasets, fields[1:]
+        elif fields[0] == "error":
+            raise ValueError(line.strip())
+        else:
+            raise ValueError(f"unexpected response line: {line.strip()}")
+
+
+#
+# main
+#
+
+socket_path = config.getCmdLineArg("socket")
+if not socket_path:
+    sys.exit("use --socket=<path> to give the server's socket")
+granule = config.getCmdLineArg("granule") or config.get("input_filename")
+repeat = int(config.getCmdLineArg("repeat") or 1)
+command = "ranges" if config.getCmdLineArg("ranges") else "subset"
+
+min_lon = config.get("min_lon")
+max_lon = config.get("max_lon")
+min_lat = config.get("min_lat")
+max_lat = config.get("max_lat")
+request = f"{command} {granule} {min_lon} {max_lon} {min_lat} {max_lat}\n"
+
+with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+    sock.connect(socket_path)
+    f = sock.makefile("rb")
+    for i in range(repeat):
+        start_time = time.time()
+        sock.sendall(request.encode("utf-8"))
+        tracks, datasets, result = read_response(f)
+        elapsed = time.time() - start_time
+        if i == 0:
+            for track in tracks:
+                print("track,", ", ".join(track))
+        # "request, <n>, <client seconds>, <server seconds>, <bytes>, <hit|miss>"
+        print(f"request, {i + 1}, {elapsed:.6f}, {result[0]}, {result[1]}, {result[2]}")
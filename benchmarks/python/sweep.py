@@ -0,0 +1,216 @@
+from datetime import datetime
+import argparse
+import itertools
+import logging
+import os
+import subprocess
+import sys
+import tempfile
+import time
+import yaml
+import config
+
+# columns of the results table, one row per run
+columns = ("run", "config", "backend", "use_multi", "page_buf_size_exp", "paged",
+           "threads", "concurrency", "repetition", "cache", "start", "elapsed",
+           "bytes", "mib_per_sec", "speedup", "efficiency", "machine")
+
+# matrix parameters that identify a configuration apart from its parallelism
+group_keys = ("backend", "use_multi", "page_buf_size_exp", "paged")
+
+
+def get_loglevel():
+    val = config.get("loglevel")
+    val = val.upper()
+    if val == "DEBUG":
+        loglevel = logging.DEBUG
+    elif val == "INFO":
+        loglevel = logging.INFO
+    elif val in ("WARN", "WARNING"):
+        loglevel = logging.WARNING
+    elif val == "ERROR":
+        loglevel = logging.ERROR
+    else:
+        choices = ("DEBUG", "INFO", "WARNING", "ERROR")
+
+        raise ValueError(f"loglevel must be one of {choices}")
+    return loglevel
+
+
+# true if every key of an exclude entry matches the configuration, a list matching any of its values
+def is_excluded(configuration, exclude):
+    for entry in exclude:
+        if all(configuration.get(key) in (value if isinstance(value, list) else [value])
+               for key, value in entry.items()):
+            return True
+    return False
+
+
+# expand the matrix into a list of configurations in a fixed order, leaving out excluded ones
+def get_configurations(matrix, exclude):
+    keys = list(matrix.keys())
+    configurations = []
+    for values in itertools.product(*[matrix[key] for key in keys]):
+        configuration = dict(zip(keys, values))
+        if not is_excluded(configuration, exclude):
+            configurations.append(configuration)
+    return configurations
+
+
+# order (configuration index, repetition) pairs
+def get_schedule(num_configs, repetitions, order):
+    if order == "blocked":
+        return [(i, rep) for i in range(num_configs) for rep in range(repetitions)]
+    elif order == "interleaved":
+        return [(i, rep) for rep in range(repetitions) for i in range(num_configs)]
+    else:
+        raise ValueError("order must be one of ('blocked', 'interleaved')")
+
+
+# write a copy of the base config with the run's overrides applied
+def write_config(base_cfg, overrides, dirname, name):
+    cfg = dict(base_cfg)
+    cfg.update(overrides)
+    filepath = os.path.join(dirname, name)
+    with open(filepath, "w") as f:
+        # the C benchmark's parser only understands flat scalar key/value pairs
+        for k, v in cfg.items():
+            if isinstance(v, (dict, list)):
+                continue
+            if v is None:
+                v = ""
+            f.write(f"{k}: {v}\n")
+    return filepath
+
+
+# command line for one benchmark process
+def get_command(sweep_cfg, run_cfg, config_filepath):
+    cmd = [os.path.abspath(sweep_cfg["binary"]), "-config", config_filepath]
+    if run_cfg["backend"] == "ros3":
+        cmd.append("-use_ros3")
+    elif run_cfg["backend"] == "rest_vol":
+        cmd.append("-use_rest_vol")
+    if run_cfg["use_multi"]:
+        cmd.append("-use_multi")
+    if run_cfg["threads"] > 0:
+        cmd.extend(["-parallel_decode", "-threads", str(run_cfg["threads"])])
+    cmd.extend(sweep_cfg.get("extra_args") or [])
+    return cmd
+
+
+# get elapsed seconds and bytes from the "result, <elapsed>, <bytes>" line
+def parse_result(output):
+    for line in output.splitlines():
+        if line.startswith("result,"):
+            fields = [field.strip() for field in line.split(",")]
+            return float(fields[1]), int(fields[2])
+    raise ValueError("no result line in benchmark output")
+
+
+# run `concurrency` benchmark processes at once, return total elapsed and bytes
+def run_once(sweep_cfg, base_cfg, run_cfg, tmpdir):
+    procs = []
+    start_time = time.time()
+    for i in range(run_cfg["concurrency"]):
+        paged = run_cfg["paged"]
+        overrides = {
+            "input_foldername": sweep_cfg["input_foldername"][run_cfg["backend"]],
+            "input_filename": sweep_cfg["paged_input_filename" if paged else "input_filename"],
+            "page_buf_size_exp": run_cfg["page_buf_size_exp"],
+            "output_filename": f"sweep_{i}_{base_cfg['output_filename']}",
+        }
+        config_filepath = write_config(base_cfg, overrides, tmpdir, f"config_{i}.yml")
+        cmd = get_command(sweep_cfg, run_cfg, config_filepath)
+        logging.info(f"running: {' '.join(cmd)}")
+        procs.append(subprocess.Popen(cmd, stdout=subprocess.PIPE, text=True,
+                                      cwd=os.path.dirname(os.path.abspath(sweep_cfg["binary"]))))
+
+    total_bytes = 0
+    for proc in procs:
+        output, _ = proc.communicate()
+        if proc.returncode != 0:
+            raise RuntimeError(f"benchmark exited with {proc.returncode}")
+        _, nbytes = parse_result(output)
+        total_bytes += nbytes
+    elapsed = time.time() - start_time
+    return start_time, elapsed, total_bytes
+
+
+# fill in speedup and efficiency relative to the least parallel run of the same configuration group
+def add_scaling(rows):
+    baselines = {}
+    for row in rows:
+        key = tuple(row[k] for k in group_keys) + (row["cache"],)
+        parallelism = (max(row["threads"], 1) * row["concurrency"], row["threads"])
+        if key not in baselines or parallelism < baselines[key][0]:
+            baselines[key] = (parallelism, [])
+        if parallelism == baselines[key][0]:
+            baselines[key][1].append(row["mib_per_sec"])
+
+    for row in rows:
+        key = tuple(row[k] for k in group_keys) + (row["cache"],)
+        baseline = sum(baselines[key][1]) / len(baselines[key][1])
+        speedup = row["mib_per_sec"] / baseline if baseline > 0 else 0.0
+        row["speedup"] = f"{speedup:.2f}"
+        row["efficiency"] = f"{speedup / (max(row['threads'], 1) * row['concurrency']):.2f}"
+
+
+#
+# main
+#
+parser = argparse.ArgumentParser()
+parser.add_argument("--sweep", default="../config/sweep.yml", help="Parameter matrix to run")
+parser.add_argument("--output", default=None, help="Write the results table to this CSV file instead of stdout")
+args, _ = parser.parse_known_args()
+
+# setup logging
+logfname = config.get("log_file")
+loglevel = get_loglevel()
+logging.basicConfig(filename=logfname, format='%(levelname)s %(asctime)s %(message)s', level=loglevel)
+logging.debug(f"set log_level to {loglevel}")
+
+with open(args.sweep, "r") as f:
+    sweep_cfg = yaml.safe_load(f)
+
+with open(os.path.join("..", "config", "config.yml"), "r") as f:
+    base_cfg = yaml.safe_load(f)
+
+configurations = get_configurations(sweep_cfg["matrix"], sweep_cfg.get("exclude") or [])
+schedule = get_schedule(len(configurations), sweep_cfg["repetitions"], sweep_cfg.get("order", "blocked"))
+machine = config.get("machine")
+logging.info(f"{len(configurations)} configurations, {len(schedule)} runs")
+
+rows = []
+with tempfile.TemporaryDirectory() as tmpdir:
+    for run_number, (config_index, repetition) in enumerate(schedule):
+        run_cfg = configurations[config_index]
+        cache = "cold" if repetition == 0 else "warm"
+        if cache == "cold" and sweep_cfg.get("cold_cmd"):
+            logging.info(f"running cold_cmd: {sweep_cfg['cold_cmd']}")
+            subprocess.run(sweep_cfg["cold_cmd"], shell=True, check=True)
+
+        start_time, elapsed, nbytes = run_once(sweep_cfg, base_cfg, run_cfg, tmpdir)
+        row = dict(run_cfg)
+        row.update({
+            "run": run_number + 1,
+            "config": config_index + 1,
+            "repetition": repetition + 1,
+            "cache": cache,
+            "start": datetime.fromtimestamp(start_time).strftime("%Y-%m-%d %H:%M:%S"),
+            "elapsed": f"{elapsed:.3f}",
+            "bytes": nbytes,
+            "mib_per_sec": nbytes / elapsed / (1024 * 1024) if elapsed > 0 else 0.0,
+            "machine": machine,
+        })
+        rows.append(row)
+        print(f"run {run_number + 1}/{len(schedule)}: {run_cfg} {cache} {elapsed:.1f}s", file=sys.stderr)
+
+add_scaling(rows)
+
+out = open(args.output, "w") if args.output else sys.stdout
+out.write(", ".join(columns) + "\n")
+for row in rows:
+    row["mib_per_sec"] = f"{row['mib_per_sec']:.2f}"
+    out.write(", ".join(str(row[column]) for column in columns) + "\n")
+if args.output:
+    out.close()